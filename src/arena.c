@@ -0,0 +1,191 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*** src type: no GUI code ***/
+
+#include "dvdisaster.h"
+
+#ifdef HAVE_MMAP
+  #include <sys/mman.h>
+#endif
+
+/***
+ *** Arena for the codec buffers.
+ ***
+ * The codecs work on a few hundred large buffers which are accessed
+ * column-wise, e.g. one sector from each layer in turn. With separate
+ * allocations nearly every access hits another page and misses the TLB.
+ * Instead, the buffers of an action are carved out of one region
+ * which is backed by huge pages where the system provides them.
+ * Each buffer starts on a cache line.
+ *
+ * Buffers which do not fit into the region are allocated separately.
+ * All buffers are released together by FreeArena().
+ * An arena must only be used by one thread at a time.
+ */
+
+#define HUGE_PAGE_SIZE (2<<20)
+
+static char *backing_name[] = { "none", "heap", "4K pages",
+				"transparent huge pages", "huge pages" };
+
+/*
+ * Reserve the region. Explicit huge pages must be set up by the
+ * administrator and are therefore rarely available, but they are
+ * tried first. Otherwise transparent huge pages are requested for
+ * normal anonymous memory; the region is aligned to the huge page size
+ * so that the kernel can actually use them.
+ * Unused parts of a mapped region are never touched and cost no memory.
+ */
+
+static void reserve_region(Arena *a, gsize size)
+{
+#ifdef HAVE_MMAP
+   void *map;
+
+#ifdef MAP_HUGETLB
+   if(size >= HUGE_PAGE_SIZE)
+   {  gsize huge_size = (size + HUGE_PAGE_SIZE-1) & ~(gsize)(HUGE_PAGE_SIZE-1);
+
+      map = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if(map != MAP_FAILED)
+      {  a->region = a->base = map;
+	 a->regionSize = a->size = huge_size;
+	 a->backing = ARENA_HUGETLB;
+	 return;
+      }
+   }
+#endif
+
+   map = mmap(NULL, size+HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if(map != MAP_FAILED)
+   {  a->region     = map;
+      a->regionSize = size+HUGE_PAGE_SIZE;
+      a->base       = (unsigned char*)(((intptr_t)map + HUGE_PAGE_SIZE-1) & ~(intptr_t)(HUGE_PAGE_SIZE-1));
+      a->size       = size;
+      a->backing    = ARENA_MAPPED;
+#ifdef MADV_HUGEPAGE
+      if(size >= HUGE_PAGE_SIZE && !madvise(a->base, size, MADV_HUGEPAGE))
+	 a->backing = ARENA_THP;
+#endif
+      return;
+   }
+#endif /* HAVE_MMAP */
+
+   a->region = g_try_malloc(size+a->align);
+   if(a->region)
+   {  a->regionSize = size+a->align;
+      a->base       = (unsigned char*)(((intptr_t)a->region + a->align-1) & ~(intptr_t)(a->align-1));
+      a->size       = size;
+      a->backing    = ARENA_HEAP;
+   }
+}
+
+/*
+ * Create an arena for buffers totalling about size bytes.
+ * If the region can not be reserved, all buffers
+ * will be allocated separately.
+ */
+
+Arena* CreateArena(char *name, gsize size)
+{  Arena *a = g_malloc0(sizeof(Arena));
+
+   a->name  = name;
+   a->align = Closure->clSize >= 16 ? Closure->clSize : 64;
+   a->extra = g_ptr_array_new();
+
+   if(size)
+      reserve_region(a, size);
+
+   return a;
+}
+
+static void* arena_alloc(Arena *a, gsize size, int may_fail)
+{  gsize aligned = (size + a->align-1) & ~(gsize)(a->align-1);
+   void *ptr;
+
+   if(a->base && a->used + aligned <= a->size)
+   {  ptr = a->base + a->used;
+      a->used += aligned;
+      a->buffers++;
+      return ptr;
+   }
+
+   /* Region exhausted or not available */
+
+   ptr = may_fail ? g_try_malloc(size) : g_malloc(size);
+   if(ptr)
+   {  g_ptr_array_add(a->extra, ptr);
+      a->extraBytes += size;
+   }
+
+   return ptr;
+}
+
+void* ArenaAlloc(Arena *a, gsize size)
+{  return arena_alloc(a, size, FALSE);
+}
+
+/* Returns NULL instead of aborting when out of memory */
+
+void* ArenaTryAlloc(Arena *a, gsize size)
+{  return arena_alloc(a, size, TRUE);
+}
+
+void PrintArenaStats(Arena *a)
+{
+   /* Huge page backing depends on the machine */
+
+   if(Closure->regtestMode)
+     return;
+
+   Verbose("%s arena: %" PRId64 "M reserved (%s), %d buffers with %" PRId64 "K carved out, "
+	   "%d buffers with %" PRId64 "K allocated separately\n",
+	   a->name, (gint64)(a->size>>20), backing_name[a->backing],
+	   a->buffers, (gint64)(a->used>>10),
+	   a->extra->len, (gint64)(a->extraBytes>>10));
+}
+
+void FreeArena(Arena *a)
+{  guint i;
+
+   for(i=0; i<a->extra->len; i++)
+      g_free(g_ptr_array_index(a->extra, i));
+   g_ptr_array_free(a->extra, TRUE);
+
+   switch(a->backing)
+   {  case ARENA_HEAP:
+	 g_free(a->region);
+	 break;
+#ifdef HAVE_MMAP
+      case ARENA_MAPPED:
+      case ARENA_THP:
+      case ARENA_HUGETLB:
+	 munmap(a->region, a->regionSize);
+	 break;
+#endif
+   }
+
+   g_free(a);
+}
@@ -0,0 +1,236 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*** src type: no GUI code ***/
+
+#include "dvdisaster.h"
+
+/***
+ *** Processing a batch of images.
+ ***
+ * The images are named in a list file (one per line; empty lines
+ * and lines starting with '#' are skipped) or are all *.iso files
+ * in a directory, taken in alphabetical order.
+ * They are processed one after another within this process, so
+ * the codec tables are only built once and each image gets all
+ * codec threads without competing against other images.
+ * While the current image keeps the processors busy, a prefetch
+ * thread reads the beginning of the next images into the page cache,
+ * so that the codec does not start the next image with an idle
+ * processor waiting for the disk.
+ */
+
+#define BATCH_BLOCK_SIZE (1<<20)    /* read ahead in blocks of this size */
+#define BATCH_READ_AHEAD_MIB 1024   /* read ahead at most this much of each image */
+
+static int compare_names(const void *a, const void *b)
+{
+   return strcmp(*(char**)a, *(char**)b);
+}
+
+static void add_directory(Batch *b, char *path)
+{  GDir *dir;
+   const char *name;
+   int first = b->images->len;
+
+   dir = g_dir_open(path, 0, NULL);
+   if(!dir)
+     Stop(_("Could not open %s: %s"), path, strerror(errno));
+
+   while((name = g_dir_read_name(dir)))
+     if(g_str_has_suffix(name, ".iso"))
+       g_ptr_array_add(b->images, g_strdup_printf("%s/%s", path, name));
+
+   g_dir_close(dir);
+
+   qsort(b->images->pdata+first, b->images->len-first, sizeof(char*), compare_names);
+}
+
+#define MAX_LINE_LEN 4096
+
+static void add_list_file(Batch *b, char *path)
+{  FILE *file;
+   char line[MAX_LINE_LEN];
+
+   file = portable_fopen(path, "rb");
+   if(!file)
+     Stop(_("Could not open %s: %s"), path, strerror(errno));
+
+   while(fgets(line, MAX_LINE_LEN, file))
+   {  int n = strlen(line);
+
+      while(n > 0 && (line[n-1] == '\n' || line[n-1] == '\r' || line[n-1] == ' '))
+	line[--n] = 0;
+
+      if(!n || *line == '#') continue;
+
+      g_ptr_array_add(b->images, g_strdup(line));
+   }
+
+   fclose(file);
+}
+
+/*
+ * Read the beginning of an image into the page cache.
+ * Gives up as soon as the image is being processed,
+ * since the codec is then reading it anyway.
+ * Reads around LargeRead() so that the statistics of the
+ * current image are not distorted by the read ahead.
+ */
+
+static void read_ahead(Batch *b, int idx, char *buf)
+{  char *path = g_ptr_array_index(b->images, idx);
+   LargeFile *file;
+   gint64 done = 0;
+
+   file = LargeOpen(path, O_RDONLY, IMG_PERMS);
+   if(!file)
+     return;   /* reported when the image is processed */
+
+   ProfileBegin("batch_read_ahead");
+   while(done < b->readAheadBytes)
+   {  ssize_t n;
+
+      if(g_atomic_int_get(&b->stop) || g_atomic_int_get(&b->current) >= idx)
+	break;
+
+      n = read(file->fileHandle, buf, BATCH_BLOCK_SIZE);
+      if(n <= 0)
+	break;
+      done += n;
+   }
+   ProfileEnd("batch_read_ahead");
+
+   LargeClose(file);
+}
+
+static gpointer prefetch_thread(gpointer data)
+{  Batch *b = (Batch*)data;
+   char *buf = g_malloc(BATCH_BLOCK_SIZE);
+
+   g_mutex_lock(&b->lock);
+   while(!b->stop)
+   {  int next = MAX(b->readAhead, b->current) + 1;
+
+      if(next > b->current + b->window || next >= b->images->len)
+      {  g_cond_wait(&b->cond, &b->lock);
+	 continue;
+      }
+
+      b->readAhead = next;
+      g_mutex_unlock(&b->lock);
+      read_ahead(b, next, buf);
+      g_mutex_lock(&b->lock);
+   }
+   g_mutex_unlock(&b->lock);
+
+   g_free(buf);
+
+   return NULL;
+}
+
+/*
+ * Collect the images of a batch and start reading ahead
+ */
+
+Batch* OpenBatch(char *path)
+{  Batch *b = g_malloc0(sizeof(Batch));
+
+   b->images = g_ptr_array_new();
+   b->current   = -1;
+   b->readAhead = 0;    /* the first image is not worth waiting for */
+
+   if(DirStat(path))
+        add_directory(b, path);
+   else add_list_file(b, path);
+
+   if(!b->images->len)
+     Stop(_("No images found in %s."), path);
+
+   b->window = MIN(Closure->batchReadAhead, b->images->len-1);
+   if(b->window > 0)
+   {  gint64 mib = PlanMemory(_("MiB read ahead per batch image"), BATCH_READ_AHEAD_MIB, 0,
+			      (gint64)b->window<<20, 0);
+
+      b->readAheadBytes = mib<<20;
+   }
+
+   g_mutex_init(&b->lock);
+   g_cond_init(&b->cond);
+   if(b->readAheadBytes)
+     b->prefetcher = CreateGThread(prefetch_thread, b);
+
+   return b;
+}
+
+/*
+ * Make the next image of the batch the current one.
+ * Ecc files are named after their image.
+ */
+
+int NextBatchImage(Batch *b)
+{  char *image;
+
+   if(b->current+1 >= b->images->len)
+     return FALSE;
+
+   g_mutex_lock(&b->lock);
+   b->current++;
+   g_cond_signal(&b->cond);
+   g_mutex_unlock(&b->lock);
+
+   image = g_ptr_array_index(b->images, b->current);
+
+   g_free(Closure->imageName);
+   Closure->imageName = g_strdup(image);
+
+   g_free(Closure->eccName);
+   if(g_str_has_suffix(image, ".iso"))
+        Closure->eccName = g_strdup_printf("%.*s.ecc", (int)strlen(image)-4, image);
+   else Closure->eccName = g_strdup_printf("%s.ecc", image);
+
+   PrintLog(_("\nBatch image %d of %d: %s\n"), b->current+1, b->images->len, image);
+
+   return TRUE;
+}
+
+void CloseBatch(Batch *b)
+{  int i;
+
+   if(b->prefetcher)
+   {  g_mutex_lock(&b->lock);
+      b->stop = TRUE;
+      g_cond_signal(&b->cond);
+      g_mutex_unlock(&b->lock);
+      g_thread_join(b->prefetcher);
+   }
+
+   g_mutex_clear(&b->lock);
+   g_cond_clear(&b->cond);
+
+   for(i=0; i<b->images->len; i++)
+     g_free(g_ptr_array_index(b->images, i));
+   g_ptr_array_free(b->images, TRUE);
+
+   g_free(b);
+}
@@ -551,6 +551,7 @@ void InitClosure()
    Closure->dDumpDir    = g_strdup(Closure->homeDir);
    Closure->cacheMiB    = 32;
    Closure->prefetchSectors = 128;
+   Closure->batchReadAhead = 1;
    Closure->codecThreads = 1;
    Closure->eccTarget = 1;
    Closure->encodingAlgorithm = ENCODING_ALG_DEFAULT;
@@ -559,6 +560,7 @@ void InitClosure()
    Closure->rawMode     = 0x20;
    Closure->internalAttempts = -1;
    Closure->sectorSkip  = 16;
+   Closure->readQueue   = 2;
    Closure->spinupDelay = 5;
    Closure->fillUnreadable = -1;
    Closure->welcomeMessage = 1;
@@ -686,6 +688,9 @@ void FreeClosure()
      g_free(Closure->readAdaptiveErrorMsg);
 #endif /* WITH_GUI_YES */
 
+   CloseStatsJson();
+   CloseProfile();
+
    if(Closure->crcBuf)
      FreeCrcBuf(Closure->crcBuf);
 
@@ -700,6 +705,8 @@ void FreeClosure()
 
    CallMethodDestructors();
    cond_free_ptr_array(Closure->methodList);
+   FreeTableCache();
+   CloseDefectiveSectorCache();
 
    cond_free(Closure->methodName);
    cond_free(Closure->homeDir);
@@ -709,6 +716,13 @@ void FreeClosure()
    cond_free(Closure->docDir);
    cond_free(Closure->errorTitle);
    cond_free(Closure->simulateCD);
+   cond_free(Closure->simulateTiming);
+   cond_free(Closure->recordTrace);
+   cond_free(Closure->replayTrace);
+   cond_free(Closure->statsJson);
+   cond_free(Closure->profileFile);
+   cond_free(Closure->batchList);
+   cond_free(Closure->stopMessage);
    cond_free(Closure->dDumpDir);
    cond_free(Closure->dDumpPrefix);
 
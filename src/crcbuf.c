@@ -152,12 +152,21 @@ int AddSectorToCrcBuffer(CrcBuf *cb, int mode, guint64 idx, unsigned char *buf,
  */
 
 int CheckAgainstCrcBuffer(CrcBuf *cb, gint64 idx, unsigned char *buf)
-{  guint32 crc;
-
+{
    if(idx < 0 || idx >= cb->crcSize)
      return CRC_OUTSIDE_BOUND;
    
-   crc = Crc32(buf, 2048);
+   return CompareWithCrcBuffer(cb, idx, Crc32(buf, 2048));
+}
+
+/*
+ * Same as above, for an already calculated CRC
+ */
+
+int CompareWithCrcBuffer(CrcBuf *cb, gint64 idx, guint32 crc)
+{
+   if(idx < 0 || idx >= cb->crcSize)
+     return CRC_OUTSIDE_BOUND;
 
    if(!GetBit(cb->valid, idx))
       return CRC_UNKNOWN;
@@ -0,0 +1,385 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*** src type: no GUI code ***/
+
+#include "dvdisaster.h"
+
+#include "scsi-layer.h"
+
+/***
+ *** Recording and replaying read sessions
+ ***
+ * With --record-trace, every READ command sent to the drive is logged
+ * together with its outcome, sense data, duration and C2 errors.
+ * With --replay-trace, the simulated drive (--sim-cd) reproduces the
+ * read errors of the recorded session: a sector fails as often as it
+ * failed in the recording before it becomes readable, or fails forever
+ * if it was never read successfully. Together with the drive timing
+ * model, failed reads take as long as they did in the recording.
+ */
+
+typedef struct
+{  gint64 lba;
+   int failures;              /* failed attempts before the sector was read */
+   int readable;              /* sector was read eventually */
+   guint8 senseKey, asc, ascq;
+   double failTime;           /* seconds spent in all failed attempts */
+
+   int attempts;              /* failed attempts during replay */
+} replay_entry;
+
+typedef struct _DefectTrace
+{  /* Recording */
+
+   FILE *file;
+   GTimer *timer;
+   gint64 startClock;
+
+   /* Replaying */
+
+   replay_entry *entry;       /* sorted by lba */
+   int nEntries;
+} DefectTrace;
+
+static DefectTrace* get_trace(DeviceHandle *dh)
+{
+   if(!dh->trace)
+      dh->trace = g_malloc0(sizeof(DefectTrace));
+
+   return dh->trace;
+}
+
+/***
+ *** Recording
+ ***/
+
+static void open_recording(DeviceHandle *dh, char *path)
+{  DefectTrace *dt = get_trace(dh);
+   DefectTraceHeader dth;
+
+   dt->file = portable_fopen(path, "wb");
+   if(!dt->file)
+      Stop(_("Could not open %s: %s"), path, strerror(errno));
+
+   memset(&dth, 0, sizeof(DefectTraceHeader));
+   memcpy(dth.cookie, "*dvdisaster*", 12);
+   memcpy(dth.method, "Trce", 4);
+   dth.sectors = dh->sectors;
+   dth.version = TRACE_VERSION;
+   strncpy(dth.drive, dh->vendor, sizeof(dth.drive)-1);
+
+#ifdef HAVE_BIG_ENDIAN
+   SwapDefectTraceHeaderBytes(&dth);
+#endif
+
+   if(fwrite(&dth, sizeof(DefectTraceHeader), 1, dt->file) != 1)
+      Stop(_("Failed writing to %s: %s"), path, strerror(errno));
+
+   dt->timer = g_timer_new();
+   PrintLog(_("Recording read session into %s.\n"), path);
+}
+
+void TraceReadStart(DeviceHandle *dh)
+{  DefectTrace *dt = dh->trace;
+
+   if(!dt || !dt->file)
+      return;
+
+   g_timer_start(dt->timer);
+   dt->startClock = SimulatedClock(dh);
+}
+
+void TraceReadDone(DeviceHandle *dh, gint64 lba, int nsectors, int status, int attempt)
+{  DefectTrace *dt = dh->trace;
+   DefectTraceRecord dtr;
+   gulong ignore;
+   gint64 clock;
+   int i;
+
+   if(!dt || !dt->file)
+      return;
+
+   memset(&dtr, 0, sizeof(DefectTraceRecord));
+   dtr.lba      = lba;
+   dtr.nSectors = nsectors;
+   dtr.status   = status ? 1 : 0;
+   dtr.attempt  = MIN(attempt, 255);
+   dtr.pass     = MIN(dh->pass, 255);
+
+   /* Use the virtual clock when recording a simulated session */
+
+   clock = SimulatedClock(dh);
+   if(clock < 0)
+        dtr.duration = (gint32)MIN(1000000.0*g_timer_elapsed(dt->timer, &ignore), G_MAXINT32);
+   else dtr.duration = (gint32)MIN(clock - dt->startClock, G_MAXINT32);
+
+   if(status)
+   {  dtr.senseKey = dh->sense.sense_key;
+      dtr.asc      = dh->sense.asc;
+      dtr.ascq     = dh->sense.ascq;
+   }
+
+   if(dh->canC2Scan)
+      for(i=0; i<nsectors && i<MAX_CLUSTER_SIZE; i++)
+	 dtr.c2 += dh->c2[i];
+
+#ifdef HAVE_BIG_ENDIAN
+   SwapDefectTraceRecordBytes(&dtr);
+#endif
+
+   if(fwrite(&dtr, sizeof(DefectTraceRecord), 1, dt->file) != 1)
+      Stop(_("Failed writing to %s: %s"), Closure->recordTrace, strerror(errno));
+}
+
+/***
+ *** Replaying
+ ***/
+
+static int cmp_lba(const void *a, const void *b)
+{  gint64 x = *(gint64*)a, y = *(gint64*)b;
+
+   return x < y ? -1 : x > y;
+}
+
+/* Index of the first entry with lba >= given lba */
+
+static int lower_bound(DefectTrace *dt, gint64 lba)
+{  int lo = 0, hi = dt->nEntries;
+
+   while(lo < hi)
+   {  int mid = lo + (hi-lo)/2;
+
+      if(dt->entry[mid].lba < lba)
+	   lo = mid+1;
+      else hi = mid;
+   }
+
+   return lo;
+}
+
+static DefectTraceRecord* read_records(char *path, DefectTraceHeader *dth, int *n_records)
+{  DefectTraceRecord *dtr = NULL;
+   FILE *file;
+   int n = 0, max = 0;
+
+   file = portable_fopen(path, "rb");
+   if(!file)
+      Stop(_("Could not open %s: %s"), path, strerror(errno));
+
+   if(fread(dth, sizeof(DefectTraceHeader), 1, file) != 1
+      || memcmp(dth->cookie, "*dvdisaster*", 12) || memcmp(dth->method, "Trce", 4))
+   {  fclose(file);
+      Stop(_("%s is not a dvdisaster trace file.\n"), path);
+   }
+
+#ifdef HAVE_BIG_ENDIAN
+   SwapDefectTraceHeaderBytes(dth);
+#endif
+
+   if(dth->version > TRACE_VERSION)
+   {  fclose(file);
+      Stop(_("%s was created by a newer version of dvdisaster.\n"), path);
+   }
+
+   while(TRUE)
+   {  if(n >= max)
+      {  max = max ? 2*max : 4096;
+	 dtr = g_realloc(dtr, max*sizeof(DefectTraceRecord));
+      }
+
+      if(fread(&dtr[n], sizeof(DefectTraceRecord), 1, file) != 1)
+	 break;
+
+#ifdef HAVE_BIG_ENDIAN
+      SwapDefectTraceRecordBytes(&dtr[n]);
+#endif
+      n++;
+   }
+
+   fclose(file);
+   *n_records = n;
+   return dtr;
+}
+
+/*
+ * Turn the recorded commands into per-sector outcomes.
+ * A failed command tells us only that some of its sectors failed;
+ * its sectors are charged the failure just like the reader treated
+ * them. Successful commands mark all their sectors as readable.
+ */
+
+static void open_replay(DeviceHandle *dh, char *path)
+{  DefectTrace *dt = get_trace(dh);
+   DefectTraceHeader dth;
+   DefectTraceRecord *dtr;
+   gint64 *lbas;
+   int n_records, n_lbas, max_lbas;
+   int i,j,e;
+   int never_read = 0;
+
+   dtr = read_records(path, &dth, &n_records);
+
+   /* Collect all sectors which failed at least once */
+
+   n_lbas = 0; max_lbas = 1024;
+   lbas = g_malloc(max_lbas*sizeof(gint64));
+
+   for(i=0; i<n_records; i++)
+      if(dtr[i].status)
+	 for(j=0; j<dtr[i].nSectors; j++)
+	 {  if(n_lbas >= max_lbas)
+	    {  max_lbas *= 2;
+	       lbas = g_realloc(lbas, max_lbas*sizeof(gint64));
+	    }
+	    lbas[n_lbas++] = dtr[i].lba + j;
+	 }
+
+   qsort(lbas, n_lbas, sizeof(gint64), cmp_lba);
+
+   dt->entry = g_malloc0(MAX(1, n_lbas)*sizeof(replay_entry));
+   for(i=0; i<n_lbas; i++)
+      if(!dt->nEntries || dt->entry[dt->nEntries-1].lba != lbas[i])
+	 dt->entry[dt->nEntries++].lba = lbas[i];
+   g_free(lbas);
+
+   /* Replay the recording on them */
+
+   for(i=0; i<n_records; i++)
+   {  gint64 end = dtr[i].lba + dtr[i].nSectors;
+
+      for(e=lower_bound(dt, dtr[i].lba); e<dt->nEntries && dt->entry[e].lba<end; e++)
+      {  replay_entry *re = &dt->entry[e];
+
+	 if(re->readable)
+	    continue;
+
+	 if(!dtr[i].status)
+	    re->readable = TRUE;
+	 else
+	 {  re->failures++;
+	    re->failTime += dtr[i].duration/1000000.0;
+	    re->senseKey  = dtr[i].senseKey;
+	    re->asc       = dtr[i].asc;
+	    re->ascq      = dtr[i].ascq;
+	 }
+      }
+   }
+
+   for(e=0; e<dt->nEntries; e++)
+      if(!dt->entry[e].readable)
+	 never_read++;
+
+   g_free(dtr);
+
+   PrintLog(_("Replaying read session from %s (%s):\n"
+	      "%d sectors failed at least once, %d were never read.\n"),
+	    path, dth.drive, dt->nEntries, never_read);
+   if(dth.sectors != dh->sectors)
+      PrintLog(_("* Warning: trace was recorded from a medium with %" PRId64 " sectors.\n"),
+	       dth.sectors);
+}
+
+/*
+ * Called by the simulated drive for each READ command.
+ * Returns the number of good sectors before the first failing one;
+ * a failure is charged to all sectors of the command which are
+ * still supposed to fail.
+ */
+
+int ReplayDefectTrace(DeviceHandle *dh, gint64 lba, int nsectors, Sense *sense)
+{  DefectTrace *dt = dh->trace;
+   replay_entry *first = NULL;
+   int e,start;
+
+   if(!dt || !dt->entry)
+      return nsectors;
+
+   start = lower_bound(dt, lba);
+   for(e=start; e<dt->nEntries && dt->entry[e].lba<lba+nsectors; e++)
+   {  replay_entry *re = &dt->entry[e];
+
+      if(!re->readable || re->attempts < re->failures)
+      {  if(!first) first = re;
+	 re->attempts++;
+      }
+   }
+
+   if(!first)
+      return nsectors;
+
+   sense->sense_key = first->senseKey ? first->senseKey : 3;
+   sense->asc       = first->senseKey ? first->asc : 0x11;
+   sense->ascq      = first->senseKey ? first->ascq : 0x00;
+
+   return first->lba - lba;
+}
+
+/*
+ * Average time of a recorded failure of the given sector,
+ * or -1 if there is none
+ */
+
+double ReplayedErrorTime(DeviceHandle *dh, gint64 lba)
+{  DefectTrace *dt = dh->trace;
+   int e;
+
+   if(!dt || !dt->entry)
+      return -1.0;
+
+   e = lower_bound(dt, lba);
+   if(e >= dt->nEntries || dt->entry[e].lba != lba || !dt->entry[e].failures)
+      return -1.0;
+
+   return dt->entry[e].failTime / dt->entry[e].failures;
+}
+
+/***
+ *** Setup and cleanup
+ ***/
+
+void OpenDefectTrace(DeviceHandle *dh)
+{
+   if(Closure->replayTrace)
+   {  if(!dh->simImage)
+	 Stop(_("--replay-trace requires a simulated drive (--sim-cd).\n"));
+      open_replay(dh, Closure->replayTrace);
+   }
+
+   if(Closure->recordTrace)
+      open_recording(dh, Closure->recordTrace);
+}
+
+void CloseDefectTrace(DeviceHandle *dh)
+{  DefectTrace *dt = dh->trace;
+
+   if(!dt) return;
+
+   if(dt->file)
+      fclose(dt->file);
+   if(dt->timer)
+      g_timer_destroy(dt->timer);
+
+   g_free(dt->entry);
+   g_free(dt);
+   dh->trace = NULL;
+}
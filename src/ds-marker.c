@@ -165,6 +165,57 @@ char *GetSimulationHint(unsigned char *buf)
    return NULL;
 }
 
+/***
+ *** Quick screening for missing sectors
+ ***
+ * A missing sector either starts and ends with "dvdisaster dead ..."
+ * (at the start of the sector and of the end marker), or is completely
+ * filled with the Closure->fillUnreadable byte.
+ * Comparing these 2*16 bytes as 64bit words rejects nearly all
+ * regular sectors; only the remaining candidates need to be parsed.
+ */
+
+#define END_MARKER_POS (2046-34)
+
+static void get_screening_words(guint64 *word)
+{
+   if(Closure->fillUnreadable >= 0)
+        memset(word, Closure->fillUnreadable, 16);
+   else memcpy(word, "dvdisaster dead ", 16);
+}
+
+static inline int is_candidate(unsigned char *buf, guint64 *word)
+{  guint64 w[4];
+
+   memcpy(w,   buf, 16);
+   memcpy(w+2, buf+END_MARKER_POS, 16);
+
+   return !((w[0]^word[0]) | (w[1]^word[1]) | (w[2]^word[0]) | (w[3]^word[1]));
+}
+
+/*
+ * Screen n_sectors at once. Bits are set in the bitmap for all sectors
+ * which might be missing; they must be examined further with
+ * CheckForMissingSector(). Returns the number of such sectors.
+ */
+
+int ScreenForMissingSectors(unsigned char *buf, int n_sectors, Bitmap *suspicious)
+{  guint64 word[2];
+   int i,count = 0;
+
+   get_screening_words(word);
+
+   for(i=0; i<n_sectors; i++, buf+=2048)
+   {  if(is_candidate(buf, word))
+      {  SetBit(suspicious, i);
+	 count++;
+      }
+      else ClearBit(suspicious, i);
+   }
+
+   return count;
+}
+
 /***
  *** Check whether this is a missing sector
  ***/
@@ -172,15 +223,24 @@ char *GetSimulationHint(unsigned char *buf)
 int CheckForMissingSector(unsigned char *buf, guint64 sector, 
 			  unsigned char *fingerprint, guint64 fingerprint_sector)
 {  static char pattern[2048];
-   static char last_pattern = 0;
+   static int last_pattern = 0;
    guint64 recorded_number;
+   guint64 word[2];
    char *sim_hint;
-   
+
+   /* Sort out the regular sectors first */
+
+   get_screening_words(word);
+   if(!is_candidate(buf, word))
+      return SECTOR_PRESENT;
+
    /* Bytefill used as missing sector marker? */
 
    if(Closure->fillUnreadable >= 0)
    {  if(Closure->fillUnreadable != last_pattern)  /* cache the pattern */
-	 memset(pattern, Closure->fillUnreadable, 2048);
+      {  memset(pattern, Closure->fillUnreadable, 2048);
+	 last_pattern = Closure->fillUnreadable;
+      }
 
       if(memcmp(buf, pattern, 2048)) 
 	   return SECTOR_PRESENT;
@@ -241,14 +301,19 @@ int CheckForMissingSector(unsigned char *buf, guint64 sector,
 int CheckForMissingSectors(unsigned char *buf, guint64 sector, 
 			   unsigned char *fingerprint, guint64 fingerprint_sector,
 			   int n_sectors, guint64 *first_defect)
-{  int i,result;
+{  guint64 word[2];
+   int i,result;
+
+   get_screening_words(word);
 
    for(i=0; i<n_sectors; i++)
-   {  result = CheckForMissingSector(buf, sector, fingerprint, fingerprint_sector);
+   {  if(is_candidate(buf, word))
+      {  result = CheckForMissingSector(buf, sector, fingerprint, fingerprint_sector);
 
-      if(result != SECTOR_PRESENT)
-      {  *first_defect = sector;
-	 return result;
+	 if(result != SECTOR_PRESENT)
+	 {  *first_defect = sector;
+	    return result;
+	 }
       }
 
       buf += 2048;
@@ -258,6 +323,222 @@ int CheckForMissingSectors(unsigned char *buf, guint64 sector,
    return SECTOR_PRESENT;
 }
 
+/***
+ *** Sparse images
+ ***
+ * With --sparse-image the readers leave unread areas as holes in the
+ * image file instead of filling them with dead sector markers.
+ * Sectors in holes are replaced by dead sector markers when they are
+ * read back, so they are missing sectors for all other functions.
+ *
+ * File systems allocate holes in units of their block size. Writing
+ * a sector into a hole zero-fills the rest of its block, and these zeros
+ * would later be taken for regular sector contents. Therefore the
+ * unwritten neighbours of a write within the same SPARSE_ALIGN sectors
+ * are filled with dead sector markers first.
+ */
+
+#define SPARSE_ALIGN 64   /* 128KiB; covers the usual file system block sizes */
+
+#define ALIGN_DOWN(s) ((s) & ~(gint64)(SPARSE_ALIGN-1))
+#define ALIGN_UP(s)   ALIGN_DOWN((s)+SPARSE_ALIGN-1)
+
+/* First sector behind the byte position returned by LargeIsHole() */
+
+static gint64 end_sector(gint64 end)
+{
+   return end/2048 + (end%2048 ? 1 : 0);
+}
+
+/*
+ * Replace the sectors which lie in holes of the file.
+ * buf contains count sectors read from sector position first.
+ */
+
+void MarkHoleSectors(LargeFile *file, unsigned char *buf, gint64 first, gint64 count)
+{  gint64 s = first;
+
+   while(s < first+count)
+   {  gint64 end,next;
+      int hole = LargeIsHole(file, 2048*s, &end);
+
+      next = MIN(end_sector(end), first+count);
+      if(next <= s) break;
+
+      if(hole)
+	for(; s<next; s++)
+	  CreateMissingSector(buf+2048*(s-first), s, NULL, 0, NULL);
+
+      s = next;
+   }
+}
+
+/*
+ * Write dead sector markers for sectors from ... to-1.
+ * Returns FALSE and leaves errno set on failure.
+ */
+
+static int write_markers(LargeFile *file, gint64 from, gint64 to,
+			 unsigned char *fp, gint32 fp_sector, char *label)
+{  unsigned char *buf;
+   gint64 s;
+   int ok = TRUE;
+
+   if(from >= to)
+     return TRUE;
+
+   if(!LargeSeek(file, (gint64)(2048*from)))
+     return FALSE;
+
+   buf = g_malloc(2048*SPARSE_ALIGN);
+
+   for(s=from; s<to && ok; )
+   {  int i,n = MIN(to-s, SPARSE_ALIGN);
+
+      for(i=0; i<n; i++)
+	CreateMissingSector(buf+2048*i, s+i, fp, fp_sector, label);
+
+      ok = LargeWrite(file, buf, 2048*n) == 2048*n;
+      s += n;
+   }
+
+   g_free(buf);
+   return ok;
+}
+
+/*
+ * Write dead sector markers for the sectors from ... to-1
+ * which are in a hole or behind the end of file.
+ */
+
+static int fill_unwritten(LargeFile *file, gint64 from, gint64 to, gint64 eof_sector,
+			  unsigned char *fp, gint32 fp_sector, char *label)
+{  gint64 s = from;
+
+   while(s < to)
+   {  gint64 end,next;
+      int hole;
+
+      if(s >= eof_sector)
+	return write_markers(file, s, to, fp, fp_sector, label);
+
+      hole = LargeIsHole(file, 2048*s, &end);
+      next = MIN(end_sector(end), to);
+      if(next <= s) next = s+1;
+
+      if(hole && !write_markers(file, s, next, fp, fp_sector, label))
+	return FALSE;
+
+      s = next;
+   }
+
+   return TRUE;
+}
+
+/*
+ * Must be called before writing the sectors first ... first+count-1
+ * into an image which may be sparse. The file position is changed.
+ * Does not use Stop() so that it may be called from worker threads;
+ * returns FALSE and leaves errno set on failure.
+ */
+
+int PrepareSparseWrite(LargeFile *file, gint64 first, gint64 count,
+		       unsigned char *fp, gint32 fp_sector, char *label)
+{  gint64 eof_sector = end_sector(LargeFileSize(file));
+   gint64 last = first+count;
+
+   /* Unwritten sectors before and after the new ones */
+
+   if(!fill_unwritten(file, ALIGN_DOWN(first), first, eof_sector, fp, fp_sector, label))
+     return FALSE;
+   if(!fill_unwritten(file, last, MIN(ALIGN_UP(last), eof_sector), eof_sector, fp, fp_sector, label))
+     return FALSE;
+
+   /* Writing behind the end of file leaves a hole after it,
+      but the block containing the current end is already allocated. */
+
+   if(first > eof_sector)
+     return fill_unwritten(file, eof_sector, MIN(ALIGN_UP(eof_sector), first), eof_sector,
+			   fp, fp_sector, label);
+
+   return TRUE;
+}
+
+/*
+ * Extend the image from sector from up to sector to-1 with a hole,
+ * apart from the partial blocks at both ends which receive dead sector markers.
+ * Returns FALSE if the file system does not create a hole;
+ * the caller must then write the dead sector markers itself.
+ */
+
+int FillSparseGap(LargeFile *file, gint64 from, gint64 to,
+		  unsigned char *fp, gint32 fp_sector, char *label)
+{  gint64 hole_start = ALIGN_UP(from);
+   gint64 hole_end   = ALIGN_DOWN(to);
+   gint64 ignore;
+
+   if(hole_start >= hole_end)                 /* too small for a hole */
+     return FALSE;
+   if(LargeFileSize(file) > 2048*from)        /* only behind the end of file */
+     return FALSE;
+
+   if(!LargeTruncate(file, (gint64)(2048*to)))
+     return FALSE;
+   if(!LargeIsHole(file, 2048*hole_start, &ignore))
+     return FALSE;
+
+   return    write_markers(file, from, hole_start, fp, fp_sector, label)
+	  && write_markers(file, hole_end, to, fp, fp_sector, label);
+}
+
+/*
+ * Replace all holes in the image by dead sector markers,
+ * e.g. before handing the image to programs unaware of them.
+ */
+
+void FillImageHoles(void)
+{  Image *image;
+   LargeFile *file;
+   gint64 s,sectors,filled = 0;
+   int percent, last_percent = 0;
+
+   image = OpenImageFromFile(Closure->imageName, O_RDWR, IMG_PERMS);
+   if(!image)
+     Stop(_("Can't open %s:\n%s"), Closure->imageName, strerror(errno));
+   PrintLog(_("Replacing holes in the image by dead sector markers.\n"));
+
+   file = image->file;
+   sectors = file->size/2048;
+
+   for(s=0; s<sectors; )
+   {  gint64 end,next;
+      int hole = LargeIsHole(file, 2048*s, &end);
+
+      next = MIN(end_sector(end), sectors);
+      if(next <= s) break;
+
+      if(hole)
+      {  if(!write_markers(file, s, next,
+			   image->fpState == FP_PRESENT ? image->imageFP : NULL,
+			   FINGERPRINT_SECTOR, NULL))
+	   Stop(_("Failed writing to sector %" PRId64 " in image [%s]: %s"),
+		s, "fill", strerror(errno));
+	 filled += next-s;
+      }
+      s = next;
+
+      percent = (100*s)/sectors;
+      if(last_percent != percent) 
+      {  PrintProgress(_("Progress: %3d%%"),percent);
+	 last_percent = percent;
+      }
+   }
+
+   PrintProgress(_("%" PRId64 " sectors in holes replaced by dead sector markers.\n"), filled);
+
+   CloseImage(image);
+}
+
 /***
  *** Dialogue for indicating problem with the missing sector
  ***/
@@ -34,6 +34,9 @@
  */
 struct _RawBuffer *rawbuffer_forward;
 struct _DefectiveSectorHeader *dsh_forward;
+struct _DefectiveSectorRecord *dsr_forward;
+struct _DefectTraceHeader *dth_forward;
+struct _DefectTraceRecord *dtr_forward;
 struct _DeviceHandle *dh_forward;
 struct _Image *dh_image;
 
@@ -70,11 +73,15 @@ typedef enum
    MODE_TRUNCATE,
    MODE_ZERO_UNREADABLE,
    MODE_STRIP_ECC,
+   MODE_MERGE,
+   MODE_FILL_HOLES,
 
    /* don't use the ascii range 32-127 so that we
       avoid collision with the single-char options */
    MODIFIER_ADAPTIVE_READ = 128,
    MODIFIER_AUTO_SUFFIX,
+   MODIFIER_BATCH,
+   MODIFIER_BATCH_READ_AHEAD,
    MODIFIER_CACHE_SIZE, 
    MODIFIER_CLV_SPEED,    /* unused */ 
    MODIFIER_CAV_SPEED,    /* unused */
@@ -85,6 +92,7 @@ typedef enum
    MODIFIER_DRIVER,
    MODIFIER_EJECT,
    MODIFIER_ENCODING_ALGORITHM,
+   MODIFIER_ENCODING_BATCH_SIZE,
    MODIFIER_ENCODING_IO_STRATEGY,
    MODIFIER_EXAMINE_RS02,
    MODIFIER_EXAMINE_RS03,
@@ -94,28 +102,69 @@ typedef enum
    MODIFIER_IGNORE_ISO_SIZE,
    MODIFIER_IGNORE_RS03_HEADER,
    MODIFIER_INTERNAL_REREADS,
+   MODIFIER_MAX_READ_BLOCK,
+   MODIFIER_MEMORY_LIMIT,
    MODIFIER_NO_BDR_DEFECT_MANAGEMENT,
    MODIFIER_NO_PROGRESS,
    MODIFIER_OLD_DS_MARKER,
    MODIFIER_PERMISSIVE_MEDIUM_TYPE,
    MODIFIER_PREFETCH_SECTORS,
+   MODIFIER_PROFILE,
    MODIFIER_RANDOM_SEED,
    MODIFIER_RAW_MODE,
    MODIFIER_READ_ATTEMPTS,
    MODIFIER_READ_MEDIUM,
+   MODIFIER_READ_QUEUE,
    MODIFIER_READ_RAW,
+   MODIFIER_RECORD_TRACE,
    MODIFIER_REGTEST,
+   MODIFIER_REPLAY_TRACE,
    MODIFIER_RESOURCE_FILE,
    MODIFIER_SCREEN_SHOT,
    MODIFIER_SET_VERSION,
    MODIFIER_SIMULATE_CD,
    MODIFIER_SIMULATE_DEFECTS,
+   MODIFIER_SIMULATE_TIMING,
+   MODIFIER_SIMULATE_VIRTUAL_CLOCK,
+   MODIFIER_SPARSE_IMAGE,
    MODIFIER_SPEED_WARNING, 
-   MODIFIER_SPINUP_DELAY, 
+   MODIFIER_SPINUP_DELAY,
+   MODIFIER_STATS_JSON,
+   MODIFIER_THREAD_PLACEMENT, 
    MODIFIER_TRUNCATE,
    MODIFIER_VERSION,
 } run_mode;
 
+/*
+ * Execute the major modes in sequence.
+ * Not all combinations may be really useful.
+ */
+
+static void run_sequence(int sequence)
+{
+   if(sequence & 1<<MODE_SCAN)
+     ReadMediumLinear((gpointer)1);
+
+   if(sequence & 1<<MODE_READ)
+   {  if(sequence & 1<<MODE_CREATE) 
+         Closure->readAndCreate = TRUE;
+      if(strchr(Closure->device, ','))
+           ReadMediumMulti((gpointer)0);
+      else if(Closure->adaptiveRead) 
+           ReadMediumAdaptive((gpointer)0);
+      else ReadMediumLinear((gpointer)0);
+   }
+
+   if(sequence & 1<<MODE_CREATE)
+     MethodCreate();
+
+   if(sequence & 1<<MODE_FIX)
+     MethodFix();
+
+   if(sequence & 1<<MODE_VERIFY)
+     MethodVerify();
+}
+
 int main(int argc, char *argv[])
 {  int mode = MODE_NONE; 
    int sequence = MODE_NONE;
@@ -218,6 +267,8 @@ int main(int argc, char *argv[])
       { {"adaptive-read", 0, 0, MODIFIER_ADAPTIVE_READ},
 	{"auto-suffix", 0, 0,  MODIFIER_AUTO_SUFFIX},
 	{"assume", 1, 0, 'a'},
+	{"batch", 1, 0, MODIFIER_BATCH},
+	{"batch-read-ahead", 1, 0, MODIFIER_BATCH_READ_AHEAD},
 	{"byteset", 1, 0, MODE_BYTESET },
 	{"copy-sector", 1, 0, MODE_COPY_SECTOR },
 	{"compare-images", 1, 0, MODE_CMP_IMAGES },
@@ -236,10 +287,12 @@ int main(int argc, char *argv[])
 	{"ecc-target", 1, 0, 'o'},
 	{"eject", 0, 0, MODIFIER_EJECT },
 	{"encoding-algorithm", 1, 0, MODIFIER_ENCODING_ALGORITHM },
+	{"encoding-batch-size", 1, 0, MODIFIER_ENCODING_BATCH_SIZE },
 	{"encoding-io-strategy", 1, 0, MODIFIER_ENCODING_IO_STRATEGY },
 	{"erase", 1, 0, MODE_ERASE },
 	{"examine-rs02", 0, 0, MODIFIER_EXAMINE_RS02 },
 	{"examine-rs03", 0, 0, MODIFIER_EXAMINE_RS03 },
+	{"fill-holes", 0, 0, MODE_FILL_HOLES },
 	{"fill-unreadable", 1, 0, MODIFIER_FILL_UNREADABLE },
 	{"fix", 0, 0, 'f'},
 	{"fixed-speed-values", 0, 0, MODIFIER_FIXED_SPEED_VALUES },
@@ -251,7 +304,10 @@ int main(int argc, char *argv[])
         {"image", 1, 0, 'i'},
 	{"jump", 1, 0, 'j'},
 	{"marked-image", 1, 0, MODE_MARKED_IMAGE },
+	{"max-read-block", 1, 0, MODIFIER_MAX_READ_BLOCK },
+	{"memory-limit", 1, 0, MODIFIER_MEMORY_LIMIT },
 	{"medium-info", 0, 0, MODE_MEDIUM_INFO },
+	{"merge", 1, 0, MODE_MERGE },
 	{"merge-images", 1, 0, MODE_MERGE_IMAGES },
 	{"method", 2, 0, 'm' },
 	{"no-bdr-defect-management", 0, 0, MODIFIER_NO_BDR_DEFECT_MANAGEMENT },
@@ -260,6 +316,7 @@ int main(int argc, char *argv[])
 	{"permissive-medium-type", 0, 0, MODIFIER_PERMISSIVE_MEDIUM_TYPE },
 	{"prefetch-sectors", 1, 0, MODIFIER_PREFETCH_SECTORS },
         {"prefix", 1, 0, 'p'},
+	{"profile", 1, 0, MODIFIER_PROFILE },
 	{"random-errors", 1, 0, MODE_RANDOM_ERR },
 	{"random-image", 1, 0, MODE_RANDOM_IMAGE },
 	{"random-seed", 1, 0, MODIFIER_RANDOM_SEED },
@@ -268,9 +325,12 @@ int main(int argc, char *argv[])
 	{"read", 2, 0,'r'},
 	{"read-attempts", 1, 0, MODIFIER_READ_ATTEMPTS },
 	{"read-medium", 1, 0, MODIFIER_READ_MEDIUM },
+	{"read-queue", 1, 0, MODIFIER_READ_QUEUE },
 	{"read-sector", 1, 0, MODE_READ_SECTOR},
 	{"read-raw", 0, 0, MODIFIER_READ_RAW},
+	{"record-trace", 1, 0, MODIFIER_RECORD_TRACE},
 	{"regtest", 0, 0, MODIFIER_REGTEST},
+	{"replay-trace", 1, 0, MODIFIER_REPLAY_TRACE},
 	{"redundancy", 1, 0, 'n'},
 	{"resource-file", 1, 0, MODIFIER_RESOURCE_FILE},
 	{"scan", 2, 0,'s'},
@@ -281,10 +341,15 @@ int main(int argc, char *argv[])
 	{"show-sector", 1, 0, MODE_SHOW_SECTOR},
 	{"sim-cd", 2, 0, MODIFIER_SIMULATE_CD},
 	{"sim-defects", 1, 0, MODIFIER_SIMULATE_DEFECTS},
+	{"sim-timing", 1, 0, MODIFIER_SIMULATE_TIMING},
+	{"sim-virtual-clock", 0, 0, MODIFIER_SIMULATE_VIRTUAL_CLOCK},
+	{"sparse-image", 0, 0, MODIFIER_SPARSE_IMAGE},
 	{"speed-warning", 2, 0, MODIFIER_SPEED_WARNING},
 	{"spinup-delay", 1, 0, MODIFIER_SPINUP_DELAY},
+	{"stats-json", 1, 0, MODIFIER_STATS_JSON},
 	{"strip", 0, 0, 'z'},
 	{"test", 2, 0, 't'},
+	{"thread-placement", 1, 0, MODIFIER_THREAD_PLACEMENT},
         {"threads", 1, 0, 'x'},
 	{"truncate", 2, 0, MODIFIER_TRUNCATE},
 	{"unlink", 0, 0, 'u'},
@@ -411,6 +476,15 @@ int main(int argc, char *argv[])
          case MODIFIER_AUTO_SUFFIX:
 	   Closure->autoSuffix = TRUE;
 	   break;
+         case MODIFIER_BATCH:
+	   if(Closure->batchList) g_free(Closure->batchList);
+	   Closure->batchList = g_strdup(optarg);
+	   break;
+         case MODIFIER_BATCH_READ_AHEAD:
+	   Closure->batchReadAhead = atoi(optarg);
+	   if(Closure->batchReadAhead < 0)
+	      Stop(_("--batch-read-ahead must not be negative."));
+	   break;
          case MODIFIER_CACHE_SIZE:
 	   Closure->cacheMiB = atoi(optarg);
 	   if(Closure->cacheMiB <   8) 
@@ -459,6 +533,13 @@ int main(int argc, char *argv[])
 	   if(Closure->encodingAlgorithm == ENCODING_ALG_INVALID)
 	     Stop(_("--encoding-algorithm: valid types are 32bit, 64bit"));
 	   break;
+	 case MODIFIER_ENCODING_BATCH_SIZE:
+	   Closure->encodingBatchSize = atoi(optarg);
+	   if(   Closure->encodingBatchSize < 0
+	      || Closure->encodingBatchSize > MAX_PREFETCH_CACHE_SIZE)
+	      Stop(_("--encoding-batch-size must be in range 0...%d"),
+		   MAX_PREFETCH_CACHE_SIZE);
+	   break;
 	 case MODIFIER_ENCODING_IO_STRATEGY:
 	   if(!strcmp(optarg, "readwrite"))
 	   {  Closure->encodingIOStrategy = IO_STRATEGY_READWRITE;
@@ -518,6 +599,17 @@ int main(int argc, char *argv[])
 	    if(Closure->internalAttempts > 10) 
 	       Closure->internalAttempts = 10;
 	    break;
+	 case MODIFIER_MAX_READ_BLOCK:
+	    Closure->maxReadBlock = atoi(optarg);
+	    if(Closure->maxReadBlock < 0 || Closure->maxReadBlock > MAX_READ_BLOCK)
+	       Stop(_("--max-read-block must be in range 0...%d"), MAX_READ_BLOCK);
+	    break;
+	 case MODIFIER_MEMORY_LIMIT:
+	    Closure->memoryLimit = atoi(optarg);
+	    if(Closure->memoryLimit < 0)
+	       Closure->memoryLimit = 0;
+	    debug_mode_required = TRUE;
+	    break;
          case MODIFIER_DEBUG:
 	   Closure->debugMode = TRUE;
 	   break;
@@ -558,6 +650,11 @@ int main(int argc, char *argv[])
 	   if(optarg) Closure->randomSeed = atoi(optarg);
 	   debug_mode_required = TRUE;
 	   break;
+         case MODIFIER_PROFILE:
+	   if(Closure->profileFile) g_free(Closure->profileFile);
+	   Closure->profileFile = g_strdup(optarg);
+	   debug_mode_required = TRUE;
+	   break;
          case MODIFIER_RAW_MODE:
 	    if(optarg) Closure->rawMode = strtol(optarg,NULL,16);
 	   break;
@@ -587,6 +684,11 @@ int main(int argc, char *argv[])
          case MODIFIER_READ_MEDIUM:
 	   Closure->readingPasses = atoi(optarg);
 	   break;
+         case MODIFIER_READ_QUEUE:
+	   Closure->readQueue = atoi(optarg);
+	   if(Closure->readQueue < 0 || Closure->readQueue > MAX_READ_QUEUE)
+	      Stop(_("--read-queue must be in range 0...%d"), MAX_READ_QUEUE);
+	   break;
          case MODIFIER_READ_RAW:
 	   Closure->readRaw = TRUE;
 	   break;
@@ -622,13 +724,49 @@ int main(int argc, char *argv[])
 	   else Closure->simulateDefects = 10;
 	   debug_mode_required = TRUE;
 	   break;
+        case MODIFIER_RECORD_TRACE:
+	   if(Closure->recordTrace) g_free(Closure->recordTrace);
+	   Closure->recordTrace = g_strdup(optarg);
+	   debug_mode_required = TRUE;
+	   break;
+        case MODIFIER_REPLAY_TRACE:
+	   if(Closure->replayTrace) g_free(Closure->replayTrace);
+	   Closure->replayTrace = g_strdup(optarg);
+	   debug_mode_required = TRUE;
+	   break;
+        case MODIFIER_SIMULATE_TIMING:
+	   if(Closure->simulateTiming) g_free(Closure->simulateTiming);
+	   Closure->simulateTiming = g_strdup(optarg);
+	   debug_mode_required = TRUE;
+	   break;
+        case MODIFIER_SIMULATE_VIRTUAL_CLOCK:
+	   Closure->simulateVirtualClock = TRUE;
+	   debug_mode_required = TRUE;
+	   break;
          case MODIFIER_SPINUP_DELAY:
 	   if(optarg) Closure->spinupDelay = atoi(optarg);
 	   break;
+         case MODIFIER_SPARSE_IMAGE:
+	   Closure->sparseImage = TRUE;
+	   break;
          case MODIFIER_SPEED_WARNING:
 	   if(optarg) Closure->speedWarning = atoi(optarg);
 	   else Closure->speedWarning=10;
 	   break;
+         case MODIFIER_STATS_JSON:
+	   if(Closure->statsJson) g_free(Closure->statsJson);
+	   Closure->statsJson = g_strdup(optarg);
+	   break;
+         case MODIFIER_THREAD_PLACEMENT:
+	   if(!strcmp(optarg, "none"))
+	      Closure->threadPlacement = PLACEMENT_NONE;
+	   else if(!strcmp(optarg, "cpu"))
+	      Closure->threadPlacement = PLACEMENT_CPU;
+	   else if(!strcmp(optarg, "numa"))
+	      Closure->threadPlacement = PLACEMENT_NUMA;
+	   else
+	      Stop(_("--thread-placement: valid types are none, cpu and numa"));
+	   break;
          case MODIFIER_TRUNCATE: 
 	   if(optarg)                  /* debugging truncate mode */
 	   {  mode = MODE_TRUNCATE;
@@ -676,6 +814,13 @@ int main(int argc, char *argv[])
 	   mode = MODE_MEDIUM_INFO;
 	   debug_arg = g_strdup(optarg);
 	   break;
+         case MODE_MERGE:
+	   mode = MODE_MERGE;
+	   debug_arg = g_strdup(optarg);
+	   break;
+         case MODE_FILL_HOLES:
+	   mode = MODE_FILL_HOLES;
+	   break;
          case MODE_MERGE_IMAGES:
 	   mode = MODE_MERGE_IMAGES;
 	   debug_arg = g_strdup(optarg);
@@ -769,7 +914,14 @@ int main(int argc, char *argv[])
       Closure->imageName = ApplyAutoSuffix(Closure->imageName, "iso");
    }
 
-   /*** Determine the default device (OS dependent!) if 
+   /*** Batches name their images themselves
+        and are only useful for creating and verifying. */
+
+   if(Closure->batchList
+      && (mode != MODE_SEQUENCE || sequence & ~(1<<MODE_CREATE | 1<<MODE_VERIFY)))
+      Stop(_("--batch can only be used with -c and -t."));
+
+   /*** Determine the default device (OS dependent!) if
 	- none has been specified on the command line
         - and one if actually required in command line mode.
 
@@ -785,76 +937,28 @@ int main(int argc, char *argv[])
 #endif
    }
 
+   /*** Machine readable statistics are only available on the command line */
+
+   if(Closure->statsJson && mode != MODE_NONE && mode != MODE_HELP)
+      OpenStatsJson(Closure->statsJson);
+
+   if(Closure->profileFile && mode != MODE_NONE && mode != MODE_HELP)
+      OpenProfile(Closure->profileFile);
+
    /*** Dispatch action depending on mode.
         The major modes can be executed in sequence, 
 	but not all combinations may be really useful. */
 
    switch(mode)
    {  case MODE_SEQUENCE:
-	if(sequence & 1<<MODE_SCAN)
-	  ReadMediumLinear((gpointer)1);
-
-	if(sequence & 1<<MODE_READ)
-	{  if(sequence & 1<<MODE_CREATE) 
-	      Closure->readAndCreate = TRUE;
-	   if(Closure->adaptiveRead) 
-	        ReadMediumAdaptive((gpointer)0);
-	   else ReadMediumLinear((gpointer)0);
-	}
-
-	if(sequence & 1<<MODE_CREATE)
-	{  Method *method = FindMethod(Closure->methodName); 
+	if(Closure->batchList)
+	{  Batch *batch = OpenBatch(Closure->batchList);
 
-	   if(!method) Stop(_("\nMethod %s not available.\n"
-			      "Use -m without parameters for a method list.\n"), 
-			    Closure->methodName);
-
-	   method->create();
-	}
-
-	if(sequence & 1<<MODE_FIX)
-	{  Method *method = NULL;
-	   Image *image;
-
-	   PrintLog(_("\nOpening %s"), Closure->imageName);
-	   image = OpenImageFromFile(Closure->imageName, O_RDWR, IMG_PERMS);
-	   if(!image)
-	   {  PrintLog(": %s.\n", strerror(errno));
-	   }
-	   else 
-	   {  if(image->inLast == 2048)
-	           PrintLog(_(": %" PRId64 " medium sectors.\n"), image->sectorSize);
-	      else PrintLog(_(": %" PRId64 " medium sectors and %d bytes.\n"), 
-		   image->sectorSize-1, image->inLast);
-	   }
-	   image = OpenEccFileForImage(image, Closure->eccName, O_RDWR, IMG_PERMS);
-	   ReportImageEccInconsistencies(image);
-
-	   /* Determine method. Ecc files win over augmented ecc. */
-
-	   if(image && image->eccFileMethod) method = image->eccFileMethod;
-	   else if(image && image->eccMethod) method = image->eccMethod;
-	   else Stop("Internal error: No suitable method for repairing image.");
-
-	   method->fix(image);
-	}
-
-	if(sequence & 1<<MODE_VERIFY)
-	{  Method *method;
-	   Image *image;
-
-	   image = OpenImageFromFile(Closure->imageName, O_RDONLY, IMG_PERMS);
-	   image = OpenEccFileForImage(image, Closure->eccName, O_RDONLY, IMG_PERMS);
-
-	   /* Determine method. Ecc files win over augmented ecc. */
-
-	   if(image && image->eccFileMethod) method = image->eccFileMethod;
-	   else if(image && image->eccMethod) method = image->eccMethod;
-	   else if(!(method = FindMethod("RS01")))
-	           Stop(_("RS01 method not available for comparing files."));
-	     
-	   method->verify(image);
+	   while(NextBatchImage(batch))
+	     run_sequence(sequence);
+	   CloseBatch(batch);
 	}
+	else run_sequence(sequence);
 	break;
 
       case MODE_BYTESET:
@@ -929,6 +1033,14 @@ int main(int argc, char *argv[])
 	 StripECCFromImageFile();
 	 break;
 
+      case MODE_MERGE:
+	 MergeImageFiles(debug_arg);
+	 break;
+
+      case MODE_FILL_HOLES:
+	 FillImageHoles();
+	 break;
+
       case MODE_ZERO_UNREADABLE:
 	 ZeroUnreadable();
 	 break;
@@ -957,10 +1069,13 @@ int main(int argc, char *argv[])
 	     "  dvdisaster -s, --scan   # Scan the medium for read errors.\n"
 	     "  dvdisaster -t, --test   # Test integrity of the .iso and .ecc files.\n"
 	     "  dvdisaster -z, --strip  # Strip ECC data from an augmented .iso.\n"
+	     "  dvdisaster --merge a,b  # Merge partial images a,b,... into the image file.\n"
+	     "  dvdisaster --fill-holes # Replace holes of a sparse image by dead sector markers.\n"
 	     "  dvdisaster -u, --unlink # Delete .iso files (when other actions complete)\n\n"));
 
       PrintCLI(_("Drive and file specification:\n"
 	     "  -d, --device device         - read from given device   (default: %s)\n"
+	     "                                several devices (a,b,...) read one image together\n"
 	     "  -p, --prefix prefix         - prefix of .iso/.ecc file (default: medium.*  )\n"
 	     "  -i, --image imagefile       - name of image file       (default: medium.iso)\n"
 	     "  -e, --ecc eccfile           - name of parity file      (default: medium.ecc)\n"
@@ -979,6 +1094,8 @@ int main(int argc, char *argv[])
       PrintCLI(_("  -x, --threads n            - use n threads for en-/decoding (if supported by codec)\n"));
       PrintCLI(_("  --adaptive-read            - use optimized strategy for reading damaged media\n"));
       PrintCLI(_("  --auto-suffix              - automatically add .iso and .ecc file suffixes\n"));
+      PrintCLI(_("  --batch list               - run -c/-t on all images named in list file or directory\n"));
+      PrintCLI(_("  --batch-read-ahead n       - read the next n batch images ahead (default: 1)\n"));
       PrintCLI(_("  --cache-size n             - image cache size in MiB during -c mode (default: 32MiB)\n"));
       PrintCLI(_("  --dao                      - assume DAO disc; do not trim image end\n"));
       PrintCLI(_("  --defective-dump d         - directory for saving incomplete raw sectors\n"));
@@ -987,11 +1104,13 @@ int main(int argc, char *argv[])
 #endif
       PrintCLI(_("  --eject                    - eject medium after successful read\n"));
       PrintCLI(_("  --encoding-algorithm x     - possible values: 32bit, 64bit, SSE2, AltiVec\n"));
+      PrintCLI(_("  --encoding-batch-size n    - RS03 encoder threads claim n sectors at once (0=auto)\n"));
       PrintCLI(_("  --encoding-io-strategy x   - possible values: readwrite, mmap\n"));
       PrintCLI(_("  --fill-unreadable n        - fill unreadable sectors with byte n\n"));
       PrintCLI(_("  --ignore-fatal-sense       - continue reading after potentially fatal error conditon\n"));
       PrintCLI(_("  --ignore-iso-size          - ignore image size from ISO/UDF data (dangerous - see man page!)\n"));
       PrintCLI(_("  --internal-rereads n       - drive may attempt n rereads before reporting an error\n"));
+      PrintCLI(_("  --max-read-block n         - adapt linear read transfers up to n sectors (0=off)\n"));
       PrintCLI(_("  --medium-info              - print info about medium in drive\n"));
       PrintCLI(_("  --no-bdr-defect-management - use bigger RS03 images for BD-R (see man page!)\n"));
       PrintCLI(_("  --no-progress              - do not print progress information\n"));
@@ -1000,11 +1119,15 @@ int main(int argc, char *argv[])
       PrintCLI(_("  --raw-mode n               - mode for raw reading CD media (20 or 21)\n"));
       PrintCLI(_("  --read-attempts n-m        - attempts n up to m reads of a defective sector\n"));
       PrintCLI(_("  --read-medium n            - read the whole medium up to n times\n"));
+      PrintCLI(_("  --read-queue n             - keep up to n READ commands queued in the drive (0=off)\n"));
       PrintCLI(_("  --read-raw                 - performs read in raw mode if possible\n"));
       PrintCLI(_("  --regtest                  - tweaks output for compatibility with regtests\n"));
       PrintCLI(_("  --resource-file p          - get resource file from given path\n"));
+      PrintCLI(_("  --sparse-image             - leave unread areas as holes in the image file\n"));
       PrintCLI(_("  --speed-warning n          - print warning if speed changes by more than n percent\n"));
       PrintCLI(_("  --spinup-delay n           - wait n seconds for drive to spin up\n"));
+      PrintCLI(_("  --stats-json file          - append progress and statistics as JSON lines to file\n"));
+      PrintCLI(_("  --thread-placement x       - pin codec threads; possible values: none, cpu, numa\n"));
       PrintCLI(_("  --version                  - print version and some configuration info\n"));
       PrintCLI(_("  --debug                    - allow advanced dangerous options (use with --help for a list)\n"));
 
@@ -1023,22 +1146,29 @@ int main(int argc, char *argv[])
 	PrintCLI(_("  --fixed-speed-values     - output fixed speed values for better output diffing\n"));
 	PrintCLI(_("  --ignore-rs03-header     - ignore RS03 header when repairing (forcing a full search)\n"));
 	PrintCLI(_("  --marked-image n         - create image with n marked random sectors\n"));
+	PrintCLI(_("  --memory-limit n         - plan codec buffers as if only n MiB of memory were available\n"));
 	PrintCLI(_("  --merge-images a,b       - merge image a with b (a receives sectors from b)\n"));
+	PrintCLI(_("  --profile file           - write a trace of time spent in major code paths to file\n"));
 	PrintCLI(_("  --random-errors e        - seed image with (correctable) random errors\n"));
 	PrintCLI(_("  --random-image n         - create image with n sectors of random numbers\n"));
 	PrintCLI(_("  --random-seed n          - random seed for built-in random number generator\n"));
 	PrintCLI(_("  --raw-sector n           - shows hexdump of the given raw sector from medium in drive\n"));
 	PrintCLI(_("  --read-sector n          - shows hexdump of the given sector from medium in drive\n"));
+	PrintCLI(_("  --record-trace file      - record outcome and timing of all reads from the drive\n"));
 	PrintCLI(_("  --redundancy n           - for RS03, specify the target augmented image size manually,\n"
 		   "                             note that you'll also need to specify it to verify or repair\n"
 		   "                             the image, so ensure you write this value down!\n"));
+	PrintCLI(_("  --replay-trace file      - let the simulated CD fail like in a recorded session\n"));
 	PrintCLI(_("  --screen-shot            - useful for generating screen shots\n"));
 	PrintCLI(_("  --send-cdb arg           - executes given cdb at drive; kills system if used wrong\n"));
 	PrintCLI(_("  --set-version            - set program version for debugging purposes (dangerous!)\n"));
 	PrintCLI(_("  --show-header n          - assumes given sector is a ecc header and prints it\n"));
 	PrintCLI(_("  --show-sector n          - shows hexdump of the given sector in an image file\n"));
-	PrintCLI(_("  --sim-cd image           - simulate a SCSI-Level CD with contents supplied by the ISO image\n"));
+	PrintCLI(_("  --sim-cd image[,image..] - simulate a SCSI-Level CD with contents supplied by the ISO image\n"
+		   "                             (n-th image for the n-th sim-cd device with -d a,b,...)\n"));
 	PrintCLI(_("  --sim-defects n          - simulate n%% defective sectors on medium\n"));
+	PrintCLI(_("  --sim-timing file        - use drive timing profile from file for the simulated CD\n"));
+	PrintCLI(_("  --sim-virtual-clock      - advance a virtual clock instead of waiting for the simulated CD\n"));
 	PrintCLI(_("  --truncate n             - truncates image to n sectors\n")); 
 	PrintCLI(_("  --zero-unreadable        - replace the \"unreadable sector\" markers with zeros\n\n"));
       }
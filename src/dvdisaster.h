@@ -55,6 +55,7 @@
  #include <locale.h>
 #endif
 #include <math.h>
+#include <setjmp.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdarg.h>
@@ -63,6 +64,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#ifndef SYS_MINGW
+ #include <sys/uio.h>
+ #include <limits.h>
+ #ifndef IOV_MAX
+  #define IOV_MAX 1024
+ #endif
+#else
+ struct iovec { void *iov_base; size_t iov_len; };
+#endif
 
 #include "md5.h"
 
@@ -199,11 +209,25 @@ typedef void PangoLayout;
 #define MAX_OLD_CACHE_SIZE  8096         /* old cache for RS01/RS02  */
 #define MAX_PREFETCH_CACHE_SIZE (512*1024)   /* up to 0.5TB RS03  */
 
+/* Maximum number of READ commands kept in flight */
+
+#define MAX_READ_QUEUE 8
+
+/* Maximum transfer size of the adaptive linear reader (in 2K sectors) */
+
+#define MAX_READ_BLOCK 256
+
 /* Choices for I/O strategy */
 
 #define IO_STRATEGY_READWRITE 0
 #define IO_STRATEGY_MMAP 1
 
+/* Choices for codec thread placement */
+
+#define PLACEMENT_NONE 0
+#define PLACEMENT_CPU 1
+#define PLACEMENT_NUMA 2
+
 /* SCSI driver selection on Linux */
 
 #define DRIVER_NONE 0
@@ -258,6 +282,8 @@ typedef struct _GlobalClosure
    int codecThreads;    /* Number of threads to use for RS encoders */
    int encodingAlgorithm; /* Force a certain codec type for RS03 */
    int encodingIOStrategy; /* Force a IO strategy for RS03 encoding */
+   int encodingBatchSize; /* Sectors claimed at once by RS03 encoders; 0=auto */
+   int threadPlacement; /* Pin codec threads to cpus or NUMA nodes */
    int sectorSkip;      /* Number of sectors to skip after read error occurs */
    char *redundancy;    /* Error correction code redundancy */
    int eccTarget;       /* 0=file; 1=augmented image */
@@ -269,6 +295,7 @@ typedef struct _GlobalClosure
    int adaptiveRead;    /* Use optimized strategy for reading defective images */
    int speedWarning;    /* Print warning if speed changes by more than given percentage */
    int fillUnreadable;  /* Byte value for filling unreadable sectors or -1 */
+   int sparseImage;     /* leave unread areas as holes in the image file */
    int spinupDelay;     /* Seconds to wait for drive to spin up */
    int truncate;        /* confirms truncation of large images */
    int noTruncate;      /* do not truncate image at the end */
@@ -293,11 +320,27 @@ typedef struct _GlobalClosure
    int dotFileVersion;  /* version of dotfile */
    int simulateDefects; /* if >0, this is the percentage of simulated media defects */
    char *simulateCD;    /* Simulate CD from given image */
+   char *simulateTiming;/* Drive timing profile for the simulated CD */
+   int simulateVirtualClock; /* Simulated CD advances a virtual clock instead of sleeping */
+   int memoryLimit;     /* Simulated memory limit in MiB; 0 = detect */
+   char *recordTrace;   /* Record reading session into this file */
+   char *replayTrace;   /* Simulated CD replays errors from this trace */
+   char *statsJson;     /* write machine readable statistics into this file */
+   char *profileFile;   /* write trace of profiled code spans into this file */
+   char *batchList;     /* process all images named in this list file or directory */
+   int batchReadAhead;  /* number of batch images read ahead into the page cache */
+   void (*logProc)(char*, gpointer); /* library mode: receives the output instead of stdout */
+   gpointer logData;
+   jmp_buf *stopTrap;   /* library mode: Stop() returns here instead of exiting */
+   GThread *stopThread; /* thread which may return through stopTrap */
+   char *stopMessage;   /* message of the last Stop() caught by stopTrap */
    int defectiveDump;   /* dump non-recoverable sectors into given path */
    char *dDumpDir;      /* directory for above */
    char *dDumpPrefix;   /* file name prefix for above */
    int eject;           /* eject medium on success */
    int readingPasses;   /* try to read medium n times */
+   int readQueue;       /* number of READ commands kept in flight */
+   int maxReadBlock;    /* adapt linear read transfers up to this size */
    int pauseAfter;      /* pause after given amount of minutes */
    int pauseDuration;   /* duration of pause in minutes */
    int pauseEject;      /* Eject medium during pause */
@@ -331,6 +374,7 @@ typedef struct _GlobalClosure
    gint32 randomSeed;   /* for the random number generator */
 
    struct _CrcBuf *crcBuf;      /* crcBuf of last image read */
+   struct _Metrics *metrics;    /* counters of the running action */
    
    /*** GUI-related things */
 
@@ -450,6 +494,7 @@ typedef struct _LargeFile
    char *path;
    guint64 size;
    int flags;
+   gint64 dataStart, dataEnd;   /* data region cached by LargeIsHole() */
 } LargeFile;
 
 /***
@@ -531,9 +576,57 @@ typedef struct _CrcBlock
 
 extern struct _RawBuffer *rawbuffer_forward;
 extern struct _DefectiveSectorHeader *dsh_forward;
+extern struct _DefectiveSectorRecord *dsr_forward;
+extern struct _DefectTraceHeader *dth_forward;
+extern struct _DefectTraceRecord *dtr_forward;
 extern struct _DeviceHandle *dh_forward;
 extern struct _Image *dh_image;
 
+/***
+ *** arena.c
+ ***/
+
+enum { ARENA_NONE, ARENA_HEAP, ARENA_MAPPED, ARENA_THP, ARENA_HUGETLB };
+
+typedef struct _Arena
+{  char *name;
+   void *region;                /* as returned by the allocator */
+   gsize regionSize;
+   unsigned char *base;         /* start of the usable space */
+   gsize size, used;
+   int align;                   /* buffers start on cache lines */
+   int backing;                 /* ARENA_HEAP etc. */
+   int buffers;                 /* number of buffers carved out */
+   GPtrArray *extra;            /* buffers which did not fit */
+   gsize extraBytes;
+} Arena;
+
+Arena* CreateArena(char*, gsize);
+void* ArenaAlloc(Arena*, gsize);
+void* ArenaTryAlloc(Arena*, gsize);
+void PrintArenaStats(Arena*);
+void FreeArena(Arena*);
+
+/***
+ *** batch.c
+ ***/
+
+typedef struct _Batch
+{  GPtrArray *images;           /* image file names in processing order */
+   gint current;                /* index of the image being processed */
+   gint readAhead;              /* highest index read ahead so far */
+   int window;                  /* read ahead up to this many images */
+   gint64 readAheadBytes;       /* read ahead this much of each image */
+   GThread *prefetcher;
+   GMutex lock;
+   GCond cond;
+   gint stop;
+} Batch;
+
+Batch* OpenBatch(char*);
+int NextBatchImage(Batch*);
+void CloseBatch(Batch*);
+
 /***
  *** bitmap.c
  ***/
@@ -645,6 +738,7 @@ CrcBuf *CreateCrcBuf(struct _Image*);
 void FreeCrcBuf(CrcBuf*);
 
 int CheckAgainstCrcBuffer(CrcBuf*, gint64, unsigned char*);
+int CompareWithCrcBuffer(CrcBuf*, gint64, guint32);
 int AddSectorToCrcBuffer(CrcBuf*, int, guint64, unsigned char*, int);
 int CrcBufValid(CrcBuf*, struct _Image*, int);
 
@@ -719,6 +813,38 @@ Bitmap* SimulateDefects(gint64);
 void TruncateImageFile(char*);
 void ZeroUnreadable(void);
 
+/***
+ *** defect-trace.c
+ ***
+ * A trace file starts with the header below,
+ * followed by one record per READ command sent to the drive.
+ */
+
+#define TRACE_VERSION 1
+
+typedef struct _DefectTraceHeader
+{  char cookie[12];                  /* "*dvdisaster*" */
+   char method[4];                   /* "Trce" */
+   gint64 sectors;                   /* medium size */
+   gint32 version;                   /* TRACE_VERSION */
+   gint32 reserved;
+   char drive[40];                   /* vendor and product of the drive */
+} DefectTraceHeader;
+
+typedef struct _DefectTraceRecord
+{  gint64 lba;                       /* first sector of the READ command */
+   gint32 nSectors;                  /* number of sectors requested */
+   gint32 duration;                  /* time spent in the drive (microseconds) */
+   gint32 c2;                        /* C2 errors of all sectors, if available */
+   guint8 status;                    /* 0 = success */
+   guint8 senseKey, asc, ascq;       /* sense data if the command failed */
+   guint8 attempt;                   /* read attempt, starting with 1 */
+   guint8 pass;                      /* reading pass */
+   guint8 reserved[6];
+} DefectTraceRecord;
+
+/* Functions working on the DeviceHandle are declared in scsi-layer.h */
+
 /***
  *** ds-marker.c
  ***/
@@ -741,10 +867,16 @@ void CreateMissingSector(unsigned char*, guint64, unsigned char*, guint64, char*
 void CreateDebuggingSector(unsigned char*, guint64, unsigned char*, guint64, char*, char*);
 int CheckForMissingSector(unsigned char*, guint64, unsigned char*, guint64);
 int CheckForMissingSectors(unsigned char*, guint64, unsigned char*, guint64, int, guint64*);
+int ScreenForMissingSectors(unsigned char*, int, Bitmap*);
 void ExplainMissingSector(unsigned char*, guint64, int, int, int*);
 
 void CreatePaddingSector(unsigned char*, guint64, unsigned char*, guint64);
 
+void MarkHoleSectors(LargeFile*, unsigned char*, gint64, gint64);
+int PrepareSparseWrite(LargeFile*, gint64, gint64, unsigned char*, gint32, char*);
+int FillSparseGap(LargeFile*, gint64, gint64, unsigned char*, gint32, char*);
+void FillImageHoles(void);
+
 char *GetSimulationHint(unsigned char*);
 
 /***
@@ -755,6 +887,9 @@ guint32 SwapBytes32(guint32);
 guint64 SwapBytes64(guint64);
 void    SwapEccHeaderBytes(EccHeader*);
 void    SwapDefectiveHeaderBytes(struct _DefectiveSectorHeader*);
+void    SwapDefectiveRecordBytes(struct _DefectiveSectorRecord*);
+void    SwapDefectTraceHeaderBytes(struct _DefectTraceHeader*);
+void    SwapDefectTraceRecordBytes(struct _DefectTraceRecord*);
 void    SwapCrcBlockBytes(CrcBlock*);
 void    PrintEccHeader(EccHeader*);
 
@@ -797,9 +932,11 @@ typedef struct _GaloisTables
    gint32 *indexOf;     /* log */
    gint32 *alphaTo;     /* inverse log */
    gint32 *encAlphaTo; /* inverse log optimized for encoder */
+   void *tableBase;     /* allocation holding the above */
 } GaloisTables;
 
-/* Lookup and working tables for the ReedSolomon codecs */
+/* Lookup and working tables for the ReedSolomon codecs.
+   Tables are shared between all users and must not be modified. */
 
 typedef struct _ReedSolomonTables
 {  GaloisTables *gfTables;/* from above */
@@ -812,6 +949,7 @@ typedef struct _ReedSolomonTables
 
    guint8 *bLut[GF_FIELDSIZE];   /* 8bit encoder lookup table */
    guint8 *synLut;       /* Syndrome calculation speedup */
+   void *tableBase;      /* allocation holding bLut and synLut */
 } ReedSolomonTables;
 
 GaloisTables* CreateGaloisTables(gint32);
@@ -820,6 +958,8 @@ void FreeGaloisTables(GaloisTables*);
 ReedSolomonTables *CreateReedSolomonTables(GaloisTables*, gint32, gint32, int);
 void FreeReedSolomonTables(ReedSolomonTables*);
 
+void FreeTableCache(void);
+
 /***
  *** help-dialogs.c
  ***/
@@ -885,6 +1025,58 @@ int AckHeuristic(struct _RawBuffer*);
 void GuiCreateIconFactory();
 #endif
 
+/***
+ *** image-scan.c
+ ***/
+
+typedef void (*ImageScanReader)(gpointer, unsigned char*, gint64, int);
+
+typedef struct _ImageScanSlot
+{  struct _ImageScan *scan;
+   struct _AlignedBuffer *ab;   /* sector contents */
+   gint8 *missing;              /* results of CheckForMissingSector() */
+   guint32 *crc;                /* Crc32() of each sector */
+   gint8 *crcState;             /* result of comparing with the CrcBuf */
+   gint64 first;
+   int count;
+   gint nextIdx;                /* work distribution among the analysers */
+   GThread *analyser;
+} ImageScanSlot;
+
+typedef struct _ImageScan
+{  /* Current block, valid after ImageScanNextBlock() */
+
+   gint64 first;                /* first sector in block */
+   int count;                   /* number of sectors in block */
+   unsigned char *buf;          /* contents of the sectors */
+   gint8 *missing;              /* SECTOR_PRESENT or SECTOR_MISSING_xxx */
+   guint32 *crc;                /* Crc32() of the sectors */
+   gint8 *crcState;             /* CRC_GOOD etc.; CRC_UNKNOWN without CrcBuf */
+
+   /* Private */
+
+   gint64 sectors;              /* sectors to deliver */
+   gint64 next;                 /* next sector to be read */
+   LargeFile *file;             /* linear image file for the default reader */
+   gint64 fileSectors;
+   int inLast;
+   char *padLabel;              /* label for markers beyond the file end */
+   ImageScanReader reader;
+   gpointer readerData;
+   guint8 *fp;                  /* fingerprint for CheckForMissingSector() */
+   gint32 fpSector;
+   CrcBuf *crcBuf;
+   int nWorkers;
+   ImageScanSlot slot[2];
+   int current;                 /* slot handed out to the caller */
+} ImageScan;
+
+ImageScan* OpenImageScan(LargeFile*, gint64, guint8*, gint32, CrcBuf*, char*);
+ImageScan* OpenImageScanWithReader(gint64, guint8*, gint32, CrcBuf*, ImageScanReader, gpointer);
+int ImageScanNextBlock(ImageScan*);
+int ImageScanSector(ImageScan*, gint64);
+void CloseImageScan(ImageScan*);
+
 /***
  *** image.c
  ***/
@@ -960,9 +1152,16 @@ int LargeSeek(LargeFile*, off_t);
 int LargeEOF(LargeFile*);
 ssize_t LargeRead(LargeFile*, void*, size_t);
 ssize_t LargeWrite(LargeFile*, void*, size_t);
+ssize_t LargeWritev(LargeFile*, struct iovec*, int);
 int LargeClose(LargeFile*);
 int LargeTruncate(LargeFile*, off_t);
+int LargeSync(LargeFile*);
+gint64 LargeFileSize(LargeFile*);
+int LargeIsHole(LargeFile*, gint64, gint64*);
+void LargeIOTotals(gint64*, gint64*);
 int LargeStat(char*, guint64*);
+int LargeStatTime(char*, guint64*, gint64*);
+int LargeRename(char*, char*);
 int LargeUnlink(char*);
 
 int DirStat(char*);
@@ -1002,7 +1201,12 @@ void FillQVector(unsigned char*, unsigned char, int);
 void AndQVector(unsigned char*, unsigned char, int);
 void OrQVector(unsigned char*, unsigned char, int);
 
+void GetPVectors(unsigned char*, unsigned char*);
+void GetQVectors(unsigned char*, unsigned char*);
+
 int DecodePQ(ReedSolomonTables*, unsigned char*, int, int*, int);
+int DecodePVectors(ReedSolomonTables*, unsigned char*, int*, int*, unsigned char*);
+int DecodeQVectors(ReedSolomonTables*, unsigned char*, int*, int*, unsigned char*);
 
 int CountC2Errors(unsigned char*);
 
@@ -1058,6 +1262,19 @@ void PrintMediumInfo(void*);
 void GuiCreateMediumInfoWindow(void);
 #endif
 
+/***
+ *** memory-budget.c
+ ***/
+
+gint64 AvailableMemory(void);
+gint64 PlanMemory(char*, gint64, gint64, gint64, gint64);
+
+/***
+ *** merge-images.c
+ ***/
+
+void MergeImageFiles(char*);
+
 /***
  *** memtrack.c
  ***/
@@ -1165,6 +1382,75 @@ void ListMethods(void);
 Method* FindMethod(char*);
 void CallMethodDestructors(void);
 
+void MethodCreate(void);
+void MethodFix(void);
+void MethodVerify(void);
+
+/***
+ *** metrics.c
+ ***/
+
+/* Counters of one thread, on a cache line of their own */
+
+typedef struct _MetricsSlot
+{  gint sectors;                /* sectors processed */
+   gint errors;                 /* sectors which failed */
+   gint waits;                  /* number of times blocked by other threads */
+   gint waitTime;               /* milliseconds spent blocked */
+   gint64 waitTimeUS;           /* same in microseconds; owner only */
+   char pad[40];
+} MetricsSlot;
+
+typedef struct _MetricsSample
+{  gint64 sectors;
+   gint64 errors;
+   gint64 waits;
+   gint64 waitTime;             /* milliseconds, summed over all threads */
+   double elapsed;              /* seconds since CreateMetrics() */
+   gint64 total;                /* units to be processed (0 if unknown) */
+} MetricsSample;
+
+struct _Metrics;
+typedef void (*MetricsReporter)(struct _Metrics*, MetricsSample*, gpointer);
+
+typedef struct _Metrics
+{  char *phase;                 /* name of the action */
+   gint64 total;                /* units to be processed, 0 if unknown */
+   int unitSectors;             /* medium sectors per unit, e.g. per ecc block layer */
+   int nSlots;
+   MetricsSlot *slot;           /* cache line aligned */
+   void *slotBase;
+   GTimer *timer;
+   MetricsReporter report;
+   gpointer reportData;
+   GThread *reporter;
+   GMutex lock;
+   GCond cond;
+   int stopReporter;
+   gint reportDue;              /* raised by the reporter without callback */
+   int lastPermille;            /* for PrintMetricsProgress() */
+   gint cpuBound, ioBound;      /* see MetricsAddBound() */
+   int serial;                  /* tells subsequent actions apart */
+   gint64 startRead, startWritten; /* LargeIOTotals() at creation */
+   double startCpu;             /* process cpu time at creation */
+} Metrics;
+
+Metrics* CreateMetrics(char*, int, gint64, MetricsReporter, gpointer, int);
+void StopMetricsReporter(Metrics*);
+void FreeMetrics(Metrics*);
+void MetricsAddSectors(Metrics*, int, int);
+void MetricsAddErrors(Metrics*, int, int);
+void MetricsAddWait(Metrics*, int, gint64);
+void MetricsAddBound(Metrics*, int);
+void MetricsSetProgress(Metrics*, int, gint64, gint64);
+int MetricsReportDue(Metrics*);
+void PrintMetricsProgress(Metrics*, char*);
+void SampleMetrics(Metrics*, MetricsSample*);
+int SampleCurrentMetrics(MetricsSample*, char**);
+void OpenStatsJson(char*);
+void CloseStatsJson(void);
+void StatsJsonError(char*);
+
 /***
  *** misc.c 
  ***/
@@ -1195,6 +1481,7 @@ void RegisterCleanup(char*, void (*)(gpointer), gpointer);
 void UnregisterCleanup(void);
 
 GThread* CreateGThread(GThreadFunc, gpointer);
+void RunWorkerThreads(int, GThreadFunc, gpointer);
 
 /***
  *** misc-gui.c 
@@ -1235,6 +1522,25 @@ void GuiSwitchAndSetFootline(GtkWidget*, int, GtkWidget*, char*, ...) PRINTF_FOR
 
 int ModalWarning(GtkMessageType, GtkButtonsType, void (*)(GtkDialog*), char*, ...) PRINTF_FORMAT(4);
 
+/***
+ *** numa.c
+ ***/
+
+#define MAX_NUMA_NODES 64
+
+typedef struct _CodecPlacement
+{  int nNodes;                     /* nodes with usable cpus */
+   int nCpus;
+   int *cpu;                       /* usable cpus, grouped by node */
+   int nodeFirst[MAX_NUMA_NODES];  /* index of first cpu of node in cpu[] */
+   int nodeCpus[MAX_NUMA_NODES];   /* number of cpus in node */
+   int nodeId[MAX_NUMA_NODES];     /* node number as seen by the OS */
+} CodecPlacement;
+
+CodecPlacement* CreateCodecPlacement(void);
+void FreeCodecPlacement(CodecPlacement*);
+int PlaceCodecThread(CodecPlacement*, int, int);
+
 /***
  *** preferences.c
  ***/
@@ -1259,6 +1565,15 @@ char *GetSenseString(int, int, int, int);
 char* GetLastSenseString(int);
 void GetLastSense(int*, int*, int*);
 
+/***
+ *** profile.c
+ ***/
+
+void ProfileBegin(char*);
+void ProfileEnd(char*);
+void OpenProfile(char*);
+void CloseProfile(void);
+
 /***
  *** random.c
  ***/
@@ -1294,9 +1609,24 @@ enum                                 /* for ->properties above */
    DSH_XA_MODE         = (1<<1)
 };
 
+enum                                 /* for ->dshFormat above */
+{  DSH_FORMAT_SECTOR = 0,            /* one file per sector (older versions) */
+   DSH_FORMAT_CACHE  = 1             /* one file holding all sectors */
+};
+
+/* In DSH_FORMAT_CACHE files each sample is preceded by this record */
+
+typedef struct _DefectiveSectorRecord
+{  gint64 lba;                       /* LBA of the sample */
+   guint64 hash;                     /* Hash of the sample contents */
+   gint32 properties;                /* DSH_XA_MODE */
+   gint32 reserved;
+} DefectiveSectorRecord;
+
 int SaveDefectiveSector(struct _RawBuffer*, int);
 int TryDefectiveSectorCache(struct _RawBuffer*, unsigned char*);
 void ReadDefectiveSectorFile(DefectiveSectorHeader *, struct _RawBuffer*, char*);
+void CloseDefectiveSectorCache(void);
 
 /*** 
  *** read-linear.c
@@ -1331,6 +1661,33 @@ void GuiCreateLinearReadWindow(GtkWidget*);
 void GetReadingRange(gint64, gint64*, gint64*);
 void ReadMediumAdaptive(gpointer);
 
+/*** 
+ *** read-multi.c
+ ***/
+
+void ReadMediumMulti(gpointer);
+
+/***
+ *** read-journal.c
+ ***/
+
+typedef struct _ReadJournal
+{  char *path;                  /* name of the journal file */
+   LargeFile *image;            /* image file described by the journal */
+   gint32 fpSector;             /* fingerprint sector of the image */
+   int readMode;                /* reader specific, must match on resume */
+   guint8 eccDigest[16];        /* md5sum of the ecc header in use */
+   Bitmap *map;                 /* sectors present in the image and passing the CRC test */
+   GTimer *timer;               /* time since the last checkpoint */
+} ReadJournal;
+
+ReadJournal* CreateReadJournal(char*, LargeFile*, gint64, gint32, int, void*, int);
+void FreeReadJournal(ReadJournal*);
+void RemoveReadJournal(ReadJournal*);
+void SaveReadJournal(ReadJournal*, int);
+void CheckpointReadJournal(ReadJournal*);
+int LoadReadJournal(ReadJournal*);
+
 /***
  *** read-adaptive-window.c
  ***/
@@ -1414,6 +1771,10 @@ typedef struct _RawBuffer
    int bestFrame;                      /* Frame with lowest failures */
    int bestP1, bestP2, bestQ1, bestQ2;
 
+   int visitedFrames;                  /* smart_lec statistics from last run */
+   gint64 visitedLookups;
+   gint64 visitedProbes;
+
 } RawBuffer;
 
 enum                          /* values for byteState */
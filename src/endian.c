@@ -181,3 +181,24 @@ void SwapDefectiveHeaderBytes(DefectiveSectorHeader *dsh)
   dsh->dshFormat  = SwapBytes32(dsh->dshFormat);
   dsh->nSectors   = SwapBytes32(dsh->nSectors);
 }
+
+void SwapDefectiveRecordBytes(DefectiveSectorRecord *dsr)
+{  
+  dsr->lba        = SwapBytes64(dsr->lba);
+  dsr->hash       = SwapBytes64(dsr->hash);
+  dsr->properties = SwapBytes32(dsr->properties);
+}
+
+void SwapDefectTraceHeaderBytes(DefectTraceHeader *dth)
+{  
+  dth->sectors    = SwapBytes64(dth->sectors);
+  dth->version    = SwapBytes32(dth->version);
+}
+
+void SwapDefectTraceRecordBytes(DefectTraceRecord *dtr)
+{  
+  dtr->lba        = SwapBytes64(dtr->lba);
+  dtr->nSectors   = SwapBytes32(dtr->nSectors);
+  dtr->duration   = SwapBytes32(dtr->duration);
+  dtr->c2         = SwapBytes32(dtr->c2);
+}
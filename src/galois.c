@@ -37,22 +37,178 @@
  * they only work for the case of GF(p**n) with p being prime.
  */
 
-/* Initialize the Galois field tables */
+/***
+ *** Table cache.
+ ***
+ * The tables depend on nothing but their construction parameters,
+ * so all codecs and actions share one read-only copy of each variant.
+ * Create*Tables() hands out a reference from the cache and
+ * Free*Tables() returns it. A small number of unreferenced
+ * tables is kept around so that repeated create/verify/fix runs
+ * in the same process do not rebuild them.
+ */
 
+#define MAX_UNUSED_TABLES 8    /* unreferenced tables kept in the cache */
+#define TABLE_ALIGNMENT 4096   /* lookup tables start at a page boundary */
+#define LUT_ROW_ALIGNMENT 64   /* each bLut row starts at a cache line */
 
-GaloisTables* CreateGaloisTables(gint32 gf_generator)
+typedef struct _CachedTables
+{  GaloisTables *gt;
+   ReedSolomonTables *rt;
+   int refCount;
+   guint64 lastUse;
+} CachedTables;
+
+static GMutex tableLock;
+static GPtrArray *tableCache;
+static guint64 tableUseCounter;
+
+static void destroy_galois_tables(GaloisTables*);
+static void destroy_reed_solomon_tables(ReedSolomonTables*);
+static int release_tables(GaloisTables*, ReedSolomonTables*);
+
+/* Find a cache entry; must be called with tableLock held */
+
+static CachedTables *find_tables(GaloisTables *gt, gint32 gf_generator, gint32 fcr, gint32 prim_elem, int nroots)
+{  unsigned int i;
+
+   if(!tableCache)
+     return NULL;
+
+   for(i=0; i<tableCache->len; i++)
+   {  CachedTables *ct = g_ptr_array_index(tableCache, i);
+
+      if(!gt && !ct->rt && ct->gt->gfGenerator == gf_generator)
+	return ct;
+
+      if(gt && ct->rt && ct->rt->gfTables == gt
+	 && ct->rt->fcr == fcr && ct->rt->primElem == prim_elem && ct->rt->nroots == nroots)
+	return ct;
+   }
+
+   return NULL;
+}
+
+static void add_tables(GaloisTables *gt, ReedSolomonTables *rt)
+{  CachedTables *ct = g_malloc0(sizeof(CachedTables));
+
+   ct->gt = gt;
+   ct->rt = rt;
+   ct->refCount = 1;
+   ct->lastUse = ++tableUseCounter;
+
+   if(!tableCache)
+     tableCache = g_ptr_array_new();
+   g_ptr_array_add(tableCache, ct);
+}
+
+/* Drop the least recently used unreferenced tables beyond MAX_UNUSED_TABLES.
+   Reed-Solomon tables are evicted before the Galois tables they depend on.
+   Must be called with tableLock held. */
+
+static void trim_table_cache(int max_unused)
+{  
+   while(tableCache)
+   {  CachedTables *victim = NULL;
+      unsigned int i, victim_idx = 0;
+      int unused = 0;
+
+      for(i=0; i<tableCache->len; i++)
+      {  CachedTables *ct = g_ptr_array_index(tableCache, i);
+
+	 if(ct->refCount) continue;
+	 unused++;
+	 if(!victim || (ct->rt && !victim->rt) 
+	    || (!ct->rt == !victim->rt && ct->lastUse < victim->lastUse))
+	 {  victim = ct;
+	    victim_idx = i;
+	 }
+      }
+
+      if(unused <= max_unused || !victim)
+	return;
+
+      g_ptr_array_remove_index_fast(tableCache, victim_idx);
+
+      if(victim->rt)
+      {  GaloisTables *gt = victim->rt->gfTables;
+
+	 destroy_reed_solomon_tables(victim->rt);
+	 g_free(victim);
+	 release_tables(gt, NULL);
+      }
+      else
+      {  destroy_galois_tables(victim->gt);
+	 g_free(victim);
+      }
+   }
+}
+
+/* Return a reference; must be called with tableLock held */
+
+static int release_tables(GaloisTables *gt, ReedSolomonTables *rt)
+{  unsigned int i;
+
+   for(i=0; tableCache && i<tableCache->len; i++)
+   {  CachedTables *ct = g_ptr_array_index(tableCache, i);
+
+      if((rt && ct->rt == rt) || (!rt && !ct->rt && ct->gt == gt))
+      {  if(ct->refCount > 0)
+	   ct->refCount--;
+	 return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+/* Remove all tables, e.g. when shutting down */
+
+void FreeTableCache(void)
+{  
+   g_mutex_lock(&tableLock);
+   if(tableCache)
+   {  unsigned int i;
+
+      for(i=0; i<tableCache->len; i++)
+      {  CachedTables *ct = g_ptr_array_index(tableCache, i);
+	 ct->refCount = 0;
+      }
+
+      trim_table_cache(0);
+      g_ptr_array_free(tableCache, TRUE);
+      tableCache = NULL;
+   }
+   g_mutex_unlock(&tableLock);
+}
+
+/* Tables are carved from one page aligned block;
+   *base receives the pointer which must be g_free()d later. */
+
+static void* alloc_aligned_table(int size, void **base)
+{  unsigned char *ptr = g_malloc0(size+TABLE_ALIGNMENT);
+
+   *base = ptr;
+   return ptr + (TABLE_ALIGNMENT - ((intptr_t)ptr & (TABLE_ALIGNMENT-1)));
+}
+
+/* Initialize the Galois field tables */
+
+static GaloisTables* create_galois_tables(gint32 gf_generator)
 {  GaloisTables *gt = g_malloc0(sizeof(GaloisTables));
+   gint32 *table;
    gint32 b,log;
 
    /* Allocate the tables.
       The encoder uses a special version of alpha_to which has the mod_fieldmax()
-      folded into the table. */
+      folded into the table. All three tables share one aligned block. */
 
    gt->gfGenerator = gf_generator;
 
-   gt->indexOf     = g_malloc(GF_FIELDSIZE * sizeof(gint32));
-   gt->alphaTo     = g_malloc(GF_FIELDSIZE * sizeof(gint32));
-   gt->encAlphaTo  = g_malloc(2*GF_FIELDSIZE * sizeof(gint32));
+   table = alloc_aligned_table(4*GF_FIELDSIZE * sizeof(gint32), &gt->tableBase);
+   gt->indexOf     = table;
+   gt->alphaTo     = table +   GF_FIELDSIZE;
+   gt->encAlphaTo  = table + 2*GF_FIELDSIZE;
    
    /* create the log/ilog values */
 
@@ -64,7 +220,10 @@ GaloisTables* CreateGaloisTables(gint32 gf_generator)
 	b = b ^ gf_generator;
    }
 
-   if(b!=1) Stop("Failed to create the Galois field log tables!\n");
+   if(b!=1)  /* caller will bail out */
+   {  destroy_galois_tables(gt);
+      return NULL;
+   }
 
    /* we're even closed using infinity (makes things easier) */
 
@@ -77,26 +236,60 @@ GaloisTables* CreateGaloisTables(gint32 gf_generator)
    return gt;
 }
 
-void FreeGaloisTables(GaloisTables *gt)
+static void destroy_galois_tables(GaloisTables *gt)
 {
-  if(gt->indexOf)     g_free(gt->indexOf);
-  if(gt->alphaTo)     g_free(gt->alphaTo);
-  if(gt->encAlphaTo) g_free(gt->encAlphaTo);
+  if(gt->tableBase) g_free(gt->tableBase);
 
   g_free(gt);
 }
 
+GaloisTables* CreateGaloisTables(gint32 gf_generator)
+{  CachedTables *ct;
+   GaloisTables *gt;
+
+   g_mutex_lock(&tableLock);
+   ct = find_tables(NULL, gf_generator, 0, 0, 0);
+   if(ct)
+   {  ct->refCount++;
+      ct->lastUse = ++tableUseCounter;
+      gt = ct->gt;
+   }
+   else
+   {  gt = create_galois_tables(gf_generator);
+      if(!gt)
+      {  g_mutex_unlock(&tableLock);
+	 Stop("Failed to create the Galois field log tables!\n");
+      }
+      add_tables(gt, NULL);
+   }
+   g_mutex_unlock(&tableLock);
+
+   return gt;
+}
+
+void FreeGaloisTables(GaloisTables *gt)
+{  int found;
+
+   g_mutex_lock(&tableLock);
+   found = release_tables(gt, NULL);
+   trim_table_cache(MAX_UNUSED_TABLES);
+   g_mutex_unlock(&tableLock);
+
+   if(!found)
+     Stop("FreeGaloisTables() called with uncached tables.\n");
+}
+
 /***
  *** Create the Reed-Solomon generator polynomial
  *** and some auxiliary data structures.
  */
 
-ReedSolomonTables *CreateReedSolomonTables(GaloisTables *gt,
-					   gint32 first_consecutive_root,
-					   gint32 prim_elem,
-					   int nroots_in)
+static ReedSolomonTables *create_reed_solomon_tables(GaloisTables *gt,
+						     gint32 first_consecutive_root,
+						     gint32 prim_elem,
+						     int nroots_in)
 {  ReedSolomonTables *rt = g_malloc0(sizeof(ReedSolomonTables));
-   int lut_size, feedback;
+   int lut_size, lut_stride, feedback;
    gint32 i,j,root;
    guint8 *lut;
 
@@ -162,8 +355,11 @@ ReedSolomonTables *CreateReedSolomonTables(GaloisTables *gt,
 
    lut_size = (rt->nroots+15)&~15;
    lut_size += 16;
+   lut_stride = (2*lut_size + LUT_ROW_ALIGNMENT-1) & ~(LUT_ROW_ALIGNMENT-1);
+
+   lut = alloc_aligned_table(GF_FIELDSIZE*lut_stride + rt->nroots*GF_FIELDSIZE, &rt->tableBase);
    for(i=0; i<GF_FIELDSIZE; i++)
-      rt->bLut[i] = g_malloc0(2*lut_size);
+      rt->bLut[i] = lut + i*lut_stride;
 
    for(feedback=0; feedback<256; feedback++)
    {  gint32 *gpoly        = rt->gpoly + rt->nroots;
@@ -180,7 +376,7 @@ ReedSolomonTables *CreateReedSolomonTables(GaloisTables *gt,
     * Prepare lookup table for syndrome calculation.
     */
 
-   lut = rt->synLut = g_malloc(rt->nroots * GF_FIELDSIZE * sizeof(int));
+   lut = rt->synLut = lut + GF_FIELDSIZE*lut_stride;
    for(i=0; i<rt->nroots; i++)
      for(j=0; j<GF_FIELDSIZE; j++)
        *lut++ = gt->alphaTo[mod_fieldmax(gt->indexOf[j] + (rt->fcr+i)*rt->primElem)];
@@ -188,15 +384,54 @@ ReedSolomonTables *CreateReedSolomonTables(GaloisTables *gt,
    return rt;
 }
 
-void FreeReedSolomonTables(ReedSolomonTables *rt)
-{ int i;
-
+static void destroy_reed_solomon_tables(ReedSolomonTables *rt)
+{
   if(rt->gpoly)        g_free(rt->gpoly);
-
-  for(i=0; i<GF_FIELDSIZE; i++)
-  {  g_free(rt->bLut[i]);
-  }
-  g_free(rt->synLut);
+  if(rt->tableBase)    g_free(rt->tableBase);
 
   g_free(rt);
 }
+
+ReedSolomonTables *CreateReedSolomonTables(GaloisTables *gt,
+					   gint32 first_consecutive_root,
+					   gint32 prim_elem,
+					   int nroots)
+{  CachedTables *ct;
+   ReedSolomonTables *rt;
+
+   g_mutex_lock(&tableLock);
+   ct = find_tables(gt, gt->gfGenerator, first_consecutive_root, prim_elem, nroots);
+   if(ct)
+   {  ct->refCount++;
+      ct->lastUse = ++tableUseCounter;
+      rt = ct->rt;
+   }
+   else
+   {  /* the RS tables keep their Galois tables alive while cached */
+
+      ct = find_tables(NULL, gt->gfGenerator, 0, 0, 0);
+      if(!ct || ct->gt != gt)
+      {  g_mutex_unlock(&tableLock);
+	 Stop("CreateReedSolomonTables() called with uncached Galois tables.\n");
+      }
+      ct->refCount++;
+
+      rt = create_reed_solomon_tables(gt, first_consecutive_root, prim_elem, nroots);
+      add_tables(gt, rt);
+   }
+   g_mutex_unlock(&tableLock);
+
+   return rt;
+}
+
+void FreeReedSolomonTables(ReedSolomonTables *rt)
+{  int found;
+
+   g_mutex_lock(&tableLock);
+   found = release_tables(rt->gfTables, rt);
+   trim_table_cache(MAX_UNUSED_TABLES);
+   g_mutex_unlock(&tableLock);
+
+   if(!found)
+     Stop("FreeReedSolomonTables() called with uncached tables.\n");
+}
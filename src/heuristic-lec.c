@@ -66,28 +66,24 @@ void UpdateByteCounts(RawBuffer *rb)
  */
 
 void CalculatePQLoad(RawBuffer *rb)
-{  unsigned char p_vector[P_VECTOR_SIZE];
-   unsigned char q_vector[Q_VECTOR_SIZE];
-   int frame_idx = rb->samplesRead - 1;
+{  int frame_idx = rb->samplesRead - 1;
    unsigned char *new_frame = rb->rawBuf[frame_idx];
-   int ignore[2];
+   int p_err[N_P_VECTORS];
+   int q_err[N_Q_VECTORS];
    int q, p;
-   int err;
-        
+
+   DecodeQVectors(rb->rt, new_frame, q_err, NULL, NULL);
    for(q = 0; q < N_Q_VECTORS; q++)
    {
-     GetQVector(new_frame, q_vector, q);
-     err = DecodePQ(rb->rt, q_vector, Q_PADDING, ignore, 0);
-     if(err <  0) rb->qLoad[frame_idx] += 2;
-     if(err == 1) rb->qLoad[frame_idx]++; /* We assume without any erasures specified there can't be more than 1 errors corrected. */
+     if(q_err[q] <  0) rb->qLoad[frame_idx] += 2;
+     if(q_err[q] == 1) rb->qLoad[frame_idx]++; /* We assume without any erasures specified there can't be more than 1 errors corrected. */
    }      
 
+   DecodePVectors(rb->rt, new_frame, p_err, NULL, NULL);
    for(p = 0; p < N_P_VECTORS; p++)
    {
-     GetPVector(new_frame, p_vector, p);
-     err = DecodePQ(rb->rt, p_vector, P_PADDING, ignore, 0);
-     if(err <  0) rb->pLoad[frame_idx] += 2;
-     if(err == 1) rb->pLoad[frame_idx]++; /* We assume without any erasures specified there can't be more than 1 errors corrected. */
+     if(p_err[p] <  0) rb->pLoad[frame_idx] += 2;
+     if(p_err[p] == 1) rb->pLoad[frame_idx]++; /* We assume without any erasures specified there can't be more than 1 errors corrected. */
    }      
 }   
 
@@ -165,24 +161,21 @@ void UpdatePQParityList(RawBuffer *rb, unsigned char *new_frame)
 static int eval_q_candidate(RawBuffer *rb, unsigned char *q_vector, int q, 
                             int *p_failures_out, int *p_errors_out)
 {
-   unsigned char     p_vector[P_VECTOR_SIZE];
    unsigned char old_q_vector[Q_VECTOR_SIZE];
-   int ignore[2];
+   int p_results[N_P_VECTORS];
    int p, p_errors = 0;
    int p_failures = 0;
-   int err;
    
    GetQVector(rb->recovered, old_q_vector, q);
    SetQVector(rb->recovered,     q_vector, q);
    
    /* Count P failures after setting our Q vector. */
 
+   DecodePVectors(rb->rt, rb->recovered, p_results, NULL, NULL);
    for(p = 0; p < N_P_VECTORS; p++)
    {
-      GetPVector(rb->recovered, p_vector, p);
-      err = DecodePQ(rb->rt, p_vector, P_PADDING, ignore, 0);
-      if(err <  0) p_failures++;
-      else if(err == 1) p_errors++;
+      if(p_results[p] <  0) p_failures++;
+      else if(p_results[p] == 1) p_errors++;
    }            
 
    SetQVector(rb->recovered, old_q_vector, q);
@@ -196,24 +189,21 @@ static int eval_q_candidate(RawBuffer *rb, unsigned char *q_vector, int q,
 static void eval_p_candidate(RawBuffer *rb, unsigned char *p_vector, int p, 
                             int *q_failures_out, int *q_errors_out)
 {
-   unsigned char     q_vector[Q_VECTOR_SIZE];
    unsigned char old_p_vector[P_VECTOR_SIZE];
-   int ignore[2];
+   int q_results[N_Q_VECTORS];
    int q, q_errors = 0;
    int q_failures = 0;
-   int err;
    
    GetPVector(rb->recovered, old_p_vector, p);
    SetPVector(rb->recovered,     p_vector, p);
    
    /* Count Q failures after setting our P vector. */
 
+   DecodeQVectors(rb->rt, rb->recovered, q_results, NULL, NULL);
    for(q = 0; q < N_Q_VECTORS; q++)
    {
-      GetQVector(rb->recovered, q_vector, q);
-      err = DecodePQ(rb->rt, q_vector, Q_PADDING, ignore, 0);
-      if(err <  0) q_failures++;
-      else if(err == 1) q_errors++;
+      if(q_results[q] <  0) q_failures++;
+      else if(q_results[q] == 1) q_errors++;
    }            
 
    SetPVector(rb->recovered, old_p_vector, p);
@@ -236,7 +226,6 @@ int HeuristicLEC(unsigned char *cd_frame, RawBuffer *rb, unsigned char *out)
    unsigned char p_state[P_VECTOR_SIZE];
    unsigned char q_state[Q_VECTOR_SIZE];
    int erasures[Q_VECTOR_SIZE], decimated_erasures[2], erasure_count;
-   int ignore[2];
    int p_failures, q_failures;
    int p_corrected, q_corrected;
    int i,p,q;
@@ -251,28 +240,30 @@ int HeuristicLEC(unsigned char *cd_frame, RawBuffer *rb, unsigned char *out)
    int max_p_errors = 0;
    int max_q_failures = 0;
    int max_q_errors = 0;
+   unsigned char p_vectors[N_P_VECTORS*P_VECTOR_SIZE];
+   unsigned char q_vectors[N_Q_VECTORS*Q_VECTOR_SIZE];
+   int p_results[N_P_VECTORS];
+   int q_results[N_Q_VECTORS];
    int err;
 
    memset(rb->byteState, FRAME_BYTE_UNKNOWN, rb->sampleSize);
    
    /* Count initial P failures */
 
+   DecodePVectors(rb->rt, rb->recovered, p_results, NULL, NULL);
    for(p = 0; p < N_P_VECTORS; p++)
    {
-      GetPVector(rb->recovered, p_vector, p);
-      err = DecodePQ(rb->rt, p_vector, P_PADDING, ignore, 0);
-      if(err < 0) max_p_failures++;
-      if(err == 1) max_p_errors++;
+      if(p_results[p] < 0) max_p_failures++;
+      if(p_results[p] == 1) max_p_errors++;
    }
 
    /* Count initial Q failures */
 
+   DecodeQVectors(rb->rt, rb->recovered, q_results, NULL, NULL);
    for(q = 0; q < N_Q_VECTORS; q++)
    {
-      GetQVector(rb->recovered, q_vector, q);
-      err = DecodePQ(rb->rt, q_vector, Q_PADDING, ignore, 0);
-      if(err < 0) max_q_failures++;
-      if(err == 1) max_q_errors++;
+      if(q_results[q] < 0) max_q_failures++;
+      if(q_results[q] == 1) max_q_errors++;
    }   
    
 #ifdef DEBUG_HEURISTIC_LEC
@@ -287,7 +278,11 @@ int HeuristicLEC(unsigned char *cd_frame, RawBuffer *rb, unsigned char *out)
       p_err = q_err = 0;
       p_decimated = q_decimated = 0;
 
-      /* Perform P-Parity error correction */
+      /* Perform P-Parity error correction.
+         The P vectors do not overlap, so all of them can be
+         decoded up front without erasure markings. */
+
+      DecodePVectors(rb->rt, rb->recovered, p_results, NULL, p_vectors);
 
       for(p=0; p<N_P_VECTORS; p++)
       {  
@@ -301,12 +296,11 @@ int HeuristicLEC(unsigned char *cd_frame, RawBuffer *rb, unsigned char *out)
 
          /* First try to see whether P is correctable without erasure markings. */
 
-         GetPVector(rb->recovered, p_vector, p);
-         err = DecodePQ(rb->rt, p_vector, P_PADDING, ignore, 0);
+         err = p_results[p];
          
          if(err == 1) /* Store back corrected vector */ 
          {  
-            SetPVector(rb->recovered, p_vector, p);
+            SetPVector(rb->recovered, p_vectors + p*P_VECTOR_SIZE, p);
             FillPVector(rb->byteState, FRAME_BYTE_GOOD, p);
             p_corrected++;
             p_err += err;
@@ -373,6 +367,8 @@ int HeuristicLEC(unsigned char *cd_frame, RawBuffer *rb, unsigned char *out)
 
       /* Perform Q-Parity error correction */
 
+      DecodeQVectors(rb->rt, rb->recovered, q_results, NULL, q_vectors);
+
       for(q=0; q<N_Q_VECTORS; q++)
       {  
          /* Determine number of erasures */
@@ -385,12 +381,11 @@ int HeuristicLEC(unsigned char *cd_frame, RawBuffer *rb, unsigned char *out)
 
          /* First try to see whether Q is correctable without erasure markings. */
 
-         GetQVector(rb->recovered, q_vector, q);
-         err = DecodePQ(rb->rt, q_vector, Q_PADDING, ignore, 0);
+         err = q_results[q];
 
          if(err == 1) /* Store back corrected vector */ 
          {  
-            SetQVector(rb->recovered, q_vector, q);
+            SetQVector(rb->recovered, q_vectors + q*Q_VECTOR_SIZE, q);
             FillQVector(rb->byteState, FRAME_BYTE_GOOD, q);
             q_corrected++;
             q_err++;
@@ -688,19 +683,220 @@ static void initialize_frame(RawBuffer *rb)
       memset(&(rb->recovered[2068]), 0, 8); /* 8 zero fill bytes */
 }
 
-//#define DEBUG_SEARCH_PLAUSIBLE
+/*
+ * The vectors of one kind do not share any bytes, so all Q (or P) vectors 
+ * of a pass can be corrected independently of each other.
+ * This lets several threads work on a pass; only the counters
+ * need to be summed up, which makes the result independent
+ * of the number of threads.
+ */
 
-int SearchPlausibleSector(RawBuffer *rb, int noCreateBuffer)
-{
-   unsigned char p_vector[26];
-   unsigned char q_vector[45];
-   unsigned char cp_vector[26];
+typedef struct
+{  RawBuffer *rb;
+   gint next;                  /* next vector to be processed */
+   gint failures;
+   gint corrected;
+   gint err;
+   gint decimated;
+} pass_context;
+
+static void plausible_q_vector(RawBuffer *rb, int q, pass_context *pass)
+{  unsigned char q_vector[45];
    unsigned char cq_vector[45];
    int decimated_erasures[2];
    int ignore[2];
+   int err;
+
+   /* Check whether Q is correct. */
+   GetQVector(rb->recovered, q_vector, q);
+   err = DecodePQ(rb->rt, q_vector, Q_PADDING, ignore, 0);
+
+   /* If it is not correct. */
+   if(err == 1 || err < 0)
+   {
+     /* If Q is correctable. */
+     if(err == 1)
+     {
+       /* Check correction for plausibility: if corrected byte was read in one of the read attempts. */
+       if(check_q_plausibility(rb, q_vector, q, -1, -1))
+       {
+	 /* Store back corrected vector */
+	 SetQVector(rb->recovered, q_vector, q);
+	 g_atomic_int_inc(&pass->corrected);
+	 g_atomic_int_inc(&pass->err);
+       }
+       else
+       {
+	 /* See whether we can find some Q parity bytes accepting the original Q vector. */
+	 if(find_better_q(rb, q, 1))
+	 {
+	   g_atomic_int_inc(&pass->corrected);
+	   g_atomic_int_inc(&pass->err);
+	 }
+	 else err = -1;
+       }
+     }
+
+     /* If correction is not plausible or possible then try 2 error-decimation. */
+     if(err < 0)
+     {
+       /* Try error correction with decimated erasures.
+	  Note that no erasure information for the parity bytes is available */
+       int a, b;
+       int solFound = FALSE;
+
+       GetQVector(rb->byteCount, cq_vector, q);
+
+       for(a = 0; a < Q_VECTOR_SIZE - 2; a++)
+       {
+	 if(cq_vector[a] == 1) continue; /* no alternatives */
+	 for(b = a + 1; b < Q_VECTOR_SIZE - 2; b++)
+	 {
+	   if(cq_vector[b] == 1) continue; /* again, no alternatives present */
+
+	   decimated_erasures[0] = a;
+	   decimated_erasures[1] = b;
+	   GetQVector(rb->recovered, q_vector, q);
+	   err = DecodePQ(rb->rt, q_vector, Q_PADDING, decimated_erasures, 2);
+	   if(err == 2)
+	   {
+	     if(check_q_plausibility(rb, q_vector, q, a, b)) { solFound = TRUE; break;     }
+	   }
+	 }
+	 if(solFound) break;
+       }
+       if(solFound)
+       {
+	 /* Store back corrected vector */
+	 SetQVector(rb->recovered, q_vector, q);
+	 g_atomic_int_add(&pass->err, 2);
+	 g_atomic_int_inc(&pass->corrected);
+	 g_atomic_int_inc(&pass->decimated);
+       }
+       else
+       {
+	 /* See whether we can find some Q parity bytes accepting the original Q vector. */
+	 if(find_better_q(rb, q, 2))
+	 {
+	   g_atomic_int_inc(&pass->corrected);
+	   g_atomic_int_inc(&pass->err);
+	 }
+	 else g_atomic_int_inc(&pass->failures); /* If Q failed */
+       }
+     }
+   }
+}
+
+static void plausible_p_vector(RawBuffer *rb, int p, pass_context *pass)
+{  unsigned char p_vector[26];
+   unsigned char cp_vector[26];
+   int decimated_erasures[2];
+   int ignore[2];
+   int err;
+
+   /* Check whether P is correct. */
+   GetPVector(rb->recovered, p_vector, p);
+   err = DecodePQ(rb->rt, p_vector, P_PADDING, ignore, 0);
+
+   /* If it is not correct. */
+   if(err == 1 || err < 0)
+   {
+     /* If Q is correctable. */
+     if(err == 1)
+     {
+       /* Check correction for plausibility: if corrected byte was read in one of the read attempts. */
+       if(check_p_plausibility(rb, p_vector, p, -1, -1))
+       {
+	 /* Store back corrected vector */
+	 SetPVector(rb->recovered, p_vector, p);
+	 g_atomic_int_inc(&pass->corrected);
+	 g_atomic_int_inc(&pass->err);
+       }
+       else
+       {
+	 /* See whether we can find some P parity bytes accepting the original P vector. */
+	 if(find_better_p(rb, p, 1))
+	 {
+	   g_atomic_int_inc(&pass->corrected);
+	   g_atomic_int_inc(&pass->err);
+	 }
+	 else err = -1;
+       }
+     }
+
+     /* If correction is not plausible or possible then try 2 error-decimation. */
+     if(err < 0)
+     {
+       /* Try error correction with decimated erasures */
+       int a, b;
+       int solFound = FALSE;
+       GetPVector(rb->byteCount, cp_vector, p);
+       for(a = 0; a < P_VECTOR_SIZE-2; a++)         /* fixme: why -2? */
+       { if(cp_vector[a] == 1) continue;
+
+	 for(b = a + 1; b < P_VECTOR_SIZE-2; b++)   /* fixme: why -2? */
+	 { if(cp_vector[b] == 1) continue;
+
+	   decimated_erasures[0] = a;
+	   decimated_erasures[1] = b;
+	   GetPVector(rb->recovered, p_vector, p);
+	   err = DecodePQ(rb->rt, p_vector, P_PADDING, decimated_erasures, 2);
+	   if(err == 2)
+	   {
+	     if(check_p_plausibility(rb, p_vector, p, a, b)) { solFound = TRUE; break; }
+	   }
+	 }
+	 if(solFound) break;
+       }
+       if(solFound)
+       {
+	 /* Store back corrected vector */
+	 SetPVector(rb->recovered, p_vector, p);
+	 g_atomic_int_add(&pass->err, 2);
+	 g_atomic_int_inc(&pass->corrected);
+	 g_atomic_int_inc(&pass->decimated);
+       }
+       else
+       {
+	 /* See whether we can find some P parity bytes accepting the original P vector. */
+	 if(find_better_p(rb, p, 2))
+	 {
+	   g_atomic_int_inc(&pass->corrected);
+	   g_atomic_int_inc(&pass->err);
+	 }
+	 else g_atomic_int_inc(&pass->failures); /* If P failed */
+       }
+     }
+   }
+}
+
+static gpointer plausible_q_worker(gpointer data)
+{  pass_context *pass = (pass_context*)data;
+   int q;
+
+   while((q = g_atomic_int_add(&pass->next, 1)) < N_Q_VECTORS)
+      plausible_q_vector(pass->rb, q, pass);
+
+   return NULL;
+}
+
+static gpointer plausible_p_worker(gpointer data)
+{  pass_context *pass = (pass_context*)data;
+   int p;
+
+   while((p = g_atomic_int_add(&pass->next, 1)) < N_P_VECTORS)
+      plausible_p_vector(pass->rb, p, pass);
+
+   return NULL;
+}
+
+//#define DEBUG_SEARCH_PLAUSIBLE
+
+int SearchPlausibleSector(RawBuffer *rb, int noCreateBuffer)
+{
+   pass_context q_pass, p_pass;
    int p_failures, q_failures;
    int p_corrected, q_corrected;
-   int p,q;
    int iteration=1;
    int p_err, q_err;
    int p_decimated, q_decimated;
@@ -708,7 +904,6 @@ int SearchPlausibleSector(RawBuffer *rb, int noCreateBuffer)
    int last_q_err = N_Q_VECTORS;
    int last_p_failures = N_P_VECTORS;
    int last_q_failures = N_Q_VECTORS;
-   int err;
    
    /* Initialize sector */     
 
@@ -717,174 +912,22 @@ int SearchPlausibleSector(RawBuffer *rb, int noCreateBuffer)
 	
    for(; ;) /* iterate over P- and Q-Parity until failures converge */
    {   
-      p_failures = q_failures = 0;
-      p_corrected = q_corrected = 0;
-      p_err = q_err = 0;
-      p_decimated = q_decimated = 0;
-
       /* Perform Q-Parity error correction */
 
-      for(q=0; q<N_Q_VECTORS; q++)
-      {  
-      	/* Check whether Q is correct. */
-      	GetQVector(rb->recovered, q_vector, q);
-	err = DecodePQ(rb->rt, q_vector, Q_PADDING, ignore, 0);
-         
-	/* If it is not correct. */
-	if(err == 1 || err < 0)
-        {	        
-	  /* If Q is correctable. */
-	  if(err == 1)
-	  {
-	    /* Check correction for plausibility: if corrected byte was read in one of the read attempts. */
-	    if(check_q_plausibility(rb, q_vector, q, -1, -1))
-	    {
-	      /* Store back corrected vector */ 
-	      SetQVector(rb->recovered, q_vector, q);
-	      q_corrected++;
-	      q_err++;
-	    }
-	    else 
-	    {
-	      /* See whether we can find some Q parity bytes accepting the original Q vector. */
-	      if(find_better_q(rb, q, 1)) 
-	      { 
-		q_corrected++; 
-		q_err++; 
-	      }
-	      else err = -1;
-	    }
-	  }
-	         
-	  /* If correction is not plausible or possible then try 2 error-decimation. */
-	  if(err < 0)
-	  {
-	    /* Try error correction with decimated erasures.
-	       Note that no erasure information for the parity bytes is available */
-	    int a, b; 
-	    int solFound = FALSE;     
-
-	    GetQVector(rb->byteCount, cq_vector, q);
-
-	    for(a = 0; a < Q_VECTOR_SIZE - 2; a++)
-	    {
-	      if(cq_vector[a] == 1) continue; /* no alternatives */
-	      for(b = a + 1; b < Q_VECTOR_SIZE - 2; b++)
-	      {
-		if(cq_vector[b] == 1) continue; /* again, no alternatives present */
-
-		decimated_erasures[0] = a;
-		decimated_erasures[1] = b;
-		GetQVector(rb->recovered, q_vector, q);
-		err = DecodePQ(rb->rt, q_vector, Q_PADDING, decimated_erasures, 2);
-		if(err == 2) 
-		{ 
-		  if(check_q_plausibility(rb, q_vector, q, a, b)) { solFound = TRUE; break;	}
-		}
-	      }
-	      if(solFound) break;
-	    }
-	    if(solFound)
-	    {
-	      /* Store back corrected vector */ 
-	      SetQVector(rb->recovered, q_vector, q);
-	      q_err += 2;
-	      q_corrected++;
-	      q_decimated++;
-	    }
-	    else 
-	    {
-	      /* See whether we can find some Q parity bytes accepting the original Q vector. */
-	      if(find_better_q(rb, q, 2)) 
-	      { 
-		q_corrected++; 
-		q_err++; 
-	      }
-	      else q_failures++; /* If Q failed */
-	    }
-	  }
-	}
-      }
+      memset(&q_pass, 0, sizeof(pass_context));
+      q_pass.rb = rb;
+      RunWorkerThreads(Closure->codecThreads, plausible_q_worker, &q_pass);
 
       /* Perform P-Parity error correction */
 
-      for(p=0; p<N_P_VECTORS; p++)
-      {  
-      	/* Check whether P is correct. */
-      	GetPVector(rb->recovered, p_vector, p);
-	err = DecodePQ(rb->rt, p_vector, P_PADDING, ignore, 0);
-         
-	/* If it is not correct. */
-	if(err == 1 || err < 0)
-        {	        
-	  /* If Q is correctable. */
-	  if(err == 1)
-	  {
-	    /* Check correction for plausibility: if corrected byte was read in one of the read attempts. */
-	    if(check_p_plausibility(rb, p_vector, p, -1, -1))
-	    {
-	      /* Store back corrected vector */ 
-	      SetPVector(rb->recovered, p_vector, p);
-	      p_corrected++;
-	      p_err++;
-	    }
-	    else 
-	    {
-	      /* See whether we can find some P parity bytes accepting the original P vector. */
-	      if(find_better_p(rb, p, 1)) 
-	      { 
-		p_corrected++; 
-		p_err++; 
-	      }
-	      else err = -1;
-	    }
-	  }
-	  
-	  /* If correction is not plausible or possible then try 2 error-decimation. */
-	  if(err < 0)
-	  {
-	    /* Try error correction with decimated erasures */
-	    int a, b; 
-	    int solFound = FALSE;     
-	    GetPVector(rb->byteCount, cp_vector, p);
-	    for(a = 0; a < P_VECTOR_SIZE-2; a++)         /* fixme: why -2? */
-	    { if(cp_vector[a] == 1) continue;
-
-	      for(b = a + 1; b < P_VECTOR_SIZE-2; b++)   /* fixme: why -2? */
-	      { if(cp_vector[b] == 1) continue;
-
-		decimated_erasures[0] = a;
-		decimated_erasures[1] = b;
-		GetPVector(rb->recovered, p_vector, p);
-		err = DecodePQ(rb->rt, p_vector, P_PADDING, decimated_erasures, 2);
-		if(err == 2) 
-		{ 
-		  if(check_p_plausibility(rb, p_vector, p, a, b)) { solFound = TRUE; break; }
-		}
-	      }
-	      if(solFound) break;
-	    }
-	    if(solFound)
-	    {
-	      /* Store back corrected vector */ 
-	      SetPVector(rb->recovered, p_vector, p);
-	      p_err += 2;
-	      p_corrected++;
-	      p_decimated++;
-	    }
-	    else 
-	    {
-	      /* See whether we can find some P parity bytes accepting the original P vector. */
-	      if(find_better_p(rb, p, 2)) 
-	      { 
-		p_corrected++; 
-		p_err++; 
-	      }
-	      else p_failures++; /* If P failed */
-	    }
-	  }
-	}
-      }
+      memset(&p_pass, 0, sizeof(pass_context));
+      p_pass.rb = rb;
+      RunWorkerThreads(Closure->codecThreads, plausible_p_worker, &p_pass);
+
+      q_failures  = q_pass.failures;  p_failures  = p_pass.failures;
+      q_corrected = q_pass.corrected; p_corrected = p_pass.corrected;
+      q_err       = q_pass.err;       p_err       = p_pass.err;
+      q_decimated = q_pass.decimated; p_decimated = p_pass.decimated;
 
       /* See if there was an improvement */
 
@@ -1158,6 +1201,8 @@ int AckHeuristic(RawBuffer *rb)
    unsigned char pq_sector_exist[26];
    unsigned char p_status[N_P_VECTORS];
    unsigned char q_status[N_Q_VECTORS];
+   int p_results[N_P_VECTORS];
+   int q_results[N_Q_VECTORS];
    int decimated_erasures[2];
    int ignore[2];
    int p_failures, q_failures;
@@ -1187,20 +1232,20 @@ int AckHeuristic(RawBuffer *rb)
       p_err = q_err = 0;
       
       /* Get the entire Q status */
+      DecodeQVectors(rb->rt, rb->recovered, q_results, NULL, NULL);
       for(q = 0; q < N_Q_VECTORS; q++)
       {  
-	 GetQVector(rb->recovered, q_vector, q);
-	 err = DecodePQ(rb->rt, q_vector, Q_PADDING, ignore, 0);
+	 err = q_results[q];
 	 if(err <  0) q_status[q] = 2;
 	 if(err == 1) q_status[q] = 1;
 	 if(!err)	 q_status[q] = 0;
       }
       
       /* Get the entire P status */
+      DecodePVectors(rb->rt, rb->recovered, p_results, NULL, NULL);
       for(p = 0; p < N_P_VECTORS; p++)
       {  
-	 GetPVector(rb->recovered, p_vector, p);
-	 err = DecodePQ(rb->rt, p_vector, P_PADDING, ignore, 0);
+	 err = p_results[p];
 	 if(err <  0) p_status[p] = 2;
 	 if(err == 1) p_status[p] = 1;
 	 if(!err)	 p_status[p] = 0;
@@ -1535,20 +1580,20 @@ int AckHeuristic(RawBuffer *rb)
       if(CheckEDC(rb->recovered, rb->xaMode)) break;
       
       /* Get the entire Q status */
+      DecodeQVectors(rb->rt, rb->recovered, q_results, NULL, NULL);
       for(q = 0; q < N_Q_VECTORS; q++)
       {  
-	 GetQVector(rb->recovered, q_vector, q);
-	 err = DecodePQ(rb->rt, q_vector, Q_PADDING, ignore, 0);
+	 err = q_results[q];
 	 if(err <  0) q_status[q] = 2;
 	 if(err == 1) q_status[q] = 1;
 	 if(!err)	 q_status[q] = 0;
       }
 
       /* Get the entire P status */
+      DecodePVectors(rb->rt, rb->recovered, p_results, NULL, NULL);
       for(p = 0; p < N_P_VECTORS; p++)
       {  
-	 GetPVector(rb->recovered, p_vector, p);
-	 err = DecodePQ(rb->rt, p_vector, P_PADDING, ignore, 0);
+	 err = p_results[p];
 	 if(err <  0) p_status[p] = 2;
 	 if(err == 1) p_status[p] = 1;
 	 if(!err)	 p_status[p] = 0;
@@ -1887,6 +1932,144 @@ int AckHeuristic(RawBuffer *rb)
    return 1;
 }
 
+/*
+ * Enumeration of candidate vectors for the brute force search.
+ *
+ * Candidate k is the k-th combination of the byte alternatives in zList,
+ * with position 0 changing fastest. The sequential search walked through
+ * all candidates in this order and accepted the first one which decodes
+ * with at most one error (if the vector was uncorrectable), followed by
+ * the first one decoding without errors. Since the candidates do not
+ * depend on each other, the search can be split into chunks which are
+ * processed by several threads. Only the lowest indices of both kinds
+ * of candidates are recorded, which gives the same result as the 
+ * sequential search regardless of the number of threads.
+ */
+
+#define ENUM_CHUNK_SIZE 256
+#define PARALLEL_ENUM_THRESHOLD 4096
+
+typedef struct
+{  RawBuffer *rb;
+   unsigned char (*zList)[256];
+   unsigned char *czList;
+   int size;                   /* vector size; 45 for Q, 26 for P */
+   int padding;
+   int complexity;             /* number of candidates */
+   gint nextChunk;
+   gint firstGood;             /* lowest candidate decoding without errors */
+   gint firstUsable;           /* lowest candidate decoding with at most one error */
+} enum_context;
+
+static void atomic_min(gint *value, gint candidate)
+{  gint old;
+
+   do
+   {  old = g_atomic_int_get(value);
+      if(candidate >= old)
+	 return;
+   } while(!g_atomic_int_compare_and_exchange(value, old, candidate));
+}
+
+/* Set up zStack and vector for candidate k */
+
+static void build_candidate(enum_context *ec, int k, int *zStack, unsigned char *vector)
+{  int a;
+
+   for(a = 0; a < ec->size; a++)
+   {  zStack[a] = k % ec->czList[a];
+      k /= ec->czList[a];
+      vector[a] = ec->zList[a][zStack[a]];
+   }
+}
+
+static gpointer enum_worker(gpointer data)
+{  enum_context *ec = (enum_context*)data;
+   unsigned char vector[45];
+   int zStack[45];
+   int ignore[2];
+
+   for(;;)
+   {  int first = g_atomic_int_add(&ec->nextChunk, 1) * ENUM_CHUNK_SIZE;
+      int last  = MIN(first + ENUM_CHUNK_SIZE, ec->complexity);
+      int k,a,err;
+
+      /* Chunks are handed out in ascending order, so once a good
+	 candidate is known no later chunk can improve the result. */
+
+      if(first >= ec->complexity || first > g_atomic_int_get(&ec->firstGood))
+	 break;
+
+      build_candidate(ec, first, zStack, vector);
+
+      for(k = first; k < last; k++)
+      {  err = DecodePQ(ec->rb->rt, vector, ec->padding, ignore, 0);
+
+	 if(err >= 0)
+	    atomic_min(&ec->firstUsable, k);
+	 if(err == 0)
+	 {  atomic_min(&ec->firstGood, k);
+	    break;
+	 }
+
+	 /* Step to the next candidate; DecodePQ() may have changed the vector */
+
+	 for(a = 0; a < ec->size; a++)
+	 {  zStack[a]++;
+	    if(zStack[a] < ec->czList[a]) break;
+	    zStack[a] = 0;
+	 }
+	 for(a = 0; a < ec->size; a++)
+	    vector[a] = ec->zList[a][zStack[a]];
+      }
+   }
+
+   return NULL;
+}
+
+/*
+ * Returns the number of accepted candidates (as the sequential search
+ * would have counted them) and the last accepted vector in out.
+ */
+
+static int enumerate_candidates(RawBuffer *rb, unsigned char zList[][256], unsigned char *czList,
+				int size, int padding, int complexity, int referr, 
+				unsigned char *out)
+{  enum_context ec;
+   int zStack[45];
+   int ignore[2];
+   int corrected = 0;
+
+   ec.rb          = rb;
+   ec.zList       = zList;
+   ec.czList      = czList;
+   ec.size        = size;
+   ec.padding     = padding;
+   ec.complexity  = complexity;
+   ec.nextChunk   = 0;
+   ec.firstGood   = G_MAXINT;
+   ec.firstUsable = G_MAXINT;
+
+   RunWorkerThreads(complexity >= PARALLEL_ENUM_THRESHOLD ? Closure->codecThreads : 1,
+		    enum_worker, &ec);
+
+   /* Replay the decisions of the sequential search */
+
+   if(referr < 0 && ec.firstUsable != G_MAXINT)
+   {  build_candidate(&ec, ec.firstUsable, zStack, out);
+      referr = DecodePQ(rb->rt, out, padding, ignore, 0);
+      corrected++;
+   }
+
+   if(referr == 1 && ec.firstGood != G_MAXINT)
+   {  build_candidate(&ec, ec.firstGood, zStack, out);
+      DecodePQ(rb->rt, out, padding, ignore, 0);
+      corrected++;
+   }
+
+   return corrected;
+}
+
 int BruteForceSearchPlausibleSector(RawBuffer *rb)
 {
    unsigned char p_vector[26];
@@ -1907,7 +2090,7 @@ int BruteForceSearchPlausibleSector(RawBuffer *rb)
    
    unsigned char  zList[45][256]; /* stores different bytes which were read for each position in a sector */   
    unsigned char czList[45];	   /* counts different bytes which were read for each position in a sector */
-   int zStack[45], pzStack;
+   int corrected;
 
    /* Re-Initialize sector */     
    InitializeCDFrame(rb->recovered, rb->lba, rb->xaMode, 1);
@@ -1981,37 +2164,11 @@ int BruteForceSearchPlausibleSector(RawBuffer *rb)
 	    /* no degrees of freedom */
 	    if(complexity == 1) continue; 
 
-	    memset(zStack, 0, 45 * sizeof(int));
-	    while(1)
-	    {
-	       for(a = 0; a < 45; a++)
-	       {
-		  cq_vector[a] = zList[a][zStack[a]];
-	       }					
-	       
-	       err = DecodePQ(rb->rt, cq_vector, Q_PADDING, ignore, 0);
-	       if((referr < 0 && err >= 0) || (referr == 1 && err == 0)) 
-	       {
-		  SetQVector(rb->recovered, cq_vector, q);
-		  q_corrected++;
-
-		  referr = err;
-		  if(referr == 0) break;
-	       }
-	       
-	       pzStack = 0;
-	       while(pzStack < 45)
-	       {
-		  zStack[pzStack]++;
-		  if(zStack[pzStack] == czList[pzStack]) 
-		  {
-		     zStack[pzStack] = 0;
-		     pzStack++;
-		  }
-		  else break;
-	       }
-	       
-	       if(pzStack == 45) break;
+	    corrected = enumerate_candidates(rb, zList, czList, 45, Q_PADDING,
+					     complexity, referr, cq_vector);
+	    if(corrected)
+	    {  SetQVector(rb->recovered, cq_vector, q);
+	       q_corrected += corrected;
 	    }
 	 }
       }
@@ -2078,37 +2235,11 @@ int BruteForceSearchPlausibleSector(RawBuffer *rb)
 	    /* no degrees of freedom */
 	    if(complexity == 1) continue; 
 	    
-	    memset(zStack, 0, 26 * sizeof(int));
-	    while(1)
-	    {
-	       for(a = 0; a < 26; a++)
-	       {
-		  cp_vector[a] = zList[a][zStack[a]];
-	       }					
-
-	       err = DecodePQ(rb->rt, cp_vector, P_PADDING, ignore, 0);
-	       if((referr < 0 && err >= 0) || (referr == 1 && err == 0)) 
-	       {
-		  SetPVector(rb->recovered, cp_vector, p);
-		  p_corrected++;
-		  
-		  referr = err;
-		  if(referr == 0) break;
-	       }
-	       
-	       pzStack = 0;
-	       while(pzStack < 26)
-	       {
-		  zStack[pzStack]++;
-		  if(zStack[pzStack] == czList[pzStack]) 
-		  {
-		     zStack[pzStack] = 0;
-		     pzStack++;
-		  }
-		  else break;
-	       }
-	       
-	       if(pzStack == 26) break;
+	    corrected = enumerate_candidates(rb, zList, czList, 26, P_PADDING,
+					     complexity, referr, cp_vector);
+	    if(corrected)
+	    {  SetPVector(rb->recovered, cp_vector, p);
+	       p_corrected += corrected;
 	    }
 	 }
       }
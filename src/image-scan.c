@@ -0,0 +1,280 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*** src type: no GUI code ***/
+
+#include "dvdisaster.h"
+
+/***
+ *** Scanning an image in large blocks.
+ ***
+ * The image is read in blocks of SCAN_BLOCK_SECTORS. The sectors
+ * of each block are checked for dead sector markers and their CRC32
+ * is calculated by a pool of worker threads, while the next block
+ * is being read and the caller processes the previous one.
+ * The caller receives the blocks in ascending order and does
+ * everything which must happen sequentially (md5sums, messages).
+ *
+ * Reading happens in the caller's thread so that the reader
+ * may use Stop() as usual.
+ */
+
+#define SCAN_BLOCK_SECTORS 1024  /* sectors read at once (2 MiB) */
+#define SCAN_CHUNK 64            /* sectors handed out to a worker at once */
+#define SCAN_MAX_WORKERS 16
+
+/*
+ * Analyse the sectors of a block
+ */
+
+static gpointer analyse_worker(gpointer data)
+{  ImageScanSlot *slot = (ImageScanSlot*)data;
+   ImageScan *scan = slot->scan;
+
+   for(;;)
+   {  int i = g_atomic_int_add(&slot->nextIdx, SCAN_CHUNK);
+      int end = MIN(i+SCAN_CHUNK, slot->count);
+
+      if(i >= slot->count)
+	break;
+
+      for(; i<end; i++)
+      {  unsigned char *buf = slot->ab->buf + 2048*i;
+	 gint64 sector = slot->first + i;
+
+	 slot->missing[i] = CheckForMissingSector(buf, sector, scan->fp, scan->fpSector);
+	 slot->crc[i] = Crc32(buf, 2048);
+
+	 if(scan->crcBuf)
+	      slot->crcState[i] = CompareWithCrcBuffer(scan->crcBuf, sector, slot->crc[i]);
+	 else slot->crcState[i] = CRC_UNKNOWN;
+      }
+   }
+
+   return NULL;
+}
+
+static gpointer analyse_thread(gpointer data)
+{  ImageScanSlot *slot = (ImageScanSlot*)data;
+
+   RunWorkerThreads(slot->scan->nWorkers, analyse_worker, slot);
+
+   return NULL;
+}
+
+/*
+ * Read the next block into the given slot and start analysing it
+ */
+
+static void fill_slot(ImageScan *scan, ImageScanSlot *slot)
+{
+   slot->first = scan->next;
+   slot->count = MIN(SCAN_BLOCK_SECTORS, scan->sectors - scan->next);
+   scan->next += slot->count;
+
+   if(!slot->count)
+     return;
+
+   scan->reader(scan->readerData, slot->ab->buf, slot->first, slot->count);
+
+   slot->nextIdx = 0;
+   slot->analyser = CreateGThread(analyse_thread, slot);
+}
+
+/*
+ * Default reader for images stored linearly in a file.
+ * Holes of sparse images are not read but replaced by dead sector markers,
+ * as are sectors beyond the end of the file.
+ * An incomplete last sector is padded with zeros.
+ */
+
+static void read_file(gpointer data, unsigned char *buf, gint64 first, int count)
+{  ImageScan *scan = (ImageScan*)data;
+   gint64 present = MIN(count, scan->fileSectors - first);
+   gint64 s,i;
+
+   if(present < 0)
+     present = 0;
+
+   for(s=first; s<first+present; )
+   {  gint64 end,next;
+      int hole = LargeIsHole(scan->file, 2048*s, &end);
+
+      next = MIN(end/2048 + (end%2048 ? 1 : 0), first+present);
+      if(next <= s) next = first+present;
+
+      if(hole)
+      {  for(i=s; i<next; i++)
+	   CreateMissingSector(buf + 2048*(i-first), i, NULL, 0, NULL);
+      }
+      else
+      {  unsigned char *ptr = buf + 2048*(s-first);
+	 size_t expected = 2048*(next-s);
+	 ssize_t n;
+
+	 if(next == scan->fileSectors && scan->inLast < 2048)
+	 {  memset(ptr + 2048*(next-s-1), 0, 2048);
+	    expected -= 2048 - scan->inLast;
+	 }
+
+	 if(!LargeSeek(scan->file, (gint64)(2048*s)))
+	   Stop(_("Failed seeking to sector %" PRId64 " in image: %s"),
+		s, strerror(errno));
+
+	 n = LargeRead(scan->file, ptr, expected);
+	 if(n != expected)
+	   Stop(_("Failed reading sector %" PRId64 " in image: %s"),
+		s + (n > 0 ? n/2048 : 0), strerror(errno));
+      }
+
+      s = next;
+   }
+
+   for(i=present; i<count; i++)
+     CreateMissingSector(buf + 2048*i, first+i, scan->fp, scan->fpSector, scan->padLabel);
+}
+
+/*
+ * Set up a scan over the given number of sectors.
+ * fp and fp_sector are passed to CheckForMissingSector();
+ * CRC states are only determined if crc_buf is given.
+ */
+
+static ImageScan* create_scan(gint64 sectors, guint8 *fp, gint32 fp_sector, CrcBuf *crc_buf)
+{  ImageScan *scan = g_malloc0(sizeof(ImageScan));
+   int i;
+
+   scan->sectors  = sectors;
+   scan->fp       = fp;
+   scan->fpSector = fp_sector;
+   scan->crcBuf   = crc_buf;
+   scan->nWorkers = MIN(g_get_num_processors(), SCAN_MAX_WORKERS);
+   if(scan->nWorkers < 1) scan->nWorkers = 1;
+
+   for(i=0; i<2; i++)
+   {  ImageScanSlot *slot = &scan->slot[i];
+
+      slot->scan     = scan;
+      slot->ab       = CreateAlignedBuffer(SCAN_BLOCK_SECTORS*2048);
+      slot->missing  = g_malloc(SCAN_BLOCK_SECTORS*sizeof(gint8));
+      slot->crc      = g_malloc(SCAN_BLOCK_SECTORS*sizeof(guint32));
+      slot->crcState = g_malloc(SCAN_BLOCK_SECTORS*sizeof(gint8));
+   }
+
+   scan->current = -1;
+
+   return scan;
+}
+
+ImageScan* OpenImageScan(LargeFile *file, gint64 sectors, guint8 *fp, gint32 fp_sector,
+			 CrcBuf *crc_buf, char *pad_label)
+{  ImageScan *scan = create_scan(sectors, fp, fp_sector, crc_buf);
+   guint64 file_sectors;
+
+   CalcSectors(file->size, &file_sectors, &scan->inLast);
+
+   scan->file        = file;
+   scan->fileSectors = file_sectors;
+   scan->padLabel    = pad_label;
+   scan->reader      = read_file;
+   scan->readerData  = scan;
+
+   return scan;
+}
+
+ImageScan* OpenImageScanWithReader(gint64 sectors, guint8 *fp, gint32 fp_sector, CrcBuf *crc_buf,
+				   ImageScanReader reader, gpointer reader_data)
+{  ImageScan *scan = create_scan(sectors, fp, fp_sector, crc_buf);
+
+   scan->reader     = reader;
+   scan->readerData = reader_data;
+
+   return scan;
+}
+
+/*
+ * Make the next block available in scan->first, scan->count etc.
+ * Returns FALSE after the last block.
+ */
+
+int ImageScanNextBlock(ImageScan *scan)
+{  ImageScanSlot *slot;
+   int next = scan->current < 0 ? 0 : 1-scan->current;
+
+   /* Prime the pipeline */
+
+   if(scan->current < 0)
+     fill_slot(scan, &scan->slot[0]);
+
+   slot = &scan->slot[next];
+   if(!slot->count)
+     return FALSE;
+
+   /* Read the block after this one while it is being analysed.
+      The slot of the previous block has been released by the caller. */
+
+   fill_slot(scan, &scan->slot[1-next]);
+
+   g_thread_join(slot->analyser);
+   slot->analyser = NULL;
+
+   scan->current  = next;
+   scan->first    = slot->first;
+   scan->count    = slot->count;
+   scan->buf      = slot->ab->buf;
+   scan->missing  = slot->missing;
+   scan->crc      = slot->crc;
+   scan->crcState = slot->crcState;
+
+   return TRUE;
+}
+
+/*
+ * Sector lookup; fetches the next block when needed.
+ * Sectors must be requested in ascending order.
+ */
+
+int ImageScanSector(ImageScan *scan, gint64 sector)
+{
+   while(sector >= scan->first + scan->count)
+     if(!ImageScanNextBlock(scan))
+       Stop("ImageScanSector: sector %" PRId64 " beyond end of scan\n", sector);
+
+   return sector - scan->first;
+}
+
+void CloseImageScan(ImageScan *scan)
+{  int i;
+
+   for(i=0; i<2; i++)
+   {  ImageScanSlot *slot = &scan->slot[i];
+
+      if(slot->analyser)
+	g_thread_join(slot->analyser);
+      FreeAlignedBuffer(slot->ab);
+      g_free(slot->missing);
+      g_free(slot->crc);
+      g_free(slot->crcState);
+   }
+
+   g_free(scan);
+}
@@ -237,7 +237,8 @@ int ImageReadSectors(Image* image, void *buf, guint64 first, int n)
         if(!LargeSeek(image->file, first*2048))
 	  Stop("ImageReadSectors(): seek failed");
         if(LargeRead(image->file, buf, n*2048) == n*2048)
-	{  if(CheckForMissingSectors(buf, first, NULL, 0, n, &first_defect) == SECTOR_PRESENT)
+	{  MarkHoleSectors(image->file, buf, first, n);
+	   if(CheckForMissingSectors(buf, first, NULL, 0, n, &first_defect) == SECTOR_PRESENT)
 	        return n;
 	   else return 0;
 	}
@@ -138,66 +138,115 @@ void AndPVector(unsigned char *frame, unsigned char value, int n)
 
 /*
  * There are 52 vectors of Q-parity, yielding a RS(45,43) code.
+ * The Q vectors run diagonally through the frame, so their byte
+ * positions are looked up from a table instead of being recomputed
+ * with modulo arithmetic for each byte.
  */
 
+static guint16 q_index[N_Q_VECTORS][Q_VECTOR_SIZE];
+static guint16 q_pairs[Q_VECTOR_SIZE][N_Q_VECTORS/2];
+static gint q_index_ready;
+static GMutex q_index_lock;
+
+static void init_q_index(void)
+{  int q,i;
+
+   if(g_atomic_int_get(&q_index_ready))
+      return;
+
+   g_mutex_lock(&q_index_lock);
+   if(!q_index_ready)
+   {  for(q=0; q<N_Q_VECTORS; q++)
+      {  int offset = 12 + (q & 1);
+	 int w_idx  = (q&~1) * 43;
+
+	 for(i=0; i<43; i++, w_idx+=88)
+	    q_index[q][i] = (w_idx % 2236) + offset;
+
+	 q_index[q][43] = 2248 + q;
+	 q_index[q][44] = 2300 + q;
+      }
+
+      /* Q vectors 2k and 2k+1 always occupy neighbouring bytes,
+	 so byte i of all Q vectors can be gathered pairwise. */
+
+      for(i=0; i<Q_VECTOR_SIZE; i++)
+	 for(q=0; q<N_Q_VECTORS/2; q++)
+	    q_pairs[i][q] = q_index[2*q][i];
+      g_atomic_int_set(&q_index_ready, 1);
+   }
+   g_mutex_unlock(&q_index_lock);
+}
+
 void GetQVector(unsigned char *frame, unsigned char *data, int n)
-{  int offset = 12 + (n & 1);
-   int w_idx  = (n&~1) * 43;
+{  guint16 *idx = q_index[n];
    int i;
 
-   for(i=0; i<43; i++, w_idx+=88)
-     data[i] = frame[(w_idx % 2236) + offset];
-
-   data[43] = frame[2248 + n];
-   data[44] = frame[2300 + n];
+   init_q_index();
+   for(i=0; i<Q_VECTOR_SIZE; i++)
+     data[i] = frame[idx[i]];
 }
 
 void SetQVector(unsigned char *frame, unsigned char *data, int n)
-{  int offset = 12 + (n & 1);
-   int w_idx  = (n&~1) * 43;
+{  guint16 *idx = q_index[n];
    int i;
 
-   for(i=0; i<43; i++, w_idx+=88)
-     frame[(w_idx % 2236) + offset] = data[i];
-
-   frame[2248 + n] = data[43];
-   frame[2300 + n] = data[44];
+   init_q_index();
+   for(i=0; i<Q_VECTOR_SIZE; i++)
+     frame[idx[i]] = data[i];
 }
 
 void FillQVector(unsigned char *frame, unsigned char data, int n)
-{  int offset = 12 + (n & 1);
-   int w_idx  = (n&~1) * 43;
+{  guint16 *idx = q_index[n];
    int i;
 
-   for(i=0; i<43; i++, w_idx+=88)
-     frame[(w_idx % 2236) + offset] = data;
-
-   frame[2248 + n] = data;
-   frame[2300 + n] = data;
+   init_q_index();
+   for(i=0; i<Q_VECTOR_SIZE; i++)
+     frame[idx[i]] = data;
 }
 
 void OrQVector(unsigned char *frame, unsigned char data, int n)
-{  int offset = 12 + (n & 1);
-   int w_idx  = (n&~1) * 43;
+{  guint16 *idx = q_index[n];
    int i;
 
-   for(i=0; i<43; i++, w_idx+=88)
-     frame[(w_idx % 2236) + offset] |= data;
-
-   frame[2248 + n] |= data;
-   frame[2300 + n] |= data;
+   init_q_index();
+   for(i=0; i<Q_VECTOR_SIZE; i++)
+     frame[idx[i]] |= data;
 }
 
 void AndQVector(unsigned char *frame, unsigned char data, int n)
-{  int offset = 12 + (n & 1);
-   int w_idx  = (n&~1) * 43;
+{  guint16 *idx = q_index[n];
    int i;
 
-   for(i=0; i<43; i++, w_idx+=88)
-     frame[(w_idx % 2236) + offset] &= data;
+   init_q_index();
+   for(i=0; i<Q_VECTOR_SIZE; i++)
+     frame[idx[i]] &= data;
+}
+
+/*
+ * Gather all P or Q vectors of a frame in one go.
+ * The vectors are stored one after another, e.g. vectors + p*P_VECTOR_SIZE
+ * holds the same bytes as GetPVector(frame, ..., p) would return.
+ */
 
-   frame[2248 + n] &= data;
-   frame[2300 + n] &= data;
+void GetPVectors(unsigned char *frame, unsigned char *vectors)
+{  int p,i;
+
+   for(i=0; i<P_VECTOR_SIZE; i++)
+   {  unsigned char *row = frame + 12 + i*N_P_VECTORS;
+
+      for(p=0; p<N_P_VECTORS; p++)
+	 vectors[p*P_VECTOR_SIZE+i] = row[p];
+   }
+}
+
+void GetQVectors(unsigned char *frame, unsigned char *vectors)
+{  guint16 *idx = &q_index[0][0];
+   int i;
+
+   init_q_index();
+   for(i=0; i<N_Q_VECTORS*Q_VECTOR_SIZE; i++)
+      vectors[i] = frame[idx[i]];
 }
 
 /***
@@ -490,3 +539,158 @@ int DecodePQ(ReedSolomonTables *rt, unsigned char *data, int padding,
 }
 
 
+
+/***
+ *** Decoding all P or Q vectors of a frame at once
+ ***/
+
+/*
+ * Most vectors of a frame are usually error free, but DecodePQ()
+ * can only tell so after evaluating the syndromes byte by byte
+ * through the log tables. Here the syndromes of all vectors are
+ * computed side by side instead, eight vectors per 64bit word.
+ * The first syndrome is the xor of all vector bytes. The second one
+ * is evaluated by Horner's scheme, where multiplying with alpha
+ * boils down to a shift and a conditional xor with the low byte
+ * of the field polynomial (= alpha^8).
+ */
+
+#define LANE_WORDS ((N_P_VECTORS+7)/8)
+#define LANE_HIGH_BITS 0x8080808080808080ULL
+#define LANE_LOW_BITS  0x7f7f7f7f7f7f7f7fULL
+
+static inline guint64 mul_alpha(guint64 x, guint64 reduction)
+{  guint64 high = (x & LANE_HIGH_BITS) >> 7;
+
+   return ((x & LANE_LOW_BITS) << 1) ^ (high * reduction);
+}
+
+/*
+ * rows points to n_rows rows of n_vectors bytes each, row i holding
+ * byte i of all vectors. Sets failing[v] for each vector v with
+ * a nonzero syndrome and returns the number of such vectors.
+ */
+
+static int find_failing_vectors(GaloisTables *gt, unsigned char *rows, int n_rows,
+				int n_vectors, unsigned char *failing)
+{  guint64 syn0[LANE_WORDS], syn1[LANE_WORDS];
+   unsigned char s0[LANE_WORDS*8], s1[LANE_WORDS*8];
+   guint64 reduction = gt->alphaTo[8];
+   int words = (n_vectors+7)/8;
+   int tail  = n_vectors - 8*(words-1);
+   int count = 0;
+   int i,w;
+
+   memset(syn0, 0, sizeof(syn0));
+   memset(syn1, 0, sizeof(syn1));
+
+   for(i=0; i<n_rows; i++, rows+=n_vectors)
+   {  guint64 data;
+
+      for(w=0; w<words-1; w++)
+      {  memcpy(&data, rows+8*w, 8);
+	 syn0[w] ^= data;
+	 syn1[w] = mul_alpha(syn1[w], reduction) ^ data;
+      }
+
+      data = 0;
+      memcpy(&data, rows+8*w, tail);
+      syn0[w] ^= data;
+      syn1[w] = mul_alpha(syn1[w], reduction) ^ data;
+   }
+
+   /* Byte lanes are independent, so the words can be split up
+      again regardless of the machine's endianess. */
+
+   memcpy(s0, syn0, sizeof(s0));
+   memcpy(s1, syn1, sizeof(s1));
+
+   for(i=0; i<n_vectors; i++)
+   {  failing[i] = s0[i] | s1[i];
+      if(failing[i]) count++;
+   }
+
+   return count;
+}
+
+/*
+ * Run DecodePQ() on the failing vectors only.
+ * err[v] receives the DecodePQ() result for vector v (0 for intact vectors).
+ * If position is not NULL, position[v] receives the location of the
+ * corrected byte for vectors with err[v] == 1.
+ * If vectors is not NULL, it receives all vectors as by Get[PQ]Vectors(),
+ * with the failing ones as left behind by DecodePQ().
+ * Returns the number of vectors with a nonzero result.
+ */
+
+static int decode_failing_vectors(ReedSolomonTables *rt, unsigned char *frame,
+				  unsigned char *failing, int n_vectors, int vector_size,
+				  int padding, int *err, int *position, unsigned char *vectors,
+				  void (*get_vector)(unsigned char*, unsigned char*, int))
+{  unsigned char scratch[Q_VECTOR_SIZE];
+   int count = 0;
+   int v;
+
+   for(v=0; v<n_vectors; v++)
+   {  unsigned char *vector = vectors ? vectors + v*vector_size : scratch;
+      int eras[2];
+
+      err[v] = 0;
+      if(!failing[v])
+	 continue;
+
+      if(!vectors)
+	 get_vector(frame, vector, v);
+
+      err[v] = DecodePQ(rt, vector, padding, eras, 0);
+      if(err[v] == 1 && position)
+	 position[v] = eras[0];
+      if(err[v])
+	 count++;
+   }
+
+   return count;
+}
+
+int DecodePVectors(ReedSolomonTables *rt, unsigned char *frame,
+		   int *err, int *position, unsigned char *vectors)
+{  unsigned char failing[N_P_VECTORS];
+
+   /* The P vectors are the columns of the frame,
+      so the frame rows can be scanned directly. */
+
+   if(vectors) GetPVectors(frame, vectors);
+
+   if(!find_failing_vectors(rt->gfTables, frame+12, P_VECTOR_SIZE, N_P_VECTORS, failing))
+   {  memset(err, 0, N_P_VECTORS*sizeof(int));
+      return 0;
+   }
+
+   return decode_failing_vectors(rt, frame, failing, N_P_VECTORS, P_VECTOR_SIZE,
+				 P_PADDING, err, position, vectors, GetPVector);
+}
+
+int DecodeQVectors(ReedSolomonTables *rt, unsigned char *frame,
+		   int *err, int *position, unsigned char *vectors)
+{  unsigned char rows[Q_VECTOR_SIZE*N_Q_VECTORS];
+   unsigned char failing[N_Q_VECTORS];
+   unsigned char *row = rows;
+   int k,i;
+
+   /* Transpose the diagonal Q vectors into rows first */
+
+   init_q_index();
+   for(i=0; i<Q_VECTOR_SIZE; i++)
+      for(k=0; k<N_Q_VECTORS/2; k++, row+=2)
+	 memcpy(row, frame + q_pairs[i][k], 2);
+
+   if(vectors) GetQVectors(frame, vectors);
+
+   if(!find_failing_vectors(rt->gfTables, rows, Q_VECTOR_SIZE, N_Q_VECTORS, failing))
+   {  memset(err, 0, N_Q_VECTORS*sizeof(int));
+      return 0;
+   }
+
+   return decode_failing_vectors(rt, frame, failing, N_Q_VECTORS, Q_VECTOR_SIZE,
+				 Q_PADDING, err, position, vectors, GetQVector);
+}
@@ -43,6 +43,7 @@
 #include <windows.h>
 
 #define large_stat _stati64
+#define large_fstat _fstati64
 #define large_lseek _lseeki64
 
 /* The original windows ftruncate has off_size (32bit) */
@@ -65,6 +66,7 @@ int large_ftruncate(int fd, gint64 size)
 #else
   #define large_ftruncate ftruncate
   #define large_stat stat
+  #define large_fstat fstat
   #define large_lseek lseek
 #endif /* SYS_MINGW */
 
@@ -107,6 +109,37 @@ int LargeStat(char *path, guint64 *length_return)
    return TRUE;
 }
 
+/*
+ * Stat() variant which also returns the modification time
+ * (in nanoseconds where the platform provides them)
+ */
+
+int LargeStatTime(char *path, guint64 *length_return, gint64 *mtime_return)
+{  struct stat mystat;
+   gchar *cp_path = os_path(path);
+
+   if(!cp_path) return FALSE;
+
+   if(large_stat(cp_path, &mystat) == -1)
+   {  g_free(cp_path);
+      return FALSE;
+   }
+   g_free(cp_path);
+
+   if(!S_ISREG(mystat.st_mode))
+      return FALSE;
+
+   *length_return = mystat.st_size;
+#if defined(SYS_MINGW) || defined(SYS_UNKNOWN)
+   *mtime_return = (gint64)mystat.st_mtime * 1000000000;
+#elif defined(SYS_DARWIN)
+   *mtime_return = (gint64)mystat.st_mtimespec.tv_sec * 1000000000 + mystat.st_mtimespec.tv_nsec;
+#else
+   *mtime_return = (gint64)mystat.st_mtim.tv_sec * 1000000000 + mystat.st_mtim.tv_nsec;
+#endif
+   return TRUE;
+}
+
 /*
  * Stat() variant for testing directories
  */
@@ -200,11 +233,38 @@ int LargeEOF(LargeFile *lf)
  * Reading large files
  */
 
+/*
+ * Bytes transferred through all LargeFiles, for the statistics.
+ * Only counted when they are requested by --stats-json.
+ */
+
+static gint64 totalRead, totalWritten;
+static GMutex totalsLock;
+
+static void count_bytes(gint64 *counter, ssize_t n)
+{
+   if(n <= 0 || !Closure->statsJson)
+     return;
+
+   g_mutex_lock(&totalsLock);
+   *counter += n;
+   g_mutex_unlock(&totalsLock);
+}
+
+void LargeIOTotals(gint64 *read, gint64 *written)
+{
+   g_mutex_lock(&totalsLock);
+   *read    = totalRead;
+   *written = totalWritten;
+   g_mutex_unlock(&totalsLock);
+}
+
 ssize_t LargeRead(LargeFile *lf, void *buf, size_t count)
 {  ssize_t n;
 
    n = read(lf->fileHandle, buf, count);
    lf->offset += n;
+   count_bytes(&totalRead, n);
 
    return n;
 }
@@ -281,10 +341,58 @@ ssize_t LargeWrite(LargeFile *lf, void *buf, size_t count)
 
    n = xwrite(lf->fileHandle, buf, count);
    lf->offset += n;
+   count_bytes(&totalWritten, n);
 
    return n;
 }
 
+/*
+ * Writing several buffers to consecutive file positions.
+ * The iovec array is modified when writev() completes only partially.
+ * The GUI (which may ask for freeing disk space) and Windows
+ * write the buffers one by one instead.
+ */
+
+ssize_t LargeWritev(LargeFile *lf, struct iovec *iov, int iovcnt)
+{  ssize_t total = 0;
+   int i;
+
+#ifndef SYS_MINGW
+   if(!Closure->guiMode)
+   {  while(iovcnt > 0)
+      {  ssize_t n = writev(lf->fileHandle, iov, MIN(iovcnt, IOV_MAX));
+
+	 if(n <= 0) break;  /* error occurred */
+
+	 total += n;
+	 lf->offset += n;
+	 count_bytes(&totalWritten, n);
+
+	 while(iovcnt > 0 && n >= (ssize_t)iov->iov_len)
+	 {  n -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	 }
+	 if(iovcnt > 0)
+	 {  iov->iov_base = (char*)iov->iov_base + n;
+	    iov->iov_len -= n;
+	 }
+      }
+      return total;
+   }
+#endif
+
+   for(i=0; i<iovcnt; i++)
+   {  ssize_t n = LargeWrite(lf, iov[i].iov_base, iov[i].iov_len);
+
+      total += n;
+      if(n != (ssize_t)iov[i].iov_len)
+	break;
+   }
+
+   return total;
+}
+
 /*
  * Large file closing
  */
@@ -314,9 +422,123 @@ int LargeTruncate(LargeFile *lf, off_t length)
    if(result)
      lf->size = length;
 
+   lf->dataStart = lf->dataEnd = 0;  /* may have created a hole */
+
    return result;
 }
 
+/*
+ * Current size of an open file
+ * (lf->size is only determined when opening the file)
+ */
+
+gint64 LargeFileSize(LargeFile *lf)
+{  struct stat mystat;
+
+   if(large_fstat(lf->fileHandle, &mystat) == -1)
+     return lf->size;
+
+   return mystat.st_size;
+}
+
+/*
+ * Sparse file support. Returns TRUE if the byte at pos lies in a hole
+ * of the file. *end receives the end of the hole or of the data region
+ * containing pos. Positions beyond the end of file are not in a hole.
+ * Where holes can not be detected, the whole file is reported as data.
+ * The file position is not changed.
+ */
+
+int LargeIsHole(LargeFile *lf, gint64 pos, gint64 *end)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE) && !defined(SYS_MINGW)
+   off_t data, hole;
+   int err;
+
+   if(pos >= lf->dataStart && pos < lf->dataEnd)
+   {  *end = lf->dataEnd;
+      return FALSE;
+   }
+
+   data = large_lseek(lf->fileHandle, pos, SEEK_DATA);
+   err  = errno;
+
+   if(data == -1)
+   {  gint64 size = LargeFileSize(lf);
+
+      large_lseek(lf->fileHandle, lf->offset, SEEK_SET);
+
+      if(err == ENXIO && pos < size)  /* hole up to the end of file */
+      {  *end = size;
+	 return TRUE;
+      }
+
+      *end = G_MAXINT64;
+      return FALSE;
+   }
+
+   if(data > pos)
+   {  large_lseek(lf->fileHandle, lf->offset, SEEK_SET);
+      *end = data;
+      return TRUE;
+   }
+
+   hole = large_lseek(lf->fileHandle, pos, SEEK_HOLE);
+   large_lseek(lf->fileHandle, lf->offset, SEEK_SET);
+   if(hole == -1)
+   {  *end = G_MAXINT64;
+      return FALSE;
+   }
+
+   lf->dataStart = pos;
+   lf->dataEnd   = hole;
+   *end = hole;
+   return FALSE;
+#else
+   *end = G_MAXINT64;
+   return FALSE;
+#endif
+}
+
+/*
+ * Flush the file contents to the disk
+ */
+
+int LargeSync(LargeFile *lf)
+{
+#ifdef SYS_MINGW
+   return _commit(lf->fileHandle) == 0;
+#else
+   return fsync(lf->fileHandle) == 0;
+#endif
+}
+
+/*
+ * Large file renaming. An existing file at the new name is replaced.
+ */
+
+int LargeRename(char *old_path, char *new_path)
+{  gchar *cp_old, *cp_new;
+   int result;
+
+   cp_old = os_path(old_path);
+   if(!cp_old) return FALSE;
+   cp_new = os_path(new_path);
+   if(!cp_new)
+   {  g_free(cp_old);
+      return FALSE;
+   }
+
+#ifdef SYS_MINGW
+   unlink(cp_new);  /* rename() does not replace existing files here */
+#endif
+   result = rename(cp_old, cp_new);
+   g_free(cp_old);
+   g_free(cp_new);
+
+   return result == 0;
+}
+
 /*
  * Large file unlinking
  */
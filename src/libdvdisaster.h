@@ -0,0 +1,69 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBDVDISASTER_H
+#define LIBDVDISASTER_H
+
+/***
+ *** Embedding dvdisaster into other programs.
+ ***
+ * Link against libdvdisaster.a (make libdvdisaster.a, preferably
+ * configured with --with-gui=no) and glib.
+ * Call DvdisasterInit() once; afterwards images can be processed
+ * with the functions below. Only one of them runs at a time; calls
+ * from several threads wait for their turn.
+ * The functions return DVDISASTER_OK when the action ran through.
+ * Whether an image is damaged is reported through the log callback
+ * just like on the command line.
+ */
+
+enum
+{  DVDISASTER_OK = 0,
+   DVDISASTER_FAILED = -1,           /* see DvdisasterLastError() */
+   DVDISASTER_BAD_OPTION = -2,
+   DVDISASTER_NOT_INITIALIZED = -3
+};
+
+typedef void (*DvdisasterLogFunc)(const char *msg, void *data);
+typedef void (*DvdisasterProgressFunc)(const char *phase, double done, void *data);
+
+/* All fields may be left zero for the defaults. */
+
+typedef struct _DvdisasterOptions
+{  const char *method;               /* "RS01", "RS02" or "RS03"; default RS01 */
+   const char *redundancy;           /* as for -n; default depends on method */
+   int threads;                      /* codec threads; default 1 */
+   int eccFile;                      /* RS03: create an ecc file instead of augmenting the image */
+   int verbose;                      /* more log messages */
+   DvdisasterLogFunc log;            /* receives the output; default: discard */
+   DvdisasterProgressFunc progress;  /* called 4 times per second; done is 0..1 or -1 if unknown */
+   void *data;                       /* passed to the callbacks */
+} DvdisasterOptions;
+
+int DvdisasterInit(void);
+int DvdisasterCreate(const char *image, const char *ecc, const DvdisasterOptions*);
+int DvdisasterVerify(const char *image, const char *ecc, const DvdisasterOptions*);
+int DvdisasterFix(const char *image, const char *ecc, const DvdisasterOptions*);
+const char* DvdisasterLastError(void);
+void DvdisasterShutdown(void);
+
+#endif /* LIBDVDISASTER_H */
@@ -0,0 +1,221 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*** src type: no GUI code ***/
+
+#include "dvdisaster.h"
+#include "libdvdisaster.h"
+
+/***
+ *** Running dvdisaster as a library.
+ ***
+ * The codecs take their parameters from the global closure and
+ * report through PrintLog() and Stop(). So each call fills in the
+ * closure, hands the output to the caller's log callback and catches
+ * Stop() instead of letting it end the process.
+ * There is only one closure, hence only one call runs at a time.
+ * A Stop() raised by a codec worker thread can not be caught and
+ * still ends the process; the codecs only do so on internal errors.
+ */
+
+#define PROGRESS_INTERVAL 250   /* milliseconds between progress callbacks */
+
+static GMutex callLock;         /* serializes the calls */
+static const DvdisasterOptions *current;
+
+/* Progress is sampled from the metrics of the running action */
+
+static GMutex progressLock;
+static GCond progressCond;
+static int progressStop;
+
+static gpointer progress_thread(gpointer data)
+{
+   g_mutex_lock(&progressLock);
+   while(!progressStop)
+   {  gint64 timeout = g_get_monotonic_time() + PROGRESS_INTERVAL*G_TIME_SPAN_MILLISECOND;
+      MetricsSample sample;
+      char *phase;
+
+      if(g_cond_wait_until(&progressCond, &progressLock, timeout) || progressStop)
+	continue;
+
+      if(!SampleCurrentMetrics(&sample, &phase))
+	continue;
+
+      g_mutex_unlock(&progressLock);
+      current->progress(phase, sample.total ? (double)sample.sectors/(double)sample.total : -1.0,
+			current->data);
+      g_mutex_lock(&progressLock);
+   }
+   g_mutex_unlock(&progressLock);
+
+   return NULL;
+}
+
+static void forward_log(char *msg, gpointer data)
+{
+   if(current && current->log)
+     current->log(msg, current->data);
+}
+
+/*
+ * Copy the options into the closure
+ */
+
+static int apply_options(const char *image, const char *ecc, const DvdisasterOptions *options)
+{  const char *method = options->method ? options->method : "RS01";
+
+   if(!image || !FindMethod((char*)method))
+     return DVDISASTER_BAD_OPTION;
+   if(options->threads < 0 || options->threads > MAX_CODEC_THREADS)
+     return DVDISASTER_BAD_OPTION;
+
+   g_free(Closure->imageName);
+   Closure->imageName = g_strdup(image);
+   g_free(Closure->eccName);
+   Closure->eccName = g_strdup(ecc ? ecc : "");
+
+   g_free(Closure->methodName);
+   Closure->methodName = g_strdup(method);
+   if(Closure->redundancy) g_free(Closure->redundancy);
+   Closure->redundancy = options->redundancy ? g_strdup(options->redundancy) : NULL;
+
+   Closure->codecThreads = options->threads ? options->threads : 1;
+   Closure->eccTarget    = options->eccFile ? ECC_FILE : ECC_IMAGE;
+   Closure->verbose      = options->verbose;
+
+   return DVDISASTER_OK;
+}
+
+/*
+ * Run one action with the Stop() trap set
+ */
+
+static int run_action(void (*action)(void), const char *image, const char *ecc,
+		      const DvdisasterOptions *options)
+{  static const DvdisasterOptions defaults;
+   GThread *reporter = NULL;
+   jmp_buf trap;
+   volatile int result;
+
+   if(!Closure)
+     return DVDISASTER_NOT_INITIALIZED;
+
+   g_mutex_lock(&callLock);
+   current = options ? options : &defaults;
+
+   result = apply_options(image, ecc, current);
+   if(result != DVDISASTER_OK)
+   {  current = NULL;
+      g_mutex_unlock(&callLock);
+      return result;
+   }
+
+   g_free(Closure->stopMessage);
+   Closure->stopMessage = NULL;
+   Closure->mainThread = Closure->stopThread = g_thread_self();
+   Closure->stopTrap = &trap;
+
+   if(current->progress)
+   {  progressStop = FALSE;
+      reporter = CreateGThread(progress_thread, NULL);
+   }
+
+   if(!setjmp(trap))
+        action();
+   else result = DVDISASTER_FAILED;
+
+   Closure->stopTrap = NULL;
+
+   if(reporter)
+   {  g_mutex_lock(&progressLock);
+      progressStop = TRUE;
+      g_cond_signal(&progressCond);
+      g_mutex_unlock(&progressLock);
+      g_thread_join(reporter);
+   }
+
+   current = NULL;
+   g_mutex_unlock(&callLock);
+
+   return result;
+}
+
+/***
+ *** The library interface (see libdvdisaster.h)
+ ***/
+
+int DvdisasterInit(void)
+{
+   if(Closure)
+     return DVDISASTER_OK;
+
+   InitClosure();
+   Closure->mainThread = g_thread_self();
+   Closure->logProc    = forward_log;
+   g_cond_init(&progressCond);
+
+   CollectMethods();
+
+   Closure->useSSE2 = ProbeSSE2();
+   Closure->useAltiVec = ProbeAltiVec();
+   Closure->clSize = ProbeCacheLineSize();
+
+   return DVDISASTER_OK;
+}
+
+int DvdisasterCreate(const char *image, const char *ecc, const DvdisasterOptions *options)
+{
+   return run_action(MethodCreate, image, ecc, options);
+}
+
+int DvdisasterVerify(const char *image, const char *ecc, const DvdisasterOptions *options)
+{
+   return run_action(MethodVerify, image, ecc, options);
+}
+
+int DvdisasterFix(const char *image, const char *ecc, const DvdisasterOptions *options)
+{
+   return run_action(MethodFix, image, ecc, options);
+}
+
+/*
+ * Message of the last failed call; valid until the next call
+ */
+
+const char* DvdisasterLastError(void)
+{
+   return Closure && Closure->stopMessage ? Closure->stopMessage : "";
+}
+
+void DvdisasterShutdown(void)
+{
+   if(!Closure)
+     return;
+
+   g_mutex_lock(&callLock);
+   FreeClosure();
+   Closure = NULL;
+   g_mutex_unlock(&callLock);
+}
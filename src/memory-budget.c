@@ -0,0 +1,256 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*** src type: no GUI code ***/
+
+#include "dvdisaster.h"
+
+/***
+ *** Memory budget for the codec buffers.
+ ***
+ * The cache size and the number of prefetched sectors are set by the
+ * user, who does not necessarily know how much memory the machine or
+ * container grants us. So before allocating their buffers, the codecs
+ * ask how much of them fits into the memory which is currently
+ * available and scale the buffers down if needed.
+ * Available memory is the smaller one of what the kernel reports as
+ * available and the room left below the cgroup memory limit.
+ * Only a share of it is planned for, since the page cache and
+ * other processes need memory, too.
+ */
+
+#define BUDGET_SHARE 75   /* percent of available memory used for buffers */
+
+#ifdef SYS_LINUX
+
+/*
+ * Read a number from a file, either the first word
+ * or the number following the given key.
+ * "max" (no cgroup limit) is not considered a number.
+ */
+
+static int read_value(char *path, char *key, gint64 *value)
+{  FILE *file = portable_fopen(path, "r");
+   char line[256];
+   int found = FALSE;
+
+   if(!file)
+     return FALSE;
+
+   while(fgets(line, sizeof(line), file))
+   {  char *pos = line;
+
+      if(key)
+      {  if(strncmp(line, key, strlen(key)))
+	    continue;
+	 pos += strlen(key);
+      }
+
+      while(*pos == ' ' || *pos == '\t')
+	 pos++;
+      if(*pos >= '0' && *pos <= '9')
+      {  *value = atoll(pos);
+	 found = TRUE;
+      }
+      break;
+   }
+
+   fclose(file);
+   return found;
+}
+
+/*
+ * Find our cgroup in /proc/self/cgroup.
+ * The unified (v2) hierarchy is the entry with an empty controller list.
+ */
+
+static char* cgroup_path(char *controller)
+{  FILE *file = portable_fopen("/proc/self/cgroup", "r");
+   char line[1024];
+   char *result = NULL;
+
+   if(!file)
+     return NULL;
+
+   while(!result && fgets(line, sizeof(line), file))
+   {  char *controllers = strchr(line, ':');
+      char *path;
+      int match;
+
+      if(!controllers)
+	 continue;
+      controllers++;
+      path = strchr(controllers, ':');
+      if(!path)
+	 continue;
+      *path++ = 0;
+      path[strcspn(path, "\n")] = 0;
+
+      if(!*controller)
+	 match = !*controllers;
+      else
+      {  char **list = g_strsplit(controllers, ",", 0);
+	 int i;
+
+	 for(i=0, match=FALSE; list[i]; i++)
+	    if(!strcmp(list[i], controller))
+	       match = TRUE;
+	 g_strfreev(list);
+      }
+
+      if(match)
+	 result = g_strdup(path);
+   }
+
+   fclose(file);
+   return result;
+}
+
+/*
+ * Room left below the limit of the cgroup in dir,
+ * or -1 if there is no limit. Inactive file pages are
+ * charged to the cgroup, but can be reclaimed.
+ */
+
+static gint64 room_in(char *dir, char *limit_file, char *usage_file, char *inactive_key)
+{  char *path;
+   gint64 limit, usage = 0, inactive = 0;
+   int limited;
+
+   path = g_strdup_printf("%s/%s", dir, limit_file);
+   limited = read_value(path, NULL, &limit);
+   g_free(path);
+
+   if(!limited || limit >= ((gint64)1<<60))  /* v1 reports "unlimited" as a huge number */
+     return -1;
+
+   path = g_strdup_printf("%s/%s", dir, usage_file);
+   read_value(path, NULL, &usage);
+   g_free(path);
+
+   path = g_strdup_printf("%s/memory.stat", dir);
+   read_value(path, inactive_key, &inactive);
+   g_free(path);
+
+   if(inactive > usage)
+     inactive = usage;
+
+   return MAX(limit - usage + inactive, 0);
+}
+
+static gint64 cgroup_room(void)
+{  char *path, *dir;
+   gint64 room = -1;
+
+   /* Containers usually see their own cgroup at the root
+      of the hierarchy, so try that if our path does not exist. */
+
+   path = cgroup_path("");
+   if(path)
+   {  dir = g_strdup_printf("/sys/fs/cgroup%s", path);
+      room = room_in(dir, "memory.max", "memory.current", "inactive_file ");
+      if(room < 0)
+	 room = room_in("/sys/fs/cgroup", "memory.max", "memory.current", "inactive_file ");
+      g_free(dir);
+      g_free(path);
+   }
+
+   if(room >= 0)
+     return room;
+
+   path = cgroup_path("memory");
+   if(path)
+   {  dir = g_strdup_printf("/sys/fs/cgroup/memory%s", path);
+      room = room_in(dir, "memory.limit_in_bytes", "memory.usage_in_bytes", "total_inactive_file ");
+      if(room < 0)
+	 room = room_in("/sys/fs/cgroup/memory", "memory.limit_in_bytes", "memory.usage_in_bytes",
+			"total_inactive_file ");
+      g_free(dir);
+      g_free(path);
+   }
+
+   return room;
+}
+
+#endif /* SYS_LINUX */
+
+/*
+ * Returns the available memory in bytes, or -1 if unknown.
+ */
+
+gint64 AvailableMemory(void)
+{  gint64 available = -1;
+
+   if(Closure->memoryLimit)  /* debugging: simulated limit */
+     return (gint64)Closure->memoryLimit<<20;
+
+#ifdef SYS_LINUX
+   {  gint64 room;
+
+      if(read_value("/proc/meminfo", "MemAvailable:", &available))
+	 available <<= 10;
+      else available = -1;
+
+      room = cgroup_room();
+      if(room >= 0 && (available < 0 || room < available))
+	 available = room;
+   }
+#endif
+
+   return available;
+}
+
+/*
+ * Plan a buffer of up to wanted units of unit_bytes each.
+ * fixed_bytes are needed in addition to the buffer.
+ * Returns the number of units fitting into the budget,
+ * but never less than minimum.
+ */
+
+gint64 PlanMemory(char *what, gint64 wanted, gint64 minimum, gint64 unit_bytes, gint64 fixed_bytes)
+{  gint64 available = AvailableMemory();
+   gint64 budget, units;
+
+   if(available < 0)
+   {  if(!Closure->regtestMode)
+        Verbose("Memory plan: %" PRId64 " %s (available memory unknown)\n", wanted, what);
+      return wanted;
+   }
+
+   budget = available/100*BUDGET_SHARE - fixed_bytes;
+   units  = budget > 0 ? budget/unit_bytes : 0;
+   if(units > wanted)  units = wanted;
+   if(units < minimum) units = minimum;
+
+   /* The available memory depends on the machine;
+      keep it out of the regression tests */
+
+   if(!Closure->regtestMode)
+     Verbose("Memory plan: %" PRId64 " %s using %" PRId64 " MiB; %" PRId64 " MiB available\n",
+	     units, what, (units*unit_bytes + fixed_bytes)>>20, available>>20);
+
+   if(units < wanted)
+     PrintLog(_("Using %" PRId64 " instead of %" PRId64 " %s to fit into %" PRId64 " MiB of available memory.\n"),
+	      units, wanted, what, available>>20);
+
+   return units;
+}
@@ -0,0 +1,495 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*** src type: no GUI code ***/
+
+#include "dvdisaster.h"
+
+/***
+ *** Merging several partial images into one.
+ ***
+ * Typically the images were read from the same medium in different
+ * drives or reading sessions. All images are read in parallel,
+ * one thread per image, in blocks of MERGE_BLOCK sectors.
+ * For each sector the first copy which is present and matches the CRC
+ * from the ecc data is used. Without CRC information the first present
+ * copy wins, and copies with CRC errors are only used if nothing better
+ * is available.
+ * The target image (-i) takes part as the first source if it already
+ * exists, so that only sectors for which a better copy was found
+ * are written to it.
+ */
+
+#define MERGE_BLOCK 512       /* sectors read from each image at once (1 MiB) */
+#define MERGE_BUFFERS 2       /* blocks buffered per image */
+
+enum { COPY_NONE, COPY_BAD, COPY_UNKNOWN, COPY_GOOD };
+
+typedef struct _merge_closure merge_closure;
+
+typedef struct
+{  merge_closure *mc;
+   char *path;
+   LargeFile *file;
+   gint64 sectors;
+   GThread *thread;
+   AlignedBuffer *ab[MERGE_BUFFERS];
+   int filled[MERGE_BUFFERS];  /* sectors in buffer; -1 while not yet read */
+   int readError;              /* errno from a failed read */
+
+   gint64 present;             /* sectors present in this image */
+   gint64 crcErrors;           /* present sectors failing the CRC test */
+   gint64 used;                /* sectors taken from this image */
+} merge_source;
+
+struct _merge_closure
+{  merge_source *src;
+   int nSources;
+   int targetIsSource;         /* src[0] is the existing target image */
+   LargeFile *target;
+   gint64 sectors;             /* size of the merged image */
+   CrcBuf *crcBuf;             /* CRC sums from the ecc data */
+   struct iovec *iov;          /* run of sectors to be written */
+
+   GMutex *lock;
+   GCond *filled;
+   GCond *emptied;
+   int stopReaders;
+
+   gint64 missing;             /* sectors not present in any image */
+   gint64 crcOnly;             /* sectors present only with CRC errors */
+   gint64 differing;           /* copies differ and no CRC decides */
+   gint64 written;
+};
+
+/*
+ * Cleanup
+ */
+
+static void cleanup(gpointer data)
+{  merge_closure *mc = (merge_closure*)data;
+   int i,j;
+
+   UnregisterCleanup();
+
+   if(mc->lock)
+   {  g_mutex_lock(mc->lock);
+      mc->stopReaders = TRUE;
+      g_cond_broadcast(mc->emptied);
+      g_mutex_unlock(mc->lock);
+   }
+
+   for(i=0; i<mc->nSources; i++)
+   {  merge_source *src = &mc->src[i];
+
+      if(src->thread) g_thread_join(src->thread);
+      if(src->file) LargeClose(src->file);
+      for(j=0; j<MERGE_BUFFERS; j++)
+	if(src->ab[j]) FreeAlignedBuffer(src->ab[j]);
+      g_free(src->path);
+   }
+   if(mc->src) g_free(mc->src);
+
+   if(mc->target)
+     if(!LargeClose(mc->target))
+       Stop(_("Error closing image file:\n%s"), strerror(errno));
+
+   if(mc->crcBuf) FreeCrcBuf(mc->crcBuf);
+   if(mc->iov) g_free(mc->iov);
+
+   if(mc->lock)
+   {  g_mutex_clear(mc->lock);
+      g_free(mc->lock);
+   }
+   if(mc->filled)
+   {  g_cond_clear(mc->filled);
+      g_free(mc->filled);
+   }
+   if(mc->emptied)
+   {  g_cond_clear(mc->emptied);
+      g_free(mc->emptied);
+   }
+
+   g_free(mc);
+}
+
+/***
+ *** Preparations
+ ***/
+
+static void add_source(merge_closure *mc, char *path)
+{  merge_source *src = &mc->src[mc->nSources++];
+   guint64 size;
+   int i;
+
+   src->mc   = mc;
+   src->path = g_strdup(path);
+
+   if(!LargeStat(path, &size))
+     Stop(_("Can't open %s:\n%s"), path, strerror(errno));
+   if(!(src->file = LargeOpen(path, O_RDONLY, IMG_PERMS)))
+     Stop(_("Can't open %s:\n%s"), path, strerror(errno));
+
+   src->sectors = size/2048;
+   if(src->sectors > mc->sectors)
+     mc->sectors = src->sectors;
+
+   for(i=0; i<MERGE_BUFFERS; i++)
+   {  src->ab[i] = CreateAlignedBuffer(MERGE_BLOCK*2048);
+      src->filled[i] = -1;
+   }
+
+   PrintLog(_("%s: %" PRId64 " sectors.\n"), path, src->sectors);
+}
+
+/*
+ * Get the CRC sums from the ecc file or from the first image
+ * carrying augmented ecc data.
+ */
+
+static void load_crc_buf(merge_closure *mc)
+{  int i;
+
+   for(i=0; i<mc->nSources; i++)
+   {  Image *image = OpenImageFromFile(mc->src[i].path, O_RDONLY, IMG_PERMS);
+      Method *method = NULL;
+
+      image = OpenEccFileForImage(image, Closure->eccName, O_RDONLY, IMG_PERMS);
+      if(!image)
+	continue;
+
+      if(image->eccFileMethod)  method = image->eccFileMethod;
+      else if(image->eccMethod) method = image->eccMethod;
+
+      if(method && method->getCrcBuf)
+      {  PrintCLI("%s (%4.4s) ... ", _("Reading CRC information from ecc data"), method->name);
+	 mc->crcBuf = method->getCrcBuf(image);
+	 PrintCLI(_("done.\n"));
+      }
+
+      CloseImage(image);
+      if(mc->crcBuf)
+	return;
+   }
+
+   PrintLog(_("No ecc data found; using the first present copy of each sector.\n"));
+}
+
+/***
+ *** Streaming the images
+ ***/
+
+static gpointer reader_thread(merge_source *src)
+{  merge_closure *mc = src->mc;
+   int slot = 0;
+   gint64 s;
+
+   for(s=0; s<mc->sectors; s+=MERGE_BLOCK)
+   {  int n = 0;
+
+      g_mutex_lock(mc->lock);
+      while(src->filled[slot] >= 0 && !mc->stopReaders)
+	g_cond_wait(mc->emptied, mc->lock);
+      g_mutex_unlock(mc->lock);
+
+      if(mc->stopReaders)
+	break;
+
+      if(s < src->sectors && !src->readError)
+      {  n = MIN(MERGE_BLOCK, src->sectors - s);
+
+	 if(LargeRead(src->file, src->ab[slot]->buf, 2048*n) != 2048*n)
+	 {  src->readError = errno ? errno : EIO;
+	    n = 0;
+	 }
+	 else MarkHoleSectors(src->file, src->ab[slot]->buf, s, n);
+      }
+
+      g_mutex_lock(mc->lock);
+      src->filled[slot] = n;
+      g_cond_broadcast(mc->filled);
+      g_mutex_unlock(mc->lock);
+
+      if(++slot >= MERGE_BUFFERS)
+	slot = 0;
+   }
+
+   return NULL;
+}
+
+/***
+ *** Merging
+ ***/
+
+static void write_run(merge_closure *mc, gint64 start, int count)
+{
+   if(!count)
+     return;
+
+   if(!PrepareSparseWrite(mc->target, start, count, NULL, 0, NULL))
+     Stop(_("Failed writing to sector %" PRId64 " in image [%s]: %s"),
+	  start, "merge", strerror(errno));
+
+   if(!LargeSeek(mc->target, (gint64)(2048*start)))
+     Stop(_("Failed seeking to sector %" PRId64 " in image [%s]: %s"),
+	  start, "merge", strerror(errno));
+
+   if(LargeWritev(mc->target, mc->iov, count) != 2048*count)
+     Stop(_("Failed writing to sector %" PRId64 " in image [%s]: %s"),
+	  start, "merge", strerror(errno));
+
+   mc->written += count;
+}
+
+/*
+ * Rate the copy of a sector in the given image.
+ */
+
+static int rate_copy(merge_closure *mc, merge_source *src, gint64 sector, unsigned char *buf)
+{
+   if(CheckForMissingSector(buf, sector, NULL, 0) != SECTOR_PRESENT)
+     return COPY_NONE;
+
+   src->present++;
+
+   if(!mc->crcBuf)
+     return COPY_UNKNOWN;
+
+   switch(CheckAgainstCrcBuffer(mc->crcBuf, sector, buf))
+   {  case CRC_GOOD:
+	return COPY_GOOD;
+      case CRC_BAD:
+	src->crcErrors++;
+	return COPY_BAD;
+      default:
+	return COPY_UNKNOWN;
+   }
+}
+
+static void merge_block(merge_closure *mc, gint64 start, int nsectors, int slot)
+{  gint64 run_start = start;
+   int run_length = 0;
+   int i,j;
+
+   for(i=0; i<nsectors; i++)
+   {  gint64 sector = start+i;
+      unsigned char *best_buf = NULL;
+      int best = -1, best_rating = COPY_NONE;
+
+      /* Find the best copy. Sectors which are missing everywhere are taken
+	 from the first image covering them (e.g. its dead sector marker). */
+
+      for(j=0; j<mc->nSources; j++)
+      {  merge_source *src = &mc->src[j];
+	 unsigned char *buf;
+	 int rating;
+
+	 if(i >= src->filled[slot])
+	   continue;
+
+	 buf = src->ab[slot]->buf + 2048*i;
+	 rating = rate_copy(mc, src, sector, buf);
+
+	 if(best < 0 || rating > best_rating)
+	 {  best = j;
+	    best_rating = rating;
+	    best_buf = buf;
+	 }
+      }
+
+      switch(best_rating)
+      {  case COPY_NONE:
+	   mc->missing++;
+	   break;
+	 case COPY_BAD:
+	   mc->crcOnly++;
+	   break;
+	 case COPY_UNKNOWN:
+	   for(j=best+1; j<mc->nSources; j++)
+	   {  merge_source *src = &mc->src[j];
+	      unsigned char *buf = src->ab[slot]->buf + 2048*i;
+
+	      if(i < src->filled[slot]
+		 && CheckForMissingSector(buf, sector, NULL, 0) == SECTOR_PRESENT
+		 && memcmp(buf, best_buf, 2048))
+	      {  Verbose("Sector %" PRId64 " differs in %s and %s\n",
+			 sector, mc->src[best].path, src->path);
+		 mc->differing++;
+		 break;
+	      }
+	   }
+	   break;
+      }
+
+      if(best_rating != COPY_NONE)
+	mc->src[best].used++;
+
+      /* The target already contains its own copy */
+
+      if(mc->targetIsSource && best == 0)
+      {  write_run(mc, run_start, run_length);
+	 run_length = 0;
+	 continue;
+      }
+
+      if(!run_length)
+	run_start = sector;
+      mc->iov[run_length].iov_base = best_buf;
+      mc->iov[run_length].iov_len  = 2048;
+      run_length++;
+   }
+
+   write_run(mc, run_start, run_length);
+}
+
+/***
+ *** Merge the given images into Closure->imageName
+ ***/
+
+void MergeImageFiles(char *arg)
+{  merge_closure *mc = g_malloc0(sizeof(merge_closure));
+   char **paths = g_strsplit(arg, ",", 0);
+   GTimer *timer = g_timer_new();
+   int i,n_paths,slot,percent,last_percent = -1;
+   guint64 size;
+   gint64 s;
+   char *t;
+
+   RegisterCleanup(_("Merging aborted"), cleanup, mc);
+
+   for(n_paths=0; paths[n_paths]; n_paths++)
+     ;
+   mc->src = g_malloc0((n_paths+1)*sizeof(merge_source));
+
+   /*** The existing target image is the first source */
+
+   if(LargeStat(Closure->imageName, &size))
+   {  add_source(mc, Closure->imageName);
+      mc->targetIsSource = TRUE;
+
+      if(!(mc->target = LargeOpen(Closure->imageName, O_WRONLY, IMG_PERMS)))
+	Stop(_("Can't open %s:\n%s"), Closure->imageName, strerror(errno));
+   }
+   else
+   {  if(!(mc->target = LargeOpen(Closure->imageName, O_WRONLY | O_CREAT, IMG_PERMS)))
+	Stop(_("Can't open %s:\n%s"), Closure->imageName, strerror(errno));
+   }
+
+   for(i=0; i<n_paths; i++)
+     if(*paths[i] && strcmp(paths[i], Closure->imageName))
+       add_source(mc, paths[i]);
+   g_strfreev(paths);
+
+   if(mc->nSources - mc->targetIsSource < 1)
+     Stop(_("No images given for merging.\n"));
+
+   PrintLog(_("Merging %d images into %s (%" PRId64 " sectors).\n"),
+	    mc->nSources, Closure->imageName, mc->sectors);
+
+   load_crc_buf(mc);
+
+   /*** Start one reader per image */
+
+   mc->iov = g_malloc(MERGE_BLOCK*sizeof(struct iovec));
+   mc->lock = g_malloc(sizeof(GMutex));
+     g_mutex_init(mc->lock);
+   mc->filled = g_malloc(sizeof(GCond));
+     g_cond_init(mc->filled);
+   mc->emptied = g_malloc(sizeof(GCond));
+     g_cond_init(mc->emptied);
+
+   for(i=0; i<mc->nSources; i++)
+   {  GError *err = NULL;
+
+      mc->src[i].thread = g_thread_try_new("merge_reader", (GThreadFunc)reader_thread,
+					   (gpointer)&mc->src[i], &err);
+      if(!mc->src[i].thread)
+	Stop("Could not create reader thread: %s", err->message);
+   }
+
+   /*** Merge block by block */
+
+   for(s=0, slot=0; s<mc->sectors; s+=MERGE_BLOCK)
+   {  int nsectors = MIN(MERGE_BLOCK, mc->sectors - s);
+
+      g_mutex_lock(mc->lock);
+      for(i=0; i<mc->nSources; i++)
+	while(mc->src[i].filled[slot] < 0)
+	  g_cond_wait(mc->filled, mc->lock);
+      g_mutex_unlock(mc->lock);
+
+      for(i=0; i<mc->nSources; i++)
+	if(mc->src[i].readError)
+	  Stop(_("Failed reading sector %" PRId64 " in image %s: %s"),
+	       s, mc->src[i].path, strerror(mc->src[i].readError));
+
+      merge_block(mc, s, nsectors, slot);
+
+      g_mutex_lock(mc->lock);
+      for(i=0; i<mc->nSources; i++)
+	mc->src[i].filled[slot] = -1;
+      g_cond_broadcast(mc->emptied);
+      g_mutex_unlock(mc->lock);
+
+      if(++slot >= MERGE_BUFFERS)
+	slot = 0;
+
+      percent = (100*(s+nsectors))/mc->sectors;
+      if(last_percent != percent)
+      {  PrintProgress(_("Merging: %3d%%"), percent);
+	 last_percent = percent;
+      }
+   }
+   ClearProgress();
+
+   /*** Print summary */
+
+   for(i=0; i<mc->nSources; i++)
+   {  merge_source *src = &mc->src[i];
+
+      PrintLog(_("%s: %" PRId64 " sectors present, %" PRId64 " CRC errors, %" PRId64 " sectors used.\n"),
+	       src->path, src->present, src->crcErrors, src->used);
+   }
+
+   if(mc->differing)
+     PrintLog(_("%" PRId64 " sectors differ between the images without CRC information to decide.\n"),
+	      mc->differing);
+
+   if(!mc->missing && !mc->crcOnly)
+   {  if(mc->crcBuf) t = g_strdup_printf(_("Merged image is complete (%" PRId64 " sectors written). Checksums match."), mc->written);
+      else           t = g_strdup_printf(_("Merged image is complete (%" PRId64 " sectors written)."), mc->written);
+   }
+   else
+   {  t = g_strdup_printf(_("%" PRId64 " sectors written; %" PRId64 " sectors missing, %" PRId64 " sectors with CRC errors."),
+			  mc->written, mc->missing, mc->crcOnly);
+      exitCode = EXIT_FAILURE;
+   }
+
+   PrintLog("\n%s\n", t);
+   g_free(t);
+
+   if(!Closure->fixedSpeedValues)
+     PrintTimeToLog(timer, "for merging.\n");
+   g_timer_destroy(timer);
+
+   cleanup((gpointer)mc);
+}
@@ -102,3 +102,70 @@ Method *FindMethod(char *name)
    return NULL;
 }
 
+
+/***
+ *** Process the image named in the closure
+ ***/
+
+/*
+ * Create error correction data with the selected method
+ */
+
+void MethodCreate(void)
+{  Method *method = FindMethod(Closure->methodName); 
+
+   if(!method) Stop(_("\nMethod %s not available.\n"
+		      "Use -m without parameters for a method list.\n"), 
+		    Closure->methodName);
+
+   method->create();
+}
+
+/*
+ * Repair the image. Ecc files win over augmented ecc.
+ */
+
+void MethodFix(void)
+{  Method *method = NULL;
+   Image *image;
+
+   PrintLog(_("\nOpening %s"), Closure->imageName);
+   image = OpenImageFromFile(Closure->imageName, O_RDWR, IMG_PERMS);
+   if(!image)
+   {  PrintLog(": %s.\n", strerror(errno));
+   }
+   else 
+   {  if(image->inLast == 2048)
+           PrintLog(_(": %" PRId64 " medium sectors.\n"), image->sectorSize);
+      else PrintLog(_(": %" PRId64 " medium sectors and %d bytes.\n"), 
+		    image->sectorSize-1, image->inLast);
+   }
+   image = OpenEccFileForImage(image, Closure->eccName, O_RDWR, IMG_PERMS);
+   ReportImageEccInconsistencies(image);
+
+   if(image && image->eccFileMethod) method = image->eccFileMethod;
+   else if(image && image->eccMethod) method = image->eccMethod;
+   else Stop("Internal error: No suitable method for repairing image.");
+
+   method->fix(image);
+}
+
+/*
+ * Verify the image. Ecc files win over augmented ecc;
+ * without any ecc data the image is examined by RS01.
+ */
+
+void MethodVerify(void)
+{  Method *method;
+   Image *image;
+
+   image = OpenImageFromFile(Closure->imageName, O_RDONLY, IMG_PERMS);
+   image = OpenEccFileForImage(image, Closure->eccName, O_RDONLY, IMG_PERMS);
+
+   if(image && image->eccFileMethod) method = image->eccFileMethod;
+   else if(image && image->eccMethod) method = image->eccMethod;
+   else if(!(method = FindMethod("RS01")))
+           Stop(_("RS01 method not available for comparing files."));
+     
+   method->verify(image);
+}
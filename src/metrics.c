@@ -0,0 +1,542 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*** src type: no GUI code ***/
+
+#include "dvdisaster.h"
+
+#ifndef SYS_MINGW
+ #include <sys/resource.h>
+#endif
+
+/***
+ *** Progress and statistics counters.
+ ***
+ * Each thread working on an action owns a slot of counters which
+ * only it changes, using atomic adds so that the counters can be
+ * read at any time. The slots are placed on separate cache lines.
+ *
+ * A reporter thread sums up the slots at a fixed rate and passes
+ * the result to a callback which updates the progress output.
+ * So the hot loops neither format messages nor take locks,
+ * and the reporting overhead does not depend on the throughput.
+ *
+ * Loops which print their own messages between the progress
+ * updates go without the callback; the reporter then only flags
+ * that an update is due and the loop prints it when convenient
+ * (see MetricsReportDue()), so that the output is not garbled.
+ *
+ * The metrics of the running action are also available via
+ * SampleCurrentMetrics(), e.g. for machine readable statistics.
+ */
+
+#define METRICS_INTERVAL 250   /* milliseconds between reports */
+
+static GMutex currentLock;     /* protects Closure->metrics */
+static int nextSerial;
+
+static double cpu_time(void);
+static void write_summary(Metrics*);
+
+/*
+ * Report periodically until told to stop
+ */
+
+static gpointer reporter_thread(gpointer data)
+{  Metrics *m = (Metrics*)data;
+
+   g_mutex_lock(&m->lock);
+   while(!m->stopReporter)
+   {  gint64 timeout = g_get_monotonic_time() + METRICS_INTERVAL*G_TIME_SPAN_MILLISECOND;
+      MetricsSample sample;
+
+      if(g_cond_wait_until(&m->cond, &m->lock, timeout) || m->stopReporter)
+	continue;  /* woken up for stopping (or spuriously) */
+
+      if(!m->report)
+      {  g_atomic_int_set(&m->reportDue, TRUE);
+	 continue;
+      }
+
+      g_mutex_unlock(&m->lock);
+      SampleMetrics(m, &sample);
+      m->report(m, &sample, m->reportData);
+      g_mutex_lock(&m->lock);
+   }
+   g_mutex_unlock(&m->lock);
+
+   return NULL;
+}
+
+/*
+ * Create the metrics for an action with n_slots threads.
+ * total is the number of units to be processed (0 if unknown);
+ * by default a unit is one sector (see m->unitSectors).
+ * If report is given, it is called from a separate thread
+ * every METRICS_INTERVAL milliseconds.
+ * Without a report callback, the reporter only raises the flag
+ * tested by MetricsReportDue(), and only if with_due is set.
+ */
+
+Metrics* CreateMetrics(char *phase, int n_slots, gint64 total,
+		       MetricsReporter report, gpointer report_data, int with_due)
+{  Metrics *m = g_malloc0(sizeof(Metrics));
+
+   m->phase      = phase;
+   m->nSlots     = n_slots;
+   m->total      = total;
+   m->unitSectors = 1;
+   m->slotBase   = g_malloc0(n_slots*sizeof(MetricsSlot)+64);
+   m->slot       = (MetricsSlot*)((char*)m->slotBase + (64 - ((intptr_t)m->slotBase & 63)));
+   m->timer      = g_timer_new();
+   m->report     = report;
+   m->reportData = report_data;
+   m->lastPermille = -1;
+   g_mutex_init(&m->lock);
+   g_cond_init(&m->cond);
+
+   m->startCpu   = cpu_time();
+   LargeIOTotals(&m->startRead, &m->startWritten);
+
+   g_mutex_lock(&currentLock);
+   m->serial = ++nextSerial;
+   Closure->metrics = m;
+   g_mutex_unlock(&currentLock);
+
+   if(report || with_due)
+     m->reporter = CreateGThread(reporter_thread, m);
+
+   return m;
+}
+
+/*
+ * Stop the reporter thread. Must happen before the data
+ * used by the report callback goes away.
+ */
+
+void StopMetricsReporter(Metrics *m)
+{
+   if(!m->reporter)
+     return;
+
+   g_mutex_lock(&m->lock);
+   m->stopReporter = TRUE;
+   g_cond_signal(&m->cond);
+   g_mutex_unlock(&m->lock);
+
+   g_thread_join(m->reporter);
+   m->reporter = NULL;
+}
+
+void FreeMetrics(Metrics *m)
+{
+   StopMetricsReporter(m);
+   write_summary(m);
+
+   g_mutex_lock(&currentLock);
+   if(Closure->metrics == m)
+     Closure->metrics = NULL;
+   g_mutex_unlock(&currentLock);
+
+   g_mutex_clear(&m->lock);
+   g_cond_clear(&m->cond);
+   g_timer_destroy(m->timer);
+   g_free(m->slotBase);
+   g_free(m);
+}
+
+/*
+ * Counting. Only the thread owning the slot may call these.
+ */
+
+void MetricsAddSectors(Metrics *m, int slot, int n)
+{
+   g_atomic_int_add(&m->slot[slot].sectors, n);
+}
+
+void MetricsAddErrors(Metrics *m, int slot, int n)
+{
+   g_atomic_int_add(&m->slot[slot].errors, n);
+}
+
+/* Count a wait which started at wait_start (from g_get_monotonic_time()) */
+
+void MetricsAddWait(Metrics *m, int slot, gint64 wait_start)
+{  MetricsSlot *s = &m->slot[slot];
+
+   s->waitTimeUS += g_get_monotonic_time() - wait_start;
+   g_atomic_int_inc(&s->waits);
+   g_atomic_int_set(&s->waitTime, s->waitTimeUS/1000);
+}
+
+/* Count whether the encoders (cpu_bound) or the I/O held up the work */
+
+void MetricsAddBound(Metrics *m, int cpu_bound)
+{
+   if(cpu_bound)
+        g_atomic_int_inc(&m->cpuBound);
+   else g_atomic_int_inc(&m->ioBound);
+}
+
+/* For loops which keep their own counters: publish their current values */
+
+void MetricsSetProgress(Metrics *m, int slot, gint64 sectors, gint64 errors)
+{
+   g_atomic_int_set(&m->slot[slot].sectors, sectors);
+   g_atomic_int_set(&m->slot[slot].errors, errors);
+}
+
+/*
+ * For loops doing their own output: Returns TRUE once
+ * per METRICS_INTERVAL when the progress should be updated.
+ */
+
+int MetricsReportDue(Metrics *m)
+{
+   return g_atomic_int_get(&m->reportDue)
+          && g_atomic_int_compare_and_exchange(&m->reportDue, TRUE, FALSE);
+}
+
+/*
+ * Print the progress in per mille using the given format
+ * (which takes the integer and the fractional percent digit),
+ * unless it did not change.
+ */
+
+void PrintMetricsProgress(Metrics *m, char *format)
+{  MetricsSample sample;
+   int permille;
+
+   if(!m->total)
+     return;
+
+   SampleMetrics(m, &sample);
+   permille = (1000*sample.sectors)/m->total;
+   if(permille == m->lastPermille)
+     return;
+
+   m->lastPermille = permille;
+   PrintProgress(format, permille/10, permille%10);
+}
+
+/*
+ * Sum up the slots
+ */
+
+void SampleMetrics(Metrics *m, MetricsSample *sample)
+{  int i;
+
+   memset(sample, 0, sizeof(MetricsSample));
+
+   for(i=0; i<m->nSlots; i++)
+   {  MetricsSlot *s = &m->slot[i];
+
+      sample->sectors  += g_atomic_int_get(&s->sectors);
+      sample->errors   += g_atomic_int_get(&s->errors);
+      sample->waits    += g_atomic_int_get(&s->waits);
+      sample->waitTime += g_atomic_int_get(&s->waitTime);
+   }
+
+   sample->elapsed = g_timer_elapsed(m->timer, NULL);
+   sample->total   = m->total;
+}
+
+/*
+ * Sample the metrics of the running action, if any.
+ * phase receives the name of the action.
+ */
+
+int SampleCurrentMetrics(MetricsSample *sample, char **phase)
+{  int found = FALSE;
+
+   g_mutex_lock(&currentLock);
+   if(Closure->metrics)
+   {  SampleMetrics(Closure->metrics, sample);
+      *phase = Closure->metrics->phase;
+      found = TRUE;
+   }
+   g_mutex_unlock(&currentLock);
+
+   return found;
+}
+
+/***
+ *** Machine readable statistics (--stats-json)
+ ***
+ * A separate thread appends a record about the running action to the
+ * file every STATS_JSON_INTERVAL milliseconds. Each action finishes
+ * with a summary record when its metrics are freed.
+ * The records are JSON objects, one per line.
+ */
+
+#define STATS_JSON_INTERVAL 1000  /* milliseconds between records */
+
+typedef struct
+{  FILE *file;
+   GMutex lock;              /* serializes writing the records */
+   GCond cond;
+   GThread *thread;
+   int stop;
+   int serial;               /* metrics described by the values below */
+   double lastElapsed;
+   gint64 lastSectors;
+   gint64 lastRead, lastWritten;
+   double lastCpu;
+} stats_json;
+
+static stats_json *stats;
+
+/*
+ * Resource usage of the process
+ */
+
+static double cpu_time(void)
+{
+#ifndef SYS_MINGW
+   struct rusage ru;
+
+   if(!getrusage(RUSAGE_SELF, &ru))
+     return   ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1000000.0
+            + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1000000.0;
+#endif
+   return 0.0;
+}
+
+static gint64 resident_memory(void)
+{
+#if defined(SYS_LINUX)
+   FILE *file = fopen("/proc/self/statm", "r");
+   long long size, resident;
+   int n;
+
+   if(!file)
+     return -1;
+
+   n = fscanf(file, "%lld %lld", &size, &resident);
+   fclose(file);
+
+   if(n == 2)
+     return resident*sysconf(_SC_PAGESIZE);
+#endif
+   return -1;
+}
+
+/*
+ * JSON formatting. Numbers must not depend on the locale.
+ */
+
+static void append_double(GString *line, char *name, double value)
+{  char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+   g_string_append_printf(line, ",\"%s\":%s", name,
+			  g_ascii_formatd(buf, G_ASCII_DTOSTR_BUF_SIZE, "%.3f", value));
+}
+
+static void append_string(GString *line, char *name, char *value)
+{  unsigned char *c;
+
+   g_string_append_printf(line, ",\"%s\":\"", name);
+   for(c=(unsigned char*)value; *c; c++)
+   {  if(*c == '"' || *c == '\\')
+           g_string_append_printf(line, "\\%c", *c);
+      else if(*c < 0x20)
+	   g_string_append_printf(line, "\\u%04x", *c);
+      else g_string_append_c(line, *c);
+   }
+   g_string_append_c(line, '"');
+}
+
+static void write_line(GString *line)
+{
+   g_string_append(line, "}\n");
+   fputs(line->str, stats->file);
+   fflush(stats->file);
+   g_string_free(line, TRUE);
+}
+
+static GString* start_record(char *type)
+{  GString *line = g_string_new("{");
+
+   g_string_append_printf(line, "\"type\":\"%s\"", type);
+   append_double(line, "time", g_get_real_time()/1000000.0);
+
+   return line;
+}
+
+/*
+ * Describe the given metrics in medium sectors. Progress records give the rates
+ * since the previous record, summaries those of the whole action.
+ * Caller must hold stats->lock.
+ */
+
+static void write_record(Metrics *m, char *type, int summary)
+{  GString *line = start_record(type);
+   MetricsSample sample;
+   gint64 read, written, memory;
+   double cpu, interval;
+   int i;
+
+   SampleMetrics(m, &sample);
+   LargeIOTotals(&read, &written);
+   cpu = cpu_time();
+   memory = resident_memory();
+
+   if(summary || stats->serial != m->serial)
+   {  stats->serial      = m->serial;
+      stats->lastElapsed = 0.0;
+      stats->lastSectors = 0;
+      stats->lastRead    = m->startRead;
+      stats->lastWritten = m->startWritten;
+      stats->lastCpu     = m->startCpu;
+   }
+
+   interval = sample.elapsed - stats->lastElapsed;
+   if(interval <= 0.0)
+     interval = 1e-6;
+   sample.sectors *= m->unitSectors;
+
+   append_string(line, "phase", m->phase);
+   append_double(line, "elapsed", sample.elapsed);
+   g_string_append_printf(line, ",\"sectors\":%" PRId64, sample.sectors);
+   if(m->total)
+   {  g_string_append_printf(line, ",\"total\":%" PRId64, m->total*m->unitSectors);
+      append_double(line, "done", (double)sample.sectors/(double)(m->total*m->unitSectors));
+   }
+   append_double(line, "sectors_per_s", (sample.sectors-stats->lastSectors)/interval);
+   append_double(line, "mib_per_s", (sample.sectors-stats->lastSectors)/(512.0*interval));
+   append_double(line, "read_mib_per_s", (read-stats->lastRead)/(1048576.0*interval));
+   append_double(line, "write_mib_per_s", (written-stats->lastWritten)/(1048576.0*interval));
+   g_string_append_printf(line, ",\"errors\":%" PRId64, sample.errors);
+   g_string_append_printf(line, ",\"cpu_bound\":%d,\"io_bound\":%d",
+			  g_atomic_int_get(&m->cpuBound), g_atomic_int_get(&m->ioBound));
+   append_double(line, "cpu_s", cpu - m->startCpu);
+   append_double(line, "cpu_load", (cpu - stats->lastCpu)/interval);
+   if(memory >= 0)
+     append_double(line, "rss_mib", memory/1048576.0);
+
+   /* Utilisation of the threads: the share of the time not spent
+      waiting for other threads. */
+
+   g_string_append(line, ",\"threads\":[");
+   for(i=0; i<m->nSlots; i++)
+   {  double wait = g_atomic_int_get(&m->slot[i].waitTime)/1000.0;
+      double busy = sample.elapsed > 0.0 ? 1.0 - wait/sample.elapsed : 1.0;
+      char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+      g_string_append_printf(line, "%s{\"sectors\":%" PRId64, i ? "," : "",
+			     (gint64)g_atomic_int_get(&m->slot[i].sectors)*m->unitSectors);
+      append_double(line, "wait_s", wait);
+      g_string_append_printf(line, ",\"busy\":%s}",
+			     g_ascii_formatd(buf, G_ASCII_DTOSTR_BUF_SIZE, "%.3f", MAX(busy, 0.0)));
+   }
+   g_string_append_c(line, ']');
+
+   write_line(line);
+
+   stats->lastElapsed = sample.elapsed;
+   stats->lastSectors = sample.sectors;
+   stats->lastRead    = read;
+   stats->lastWritten = written;
+   stats->lastCpu     = cpu;
+}
+
+static void write_summary(Metrics *m)
+{
+   if(!stats)
+     return;
+
+   g_mutex_lock(&stats->lock);
+   write_record(m, "summary", TRUE);
+   g_mutex_unlock(&stats->lock);
+}
+
+static gpointer stats_json_thread(gpointer data)
+{
+   g_mutex_lock(&stats->lock);
+   while(!stats->stop)
+   {  gint64 timeout = g_get_monotonic_time() + STATS_JSON_INTERVAL*G_TIME_SPAN_MILLISECOND;
+
+      if(g_cond_wait_until(&stats->cond, &stats->lock, timeout) || stats->stop)
+	continue;
+
+      /* Keep the running action from freeing its metrics meanwhile.
+	 Taking currentLock first avoids a deadlock with FreeMetrics(). */
+
+      g_mutex_unlock(&stats->lock);
+      g_mutex_lock(&currentLock);
+      g_mutex_lock(&stats->lock);
+      if(Closure->metrics && !stats->stop)
+	write_record(Closure->metrics, "progress", FALSE);
+      g_mutex_unlock(&currentLock);
+   }
+   g_mutex_unlock(&stats->lock);
+
+   return NULL;
+}
+
+void OpenStatsJson(char *path)
+{  FILE *file = portable_fopen(path, "a");
+
+   if(!file)
+     Stop(_("Could not open %s: %s"), path, strerror(errno));
+
+   stats = g_malloc0(sizeof(stats_json));
+   stats->file = file;
+   g_mutex_init(&stats->lock);
+   g_cond_init(&stats->cond);
+   stats->thread = CreateGThread(stats_json_thread, NULL);
+}
+
+/*
+ * Record why we had to stop (called from Stop())
+ */
+
+void StatsJsonError(char *msg)
+{  GString *line;
+
+   if(!stats)
+     return;
+
+   g_mutex_lock(&stats->lock);
+   line = start_record("error");
+   append_string(line, "message", msg);
+   write_line(line);
+   g_mutex_unlock(&stats->lock);
+}
+
+void CloseStatsJson(void)
+{
+   if(!stats)
+     return;
+
+   g_mutex_lock(&stats->lock);
+   stats->stop = TRUE;
+   g_cond_signal(&stats->cond);
+   g_mutex_unlock(&stats->lock);
+   g_thread_join(stats->thread);
+
+   fclose(stats->file);
+   g_mutex_clear(&stats->lock);
+   g_cond_clear(&stats->cond);
+   g_free(stats);
+   stats = NULL;
+}
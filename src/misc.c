@@ -212,7 +212,7 @@ void CalcSectors(guint64 size, guint64 *sectors, int *in_last)
 static void print_greetings(FILE *where)
 {  static int greetings_shown;
    
-   if(greetings_shown) return;
+   if(greetings_shown || Closure->logProc) return;
 
    greetings_shown = 1;
    g_fprintf(where, "%s\n%s\n", Closure->versionString,
@@ -228,6 +228,26 @@ static void print_greetings(FILE *where)
 		      "See the file \"COPYING\" for further information.\n"));
 }
 
+/*
+ * Print to stdout, or hand the text to the application
+ * which runs us as a library (see library.c).
+ */
+
+static void print_stdout(char *format, va_list argp)
+{
+   if(Closure->logProc)
+   {  char *msg = g_strdup_vprintf(format, argp);
+
+      Closure->logProc(msg, Closure->logData);
+      g_free(msg);
+      return;
+   }
+
+   g_vprintf(format, argp);
+
+   fflush(stdout);
+}
+
 /*
  * Print to stdout if run from the command line;
  * do nothing in GUI mode unless Closure->verbose is set.
@@ -252,10 +272,8 @@ void PrintCLI(char *format, ...)
    }
 
    va_start(argp, format);
-   g_vprintf(format, argp);
+   print_stdout(format, argp);
    va_end(argp);
-
-   fflush(stdout);
 }
 
 /*
@@ -270,7 +288,7 @@ void PrintProgress(char *format, ...)
    va_list argp;
    int n;
 
-   if(Closure->guiMode)
+   if(Closure->guiMode || Closure->logProc)
      return;
   
    print_greetings(stdout);
@@ -309,7 +327,7 @@ void PrintProgress(char *format, ...)
 void ClearProgress(void)
 {  int n = Closure->progressLength;
 
-   if(Closure->noProgress)
+   if(Closure->noProgress || Closure->logProc)
      return;
   
    g_mutex_lock(&Closure->progressLock);
@@ -338,11 +356,8 @@ void PrintLog(char *format, ...)
    if(Closure->guiMode)
       log_window_vprintf(format, argp);
    else 
-   {
-      print_greetings(stdout);
-      g_vprintf(format, argp);
-
-      fflush(stdout);
+   {  print_greetings(stdout);
+      print_stdout(format, argp);
    }
 
    va_end(argp);
@@ -387,11 +402,8 @@ void PrintLogWithAsterisks(char *format, ...)
    if(Closure->guiMode)
       log_window_vprintf(new_format, argp);
    else 
-   {
-      print_greetings(stdout);
-      g_vprintf(new_format, argp);
-
-      fflush(stdout);
+   {  print_greetings(stdout);
+      print_stdout(new_format, argp);
    }
 
    va_end(argp);
@@ -419,11 +431,8 @@ void Verbose(char *format, ...)
    if(Closure->guiMode)
       log_window_vprintf(format, argp);
    else 
-   {
-      print_greetings(stdout);
-      g_vprintf(format, argp);
-
-      fflush(stdout);
+   {  print_greetings(stdout);
+      print_stdout(format, argp);
    }
 
    va_end(argp);
@@ -454,6 +463,9 @@ void PrintTimeToLog(GTimer *timer, char *format, ...)
    { 
       log_window_append(tmp2);
    }
+   else if(Closure->logProc)
+   {  Closure->logProc(tmp2, Closure->logData);
+   }
    else
    {  g_printf("%s", tmp2);
 
@@ -602,6 +614,7 @@ void LogWarning(char *format, ...)
 
 void Stop(char *format, ...)
 {  va_list argp;
+   int trapped = Closure->stopTrap && g_thread_self() == Closure->stopThread;
 
    /*** Show message depending on commandline / GUI mode  */ 
 
@@ -612,9 +625,18 @@ void Stop(char *format, ...)
       va_end(argp);
    }
 
+   /*** Library mode: keep the message for the caller */
+
+   if(trapped)
+   {  g_free(Closure->stopMessage);
+      va_start(argp, format);
+      Closure->stopMessage = g_strdup_vprintf(format, argp);
+      va_end(argp);
+   }
+
    /*** CLI mode */
    
-   if(!Closure->guiMode) 
+   else if(!Closure->guiMode) 
    {  print_greetings(stdout);
       g_printf("%s", _("\n*\n* dvdisaster - can not continue:\n*\n"));
       va_start(argp, format);
@@ -672,6 +694,16 @@ void Stop(char *format, ...)
    if(Closure->cleanupProc)
      Closure->cleanupProc(Closure->cleanupData);
 
+   if(Closure->statsJson)
+   {  char *msg;
+
+      va_start(argp, format);
+      msg = g_strdup_vprintf(format, argp);
+      va_end(argp);
+      StatsJsonError(msg);
+      g_free(msg);
+   }
+
    /* Safety check; this indicates broken code.
       Concurrent threads should have been terminated by the
       cleanup above. */
@@ -683,6 +715,11 @@ void Stop(char *format, ...)
 	printf("*\n* Warning: unterminated sub thread in Stop()\n*\n");
    }
 
+   /* Return into the library call which failed */
+
+   if(trapped)
+     longjmp(*Closure->stopTrap, 1);
+
    /* see above: possibly unreachable in GUI mode! */
 
    if(!Closure->guiMode)
@@ -737,6 +774,27 @@ GThread* CreateGThread(GThreadFunc f, gpointer data)
    return t;
 }
 
+/*
+ * Run func(data) on n threads, the calling thread being one of them,
+ * and wait until all of them have returned. The workers are expected
+ * to fetch their work items from data by themselves.
+ */
+
+void RunWorkerThreads(int n, GThreadFunc func, gpointer data)
+{  GThread *thread[MAX_CODEC_THREADS];
+   int i;
+
+   if(n > MAX_CODEC_THREADS) n = MAX_CODEC_THREADS;
+
+   for(i=1; i<n; i++)
+     thread[i] = CreateGThread(func, data);
+
+   func(data);
+
+   for(i=1; i<n; i++)
+     g_thread_join(thread[i]);
+}
+
 
 /*
  * --strip method and associated cleanup func
@@ -0,0 +1,182 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*** src type: no GUI code ***/
+
+#include "dvdisaster.h"
+
+/***
+ *** Distributing the codec threads over CPUs and NUMA nodes.
+ ***
+ * Codec thread n is placed on node n % nNodes, so that the threads
+ * are spread evenly over the nodes. Buffers which are allocated and
+ * first written by a placed thread will then be backed by memory
+ * local to its node.
+ */
+
+void FreeCodecPlacement(CodecPlacement *cp)
+{
+   if(!cp) return;
+
+   if(cp->cpu) g_free(cp->cpu);
+   g_free(cp);
+}
+
+#if defined(SYS_LINUX)
+
+#include <sched.h>
+
+/*
+ * Parse a sysfs cpu list such as "0-7,16-23" and add all cpus
+ * which we are allowed to run on to the placement table.
+ */
+
+static void add_cpu_list(CodecPlacement *cp, char *list, cpu_set_t *allowed, cpu_set_t *seen)
+{  char *c = list;
+
+   while(*c)
+   {  int first, last, i;
+
+      if(!isdigit((unsigned char)*c))
+      {  c++;
+	 continue;
+      }
+
+      first = last = strtol(c, &c, 10);
+      if(*c == '-')
+	last = strtol(c+1, &c, 10);
+
+      for(i=first; i<=last && i<CPU_SETSIZE; i++)
+	if(CPU_ISSET(i, allowed) && !CPU_ISSET(i, seen))
+	{  CPU_SET(i, seen);
+	   cp->cpu[cp->nCpus++] = i;
+	}
+   }
+}
+
+CodecPlacement* CreateCodecPlacement(void)
+{  CodecPlacement *cp = g_malloc0(sizeof(CodecPlacement));
+   cpu_set_t allowed, seen;
+   int node,i;
+
+   CPU_ZERO(&allowed);
+   CPU_ZERO(&seen);
+   if(sched_getaffinity(0, sizeof(cpu_set_t), &allowed))
+   {  for(i=0; i<sysconf(_SC_NPROCESSORS_ONLN) && i<CPU_SETSIZE; i++)
+	 CPU_SET(i, &allowed);
+   }
+
+   cp->cpu = g_malloc(CPU_SETSIZE*sizeof(int));
+
+   /* Collect the cpus node by node. Node numbers may have holes,
+      and nodes without usable cpus (e.g. memory only nodes)
+      are skipped. */
+
+   for(node=0; node<MAX_NUMA_NODES; node++)
+   {  char path[80], list[1024];
+      FILE *file;
+      int first = cp->nCpus;
+
+      sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+      file = fopen(path, "r");
+      if(!file) continue;
+
+      if(fgets(list, sizeof(list), file))
+	add_cpu_list(cp, list, &allowed, &seen);
+      fclose(file);
+
+      if(cp->nCpus > first)
+      {  cp->nodeFirst[cp->nNodes] = first;
+	 cp->nodeCpus[cp->nNodes]  = cp->nCpus - first;
+	 cp->nodeId[cp->nNodes]    = node;
+	 cp->nNodes++;
+      }
+   }
+
+   /* No NUMA information in sysfs: treat the machine as a single node.
+      Cpus not listed under any node are not used for placement. */
+
+   if(!cp->nNodes)
+   {  for(i=0; i<CPU_SETSIZE; i++)
+	if(CPU_ISSET(i, &allowed))
+	  cp->cpu[cp->nCpus++] = i;
+
+      if(cp->nCpus)
+      {  cp->nodeFirst[0] = 0;
+	 cp->nodeCpus[0]  = cp->nCpus;
+	 cp->nodeId[0]    = 0;
+	 cp->nNodes = 1;
+      }
+   }
+
+   return cp;
+}
+
+/*
+ * Bind the calling thread according to the placement strategy.
+ * Returns the index of the node the thread was placed on,
+ * or -1 if the thread could not be placed.
+ */
+
+int PlaceCodecThread(CodecPlacement *cp, int strategy, int thread)
+{  cpu_set_t mask;
+   int node,i;
+
+   if(!cp || !cp->nNodes || strategy == PLACEMENT_NONE)
+     return -1;
+
+   node = thread % cp->nNodes;
+   CPU_ZERO(&mask);
+
+   if(strategy == PLACEMENT_CPU)
+   {  i = (thread / cp->nNodes) % cp->nodeCpus[node];
+      CPU_SET(cp->cpu[cp->nodeFirst[node]+i], &mask);
+   }
+   else
+   {  for(i=0; i<cp->nodeCpus[node]; i++)
+	CPU_SET(cp->cpu[cp->nodeFirst[node]+i], &mask);
+   }
+
+   if(sched_setaffinity(0, sizeof(cpu_set_t), &mask))
+     return -1;
+
+   return node;
+}
+
+#else /* SYS_FREEBSD, SYS_MINGW and others */
+
+/* Thread placement is not implemented on these systems yet;
+   all codec threads are treated as running on a single node. */
+
+CodecPlacement* CreateCodecPlacement(void)
+{  CodecPlacement *cp = g_malloc0(sizeof(CodecPlacement));
+
+   cp->nNodes = 1;
+   return cp;
+}
+
+int PlaceCodecThread(CodecPlacement *cp, int strategy, int thread)
+{
+   return -1;
+}
+
+#endif
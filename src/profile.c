@@ -0,0 +1,173 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*** src type: no GUI code ***/
+
+/*** src type: no GUI code ***/
+
+#include "dvdisaster.h"
+
+/***
+ *** Tracing of code spans (--profile).
+ ***
+ * Instrumented code brackets interesting spans like reading a chunk
+ * or decoding an ecc block with ProfileBegin() and ProfileEnd().
+ * Each thread records its events into a ring buffer of its own,
+ * so recording takes no locks; when a buffer overflows the oldest
+ * events are overwritten.
+ * At exit the buffers are written out in the Chrome trace event format,
+ * which can be viewed in chrome://tracing or https://ui.perfetto.dev.
+ */
+
+#define PROFILE_EVENTS 65536   /* per thread, must be a power of two */
+
+typedef struct
+{  gint64 time;                /* microseconds since OpenProfile() */
+   char *name;                 /* must be a string constant */
+   char phase;                 /* 'B'egin or 'E'nd */
+} profile_event;
+
+typedef struct _profile_buffer
+{  struct _profile_buffer *next;
+   int tid;
+   guint64 count;              /* events recorded, including overwritten ones */
+   profile_event event[PROFILE_EVENTS];
+} profile_buffer;
+
+static GPrivate thread_buffer = G_PRIVATE_INIT(NULL);
+static GMutex buffer_lock;
+static profile_buffer *buffers;
+static int n_buffers;
+static FILE *profile_file;
+static gint64 start_time;
+
+/*
+ * Record an event into the buffer of the calling thread.
+ * The buffer is created upon the first event of each thread
+ * and kept until exit so that the events survive the thread.
+ */
+
+static void record(char *name, char phase)
+{  profile_buffer *pb;
+   profile_event *ev;
+
+   if(!profile_file)
+     return;
+
+   pb = g_private_get(&thread_buffer);
+   if(!pb)
+   {  pb = g_malloc0(sizeof(profile_buffer));
+      g_private_set(&thread_buffer, pb);
+
+      g_mutex_lock(&buffer_lock);
+      pb->tid  = ++n_buffers;
+      pb->next = buffers;
+      buffers  = pb;
+      g_mutex_unlock(&buffer_lock);
+   }
+
+   ev = &pb->event[pb->count & (PROFILE_EVENTS-1)];
+   ev->time  = g_get_monotonic_time() - start_time;
+   ev->name  = name;
+   ev->phase = phase;
+   pb->count++;
+}
+
+void ProfileBegin(char *name)
+{  record(name, 'B');
+}
+
+void ProfileEnd(char *name)
+{  record(name, 'E');
+}
+
+/*
+ * The file is opened right away so that a bad path
+ * is reported before any work is done.
+ */
+
+void OpenProfile(char *path)
+{  profile_file = portable_fopen(path, "w");
+
+   if(!profile_file)
+     Stop(_("Could not open %s: %s"), path, strerror(errno));
+
+   g_mutex_init(&buffer_lock);
+   start_time = g_get_monotonic_time();
+}
+
+/*
+ * Write all events and release the buffers.
+ * Must only be called after the worker threads have terminated.
+ */
+
+static void write_buffer(profile_buffer *pb, int *first)
+{  guint64 i = 0;
+   int depth = 0;
+
+   /* Skip over events which have been overwritten */
+
+   if(pb->count > PROFILE_EVENTS)
+     i = pb->count - PROFILE_EVENTS;
+
+   for(; i<pb->count; i++)
+   {  profile_event *ev = &pb->event[i & (PROFILE_EVENTS-1)];
+
+      /* After a wrap around the begin of a span may be lost */
+
+      if(ev->phase == 'E')
+      {  if(!depth) continue;
+	 depth--;
+      }
+      else depth++;
+
+      fprintf(profile_file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRId64 ",\"pid\":1,\"tid\":%d}",
+	      *first ? "" : ",", ev->name, ev->phase, ev->time, pb->tid);
+      *first = FALSE;
+   }
+}
+
+void CloseProfile(void)
+{  profile_buffer *pb;
+   int first = TRUE;
+
+   if(!profile_file)
+     return;
+
+   fprintf(profile_file, "{\"traceEvents\":[");
+
+   for(pb = buffers; pb; pb = pb->next)
+     write_buffer(pb, &first);
+
+   fprintf(profile_file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+   if(fclose(profile_file))
+     PrintLog(_("Error writing %s: %s\n"), Closure->profileFile, strerror(errno));
+   profile_file = NULL;
+
+   while(buffers)
+   {  pb = buffers->next;
+      g_free(buffers);
+      buffers = pb;
+   }
+   g_mutex_clear(&buffer_lock);
+}
@@ -254,22 +254,11 @@ static void calculate_failures(raw_editor_context *rec)
 
    for(s=0; s<n_samples; s++)
    {  unsigned char *buf = rec->rb->rawBuf[s];
-      unsigned char vector[Q_VECTOR_SIZE];
-      int eras[2];
-      int p,defective_p = 0;
-      int q,defective_q = 0;
-
-      for(p=0; p<N_P_VECTORS; p++)
-      {  GetPVector(buf, vector, p);
-	 if(DecodePQ(rec->rb->rt, vector, P_PADDING, eras, 0) != 0)
-	    defective_p++;
-      }
+      int results[N_P_VECTORS];
+      int defective_p, defective_q;
 
-      for(q=0; q<N_Q_VECTORS; q++)
-      {  GetQVector(buf, vector, q);
-	 if(DecodePQ(rec->rb->rt, vector, Q_PADDING, eras, 0) != 0)
-	    defective_q++;
-      }
+      defective_p = DecodePVectors(rec->rb->rt, buf, results, NULL, NULL);
+      defective_q = DecodeQVectors(rec->rb->rt, buf, results, NULL, NULL);
 
       rec->rbInfo[s].rawSector = rec->rb->rawBuf[s];
       rec->rbInfo[s].sectorIndex = s;
@@ -494,37 +483,36 @@ enum
 static void evaluate_vectors(raw_editor_context *rec)
 {  RawBuffer *rb = rec->rb;
    unsigned char *buf = rb->recovered;
-   unsigned char p_vector[P_VECTOR_SIZE];
-   unsigned char q_vector[Q_VECTOR_SIZE];
-   int eras[2];
+   int results[N_P_VECTORS];
+   int position[N_P_VECTORS];
    int p,q,state;
 
    memset(rb->byteState, 0, 2352);
 
    rec->p1 = rec->p2 = 0;
+   DecodePVectors(rb->rt, buf, results, position, NULL);
    for(p=0; p<N_P_VECTORS; p++)
-   {  GetPVector(buf, p_vector, p);
-      switch(DecodePQ(rb->rt, p_vector, P_PADDING, eras, 0))
+   {  switch(results[p])
       {  case 0:  state = 0; break;
 	 case 1:  state = P1_ERROR; rec->p1++; break;
 	 default: state = P2_ERROR; rec->p2++; break;
       }
       FillPVector(rb->byteState, state, p); 
       if(state == P1_ERROR)
-	 rb->byteState[PToByteIndex(p, eras[0])] |= P1_CPOS;
+	 rb->byteState[PToByteIndex(p, position[p])] |= P1_CPOS;
    }
 
    rec->q1 = rec->q2 = 0;
+   DecodeQVectors(rb->rt, buf, results, position, NULL);
    for(q=0; q<N_Q_VECTORS; q++)
-   {  GetQVector(buf, q_vector, q);
-      switch(DecodePQ(rb->rt, q_vector, Q_PADDING, eras, 0))
+   {  switch(results[q])
       {  case 0:  state = 0; break;
 	 case 1:  state = Q1_ERROR; rec->q1++; break;
 	 default: state = Q2_ERROR; rec->q2++; break;
       }
       OrQVector(rb->byteState, state, q); 
       if(state == Q1_ERROR)
-	 rb->byteState[QToByteIndex(q, eras[0])] |= Q1_CPOS;
+	 rb->byteState[QToByteIndex(q, position[q])] |= Q1_CPOS;
    }
 
    if(   CheckEDC(rb->recovered, rb->xaMode) 
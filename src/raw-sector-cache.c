@@ -24,46 +24,24 @@
 
 #include "dvdisaster.h"
 
-/*
- * Write the raw dump header
- */
-
-static void init_defective_sector_file(char *path, RawBuffer *rb, LargeFile **file, DefectiveSectorHeader *dsh)
-{   int n;
-
-    *file = LargeOpen(path, O_RDWR | O_CREAT, IMG_PERMS);
-
-    if(!*file)
-       Stop(_("Could not open %s: %s"), path, strerror(errno));
-
-    memset(dsh, 0, sizeof(DefectiveSectorHeader));
-    dsh->lba        = rb->lba;
-    dsh->sectorSize = CD_RAW_DUMP_SIZE;
-
-    if(rb->xaMode)
-       dsh->properties |= DSH_XA_MODE;
-
-    if(rb->validFP)
-    {  memcpy(dsh->mediumFP, rb->mediumFP, 16);
-       dsh->properties |= DSH_HAS_FINGERPRINT;
-    }
-
-#ifdef HAVE_BIG_ENDIAN
-    SwapDefectiveHeaderBytes(dsh);
+#ifdef HAVE_MMAP
+  #include <sys/mman.h>
 #endif
 
-    n = LargeWrite(*file, dsh, sizeof(DefectiveSectorHeader));
-
-#ifdef HAVE_BIG_ENDIAN
-    SwapDefectiveHeaderBytes(dsh);
-#endif
+/***
+ *** Per-sector dump files
+ ***/
 
-    if(n != sizeof(DefectiveSectorHeader))
-       Stop(_("Failed writing to defective sector file: %s"), strerror(errno));
-}
+/*
+ * Older versions kept one dump file per defective sector.
+ * These are still read by the raw editor, and imported into
+ * the sector cache below when the respective sector is read again.
+ */
 
 /*
- * Open raw dump, read the header
+ * Open raw dump, read the header.
+ * Cache files are recognized by their header format;
+ * their contents are left to the cache functions.
  */
 
 static void open_defective_sector_file(RawBuffer *rb, char *path, LargeFile **file, 
@@ -85,6 +63,9 @@ static void open_defective_sector_file(RawBuffer *rb, char *path, LargeFile **fi
     SwapDefectiveHeaderBytes(dsh);
 #endif
 
+    if(dsh->dshFormat == DSH_FORMAT_CACHE)
+       return;
+
     dsh->nSectors = (length-sizeof(DefectiveSectorHeader))/dsh->sectorSize;
     if((guint64)dsh->nSectors*dsh->sectorSize+sizeof(DefectiveSectorHeader) != length)
        Stop(_("Defective sector file is truncated"));
@@ -173,192 +154,766 @@ static void open_defective_sector_file(RawBuffer *rb, char *path, LargeFile **fi
 }
 
 /*
- * Append RawBuffer contents to defective sector dump
+ * Read all samples of a per-sector dump file into memory.
+ * Returns the number of samples, or -1 if there is no such file.
  */
 
-int SaveDefectiveSector(RawBuffer *rb, int can_c2_scan)
+static int read_sector_file(RawBuffer *rb, char *path, DefectiveSectorHeader *dsh,
+			    unsigned char **samples)
 {  LargeFile *file;
-   DefectiveSectorHeader *dsh = alloca(sizeof(DefectiveSectorHeader));
-   unsigned char *cache_sectors = NULL;
-   char *filename;
-   guint64 length,offset;
-   int count=0;
-   int i,j,idx;
+   int i;
 
-   if(!rb->samplesRead) 
-     return 0;  /* Nothing to be done */
+   open_defective_sector_file(rb, path, &file, dsh);
+   if(!file) return -1;
 
-   /* Open cache file */
+   if(dsh->dshFormat == DSH_FORMAT_CACHE)
+   {  LargeClose(file);
+      return -1;
+   }
 
-   filename = g_strdup_printf("%s/%s%lld.raw", 
-			      Closure->dDumpDir, Closure->dDumpPrefix, 
-			      (long long)rb->lba);
+   *samples = g_malloc((gsize)dsh->sectorSize*MAX(1, dsh->nSectors));
+   for(i=0; i<dsh->nSectors; i++)
+   {  int n=LargeRead(file, *samples+(gsize)i*dsh->sectorSize, dsh->sectorSize);
 
-   if(!LargeStat(filename, &length))
-   {  PrintCLIorLabel(Closure->status,_(" [Creating new cache file %s]\n"), filename);
-      init_defective_sector_file(filename, rb, &file, dsh);
+      if(n != dsh->sectorSize)
+	 Stop(_("Failed reading from defective sector file: %s"), strerror(errno));
    }
-   else 
-   {  open_defective_sector_file(rb, filename, &file, dsh);
-      if(!file)
-	 Stop(_("Could not open %s: %s"), filename, strerror(errno));
+
+   LargeClose(file);
+   return dsh->nSectors;
+}
+
+/***
+ *** The defective sector cache
+ ***/
+
+/*
+ * All raw samples of defective sectors are appended to a single
+ * cache file <dDumpDir>/<dDumpPrefix>cache.raw. Each sample is preceded
+ * by a DefectiveSectorRecord holding its LBA and a hash of its contents.
+ * The records are indexed in memory when the cache is opened, so that
+ * a new sample can be checked against the cache without reading back
+ * the cached samples of its sector; only samples with matching hashes
+ * are compared byte by byte.
+ * A record which was only partially written (e.g. when dvdisaster
+ * was interrupted) is ignored and overwritten by the next sample.
+ */
+
+typedef struct
+{  gint64 lba;
+   guint64 hash;
+   guint64 offset;            /* of the sample in the cache file */
+   gint32 properties;         /* DSH_XA_MODE */
+   int next;                  /* next sample of the same sector, or -1 */
+} cache_entry;
+
+typedef struct
+{  gint64 lba;
+   int first, last;           /* first and last sample of this sector */
+   int count;                 /* number of samples; 0 marks a free slot */
+} cache_sector;
+
+typedef struct
+{  char *path;
+   LargeFile *file;
+   DefectiveSectorHeader dsh;
+   guint64 fileSize;          /* end of the last complete record */
+
+   cache_entry *entry;        /* all samples in file order */
+   int nEntries, maxEntries;
+
+   int *sampleIndex;          /* hashed by lba and contents -> entry */
+   int sampleSlots;
+
+   cache_sector *sector;      /* hashed by lba */
+   int sectorSlots, nSectors;
+
+#ifdef HAVE_MMAP
+   unsigned char *map;
+   guint64 mapSize;
+#endif
+} sector_cache;
+
+/* The cache is shared by all readers of this process. Stop() does
+   not return, so make sure to release the cache before calling it. */
+
+static sector_cache *cache;
+static GMutex cache_lock;
+
+static void free_cache(sector_cache*);
+
+#define StopCache(...) \
+   do { char *msg = g_strdup_printf(__VA_ARGS__); \
+        free_cache(cache); cache = NULL; \
+        g_mutex_unlock(&cache_lock); \
+        Stop("%s", msg); \
+   } while(0)
+
+#define RECORD_SIZE(dsc) ((guint64)sizeof(DefectiveSectorRecord)+(dsc)->dsh.sectorSize)
+
+/*
+ * Hash of a sample without its last byte, which is used as C2 flag
+ * and therefore not part of the sample contents (see below).
+ * Words are taken in little endian order so that cache files
+ * can be moved between machines.
+ */
+
+static guint64 hash_sample(unsigned char *buf, int len)
+{  guint64 h = 0x9e3779b97f4a7c15ULL ^ (guint64)len;
+   int i;
+
+   for(i=0; i+8<=len; i+=8)
+   {  guint64 word;
+
+      memcpy(&word, buf+i, 8);
+#ifdef HAVE_BIG_ENDIAN
+      word = SwapBytes64(word);
+#endif
+      h = (h ^ word) * 0xff51afd7ed558ccdULL;
+      h ^= h >> 32;
    }
 
-   /* Read already cached sectors */
+   for(; i<len; i++)
+      h = (h ^ buf[i]) * 0x100000001b3ULL;
 
-   if(dsh->nSectors > 0)
-   {  if(!LargeSeek(file, sizeof(DefectiveSectorHeader)))
-	 Stop(_("Failed seeking in defective sector file: %s"), strerror(errno));
+   h ^= h >> 29;
+   h *= 0xc4ceb9fe1a85ec53ULL;
+   h ^= h >> 32;
 
-      cache_sectors = g_malloc((gsize)dsh->sectorSize*dsh->nSectors);
-      for(i=0, idx=0; i<dsh->nSectors; i++, idx+=dsh->sectorSize)
-      {  int n=LargeRead(file, cache_sectors+idx, dsh->sectorSize);
-	 
-	 if(n != dsh->sectorSize)
-	    Stop(_("Failed reading from defective sector file: %s"), strerror(errno));
-      }
+   return h;
+}
+
+static inline guint64 slot_hash(gint64 lba, guint64 hash)
+{  guint64 h = hash ^ ((guint64)lba * 0x9e3779b97f4a7c15ULL);
+
+   return h ^ (h >> 31);
+}
+
+/*
+ * Index maintenance. Both tables use open addressing with linear
+ * probing and are kept at most half full.
+ */
+
+static void index_sample(sector_cache *dsc, int e)
+{  int mask = dsc->sampleSlots-1;
+   int slot = slot_hash(dsc->entry[e].lba, dsc->entry[e].hash) & mask;
+
+   while(dsc->sampleIndex[slot] >= 0)
+      slot = (slot+1) & mask;
+
+   dsc->sampleIndex[slot] = e;
+}
+
+static void grow_sample_index(sector_cache *dsc)
+{  int i;
+
+   g_free(dsc->sampleIndex);
+   dsc->sampleSlots = dsc->sampleSlots ? 2*dsc->sampleSlots : 1024;
+   dsc->sampleIndex = g_malloc(dsc->sampleSlots*sizeof(int));
+   for(i=0; i<dsc->sampleSlots; i++)
+      dsc->sampleIndex[i] = -1;
+
+   for(i=0; i<dsc->nEntries; i++)
+      index_sample(dsc, i);
+}
+
+static cache_sector* lookup_sector(sector_cache *dsc, gint64 lba)
+{  int mask = dsc->sectorSlots-1;
+   int slot;
+
+   if(!dsc->sectorSlots)
+      return NULL;
+
+   slot = slot_hash(lba, 0) & mask;
+   while(dsc->sector[slot].count)
+   {  if(dsc->sector[slot].lba == lba)
+	 return &dsc->sector[slot];
+      slot = (slot+1) & mask;
    }
 
-   /* Store sectors which are not already cached */
-   
-   offset = sizeof(DefectiveSectorHeader) + (guint64)dsh->sectorSize*dsh->nSectors;
-   if(!LargeSeek(file, offset))
-      Stop(_("Failed seeking in defective sector file: %s"), strerror(errno));
+   return NULL;
+}
 
-   for(i=0; i<rb->samplesRead; i++)
-   {  int new_sector = TRUE;
+static cache_sector* insert_sector(sector_cache *dsc, gint64 lba)
+{  int mask = dsc->sectorSlots-1;
+   int slot = slot_hash(lba, 0) & mask;
 
-      /* See comment below on C2 mask field to understand rb->sampleSize-1 */
+   while(dsc->sector[slot].count)
+      slot = (slot+1) & mask;
 
-      if(cache_sectors)  /* Sector already in cache? */
-      {  
-	 for(j=0, idx=0; j<dsh->nSectors; j++, idx+=dsh->sectorSize) 
-	 {  if(!memcmp(rb->rawBuf[i], cache_sectors+idx, rb->sampleSize-1))
-	    {  new_sector = FALSE;
-	       break;
-	    }
-	 }
-      }
+   dsc->sector[slot].lba = lba;
+   dsc->nSectors++;
+   return &dsc->sector[slot];
+}
 
-      for(j=0; j<i; j++) /* Some drives return cached data after first read */
-      {  if(!memcmp(rb->rawBuf[i], rb->rawBuf[j], rb->sampleSize-1))
-	 {  new_sector = FALSE;
-	    break;
-	 }
+static void grow_sector_index(sector_cache *dsc)
+{  cache_sector *old = dsc->sector;
+   int old_slots = dsc->sectorSlots;
+   int i;
+
+   dsc->sectorSlots = old_slots ? 2*old_slots : 256;
+   dsc->sector = g_malloc0(dsc->sectorSlots*sizeof(cache_sector));
+   dsc->nSectors = 0;
+
+   for(i=0; i<old_slots; i++)
+      if(old[i].count)
+	 *insert_sector(dsc, old[i].lba) = old[i];
+
+   g_free(old);
+}
+
+static void add_entry(sector_cache *dsc, gint64 lba, guint64 hash,
+		      guint64 offset, gint32 properties)
+{  cache_sector *cs;
+   int e;
+
+   if(dsc->nEntries >= dsc->maxEntries)
+   {  dsc->maxEntries = dsc->maxEntries ? 2*dsc->maxEntries : 1024;
+      dsc->entry = g_realloc(dsc->entry, dsc->maxEntries*sizeof(cache_entry));
+   }
+
+   e = dsc->nEntries++;
+   dsc->entry[e].lba        = lba;
+   dsc->entry[e].hash       = hash;
+   dsc->entry[e].offset     = offset;
+   dsc->entry[e].properties = properties;
+   dsc->entry[e].next       = -1;
+
+   if(2*dsc->nEntries > dsc->sampleSlots)
+        grow_sample_index(dsc);
+   else index_sample(dsc, e);
+
+   cs = lookup_sector(dsc, lba);
+   if(!cs)
+   {  if(2*(dsc->nSectors+1) > dsc->sectorSlots)
+	 grow_sector_index(dsc);
+      cs = insert_sector(dsc, lba);
+      cs->first = e;
+   }
+   else dsc->entry[cs->last].next = e;
+
+   cs->last = e;
+   cs->count++;
+}
+
+/*
+ * Access to the cached samples. Reading goes through a read-only
+ * mapping of the cache file where available; samples appended after
+ * the mapping was created are read the conventional way.
+ */
+
+static void map_cache(sector_cache *dsc)
+{
+#ifdef HAVE_MMAP
+   void *map;
+
+   if(dsc->map && dsc->mapSize >= dsc->fileSize)
+      return;
+
+   if(dsc->map)
+      munmap(dsc->map, dsc->mapSize);
+   dsc->map = NULL;
+   dsc->mapSize = 0;
+
+   map = mmap(NULL, dsc->fileSize, PROT_READ, MAP_SHARED, dsc->file->fileHandle, 0);
+   if(map == MAP_FAILED)  /* fall back to reading */
+      return;
+
+   dsc->map = map;
+   dsc->mapSize = dsc->fileSize;
+#endif
+}
+
+static unsigned char* cached_bytes(sector_cache *dsc, guint64 offset, int size,
+				   unsigned char *scratch)
+{
+#ifdef HAVE_MMAP
+   if(dsc->map && offset+size <= dsc->mapSize)
+      return dsc->map + offset;
+#endif
+
+   if(!LargeSeek(dsc->file, offset))
+      StopCache(_("Failed seeking in defective sector file: %s"), strerror(errno));
+
+   if(LargeRead(dsc->file, scratch, size) != size)
+      StopCache(_("Failed reading from defective sector file: %s"), strerror(errno));
+
+   return scratch;
+}
+
+static void copy_cached(sector_cache *dsc, guint64 offset, int size, void *dst)
+{  unsigned char *src = cached_bytes(dsc, offset, size, dst);
+
+   if(src != dst)
+      memcpy(dst, src, size);
+}
+
+/*
+ * See if a sample is already in the cache
+ */
+
+static int is_cached(sector_cache *dsc, gint64 lba, guint64 hash, unsigned char *sample)
+{  unsigned char scratch[dsc->dsh.sectorSize];
+   int mask = dsc->sampleSlots-1;
+   int slot;
+
+   if(!dsc->sampleSlots)
+      return FALSE;
+
+   slot = slot_hash(lba, hash) & mask;
+   while(dsc->sampleIndex[slot] >= 0)
+   {  cache_entry *ce = &dsc->entry[dsc->sampleIndex[slot]];
+
+      if(ce->lba == lba && ce->hash == hash)
+      {  unsigned char *cached = cached_bytes(dsc, ce->offset, dsc->dsh.sectorSize, scratch);
+
+	 if(!memcmp(sample, cached, dsc->dsh.sectorSize-1))
+	    return TRUE;
       }
 
-      if(new_sector)   /* same sector already in cache */
-      {  int n;
+      slot = (slot+1) & mask;
+   }
+
+   return FALSE;
+}
+
+/*
+ * Append a sample to the cache
+ */
 
-        /* The C2 mask field is not used; so we put a flag into it
-	   to mark raw sectors containing C2 error information. */
+static void append_sample(sector_cache *dsc, gint64 lba, gint32 properties,
+			  guint64 hash, unsigned char *sample)
+{  DefectiveSectorRecord dsr;
+   int n;
 
-	 if(can_c2_scan)
-	    rb->rawBuf[i][CD_RAW_DUMP_SIZE-1] = 1;
+   memset(&dsr, 0, sizeof(DefectiveSectorRecord));
+   dsr.lba        = lba;
+   dsr.hash       = hash;
+   dsr.properties = properties;
 
-	 n=LargeWrite(file, rb->rawBuf[i], dsh->sectorSize);
-	 
-	 if(n != dsh->sectorSize)
-	    Stop(_("Failed writing to defective sector file: %s"), strerror(errno));
-	 count++;
+#ifdef HAVE_BIG_ENDIAN
+   SwapDefectiveRecordBytes(&dsr);
+#endif
+
+   if(!LargeSeek(dsc->file, dsc->fileSize))
+      StopCache(_("Failed seeking in defective sector file: %s"), strerror(errno));
+
+   n = LargeWrite(dsc->file, &dsr, sizeof(DefectiveSectorRecord));
+   if(n != sizeof(DefectiveSectorRecord))
+      StopCache(_("Failed writing to defective sector file: %s"), strerror(errno));
+
+   n = LargeWrite(dsc->file, sample, dsc->dsh.sectorSize);
+   if(n != dsc->dsh.sectorSize)
+      StopCache(_("Failed writing to defective sector file: %s"), strerror(errno));
+
+   add_entry(dsc, lba, hash, dsc->fileSize+sizeof(DefectiveSectorRecord), properties);
+   dsc->fileSize += RECORD_SIZE(dsc);
+}
+
+/*
+ * Open the cache file and index its contents
+ */
+
+static void write_cache_header(sector_cache *dsc)
+{  DefectiveSectorHeader dsh = dsc->dsh;
+   int n;
+
+   dsh.nSectors = 0;  /* not maintained in the file */
+
+#ifdef HAVE_BIG_ENDIAN
+   SwapDefectiveHeaderBytes(&dsh);
+#endif
+
+   if(!LargeSeek(dsc->file, 0))
+      StopCache(_("Failed seeking in defective sector file: %s"), strerror(errno));
+
+   n = LargeWrite(dsc->file, &dsh, sizeof(DefectiveSectorHeader));
+   if(n != sizeof(DefectiveSectorHeader))
+      StopCache(_("Failed writing to defective sector file: %s"), strerror(errno));
+}
+
+static void check_fingerprint(sector_cache *dsc, RawBuffer *rb)
+{
+   /* If the cache file has no fingerprint, add it now */
+
+   if(!(dsc->dsh.properties & DSH_HAS_FINGERPRINT) && rb->validFP)
+   {  memcpy(dsc->dsh.mediumFP, rb->mediumFP, 16);
+      dsc->dsh.properties |= DSH_HAS_FINGERPRINT;
+      write_cache_header(dsc);
+   }
+
+   /* Verify cache and medium fingerprint */
+
+   if((dsc->dsh.properties & DSH_HAS_FINGERPRINT) && rb->validFP)
+   {  if(memcmp(dsc->dsh.mediumFP, rb->mediumFP, 16))
+	 StopCache(_("Fingerprints of medium and defective sector cache do not match!"));
+   }
+}
+
+static void index_cache(sector_cache *dsc, guint64 length)
+{  guint64 offset = sizeof(DefectiveSectorHeader);
+
+   dsc->fileSize = length;
+   map_cache(dsc);
+
+   while(offset + RECORD_SIZE(dsc) <= length)
+   {  DefectiveSectorRecord dsr;
+
+      copy_cached(dsc, offset, sizeof(DefectiveSectorRecord), &dsr);
+#ifdef HAVE_BIG_ENDIAN
+      SwapDefectiveRecordBytes(&dsr);
+#endif
+      add_entry(dsc, dsr.lba, dsr.hash, offset+sizeof(DefectiveSectorRecord), dsr.properties);
+      offset += RECORD_SIZE(dsc);
+   }
+
+   dsc->fileSize = offset;
+}
+
+static sector_cache* open_cache(RawBuffer *rb, char *path, int create)
+{  sector_cache *dsc;
+   guint64 length = 0;
+
+   if(!LargeStat(path, &length) && !create)
+      return NULL;
+
+   dsc = g_malloc0(sizeof(sector_cache));
+   dsc->path = g_strdup(path);
+   cache = dsc;  /* so that StopCache() can clean up */
+
+   dsc->file = LargeOpen(path, O_RDWR | O_CREAT, IMG_PERMS);
+   if(!dsc->file)
+      StopCache(_("Could not open %s: %s"), path, strerror(errno));
+
+   if(length < sizeof(DefectiveSectorHeader))
+   {  PrintCLIorLabel(Closure->status,_(" [Creating new cache file %s]\n"), path);
+
+      dsc->dsh.lba        = -1;
+      dsc->dsh.sectorSize = CD_RAW_DUMP_SIZE;
+      dsc->dsh.dshFormat  = DSH_FORMAT_CACHE;
+      write_cache_header(dsc);
+      dsc->fileSize = sizeof(DefectiveSectorHeader);
+   }
+   else
+   {  if(LargeRead(dsc->file, &dsc->dsh, sizeof(DefectiveSectorHeader)) != sizeof(DefectiveSectorHeader))
+	 StopCache(_("Failed reading from defective sector file: %s"), strerror(errno));
+
+#ifdef HAVE_BIG_ENDIAN
+      SwapDefectiveHeaderBytes(&dsc->dsh);
+#endif
+
+      if(dsc->dsh.dshFormat != DSH_FORMAT_CACHE || dsc->dsh.sectorSize != CD_RAW_DUMP_SIZE)
+	 StopCache(_("%s is not a defective sector cache file.\n"), path);
+
+      index_cache(dsc, length);
+   }
+
+   check_fingerprint(dsc, rb);
+
+   return dsc;
+}
+
+static void free_cache(sector_cache *dsc)
+{  if(!dsc) return;
+
+#ifdef HAVE_MMAP
+   if(dsc->map)
+      munmap(dsc->map, dsc->mapSize);
+#endif
+   if(dsc->file)
+      LargeClose(dsc->file);
+
+   g_free(dsc->path);
+   g_free(dsc->entry);
+   g_free(dsc->sampleIndex);
+   g_free(dsc->sector);
+   g_free(dsc);
+}
+
+/*
+ * Get the cache for the given path; must be called with cache_lock held.
+ */
+
+static sector_cache* get_cache(RawBuffer *rb, char *path, int create)
+{
+   if(cache && !strcmp(cache->path, path))
+   {  check_fingerprint(cache, rb);
+      return cache;
+   }
+
+   free_cache(cache);
+   cache = NULL;
+
+   return open_cache(rb, path, create);
+}
+
+void CloseDefectiveSectorCache(void)
+{  g_mutex_lock(&cache_lock);
+   free_cache(cache);
+   cache = NULL;
+   g_mutex_unlock(&cache_lock);
+}
+
+static char* cache_path(void)
+{  return g_strdup_printf("%s/%scache.raw", Closure->dDumpDir, Closure->dDumpPrefix);
+}
+
+/*
+ * Samples of a sector dumped by older versions are moved into the cache
+ * when the sector is visited for the first time. The old file is kept.
+ */
+
+static void import_sector_file(RawBuffer *rb, char *path)
+{  DefectiveSectorHeader dsh;
+   unsigned char *samples = NULL;
+   char *filename;
+   int n_samples,i;
+
+   g_mutex_lock(&cache_lock);
+   if(cache && lookup_sector(cache, rb->lba))
+   {  g_mutex_unlock(&cache_lock);
+      return;
+   }
+   g_mutex_unlock(&cache_lock);
+
+   filename = g_strdup_printf("%s/%s%lld.raw",
+			      Closure->dDumpDir, Closure->dDumpPrefix,
+			      (long long)rb->lba);
+   n_samples = read_sector_file(rb, filename, &dsh, &samples);
+
+   if(n_samples > 0)
+   {  g_mutex_lock(&cache_lock);
+      get_cache(rb, path, TRUE);
+
+      for(i=0; i<n_samples; i++)
+      {  unsigned char *sample = samples + (gsize)i*dsh.sectorSize;
+	 guint64 hash = hash_sample(sample, dsh.sectorSize-1);
+
+	 if(!is_cached(cache, dsh.lba, hash, sample))
+	    append_sample(cache, dsh.lba, dsh.properties & DSH_XA_MODE, hash, sample);
       }
+      g_mutex_unlock(&cache_lock);
+
+      PrintCLIorLabel(Closure->status,
+		      _(" [Imported %d sectors from %s]\n"), n_samples, filename);
    }
 
-   LargeClose(file);
+   g_free(samples);
+   g_free(filename);
+}
+
+/*
+ * Append RawBuffer contents to the defective sector cache
+ */
+
+int SaveDefectiveSector(RawBuffer *rb, int can_c2_scan)
+{  sector_cache *dsc;
+   cache_sector *cs;
+   char *path;
+   int cached;
+   int count=0;
+   int i;
+
+   if(!rb->samplesRead) 
+     return 0;  /* Nothing to be done */
+
+   path = cache_path();
+   import_sector_file(rb, path);
+
+   g_mutex_lock(&cache_lock);
+   dsc = get_cache(rb, path, TRUE);
+
+   cs = lookup_sector(dsc, rb->lba);
+   cached = cs ? cs->count : 0;
+
+   /* Store sectors which are not already cached. Since new samples
+      are indexed right away, this also skips samples repeated within
+      the RawBuffer (some drives return cached data after first read). */
+
+   for(i=0; i<rb->samplesRead; i++)
+   {  guint64 hash;
+
+      /* See comment below on C2 mask field to understand sectorSize-1 */
+
+      hash = hash_sample(rb->rawBuf[i], dsc->dsh.sectorSize-1);
+      if(is_cached(dsc, rb->lba, hash, rb->rawBuf[i]))
+	 continue;
+
+      /* The C2 mask field is not used; so we put a flag into it
+	 to mark raw sectors containing C2 error information. */
+
+      if(can_c2_scan)
+	 rb->rawBuf[i][CD_RAW_DUMP_SIZE-1] = 1;
+
+      append_sample(dsc, rb->lba, rb->xaMode ? DSH_XA_MODE : 0, hash, rb->rawBuf[i]);
+      count++;
+   }
 
    PrintCLIorLabel(Closure->status,
 		   _(" [Appended %d/%d sectors to cache file %s; LBA=%" PRId64 ", ssize=%d, %d sectors]\n"), 
-		   count, rb->samplesRead, filename, dsh->lba, dsh->sectorSize, dsh->nSectors);
+		   count, rb->samplesRead, path, rb->lba, dsc->dsh.sectorSize, cached);
 
-   g_free(filename);
-   if(cache_sectors)
-      g_free(cache_sectors);
+   g_mutex_unlock(&cache_lock);
+   g_free(path);
 
    return count;
 }
 
 /*
- * Read sectors from the defective sector dump,
+ * Read sectors from the defective sector cache,
  * feed them into the raw buffer one by one
  * and retry recovery.
  */
 
 int TryDefectiveSectorCache(RawBuffer *rb, unsigned char *outbuf)
-{  DefectiveSectorHeader dsh;
-   LargeFile *file;
+{  sector_cache *dsc;
+   cache_sector *cs;
+   unsigned char *samples;
    char *path;
+   int sector_size;
    int status;
    int last_sector;
-   int i;
+   int i,e;
+
+   path = cache_path();
+   import_sector_file(rb, path);
 
-   path = g_strdup_printf("%s/%s%lld.raw", 
-			  Closure->dDumpDir, Closure->dDumpPrefix, 
-			  (long long)rb->lba);
-   open_defective_sector_file(rb, path, &file, &dsh);
+   g_mutex_lock(&cache_lock);
+   dsc = get_cache(rb, path, FALSE);
    g_free(path);
 
-   if(!file)   /* No cache file */
+   cs = dsc ? lookup_sector(dsc, rb->lba) : NULL;
+   if(!cs)   /* Sector not cached */
+   {  g_mutex_unlock(&cache_lock);
       return -1;
+   }
 
    /* skip sectors added in current pass */
 
-   last_sector = dsh.nSectors - rb->samplesRead; 
+   last_sector = cs->count - rb->samplesRead; 
+   if(last_sector <= 0)
+   {  g_mutex_unlock(&cache_lock);
+      return -1;
+   }
+
+   ReallocRawBuffer(rb, cs->count);
+
+   /* Copy the samples out of the mapping so that
+      the cache is not blocked during recovery */
 
-   ReallocRawBuffer(rb, dsh.nSectors);
+   sector_size = dsc->dsh.sectorSize;
+   samples = g_malloc((gsize)sector_size*last_sector);
+   map_cache(dsc);
+
+   for(i=0, e=cs->first; i<last_sector; i++, e=dsc->entry[e].next)
+      copy_cached(dsc, dsc->entry[e].offset, sector_size, samples + (gsize)i*sector_size);
+   g_mutex_unlock(&cache_lock);
 
    for(i=0; i<last_sector; i++)
-   {  int n;
-  
-      n = LargeRead(file, rb->workBuf->buf, dsh.sectorSize);
-      if(n != dsh.sectorSize)
-	 Stop(_("Failed reading from defective sector file: %s"), strerror(errno));
+   {  memcpy(rb->workBuf->buf, samples + (gsize)i*sector_size, sector_size);
 
       status = TryCDFrameRecovery(rb, outbuf);
       if(!status) 
       {  PrintCLIorLabel(Closure->status,
 			 " [Success after processing cached sector %d]\n", i+1);
+	 g_free(samples);
 	 return status; 
       }
    }
 
-   LargeClose(file);
-   
+   g_free(samples);
    return -1;
 }
 
 /*
- * Read sectors from the defective sector dump
+ * Read sectors from a defective sector dump.
+ * For a cache file, the sector following the one described by dsh
+ * is loaded, so that opening the cache repeatedly walks through
+ * all cached sectors.
  */
 
+static void read_cached_sector(DefectiveSectorHeader *dsh, RawBuffer *rb, char *path)
+{  sector_cache *dsc;
+   cache_sector *cs = NULL;
+   int previous = dsh->dshFormat == DSH_FORMAT_CACHE;
+   gint64 previous_lba = dsh->lba;
+   int i,e;
+
+   g_mutex_lock(&cache_lock);
+   dsc = get_cache(rb, path, FALSE);
+
+   for(i=0; i<dsc->sectorSlots; i++)
+   {  cache_sector *candidate = &dsc->sector[i];
+
+      if(!candidate->count || (previous && candidate->lba <= previous_lba))
+	 continue;
+      if(!cs || candidate->lba < cs->lba)
+	 cs = candidate;
+   }
+
+   if(!cs && previous)  /* wrap around */
+      for(i=0; i<dsc->sectorSlots; i++)
+	 if(dsc->sector[i].count && (!cs || dsc->sector[i].lba < cs->lba))
+	    cs = &dsc->sector[i];
+
+   if(!cs)
+      StopCache(_("%s does not contain any sectors.\n"), path);
+
+   *dsh = dsc->dsh;
+   dsh->lba = cs->lba;
+   dsh->nSectors = cs->count;
+   if(dsc->entry[cs->first].properties & DSH_XA_MODE)
+      dsh->properties |= DSH_XA_MODE;
+
+   ReallocRawBuffer(rb, cs->count);
+   map_cache(dsc);
+
+   for(i=0, e=cs->first; i<cs->count; i++, e=dsc->entry[e].next)
+      copy_cached(dsc, dsc->entry[e].offset, dsc->dsh.sectorSize, rb->rawBuf[i]);
+   g_mutex_unlock(&cache_lock);
+}
+
 void ReadDefectiveSectorFile(DefectiveSectorHeader *dsh, RawBuffer *rb, char *path)
 {  LargeFile *file;
+   DefectiveSectorHeader peek;
+   int n_samples;
 
-   open_defective_sector_file(rb, path, &file, dsh);
+   open_defective_sector_file(rb, path, &file, &peek);
    if(!file)
    {  Stop(_("Could not open %s: %s"), path, strerror(errno));
       return;
    }
 
+   if(peek.dshFormat == DSH_FORMAT_CACHE)
+   {  LargeClose(file);
+      read_cached_sector(dsh, rb, path);
+      n_samples = dsh->nSectors;
+   }
+   else
+   {  *dsh = peek;
+      ReallocRawBuffer(rb, dsh->nSectors);
+
+      for(n_samples=0; n_samples<dsh->nSectors; n_samples++)
+      {  int n=LargeRead(file, rb->rawBuf[n_samples], dsh->sectorSize);
+
+	 if(n != dsh->sectorSize)
+	 {  Stop(_("Failed reading from defective sector file: %s"), strerror(errno));
+	    return;
+	 }
+      }
+
+      LargeClose(file);
+   }
+
    rb->lba = dsh->lba;
 
    if(dsh->properties & DSH_XA_MODE)
         rb->dataOffset = 24;
    else rb->dataOffset = 16;
 
-   ReallocRawBuffer(rb, dsh->nSectors);
-
-   for(rb->samplesRead=0; rb->samplesRead<dsh->nSectors; )
-   {  int n=LargeRead(file, rb->rawBuf[rb->samplesRead], dsh->sectorSize);
-
-      if(n != dsh->sectorSize)
-      {  Stop(_("Failed reading from defective sector file: %s"), strerror(errno));
-	 return;
-      }
-
-      rb->samplesRead++;
+   for(rb->samplesRead=0; rb->samplesRead<n_samples; )
+   {  rb->samplesRead++;
       UpdateFrameStats(rb);
       CollectGoodVectors(rb);
    }
-
-   LargeClose(file);
 }
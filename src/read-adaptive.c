@@ -281,6 +281,7 @@ typedef struct
    unsigned char *buf;          /* buffer component from above */
    Bitmap *map;                 /* bitmap for keeping track of read sectors */
    CrcBuf *crcBuf;              /* preloaded CRC info from ecc data */
+   ReadJournal *journal;        /* persisted read state for resuming */
 
    unsigned char *fingerprint;  /* needed for missing sector */
    char *volumeLabel;           /* generation */
@@ -309,6 +310,7 @@ typedef struct
    gint64 lastUnreadable;       /* used to find out whether something changed */
    gint64 lastCorrectable;      /* since last progress output */
    char *subtitle;              /* description of reading mode */
+   Metrics *metrics;            /* for --stats-json */
  
    int sectorsPerSegment;       /* number of sectors per spiral segment */
    int *segmentState;           /* tracks whether all sectors within segment are processed */
@@ -370,6 +372,13 @@ static void cleanup(gpointer data)
    }
 
 bail_out:
+   if(rc->journal)
+   {  if(rc->readable >= rc->expectedSectors)
+	RemoveReadJournal(rc->journal);
+      else SaveReadJournal(rc->journal, TRUE);
+      FreeReadJournal(rc->journal);
+   }
+
    if(Closure->guiMode)
    {  if(rc->earlyTermination)
       {  GuiSetAdaptiveReadFootline(_("Aborted by unrecoverable error."), Closure->redText);
@@ -398,6 +407,8 @@ bail_out:
 
    if(rc->map)
      FreeBitmap(rc->map);
+   if(rc->metrics)
+     FreeMetrics(rc->metrics);
 
    g_free(rc);
 
@@ -490,6 +501,9 @@ static void print_progress(read_closure *rc, int immediate)
    int total = rc->readable+rc->correctable;
    int percent = (int)((1000LL*(long long)total)/rc->expectedSectors);
 
+   if(rc->metrics)
+      MetricsSetProgress(rc->metrics, 0, total, rc->unreadable);
+
    if(Closure->guiMode)
       return;
 
@@ -869,6 +883,7 @@ int check_image_fingerprint(read_closure *rc)
      return 0; /* can't tell, assume okay */
 
    n = LargeRead(rc->image, rc->buf, 2048);
+   MarkHoleSectors(rc->image, rc->buf, fingerprint_sector, 1);
    MD5Init(&md5ctxt);
    MD5Update(&md5ctxt, rc->buf, 2048);
    MD5Final(image_fp, &md5ctxt);
@@ -954,22 +969,38 @@ static void load_crc_buf(read_closure *rc)
    }
 }
 
+/***
+ *** Set up the read journal for the image file.
+ ***/
+
+static void create_journal(read_closure *rc)
+{  gint32 fp_sector = rc->eh ? rc->eh->fpSector : FINGERPRINT_SECTOR;
+
+   rc->journal = CreateReadJournal(Closure->imageName, rc->image,
+				   MAX(rc->sectors, rc->expectedSectors), fp_sector,
+				   rc->readMode, rc->eh, rc->eh ? sizeof(EccHeader) : 0);
+}
+
 /***
  *** Examine existing image file.
  ***
  * Build an initial interval list from it.
+ * If the read journal matches the image, the sector states
+ * are taken from it instead of reading the image.
  */
 
-static void build_interval_from_image(read_closure *rc)
-{  gint64 s;
+static void build_interval_from_image(read_closure *rc, int use_journal)
+{  ImageScan *scan = NULL;
+   gint64 s;
    gint64 first_missing, last_missing, current_missing;
    int tail_included = FALSE;
    int last_percent = 0;
    int crc_result;
 
-   /*** Rewind image file */
+   /*** Set up reading the image file */
 
-   LargeSeek(rc->image, 0);
+   if(!use_journal)
+     scan = OpenImageScan(rc->image, rc->highestWrittenSector+1, NULL, 0, rc->crcBuf, NULL);
    first_missing = last_missing = -1;
 
    /*** Go through all sectors in the image file.
@@ -979,37 +1010,40 @@ static void build_interval_from_image(read_closure *rc)
    GuiSetAdaptiveReadSubtitle(_("Analysing existing image file"));
    
    for(s=0; s<=rc->highestWrittenSector; s++)
-   {  int n,percent;
+   {  int idx,percent;
 
       /* Check for user interruption. */
 
       if(Closure->stopActions)   
       {  GuiSetAdaptiveReadFootline(_("Aborted by user request!"), Closure->redText);
 	 rc->earlyTermination = FALSE;
+	 if(scan) CloseImageScan(scan);
 	 cleanup((gpointer)rc);
       }
 
-      /* Read the next sector */
+      /* Take the sector state from the journal */
 
-      n = LargeRead(rc->image, rc->buf, 2048);
-      if(n != 2048) /* && (s != rc->sectors - 1 || n != ii->inLast)) */
-	Stop(_("premature end in image (only %d bytes): %s\n"),n,strerror(errno));
+      if(use_journal)
+      {  current_missing = !GetBit(rc->journal->map, s);
+
+	 if(current_missing)
+	   mark_sector(rc, s, Closure->redSector);
+	 goto remember_state;
+      }
 
-      /* Look for the dead sector marker */
+      /* Get the next sector; the dead sector marker test
+	 and the checksum comparison have already been done. */
 
-      current_missing = CheckForMissingSector(rc->buf, s, NULL, 0);
+      idx = ImageScanSector(scan, s);
+      current_missing = scan->missing[idx];
 
       if(current_missing)
       {  int fixme=0;
 	 mark_sector(rc, s, Closure->redSector);
-	 ExplainMissingSector(rc->buf, s, current_missing, SOURCE_IMAGE, &fixme);
+	 ExplainMissingSector(scan->buf+2048*idx, s, current_missing, SOURCE_IMAGE, &fixme);
       }
 
-      /* Compare checksums if available */
-
-      if(rc->crcBuf)
-	   crc_result = CheckAgainstCrcBuffer(rc->crcBuf, s, rc->buf);
-      else crc_result = CRC_UNKNOWN;
+      crc_result = scan->crcState[idx];
 
       switch(crc_result)
       {  case CRC_GOOD:
@@ -1027,6 +1061,7 @@ static void build_interval_from_image(read_closure *rc)
 
       /* Remember sector state */
 
+remember_state:
       if(current_missing)  /* Remember defect sector in current interval */
       {  if(first_missing < 0) first_missing = s;
 	    last_missing = s;
@@ -1035,6 +1070,7 @@ static void build_interval_from_image(read_closure *rc)
       {  rc->readable++;
 	 if(rc->map)
 	   SetBit(rc->map, s);
+	 SetBit(rc->journal->map, s);
 
 	 mark_sector(rc, s, Closure->greenSector);
 
@@ -1077,6 +1113,9 @@ static void build_interval_from_image(read_closure *rc)
       }
    }
 
+   if(scan)
+     CloseImageScan(scan);
+
    /*** If the image is shorter than the medium and the missing part
 	was not already included in the last interval,
 	insert another interval for the missing portion. */
@@ -1273,6 +1312,13 @@ void fill_gap(read_closure *rc)
   PrintCLI("%s", t);
   g_free(t);
 
+  /*** Leave the area as a hole in sparse images */
+
+  if(Closure->sparseImage
+     && FillSparseGap(rc->image, firstUnwritten, rc->intervalStart,
+		      rc->fingerprint, FINGERPRINT_SECTOR, rc->volumeLabel))
+    goto filled;
+
   /*** Seek to end of image */
 
   if(!LargeSeek(rc->image, (gint64)(2048*firstUnwritten)))
@@ -1327,6 +1373,7 @@ void fill_gap(read_closure *rc)
 #endif  /* WITH_GUI_YES */
    }
 
+filled:
   PrintCLI("               \n");
   rc->highestWrittenSector = rc->intervalStart-1;
 
@@ -1349,6 +1396,10 @@ void fill_correctable_gap(read_closure *rc, gint64 correctable)
    {  gint64 ds = rc->highestWrittenSector+1;
       unsigned char buf[2048];
 
+      if(!PrepareSparseWrite(rc->image, ds, correctable-ds+1,
+			     rc->fingerprint, FINGERPRINT_SECTOR, rc->volumeLabel))
+	Stop(_("Failed writing to sector %" PRId64 " in image [%s]: %s"),
+	     ds, "skip-corr", strerror(errno));
       if(!LargeSeek(rc->image, (gint64)(2048*ds)))
 	Stop(_("Failed seeking to sector %" PRId64 " in image [%s]: %s"),
 	     ds, "skip-corr", strerror(errno));
@@ -1485,6 +1536,11 @@ reopen_image:
       /* Preload the CRC buffer */
 
       load_crc_buf(rc);
+
+      /* Start a new journal */
+
+      create_journal(rc);
+      RemoveReadJournal(rc->journal);
    }
 
    /*** else examine the existing image file ***/
@@ -1516,9 +1572,12 @@ reopen_image:
 
       load_crc_buf(rc);
 
-      /* Build the interval list */
+      /* Build the interval list, preferably from the journal.
+	 Then mark the journal as belonging to a running session. */
 
-      build_interval_from_image(rc);
+      create_journal(rc);
+      build_interval_from_image(rc, LoadReadJournal(rc->journal));
+      SaveReadJournal(rc->journal, FALSE);
 
       /* Mark still missing RS02 header sectors as correctable. */
 
@@ -1550,6 +1609,7 @@ reopen_image:
    /*** Read the medium image. */
 
    GuiSetAdaptiveReadSubtitle(rc->subtitle);
+   rc->metrics = CreateMetrics("read", 1, rc->expectedSectors, NULL, NULL, FALSE);
 
    for(;;)
    {  int cluster_mask = rc->dh->clusterSize-1;
@@ -1581,6 +1641,8 @@ reopen_image:
 	    goto terminate;
 	 }
 
+	 CheckpointReadJournal(rc->journal);
+
 	/* avoid a division by zero */
 	if (Closure->guiMode)
 	{   GuiChangeSpiralCursor(Closure->readAdaptiveSpiral, s / rc->sectorsPerSegment);
@@ -1672,6 +1734,10 @@ reread:
 	 if(!status)   
 	 {  gint64 b;
 
+	    if(!PrepareSparseWrite(rc->image, s, nsectors,
+				   rc->fingerprint, FINGERPRINT_SECTOR, rc->volumeLabel))
+	      Stop(_("Failed writing to sector %" PRId64 " in image [%s]: %s"),
+		   s, "store", strerror(errno));
 	    if(!LargeSeek(rc->image, (gint64)(2048*s)))
 	      Stop(_("Failed seeking to sector %" PRId64 " in image [%s]: %s"),
 		   s,"store",strerror(errno));
@@ -1723,6 +1789,7 @@ reread:
 
 		     if(rc->map)
 			SetBit(rc->map, b);
+		     SetBit(rc->journal->map, b);
 		     rc->readable++;
 
 		     mark_sector(rc, b, Closure->greenSector);
@@ -1743,6 +1810,7 @@ reread:
 
 		  if(rc->map)  /* Avoids confusion in the ecc stage */
 		     ClearBit(rc->map, b);
+		  ClearBit(rc->journal->map, b);
 		  rc->readable--;
 	       }
 	    }
@@ -1871,6 +1939,10 @@ reread:
 
 	    /* Write nsectors of "dead sector" markers */
 
+	    if(!PrepareSparseWrite(rc->image, s, nsectors,
+				   rc->fingerprint, FINGERPRINT_SECTOR, rc->volumeLabel))
+	      Stop(_("Failed writing to sector %" PRId64 " in image [%s]: %s"),
+		   s, "nds", strerror(errno));
 	    if(!LargeSeek(rc->image, (gint64)(2048*s)))
 	      Stop(_("Failed seeking to sector %" PRId64 " in image [%s]: %s"),
 		   s, "nds", strerror(errno));
@@ -2036,6 +2108,8 @@ finished:
 
    //print_intervals(rc);
 
+   PrintSimulatedDriveStats(rc->dh);
+
    /*** Close and clean up */
 
    rc->earlyTermination = FALSE;
@@ -0,0 +1,274 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*** src type: no GUI code ***/
+
+#include "dvdisaster.h"
+
+/***
+ *** Journal of the reading state.
+ ***
+ * Keeps a bitmap of the sectors which are present in the image and
+ * pass the CRC test next to the image file (<image>.journal),
+ * so that a resumed reading session does not have to examine
+ * the whole image again.
+ *
+ * The journal is replaced atomically via a temporary file, and the
+ * image is flushed to disk before, so the journal never claims
+ * sectors which did not make it into the image.
+ * A journal written at the end of a session must match the image size
+ * and modification time exactly. Checkpoints written during a session
+ * may be followed by further writes to the image; since the readers
+ * never overwrite present sectors, the bitmap is still valid
+ * (sectors added after the checkpoint are simply read again).
+ */
+
+#define JOURNAL_COOKIE "*dvdjournal*"
+#define JOURNAL_VERSION 1
+#define JOURNAL_BYTE_ORDER 0x01020304
+#define JOURNAL_CHECKPOINT 30.0     /* seconds between checkpoints */
+
+typedef struct
+{  char cookie[12];
+   guint32 byteOrder;               /* journal is only valid on the same architecture */
+   guint32 version;
+   gint32 readMode;
+   gint32 clean;                    /* written at the end of a session */
+   gint32 fpSector;
+   aligned_gint64 sectors;          /* size of the bitmap */
+   aligned_gint64 imageSize;        /* image file size in bytes */
+   aligned_gint64 imageMtime;       /* image modification time in ns */
+   guint8 imageDigest[16];          /* md5sum of the image fingerprint sector */
+   guint8 eccDigest[16];            /* md5sum of the ecc header in use */
+   guint8 mapDigest[16];            /* md5sum of the bitmap */
+} JournalHeader;
+
+/*
+ * Create the journal for the given image
+ */
+
+ReadJournal* CreateReadJournal(char *image_name, LargeFile *image, gint64 sectors,
+			       gint32 fp_sector, int read_mode, void *ecc_header, int ecc_header_size)
+{  ReadJournal *j = g_malloc0(sizeof(ReadJournal));
+
+   j->path     = g_strdup_printf("%s.journal", image_name);
+   j->image    = image;
+   j->fpSector = fp_sector;
+   j->readMode = read_mode;
+   j->map      = CreateBitmap0(sectors);
+   j->timer    = g_timer_new();
+
+   if(ecc_header)
+   {  struct MD5Context md5ctxt;
+
+      MD5Init(&md5ctxt);
+      MD5Update(&md5ctxt, ecc_header, ecc_header_size);
+      MD5Final(j->eccDigest, &md5ctxt);
+   }
+
+   return j;
+}
+
+void FreeReadJournal(ReadJournal *j)
+{
+   FreeBitmap(j->map);
+   g_timer_destroy(j->timer);
+   g_free(j->path);
+   g_free(j);
+}
+
+void RemoveReadJournal(ReadJournal *j)
+{
+   LargeUnlink(j->path);
+}
+
+/*
+ * Digests of the image fingerprint sector and of the bitmap.
+ * The image file position is restored for the caller.
+ */
+
+static void image_digest(ReadJournal *j, guint8 *digest)
+{  struct MD5Context md5ctxt;
+   guint64 offset = j->image->offset;
+   unsigned char buf[2048];
+
+   memset(digest, 0, 16);
+
+   if(!LargeSeek(j->image, (gint64)(2048*j->fpSector)))
+     return;
+
+   if(LargeRead(j->image, buf, 2048) == 2048)
+   {  MD5Init(&md5ctxt);
+      MD5Update(&md5ctxt, buf, 2048);
+      MD5Final(digest, &md5ctxt);
+   }
+
+   LargeSeek(j->image, offset);
+}
+
+static void map_digest(ReadJournal *j, guint8 *digest)
+{  struct MD5Context md5ctxt;
+
+   MD5Init(&md5ctxt);
+   MD5Update(&md5ctxt, (unsigned char*)j->map->bitmap, j->map->words*sizeof(guint32));
+   MD5Final(digest, &md5ctxt);
+}
+
+/*
+ * Write the journal. Failures are not fatal as we can always
+ * fall back to examining the image; also this is called from
+ * the cleanup handlers where Stop() must not be used.
+ */
+
+void SaveReadJournal(ReadJournal *j, int clean)
+{  JournalHeader jh;
+   LargeFile *file;
+   char *tmp_path;
+   guint64 image_size;
+   gint64 image_mtime;
+   int map_size = j->map->words*sizeof(guint32);
+   int ok;
+
+   g_timer_start(j->timer);
+
+   /* The image contents must be on the disk before the journal
+      claims them as being present. */
+
+   if(!LargeSync(j->image)
+      || !LargeStatTime(j->image->path, &image_size, &image_mtime))
+   {  Verbose("Could not update read journal %s: %s\n", j->path, strerror(errno));
+      return;
+   }
+
+   memset(&jh, 0, sizeof(JournalHeader));
+   memcpy(jh.cookie, JOURNAL_COOKIE, 12);
+   jh.byteOrder  = JOURNAL_BYTE_ORDER;
+   jh.version    = JOURNAL_VERSION;
+   jh.readMode   = j->readMode;
+   jh.clean      = clean;
+   jh.fpSector   = j->fpSector;
+   jh.sectors    = j->map->size;
+   jh.imageSize  = image_size;
+   jh.imageMtime = image_mtime;
+   memcpy(jh.eccDigest, j->eccDigest, 16);
+   image_digest(j, jh.imageDigest);
+   map_digest(j, jh.mapDigest);
+
+   /* Write into a temporary file and replace the journal afterwards
+      so that an interruption never leaves a partial journal behind. */
+
+   tmp_path = g_strdup_printf("%s.tmp", j->path);
+
+   if(!(file = LargeOpen(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, IMG_PERMS)))
+   {  Verbose("Could not update read journal %s: %s\n", j->path, strerror(errno));
+      g_free(tmp_path);
+      return;
+   }
+
+   ok =    LargeWrite(file, &jh, sizeof(JournalHeader)) == sizeof(JournalHeader)
+	&& LargeWrite(file, j->map->bitmap, map_size) == map_size
+	&& LargeSync(file);
+   ok = LargeClose(file) && ok;
+   ok = ok && LargeRename(tmp_path, j->path);
+
+   if(!ok)
+   {  Verbose("Could not update read journal %s: %s\n", j->path, strerror(errno));
+      LargeUnlink(tmp_path);
+   }
+
+   g_free(tmp_path);
+}
+
+/*
+ * Write a checkpoint if enough time has passed since the last one.
+ */
+
+void CheckpointReadJournal(ReadJournal *j)
+{  gulong ignore;
+
+   if(g_timer_elapsed(j->timer, &ignore) >= JOURNAL_CHECKPOINT)
+     SaveReadJournal(j, FALSE);
+}
+
+/*
+ * Load the journal into j->map.
+ * Returns FALSE (and leaves the bitmap empty) if there is no journal
+ * or if it does not match the image and reading session.
+ */
+
+int LoadReadJournal(ReadJournal *j)
+{  JournalHeader jh;
+   LargeFile *file;
+   guint64 image_size;
+   gint64 image_mtime;
+   guint8 digest[16];
+   int map_size = j->map->words*sizeof(guint32);
+
+   if(!(file = LargeOpen(j->path, O_RDONLY, IMG_PERMS)))
+     return FALSE;
+
+   if(LargeRead(file, &jh, sizeof(JournalHeader)) != sizeof(JournalHeader)
+      || memcmp(jh.cookie, JOURNAL_COOKIE, 12)
+      || jh.byteOrder != JOURNAL_BYTE_ORDER
+      || jh.version   != JOURNAL_VERSION
+      || jh.readMode  != j->readMode
+      || jh.fpSector  != j->fpSector
+      || jh.sectors   != j->map->size
+      || memcmp(jh.eccDigest, j->eccDigest, 16))
+     goto invalid;
+
+   /* Compare with the current state of the image */
+
+   if(!LargeStatTime(j->image->path, &image_size, &image_mtime))
+     goto invalid;
+
+   if(jh.clean)
+   {  if(image_size != jh.imageSize || image_mtime != jh.imageMtime)
+	goto invalid;
+   }
+   else
+   {  if(image_size < jh.imageSize || image_mtime < jh.imageMtime)
+	goto invalid;
+   }
+
+   image_digest(j, digest);
+   if(memcmp(digest, jh.imageDigest, 16))
+     goto invalid;
+
+   /* Load the bitmap */
+
+   if(LargeRead(file, j->map->bitmap, map_size) != map_size)
+     goto invalid;
+
+   map_digest(j, digest);
+   if(memcmp(digest, jh.mapDigest, 16))
+     goto invalid;
+
+   LargeClose(file);
+   Verbose("Using read journal %s.\n", j->path);
+   return TRUE;
+
+invalid:
+   LargeClose(file);
+   memset(j->map->bitmap, 0, map_size);
+   return FALSE;
+}
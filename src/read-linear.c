@@ -153,6 +153,8 @@ static void cleanup(gpointer data)
    if(rc->speedTimer) g_timer_destroy(rc->speedTimer);
    if(rc->readTimer)  g_timer_destroy(rc->readTimer);
    if(rc->readMap) FreeBitmap(rc->readMap);
+   if(rc->suspicious) FreeBitmap(rc->suspicious);
+   if(rc->metrics) FreeMetrics(rc->metrics);
    if(rc->volumeLabel) g_free(rc->volumeLabel);
 
    if(rc->rendererMutex)
@@ -319,6 +321,7 @@ reopen_image:
       int n = LargeRead(rc->readerImage, buf, 2048);
       int fp_read;
 
+      MarkHoleSectors(rc->readerImage, buf, FINGERPRINT_SECTOR, 1);
       MD5Init(&md5ctxt);
       MD5Update(&md5ctxt, buf, 2048);
       MD5Final(image_fp, &md5ctxt);
@@ -379,7 +382,7 @@ reopen_image:
 
 /*
  * Fill the gap between rc->readMarker and rc->firstSector
- * with dead sector markers.
+ * with dead sector markers, or leave it as a hole with --sparse-image.
  */
 
 static void fill_gap(read_closure *rc)
@@ -390,6 +393,11 @@ static void fill_gap(read_closure *rc)
 
       s = rc->readMarker;
 
+      if(Closure->sparseImage
+	 && FillSparseGap(rc->writerImage, s, rc->firstSector,
+			  rc->image->imageFP, FINGERPRINT_SECTOR, rc->volumeLabel))
+	return;
+
       if(!LargeSeek(rc->writerImage, (gint64)(2048*s)))
 	Stop(_("Failed seeking to sector %" PRId64 " in image [%s]: %s"),
 	     s, "fill", strerror(errno));
@@ -501,6 +509,7 @@ static void prepare_timer(read_closure *rc)
      ReadSectors(rc->image->dh, rc->alignedBuf[0]->buf, rc->firstSector, 1); 
    g_timer_start(rc->speedTimer);
    g_timer_start(rc->readTimer);
+   rc->speedClock = SimulatedClock(rc->image->dh);
 }
 
 /*
@@ -520,6 +529,9 @@ static void show_progress(read_closure *rc)
    if(rc->readPos>rc->readMarker) rc->readMarker=rc->readPos;
    percent = (1000*rc->readPos)/rc->image->dh->sectors;
 
+   MetricsSetProgress(rc->metrics, 0, rc->readPos - rc->firstSector,
+		      Closure->readErrors + Closure->crcErrors);
+
    /* to avoid flooding logs when everything is ok, log this only when there have been errors in the read session */
    if (Closure->verbose && Closure->readErrors > 0)
       Verbose("Current sector: %" PRId64 ". This session: NewSectorsReadOK=%" PRId64 ", ReadErrors=%" PRId64 "\n",
@@ -555,7 +567,9 @@ static void show_progress(read_closure *rc)
       }
       else               /* something was read since last sample */
       {  double kb_read = (rc->readOK - rc->lastReadOK) * 2.0;
-	 double elapsed = g_timer_elapsed(rc->speedTimer, &ignore);
+	 gint64 clock   = SimulatedClock(rc->image->dh);
+	 double elapsed = clock < 0 ? g_timer_elapsed(rc->speedTimer, &ignore)
+	                            : (clock - rc->speedClock)/1000000.0;
 	 double kb_sec  = kb_read / elapsed;
 
 #ifdef WITH_GUI_YES
@@ -620,6 +634,7 @@ static void show_progress(read_closure *rc)
 	    rc->previousCRCErrors  = Closure->crcErrors;
 	    rc->lastReadOK     = rc->readOK;
 	    g_timer_start(rc->speedTimer);
+	    rc->speedClock = clock;
 	 }
       }
       rc->maxC2 = 0;
@@ -634,6 +649,194 @@ static void show_progress(read_closure *rc)
  * The writer / checksum part
  */
 
+/*
+ * Keep READ commands for the blocks following rc->readPos queued
+ * while the current one is being processed.
+ * Only sectors which would be read anyways are queued.
+ */
+
+static void queue_blocks(read_closure *rc, int nsectors)
+{  DeviceHandle *dh = rc->image->dh;
+   gint64 tao_start = (dh->sectors - 2) & ~(gint64)(dh->clusterSize-1);
+   gint64 s;
+
+   if(QueuedSector(dh) != rc->readPos)
+      CancelQueuedReads(dh);
+
+   s = NextQueuedSector(dh);
+   if(s < 0) s = rc->readPos;
+
+   while(   s+nsectors-1 <= rc->lastSector
+	 && s+nsectors <= tao_start
+	 && (rc->scanMode || s >= rc->readMarker))
+   {  if(!QueueReadSectors(dh, s, nsectors))
+	 break;
+      s += nsectors;
+   }
+}
+
+/***
+ *** Adaptive transfer size and skip distance
+ ***
+ * With --max-read-block, the transfer size grows from dh->clusterSize
+ * on clean stretches as long as this increases the throughput, and falls
+ * back to dh->clusterSize around read errors. The skip distance follows
+ * the fraction of failed transfers among the most recent ones.
+ * Statistics are logged for READ_ZONES equally sized zones of the medium.
+ */
+
+#define READ_ZONES 20
+#define GROW_AFTER 8            /* clean transfers before trying a larger size */
+#define DENSITY_TRANSFERS 16    /* transfers covered by the error density */
+#define GROW_DENSITY 0.02       /* stay small while recent errors are denser */
+
+static double read_clock(read_closure *rc)
+{  gint64 clock = SimulatedClock(rc->image->dh);
+   gulong ignore;
+
+   if(clock >= 0)
+      return clock/1000000.0;
+
+   return g_timer_elapsed(rc->readTimer, &ignore);
+}
+
+static void setup_adaptive_reading(read_closure *rc)
+{  DeviceHandle *dh = rc->image->dh;
+   int max_block;
+
+   rc->maxBlock = 0;
+   if(Closure->readRaw || Closure->maxReadBlock <= dh->clusterSize)
+      return;
+
+   max_block = Closure->maxReadBlock;
+   if(dh->maxTransfer && dh->maxTransfer < max_block)
+      max_block = dh->maxTransfer;
+   max_block &= ~(dh->clusterSize-1);
+
+   if(max_block <= dh->clusterSize)
+      return;
+
+   rc->maxBlock = max_block;
+   PrintLog(_("Adaptive reading: transfers of %d - %d sectors.\n"),
+	    dh->clusterSize, rc->maxBlock);
+}
+
+static void start_zone(read_closure *rc)
+{  gint64 sectors = rc->image->dh->sectors;
+   double now = read_clock(rc);
+
+   rc->zone          = (READ_ZONES*rc->readPos)/sectors;
+   rc->zoneEnd       = ((rc->zone+1)*sectors)/READ_ZONES;
+   rc->zoneStart     = now;
+   rc->zoneReadOK    = rc->readOK;
+   rc->zoneErrors    = Closure->readErrors;
+   rc->zoneTransfers = rc->zoneBlocks = 0;
+   rc->zoneMaxBlock  = rc->zoneMaxSkip = 0;
+
+   /* Zones differ in speed, so probe the transfer size again */
+
+   rc->blockCeiling = rc->maxBlock;
+   rc->cleanReads   = 0;
+   rc->levelStart   = now;
+   rc->levelSectors = 0;
+   rc->levelRate    = 0.0;
+}
+
+static void log_zone(read_closure *rc)
+{  gint64 read_ok = rc->readOK - rc->zoneReadOK;
+   gint64 errors  = Closure->readErrors - rc->zoneErrors;
+   double elapsed = read_clock(rc) - rc->zoneStart;
+   char speed[20];
+
+   if(!rc->zoneTransfers)   /* zone was already present in the image */
+      return;
+
+   if(Closure->fixedSpeedValues)
+        g_snprintf(speed, 20, "nn.n");
+   else g_snprintf(speed, 20, "%.1f", elapsed > 0.0 ? read_ok/(512.0*elapsed) : 0.0);
+
+   PrintLog(_("Zone %2d: %" PRId64 " read, %" PRId64 " unreadable, %s MiB/s, "
+	      "%" PRId64 " transfers of %.1f sectors (max. %d), max. skip %d\n"),
+	    rc->zone, read_ok, errors, speed,
+	    rc->zoneTransfers, (double)rc->zoneBlocks/rc->zoneTransfers,
+	    rc->zoneMaxBlock, rc->zoneMaxSkip);
+}
+
+/*
+ * Feed the result of a transfer into the controller.
+ */
+
+static void adapt_block_size(read_closure *rc, int nsectors, int status)
+{  int cluster_size = rc->image->dh->clusterSize;
+   double now,rate;
+
+   rc->zoneTransfers++;
+   rc->zoneBlocks += nsectors;
+   if(nsectors > rc->zoneMaxBlock)
+      rc->zoneMaxBlock = nsectors;
+
+   rc->errorDensity += ((status ? 1.0 : 0.0) - rc->errorDensity) / DENSITY_TRANSFERS;
+
+   if(status)
+   {  rc->readBlock    = cluster_size;
+      rc->cleanReads   = 0;
+      rc->levelStart   = read_clock(rc);
+      rc->levelSectors = 0;
+      rc->levelRate    = 0.0;
+      return;
+   }
+
+   if(nsectors != rc->readBlock)  /* single sectors, medium end */
+      return;
+
+   rc->levelSectors += nsectors;
+   if(++rc->cleanReads < GROW_AFTER)
+      return;
+
+   now  = read_clock(rc);
+   rate = now > rc->levelStart ? rc->levelSectors/(now-rc->levelStart) : 0.0;
+
+   if(rc->levelRate > 0.0 && rate < 1.05*rc->levelRate)
+   {  /* No real gain over the previous size; stay there for this zone */
+      rc->blockCeiling = rc->readBlock/2;
+      rc->readBlock    = rc->blockCeiling;
+      rc->levelRate    = 0.0;
+   }
+   else if(rc->readBlock < rc->blockCeiling && rc->errorDensity < GROW_DENSITY)
+   {  rc->readBlock = MIN(2*rc->readBlock, rc->blockCeiling);
+      rc->levelRate = rate;
+   }
+   else rc->levelRate = 0.0;
+
+   rc->cleanReads   = 0;
+   rc->levelStart   = now;
+   rc->levelSectors = 0;
+}
+
+/*
+ * Skip distance after a read error: one cluster for isolated errors,
+ * up to 16 times the --jump value in heavily damaged areas.
+ */
+
+static int skip_distance(read_closure *rc)
+{  int cluster_size = rc->image->dh->clusterSize;
+   int max_skip, skip;
+
+   if(!rc->maxBlock || !Closure->sectorSkip)
+      return Closure->sectorSkip;
+
+   max_skip = 16*MAX(Closure->sectorSkip, cluster_size);
+   skip = cluster_size*pow((double)max_skip/cluster_size, rc->errorDensity);
+   skip &= ~(cluster_size-1);
+   if(skip < cluster_size)
+      skip = cluster_size;
+
+   if(skip > rc->zoneMaxSkip)
+      rc->zoneMaxSkip = skip;
+
+   return skip;
+}
+
 static gpointer worker_thread(read_closure *rc)
 {  gint64 s;
    int nsectors;
@@ -663,6 +866,13 @@ static gpointer worker_thread(read_closure *rc)
       if(!rc->scanMode)
       {  int n;
 
+	 if(!PrepareSparseWrite(rc->writerImage, s, nsectors,
+				rc->image->imageFP, FINGERPRINT_SECTOR, rc->volumeLabel))
+	 {  rc->workerError = g_strdup_printf(_("Failed writing to sector %" PRId64 " in image [%s]: %s"),
+					      s, "store", strerror(errno));
+	    goto update_mutex;
+	 }
+
 	 if(!LargeSeek(rc->writerImage, (gint64)(2048*s)))
 	 {  rc->workerError = g_strdup_printf(_("Failed seeking to sector %" PRId64 " in image [%s]: %s"),
 					      s, "store", strerror(errno));
@@ -761,6 +971,8 @@ void ReadMediumLinear(gpointer data)
    char *t = NULL;
    int status,n;
    int tao_tail;
+   gint64 tao_start;
+   int buf_size;
    int i;
 
    /*** This value might be temporarily changed later. */
@@ -789,8 +1001,11 @@ void ReadMediumLinear(gpointer data)
 
      /*** Create the aligned buffers. */
 
+   buf_size = MAX(MAX_CLUSTER_SIZE, 2048*Closure->maxReadBlock);
    for(i=0; i<READ_BUFFERS; i++)
-     rc->alignedBuf[i] = CreateAlignedBuffer(MAX_CLUSTER_SIZE);
+     rc->alignedBuf[i] = CreateAlignedBuffer(buf_size);
+
+   rc->suspicious = CreateBitmap0(buf_size/2048);
 
    /*** Open Device and query medium properties:
         rc->image will point to the optical medium, 
@@ -926,6 +1141,11 @@ void ReadMediumLinear(gpointer data)
 
    prepare_timer(rc);
 
+   /*** Keep the following READ commands queued if possible */
+
+   OpenReadQueue(rc->image->dh, Closure->readQueue);
+   setup_adaptive_reading(rc);
+
    /*** Reset for the next reading pass */
 
    rc->lastReadOK = 0;  /* keep between passes */
@@ -955,6 +1175,9 @@ next_reading_pass:
 
    /*** Read the medium image. */
 
+   if(!rc->metrics)
+      rc->metrics = CreateMetrics(rc->scanMode ? "scan" : "read", 1,
+				  rc->lastSector - rc->firstSector + 1, NULL, NULL, FALSE);
    rc->readPos = rc->firstSector;
    rc->lastErrorsPrinted = 0;
    rc->previousReadErrors = rc->previousCRCErrors = 0;
@@ -963,6 +1186,11 @@ next_reading_pass:
    rc->firstSpeedValue = TRUE;
    tao_tail = 0;
 
+   rc->readBlock = rc->image->dh->clusterSize;
+   rc->errorDensity = 0.0;
+   if(rc->maxBlock)
+      start_zone(rc);
+
    while(rc->readPos<=rc->lastSector)
    {  int cluster_mask = rc->image->dh->clusterSize-1;
 
@@ -986,9 +1214,12 @@ next_reading_pass:
            In order to treat the 2 read errors at the end of TAO discs correctly,
            we switch back to per sector reading at the end of the medium. */
 
+      tao_start = (rc->image->dh->sectors - 2) & ~cluster_mask;
       if(   rc->readPos & cluster_mask 
-	 || rc->readPos >= ((rc->image->dh->sectors - 2) & ~cluster_mask) )
+	 || rc->readPos >= tao_start)
             nsectors = 1;
+      else if(rc->maxBlock)
+            nsectors = MIN(rc->readBlock, tao_start - rc->readPos);
       else  nsectors = rc->image->dh->clusterSize;
 
       if(rc->readPos+nsectors > rc->lastSector)  /* don't read past the (CD) media end */
@@ -1028,6 +1259,7 @@ reread:
 	       n = LargeRead(rc->readerImage, sector_buf, 2048);
 	       if(n != 2048)
 		  Stop(_("unexpected read error in image for sector %" PRId64),rc->readPos);
+	       MarkHoleSectors(rc->readerImage, sector_buf, rc->readPos+i, 1);
 	       err = CheckForMissingSector(sector_buf, rc->readPos+i,
 					   rc->image->fpState == 2 ? rc->image->imageFP : NULL,
 					   rc->image->fpSector);
@@ -1075,7 +1307,11 @@ reread:
       }
       g_mutex_unlock(rc->mutex);
 
-      status = ReadSectors(rc->image->dh, rc->alignedBuf[rc->readPtr]->buf, rc->readPos, nsectors);
+      if(rc->image->dh->readQueue && nsectors >= rc->image->dh->clusterSize)
+      {  queue_blocks(rc, nsectors);
+	 status = ReadQueuedSectors(rc->image->dh, rc->alignedBuf[rc->readPtr]->buf, rc->readPos, nsectors);
+      }
+      else status = ReadSectors(rc->image->dh, rc->alignedBuf[rc->readPtr]->buf, rc->readPos, nsectors);
 
       /*** Medium Error (3) and Illegal Request (5) may result from 
 	   a medium read problem, but other errors are regarded as fatal. */
@@ -1130,11 +1366,15 @@ reread:
 
       /*** Warn the user if we see dead sector markers on the image. */
 
-      if(!status)
+      if(!status
+	 && ScreenForMissingSectors(rc->alignedBuf[rc->readPtr]->buf, nsectors, rc->suspicious))
       {  for(i=0; i<nsectors; i++)
 	 {  unsigned char *sector_buf = rc->alignedBuf[rc->readPtr]->buf;
 	    int err;
 
+	    if(!GetBit(rc->suspicious, i))
+	       continue;
+
 	    /* Note: providing the fingerprint is not necessary as any 
 	       incoming missing sector marker indicates a huge problem. */
 
@@ -1148,6 +1388,9 @@ reread:
 	 }
       }
 
+      if(rc->maxBlock)
+	 adapt_block_size(rc, nsectors, status);
+
       /*** Pass sector(s) to the worker thread (if reading succeeded) */
 
       if(!status)
@@ -1182,7 +1425,14 @@ reread:
       /*** Process the read error if reading failed. */
 
       if(status)
-      {  int nfill;
+      {  int nfill, sector_skip;
+
+	 /* Re-read a failed large transfer in clusters */
+
+	 if(rc->maxBlock && nsectors > rc->image->dh->clusterSize)
+	 {  nsectors = rc->image->dh->clusterSize;
+	    goto reread;
+	 }
 
 	 /* Disable on the fly checksum calculation.
 	    Do NOT free the CRC cache here to avoid race condition
@@ -1197,9 +1447,10 @@ reread:
 	    Make sure not to skip past the media end
 	    and to land at a multiple of dh->clusterSize. */
 
-	 if(nsectors>=Closure->sectorSkip) nfill = nsectors;
+	 sector_skip = skip_distance(rc);
+	 if(nsectors>=sector_skip) nfill = nsectors;
 	 else
-	 {  int skip = rc->image->dh->clusterSize > Closure->sectorSkip ? rc->image->dh->clusterSize : Closure->sectorSkip;
+	 {  int skip = rc->image->dh->clusterSize > sector_skip ? rc->image->dh->clusterSize : sector_skip;
 	    if(rc->readPos+skip > rc->lastSector) nfill = rc->lastSector-rc->readPos+1;
 	    else nfill = skip - ((rc->readPos + skip) & cluster_mask);
 	 }
@@ -1294,9 +1545,19 @@ reread:
 step_counter:
       rc->readPos += nsectors;   /* advance the reading position */
 
+      if(rc->maxBlock && rc->readPos >= rc->zoneEnd)
+      {  log_zone(rc);
+	 start_zone(rc);
+      }
+
       show_progress(rc);
    }
 
+   if(rc->maxBlock)
+      log_zone(rc);
+
+   CancelQueuedReads(rc->image->dh);
+
    /*** If multiple reading passes are allowed, see if we need another pass.
         Note: Checksum errors do not trigger another pass as only sectors
         marked dead are tried on a re-read. This does not hurt as being able
@@ -1423,6 +1684,7 @@ step_counter:
 
    if(!Closure->fixedSpeedValues)
      PrintTimeToLog(rc->readTimer, "for reading/scanning.\n");
+   PrintSimulatedDriveStats(rc->image->dh);
 
    if(rc->image->dh->mainType == CD && tao_tail && tao_tail == Closure->readErrors && !Closure->noTruncate)
    {  int answer;
@@ -1473,6 +1735,8 @@ step_counter:
    rc->earlyTermination = FALSE;
 
 terminate:
+   if(rc->image && rc->image->dh)
+      CancelQueuedReads(rc->image->dh);
    PrintCrcBuf(Closure->crcBuf);
    cleanup((gpointer)rc);
 }
@@ -63,11 +63,13 @@ typedef struct
 
    gint64 readPos;                   /* current sector reading position */
    Bitmap *readMap;                  /* map of already read sectors */
+   Bitmap *suspicious;               /* possible dead sector markers in current read */
 
    gint64 readMarker;
    int rereading;                    /* TRUE if working on existing image */
    char *msg;
    GTimer *speedTimer,*readTimer;
+   gint64 speedClock;                /* virtual clock of a simulated drive at speedTimer start */
    int unreportedError;
    int earlyTermination;
    int scanMode;
@@ -82,6 +84,25 @@ typedef struct
    int pass;
    int maxC2;                       /* max C2 error since last output */
    int crcIncomplete;               /* CRC information was found incomplete (RS03 only) */
+   Metrics *metrics;                /* for --stats-json */
+
+   /* Adaptive transfer size and skip distance (--max-read-block) */
+
+   int maxBlock;                    /* largest transfer size; 0 if not adapting */
+   int readBlock;                   /* current transfer size */
+   int blockCeiling;                /* larger transfers did not pay off in this zone */
+   int cleanReads;                  /* successful transfers at the current size */
+   double levelStart;               /* time when the current size was selected */
+   gint64 levelSectors;             /* sectors read at the current size */
+   double levelRate;                /* throughput of the previous smaller size */
+   double errorDensity;             /* recent fraction of failed transfers */
+
+   int zone;                        /* statistics zone containing rc->readPos */
+   gint64 zoneEnd;
+   double zoneStart;
+   gint64 zoneReadOK, zoneErrors;   /* counters at start of zone */
+   gint64 zoneTransfers, zoneBlocks;
+   int zoneMaxBlock, zoneMaxSkip;
   
    /* for drawing the curve and spiral */
 
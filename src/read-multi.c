@@ -0,0 +1,888 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*** src type: no GUI code ***/
+
+#include "dvdisaster.h"
+
+#include "scsi-layer.h"
+#include "udf.h"
+
+/***
+ *** Reading one image from several drives in parallel.
+ ***
+ * Invoked by giving a comma separated list of devices with -d.
+ * Each drive gets its own reader thread. The unread sectors are kept
+ * in a queue of intervals, sorted by size as in read-adaptive.c, which
+ * also records the drives which already failed on each interval.
+ * An idle drive takes the largest interval it has not failed on yet;
+ * if there is none it takes over the tail of the interval with the
+ * longest remaining reading time. The tail is split according to the
+ * measured speeds of both drives.
+ * Unreadable parts are put back into the queue for the other drives.
+ * Sectors are merged into the image as they arrive. If ecc data is
+ * available, copies failing the CRC test are only kept until another
+ * drive delivers a good copy.
+ */
+
+#define MAX_DRIVES 32         /* drives are tracked in 32 bit masks */
+#define MIN_SHARE 4           /* do not take over less than 4 clusters */
+#define RATE_SMOOTHING 0.1    /* weight of the most recent transfer in the speed */
+
+typedef struct _multi_closure multi_closure;
+
+typedef struct
+{  multi_closure *mc;
+   int number;                /* drive number for the messages, starting at 1 */
+   guint32 bit;               /* drive bit in the interval masks */
+   Image *medium;             /* medium in this drive */
+   DeviceHandle *dh;
+   AlignedBuffer *ab;
+   GThread *thread;
+   GTimer *timer;             /* used when no simulated clock is available */
+   int retired;               /* drive failed with a fatal error */
+
+   gint64 pos;                /* interval currently read by this drive: [pos, end) */
+   gint64 end;
+   gint64 busyEnd;            /* end of the transfer in progress */
+   guint32 failed;            /* drives which already failed on this interval */
+   int busy;                  /* drive is holding an interval */
+
+   double rate;               /* measured reading speed in sectors/s */
+   gint64 readOK;             /* sectors merged into the image from this drive */
+   gint64 readErrors;         /* sectors this drive failed to read */
+   gint64 crcErrors;          /* sectors this drive delivered with CRC errors */
+   gint64 takenOver;          /* sectors taken over from other drives */
+} drive_reader;
+
+struct _multi_closure
+{  drive_reader *drive;
+   int nDrives;
+   guint32 activeDrives;      /* mask of drives which have not been retired */
+   GThread *mainThread;
+
+   Image *medium;             /* medium in the first drive; provides the ecc data */
+   LargeFile *image;          /* image file shared by all drives */
+   gint64 imageSectors;       /* size of the image file before reading */
+   gint64 sectors;
+   gint64 firstSector;        /* user limited reading range */
+   gint64 lastSector;
+   Bitmap *readMap;           /* sectors present in the image with good or unknown CRC */
+   Bitmap *crcMap;            /* sectors present only as a copy with CRC errors */
+   CrcBuf *crcBuf;            /* CRC sums from the ecc data */
+   char *volumeLabel;
+
+   gint64 *intervals;         /* queue of unread intervals, largest first: */
+   int nIntervals;            /* triples of start, size, mask of failed drives */
+   int maxIntervals;
+
+   GMutex *lock;              /* protects everything above and the drive intervals */
+   GCond *workChanged;
+   int busyDrives;
+   int runningDrives;
+
+   gint64 present;            /* sectors in the reading range already in the image */
+   gint64 readOK;
+   gint64 lastReadOK;         /* for updating the progress output */
+};
+
+/*
+ * Cleanup.
+ */
+
+static void cleanup(gpointer data)
+{  multi_closure *mc = (multi_closure*)data;
+   int i;
+
+   /* Stop() from a reader thread: the process is about to exit,
+      so only make sure that the image file is properly closed. */
+
+   if(g_thread_self() != mc->mainThread)
+   {  if(mc->image)
+	 LargeClose(mc->image);
+      mc->image = NULL;
+      return;
+   }
+
+   UnregisterCleanup();
+
+   if(Closure->ignoreFatalSense == 2)
+      Closure->ignoreFatalSense = 0;
+
+   if(mc->image)
+     if(!LargeClose(mc->image))
+       Stop(_("Error closing image file:\n%s"), strerror(errno));
+
+   for(i=0; i<mc->nDrives; i++)
+   {  drive_reader *d = &mc->drive[i];
+
+      if(d->medium) CloseImage(d->medium);
+      if(d->ab) FreeAlignedBuffer(d->ab);
+      if(d->timer) g_timer_destroy(d->timer);
+   }
+   if(mc->drive) g_free(mc->drive);
+
+   if(mc->crcBuf) FreeCrcBuf(mc->crcBuf);
+   if(mc->readMap) FreeBitmap(mc->readMap);
+   if(mc->crcMap) FreeBitmap(mc->crcMap);
+   if(mc->intervals) g_free(mc->intervals);
+   if(mc->volumeLabel) g_free(mc->volumeLabel);
+
+   if(mc->lock)
+   {  g_mutex_clear(mc->lock);
+      g_free(mc->lock);
+   }
+   if(mc->workChanged)
+   {  g_cond_clear(mc->workChanged);
+      g_free(mc->workChanged);
+   }
+
+   g_free(mc);
+}
+
+/***
+ *** Queue of unread intervals.
+ ***
+ * All functions below expect mc->lock to be held.
+ */
+
+/*
+ * Sort new interval into the queue
+ */
+
+static void add_interval(multi_closure *mc, gint64 start, gint64 size, guint32 failed)
+{  int i,si;
+
+   if(size <= 0)
+     return;
+
+   /* Nobody left to read it */
+
+   if((failed & mc->activeDrives) == mc->activeDrives)
+     return;
+
+   for(i=0,si=0; i<mc->nIntervals; i++,si+=3)
+     if(size > mc->intervals[si+1])
+       break;
+
+   mc->nIntervals++;
+   if(mc->nIntervals > mc->maxIntervals)
+   {  mc->maxIntervals *= 2;
+      mc->intervals = g_realloc(mc->intervals, mc->maxIntervals*3*sizeof(gint64));
+   }
+
+   if(i<mc->nIntervals-1)
+     memmove(mc->intervals+si+3, mc->intervals+si, 3*sizeof(gint64)*(mc->nIntervals-i-1));
+
+   mc->intervals[si]   = start;
+   mc->intervals[si+1] = size;
+   mc->intervals[si+2] = failed;
+
+   g_cond_broadcast(mc->workChanged);
+}
+
+/*
+ * Let the drive take the largest queued interval it has not failed on yet.
+ */
+
+static int take_queued_interval(multi_closure *mc, drive_reader *d)
+{  int i,si;
+
+   for(i=0,si=0; i<mc->nIntervals; i++,si+=3)
+     if(!(mc->intervals[si+2] & d->bit))
+       break;
+
+   if(i >= mc->nIntervals)
+     return FALSE;
+
+   d->pos    = mc->intervals[si];
+   d->end    = mc->intervals[si] + mc->intervals[si+1];
+   d->failed = (guint32)mc->intervals[si+2];
+
+   mc->nIntervals--;
+   memmove(mc->intervals+si, mc->intervals+si+3, 3*sizeof(gint64)*(mc->nIntervals-i));
+
+   return TRUE;
+}
+
+/*
+ * Take over the tail of the interval which another drive will need
+ * the longest time to complete. The remaining part is divided
+ * according to the measured speeds of both drives.
+ */
+
+static int take_over_interval(multi_closure *mc, drive_reader *d)
+{  drive_reader *victim = NULL;
+   int cluster_mask = d->dh->clusterSize-1;
+   double longest = 0.0;
+   gint64 split = 0;
+   int i;
+
+   for(i=0; i<mc->nDrives; i++)
+   {  drive_reader *v = &mc->drive[i];
+      double d_rate, v_rate, duration;
+      gint64 remaining, share, start;
+
+      if(v == d || !v->busy || (v->failed & d->bit))
+	continue;
+
+      remaining = v->end - v->busyEnd;
+      if(remaining <= 0)
+	continue;
+
+      /* Assume equal speeds until both drives have been measured */
+
+      d_rate = d->rate; v_rate = v->rate;
+      if(d_rate <= 0.0 || v_rate <= 0.0)
+	d_rate = v_rate = 1.0;
+
+      share = (gint64)((double)remaining * d_rate / (d_rate + v_rate));
+      start = (v->end - share + cluster_mask) & ~(gint64)cluster_mask;
+      if(start < v->busyEnd || v->end - start < MIN_SHARE*d->dh->clusterSize)
+	continue;
+
+      duration = (double)remaining / v_rate;
+      if(duration > longest)
+      {  longest = duration;
+	 victim = v;
+	 split = start;
+      }
+   }
+
+   if(!victim)
+     return FALSE;
+
+   d->pos    = split;
+   d->end    = victim->end;
+   d->failed = victim->failed;
+   d->takenOver += d->end - d->pos;
+   victim->end = split;
+
+   return TRUE;
+}
+
+/*
+ * Get the next interval for the drive.
+ * Waits while other drives are still working since they
+ * may return intervals they could not read.
+ */
+
+static int get_work(multi_closure *mc, drive_reader *d)
+{
+   for(;;)
+   {  if(Closure->stopActions || d->retired)
+	 return FALSE;
+
+      if(take_queued_interval(mc, d) || take_over_interval(mc, d))
+      {	 d->busy = TRUE;
+	 d->busyEnd = d->pos;
+	 mc->busyDrives++;
+	 return TRUE;
+      }
+
+      if(!mc->busyDrives)
+      {  g_cond_broadcast(mc->workChanged);
+	 return FALSE;
+      }
+
+      g_cond_wait(mc->workChanged, mc->lock);
+   }
+}
+
+static void release_work(multi_closure *mc, drive_reader *d)
+{
+   d->busy = FALSE;
+   mc->busyDrives--;
+   g_cond_broadcast(mc->workChanged);
+}
+
+/***
+ *** Merging the sectors into the image
+ ***/
+
+static void write_sectors(multi_closure *mc, gint64 sector, unsigned char *buf, int n)
+{
+   if(!PrepareSparseWrite(mc->image, sector, n,
+			  mc->medium->imageFP, FINGERPRINT_SECTOR, mc->volumeLabel))
+     Stop(_("Failed writing to sector %" PRId64 " in image [%s]: %s"),
+	  sector, "merge", strerror(errno));
+
+   if(!LargeSeek(mc->image, (gint64)(2048*sector)))
+     Stop(_("Failed seeking to sector %" PRId64 " in image [%s]: %s"),
+	  sector, "merge", strerror(errno));
+
+   if(LargeWrite(mc->image, buf, 2048*n) != 2048*n)
+     Stop(_("Failed writing to sector %" PRId64 " in image [%s]: %s"),
+	  sector, "merge", strerror(errno));
+}
+
+/*
+ * Write the sectors delivered by a drive. Sectors with CRC errors are
+ * only written if the image does not hold a copy of them yet,
+ * and are queued again for the other drives.
+ */
+
+static void merge_sectors(multi_closure *mc, drive_reader *d, unsigned char *buf, gint64 start, int n)
+{  gint64 run_start = -1;
+   int run_length = 0;
+   int i;
+
+   for(i=0; i<=n; i++)
+   {  gint64 s = start+i;
+      int good = FALSE;
+
+      if(i<n && !GetBit(mc->readMap, s))
+      {  if(mc->crcBuf && CheckAgainstCrcBuffer(mc->crcBuf, s, buf+2048*i) == CRC_BAD)
+	 {  d->crcErrors++;
+	    PrintCLI(_("Drive %d: sector %" PRId64 ": CRC error.\n"), d->number, s);
+
+	    if(!GetBit(mc->crcMap, s))
+	    {  write_sectors(mc, s, buf+2048*i, 1);
+	       SetBit(mc->crcMap, s);
+	    }
+	    add_interval(mc, s, 1, d->failed | d->bit);
+	 }
+	 else
+	 {  SetBit(mc->readMap, s);
+	    ClearBit(mc->crcMap, s);
+	    d->readOK++;
+	    mc->readOK++;
+	    good = TRUE;
+	 }
+      }
+
+      /* Write runs of good sectors at once */
+
+      if(good)
+      {  if(!run_length) run_start = s;
+	 run_length++;
+      }
+      else if(run_length)
+      {  write_sectors(mc, run_start, buf+2048*(run_start-start), run_length);
+	 run_length = 0;
+      }
+   }
+}
+
+/***
+ *** The reader threads
+ ***/
+
+static double read_clock(drive_reader *d)
+{  gint64 clock = SimulatedClock(d->dh);
+   gulong ignore;
+
+   if(clock >= 0)
+      return clock/1000000.0;
+
+   return g_timer_elapsed(d->timer, &ignore);
+}
+
+static void update_rate(drive_reader *d, int nsectors, double seconds)
+{  double rate;
+
+   if(seconds <= 0.0)
+     return;
+
+   rate = nsectors / seconds;
+   if(d->rate <= 0.0)
+        d->rate = rate;
+   else d->rate = (1.0-RATE_SMOOTHING)*d->rate + RATE_SMOOTHING*rate;
+}
+
+/*
+ * Medium Error (3) and Illegal Request (5) may result from
+ * a medium read problem, but other errors are regarded as fatal.
+ * A drive reporting them is not used any further; its interval
+ * goes back into the queue for the other drives.
+ */
+
+static int fatal_error(multi_closure *mc, drive_reader *d)
+{  int key = d->dh->sense.sense_key;
+
+   if(Closure->ignoreFatalSense || !key || key == 3 || key == 5)
+     return FALSE;
+
+   PrintCLI(_("Drive %d: sector %" PRId64 ": %s\n"
+	      "Drive %d is not used any further.\n"),
+	    d->number, d->pos, GetSenseString(key, d->dh->sense.asc, d->dh->sense.ascq, FALSE),
+	    d->number);
+
+   d->retired = TRUE;
+   mc->activeDrives &= ~d->bit;
+   add_interval(mc, d->pos, d->end - d->pos, d->failed);
+   d->pos = d->end;
+
+   return TRUE;
+}
+
+static gpointer reader_thread(drive_reader *d)
+{  multi_closure *mc = d->mc;
+   int cluster_size = d->dh->clusterSize;
+   int cluster_mask = cluster_size-1;
+   gint64 single_end = 0;
+
+   g_mutex_lock(mc->lock);
+
+   while(get_work(mc, d))
+   {  while(d->pos < d->end && !Closure->stopActions)
+      {  gint64 pos = d->pos;
+	 double start_time, elapsed;
+	 int nsectors,status;
+
+	 /* Read up to the next cluster boundary,
+	    or sector by sector after a failed cluster when sectorSkip is 0. */
+
+	 if(pos < single_end)
+	      nsectors = 1;
+	 else nsectors = cluster_size - (pos & cluster_mask);
+	 if(nsectors > d->end - pos)
+	    nsectors = d->end - pos;
+
+	 d->busyEnd = pos + nsectors;
+	 g_mutex_unlock(mc->lock);
+
+	 start_time = read_clock(d);
+	 status = ReadSectors(d->dh, d->ab->buf, pos, nsectors);
+	 elapsed = read_clock(d) - start_time;
+
+	 g_mutex_lock(mc->lock);
+	 update_rate(d, status ? 0 : nsectors, elapsed);
+
+	 if(!status)
+	 {  merge_sectors(mc, d, d->ab->buf, pos, nsectors);
+	    d->pos += nsectors;
+	    continue;
+	 }
+
+	 if(fatal_error(mc, d))
+	    break;
+
+	 if(nsectors > 1 && !Closure->sectorSkip)
+	 {  single_end = pos + nsectors;
+	    continue;
+	 }
+
+	 /* Skip forward as the linear reader does, landing on a cluster
+	    boundary, and leave the skipped sectors to the other drives.
+	    The interval end may have been moved by another drive meanwhile. */
+
+	 if(pos >= single_end)
+	 {  int skip = MAX(Closure->sectorSkip, cluster_size);
+
+	    nsectors = MAX(nsectors, skip - ((pos + skip) & cluster_mask));
+	    if(nsectors > d->end - pos)
+	       nsectors = d->end - pos;
+	 }
+
+	 if(nsectors > 1)
+	    PrintCLI(_("Drive %d: sector %" PRId64 ": %s Skipping %d sectors.\n"),
+		     d->number, pos,
+		     GetSenseString(d->dh->sense.sense_key, d->dh->sense.asc, d->dh->sense.ascq, FALSE),
+		     nsectors-1);
+	 else
+	    PrintCLI(_("Drive %d: sector %" PRId64 ": %s\n"),
+		     d->number, pos,
+		     GetSenseString(d->dh->sense.sense_key, d->dh->sense.asc, d->dh->sense.ascq, FALSE));
+
+	 d->readErrors += nsectors;
+	 add_interval(mc, pos, nsectors, d->failed | d->bit);
+	 d->pos += nsectors;
+      }
+
+      release_work(mc, d);
+   }
+
+   mc->runningDrives--;
+   g_cond_broadcast(mc->workChanged);
+   g_mutex_unlock(mc->lock);
+
+   return NULL;
+}
+
+/***
+ *** Preparations
+ ***/
+
+/*
+ * Open all drives and make sure they contain the same medium.
+ * With several --sim-cd images given, the n-th "sim-cd" device
+ * simulates the n-th image.
+ */
+
+static void open_drives(multi_closure *mc)
+{  char **devices = g_strsplit(Closure->device, ",", 0);
+   char **sim_images = NULL;
+   guint8 first_fp[16];
+   int first_fp_valid = FALSE;
+   int sim_idx = 0;
+   int i;
+
+   for(mc->nDrives=0; devices[mc->nDrives]; mc->nDrives++)
+     ;
+
+   if(mc->nDrives > MAX_DRIVES)
+     Stop(_("At most %d drives can be used for reading.\n"), MAX_DRIVES);
+
+   mc->drive = g_malloc0(mc->nDrives*sizeof(drive_reader));
+
+   if(Closure->simulateCD)
+     sim_images = g_strsplit(Closure->simulateCD, ",", 0);
+
+   for(i=0; i<mc->nDrives; i++)
+   {  drive_reader *d = &mc->drive[i];
+      guint8 fp[16];
+
+      d->mc     = mc;
+      d->number = i+1;
+      d->bit    = 1<<i;
+
+      PrintLog(_("Drive %d: %s\n"), d->number, devices[i]);
+
+      if(sim_images && !strcmp(devices[i], "sim-cd"))
+      {  char *sim_cd = Closure->simulateCD;
+
+	 Closure->simulateCD = sim_images[sim_idx];
+	 if(sim_images[sim_idx+1])
+	    sim_idx++;
+	 d->medium = OpenImageFromDevice(devices[i], 0);
+	 Closure->simulateCD = sim_cd;
+      }
+      else d->medium = OpenImageFromDevice(devices[i], 0);
+
+      if(!d->medium)
+	Stop(_("Could not open %s"), devices[i]);
+
+      d->dh    = d->medium->dh;
+      d->ab    = CreateAlignedBuffer(MAX_CLUSTER_SIZE);
+      d->timer = g_timer_new();
+      mc->activeDrives |= d->bit;
+
+      /* All drives must hold the same medium (or copies of it) */
+
+      if(!i)
+      {  mc->medium  = d->medium;
+	 mc->sectors = d->dh->sectors;
+	 first_fp_valid = GetImageFingerprint(d->medium, first_fp, FINGERPRINT_SECTOR);
+	 continue;
+      }
+
+      if(d->dh->sectors != mc->sectors)
+	Stop(_("Medium in drive %d has %" PRId64 " sectors, but medium in drive 1 has %" PRId64 " sectors.\n"),
+	     d->number, d->dh->sectors, mc->sectors);
+
+      if(first_fp_valid && GetImageFingerprint(d->medium, fp, FINGERPRINT_SECTOR)
+	 && memcmp(fp, first_fp, 16))
+	Stop(_("Medium in drive %d does not match the medium in drive 1.\n"), d->number);
+   }
+
+   if(sim_images) g_strfreev(sim_images);
+   g_strfreev(devices);
+}
+
+/*
+ * Get the CRC sums from the ecc data, preferring an ecc file
+ * over ecc data in the image as the linear reader does.
+ */
+
+static void load_crc_buf(multi_closure *mc)
+{  Method *method = NULL;
+
+   OpenEccFileForImage(mc->medium, Closure->eccName, O_RDONLY, IMG_PERMS);
+
+   if(mc->medium->eccFileMethod)
+        method = mc->medium->eccFileMethod;
+   else method = mc->medium->eccMethod;
+
+   if(!method || !method->getCrcBuf)
+     return;
+
+   PrintCLI("%s (%4.4s) ... ", _("Reading CRC information from ecc data"), method->name);
+   mc->crcBuf = method->getCrcBuf(mc->medium);
+   PrintCLI(_("done.\n"));
+}
+
+/*
+ * Open the image file. Sectors already present in an existing
+ * image are marked in the readMap and not read again.
+ */
+
+static void open_image(multi_closure *mc)
+{  unsigned char buf[2048];
+   guint64 image_size;
+   gint64 s;
+
+   mc->readMap = CreateBitmap0(mc->sectors);
+   mc->crcMap  = CreateBitmap0(mc->sectors);
+
+   if(!LargeStat(Closure->imageName, &image_size))
+   {  if(!(mc->image = LargeOpen(Closure->imageName, O_RDWR | O_CREAT, IMG_PERMS)))
+	 Stop(_("Can't open %s:\n%s"),Closure->imageName,strerror(errno));
+
+      PrintLog(_("Creating new %s image.\n"),Closure->imageName);
+      return;
+   }
+
+   if(!(mc->image = LargeOpen(Closure->imageName, O_RDWR, IMG_PERMS)))
+      Stop(_("Can't open %s:\n%s"),Closure->imageName,strerror(errno));
+
+   mc->imageSectors = MIN(image_size / 2048, mc->sectors);
+
+   /* Compare the image and medium fingerprints if both are available */
+
+   if(mc->medium->fpState == 2 && mc->imageSectors > FINGERPRINT_SECTOR
+      && LargeSeek(mc->image, (gint64)(2048*FINGERPRINT_SECTOR))
+      && LargeRead(mc->image, buf, 2048) == 2048)
+   {  MarkHoleSectors(mc->image, buf, FINGERPRINT_SECTOR, 1);
+
+      if(CheckForMissingSector(buf, FINGERPRINT_SECTOR, NULL, 0) == SECTOR_PRESENT)
+      {  struct MD5Context md5ctxt;
+	 guint8 image_fp[16];
+
+	 MD5Init(&md5ctxt);
+	 MD5Update(&md5ctxt, buf, 2048);
+	 MD5Final(image_fp, &md5ctxt);
+
+	 if(memcmp(image_fp, mc->medium->imageFP, 16))
+	   Stop(_("Image file does not match the optical disc."));
+      }
+   }
+
+   PrintLog(_("Completing image %s. Only missing sectors will be read.\n"), Closure->imageName);
+
+   if(!LargeSeek(mc->image, 0))
+     Stop(_("Failed seeking to sector %" PRId64 " in image [%s]: %s"),
+	  (gint64)0, "load", strerror(errno));
+
+   for(s=0; s<mc->imageSectors; s++)
+   {  if(LargeRead(mc->image, buf, 2048) != 2048)
+	Stop(_("unexpected read error in image for sector %" PRId64),s);
+      MarkHoleSectors(mc->image, buf, s, 1);
+
+      if(CheckForMissingSector(buf, s, mc->medium->fpState == 2 ? mc->medium->imageFP : NULL,
+			       mc->medium->fpSector) != SECTOR_PRESENT)
+	continue;
+
+      if(mc->crcBuf && CheckAgainstCrcBuffer(mc->crcBuf, s, buf) == CRC_BAD)
+	   SetBit(mc->crcMap, s);
+      else SetBit(mc->readMap, s);
+   }
+}
+
+/*
+ * Queue the unread parts of the reading range.
+ */
+
+static void build_intervals(multi_closure *mc)
+{  gint64 s, start = -1;
+
+   mc->maxIntervals = 64;
+   mc->intervals = g_malloc(mc->maxIntervals*3*sizeof(gint64));
+
+   for(s=mc->firstSector; s<=mc->lastSector+1; s++)
+   {  int unread = s <= mc->lastSector && !GetBit(mc->readMap, s);
+
+      if(s <= mc->lastSector && !unread)
+	mc->present++;
+
+      if(unread && start < 0)
+	start = s;
+      if(!unread && start >= 0)
+      {  add_interval(mc, start, s-start, 0);
+	 start = -1;
+      }
+   }
+}
+
+/*
+ * Write dead sector markers for all sectors which are neither
+ * in the image nor have been read now.
+ * With --sparse-image, holes are left as they are.
+ */
+
+static void write_dead_sectors(multi_closure *mc)
+{  unsigned char buf[2048];
+   gint64 eof_sector = LargeFileSize(mc->image)/2048;
+   gint64 s;
+
+   if(Closure->sparseImage && eof_sector <= mc->lastSector)
+     FillSparseGap(mc->image, eof_sector, mc->lastSector+1,
+		   mc->medium->imageFP, FINGERPRINT_SECTOR, mc->volumeLabel);
+
+   for(s=mc->imageSectors; s<=mc->lastSector; s++)
+   {  if(s >= mc->firstSector && (GetBit(mc->readMap, s) || GetBit(mc->crcMap, s)))
+	continue;
+
+      if(Closure->sparseImage)
+      {  gint64 end;
+
+	 if(LargeIsHole(mc->image, 2048*s, &end) && end/2048 > s)
+	 {  s = MIN(end/2048, mc->lastSector+1) - 1;
+	    continue;
+	 }
+      }
+
+      CreateMissingSector(buf, s, mc->medium->imageFP, FINGERPRINT_SECTOR, mc->volumeLabel);
+      write_sectors(mc, s, buf, 1);
+   }
+}
+
+static void show_progress(multi_closure *mc)
+{  gint64 total = mc->lastSector - mc->firstSector + 1;
+   int percent;
+
+   if(mc->readOK == mc->lastReadOK)
+     return;
+   mc->lastReadOK = mc->readOK;
+
+   percent = (int)((1000*(mc->present+mc->readOK))/total);
+   PrintProgress(_("Merged: %3d.%1d%%, %" PRId64 " sectors read OK from %d drives, %d intervals queued"),
+		 percent/10, percent%10, mc->readOK, mc->nDrives, mc->nIntervals);
+}
+
+/***
+ *** Read the medium image from several drives
+ ***/
+
+void ReadMediumMulti(gpointer data)
+{  multi_closure *mc = g_malloc0(sizeof(multi_closure));
+   gint64 unreadable = 0, crc_errors = 0, s;
+   GTimer *timer = g_timer_new();
+   char *t;
+   int i;
+
+   mc->mainThread = g_thread_self();
+   RegisterCleanup(_("Reading aborted"), cleanup, mc);
+
+   if(Closure->guiMode)
+     Stop(_("Reading from several drives is only supported on the command line.\n"));
+
+   /*** Open the drives and the ecc data */
+
+   open_drives(mc);
+
+   if(mc->medium->isoInfo && mc->medium->isoInfo->volumeLabel[0])
+      mc->volumeLabel = g_strdup(mc->medium->isoInfo->volumeLabel);
+
+   load_crc_buf(mc);
+
+   /*** Prepare the image and the queue of unread intervals */
+
+   GetReadingRange(mc->sectors, &mc->firstSector, &mc->lastSector);
+   open_image(mc);
+
+   mc->lock = g_malloc(sizeof(GMutex));
+     g_mutex_init(mc->lock);
+   mc->workChanged = g_malloc(sizeof(GCond));
+     g_cond_init(mc->workChanged);
+
+   build_intervals(mc);
+
+   PrintLog(_("Reading from %d drives: %d intervals to read in sectors %" PRId64 " - %" PRId64 ".\n"),
+	    mc->nDrives, mc->nIntervals, mc->firstSector, mc->lastSector);
+
+   /*** Start one reader per drive */
+
+   for(i=0; i<mc->nDrives; i++)
+     SpinupDevice(mc->drive[i].dh);
+
+   g_timer_start(timer);
+   mc->runningDrives = mc->nDrives;
+   for(i=0; i<mc->nDrives; i++)
+   {  GError *err = NULL;
+
+      mc->drive[i].thread = g_thread_try_new("readmulti_worker", (GThreadFunc)reader_thread,
+					     (gpointer)&mc->drive[i], &err);
+      if(!mc->drive[i].thread)
+	Stop("Could not create reader thread: %s", err->message);
+   }
+
+   /*** Output the progress until all readers have finished */
+
+   g_mutex_lock(mc->lock);
+   while(mc->runningDrives)
+   {  show_progress(mc);
+      g_mutex_unlock(mc->lock);
+      g_usleep(G_USEC_PER_SEC/4);
+      g_mutex_lock(mc->lock);
+   }
+   g_mutex_unlock(mc->lock);
+
+   for(i=0; i<mc->nDrives; i++)
+   {  g_thread_join(mc->drive[i].thread);
+      mc->drive[i].thread = NULL;
+   }
+   ClearProgress();
+
+   /*** Mark the sectors nobody could read */
+
+   write_dead_sectors(mc);
+
+   for(s=mc->firstSector; s<=mc->lastSector; s++)
+     if(!GetBit(mc->readMap, s))
+     {  if(GetBit(mc->crcMap, s)) crc_errors++;
+        else                      unreadable++;
+     }
+
+   Closure->readErrors = unreadable;
+   Closure->crcErrors  = crc_errors;
+
+   /*** Print summary */
+
+   for(i=0; i<mc->nDrives; i++)
+   {  drive_reader *d = &mc->drive[i];
+
+      PrintLog(_("Drive %d: %" PRId64 " sectors merged, %" PRId64 " unreadable, %" PRId64 " CRC errors, %" PRId64 " sectors taken over from other drives%s\n"),
+	       d->number, d->readOK, d->readErrors, d->crcErrors, d->takenOver,
+	       d->retired ? _(", failed") : ".");
+      PrintSimulatedDriveStats(d->dh);
+   }
+
+   if(!unreadable && !crc_errors)
+   {  if(mc->crcBuf) t = g_strdup(_("All sectors successfully read. Checksums match."));
+      else           t = g_strdup(_("All sectors successfully read."));
+   }
+   else if(unreadable && !crc_errors)
+      t = g_strdup_printf(_("%" PRId64 " unreadable sectors."), unreadable);
+   else if(!unreadable && crc_errors)
+      t = g_strdup_printf(_("%" PRId64 " CRC errors."), crc_errors);
+   else t = g_strdup_printf(_("%" PRId64 " CRC errors, %" PRId64 " unreadable sectors."),
+			    crc_errors, unreadable);
+
+   PrintLog("\n%s\n",t);
+   g_free(t);
+
+   if(!Closure->fixedSpeedValues)
+     PrintTimeToLog(timer, "for reading.\n");
+   g_timer_destroy(timer);
+
+   if(unreadable || crc_errors)
+     exitCode = EXIT_FAILURE;
+
+   /*** Eject media */
+
+   if(Closure->eject && !unreadable)
+     for(i=0; i<mc->nDrives; i++)
+       LoadMedium(mc->drive[i].dh, FALSE);
+
+   cleanup((gpointer)mc);
+}
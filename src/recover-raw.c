@@ -189,6 +189,9 @@ void ResetRawBuffer(RawBuffer *rb)
    rb->bestFrame = 0;
    rb->bestP1 = rb->bestP2 = N_P_VECTORS;
    rb->bestQ1 = rb->bestQ2 = N_Q_VECTORS;
+
+   rb->visitedFrames = 0;
+   rb->visitedLookups = rb->visitedProbes = 0;
 }
 
 void FreeRawBuffer(RawBuffer *rb)
@@ -393,11 +396,12 @@ int CheckEDC(unsigned char *cd_frame, int xa_mode)
 
 static int simple_lec(RawBuffer *rb, unsigned char *frame, char *msg)
 {  unsigned char byte_state[rb->sampleSize];
-   unsigned char p_vector[P_VECTOR_SIZE];
-   unsigned char q_vector[Q_VECTOR_SIZE];
+   unsigned char p_vectors[N_P_VECTORS*P_VECTOR_SIZE];
+   unsigned char q_vectors[N_Q_VECTORS*Q_VECTOR_SIZE];
    unsigned char p_state[P_VECTOR_SIZE];
    int erasures[Q_VECTOR_SIZE], erasure_count;
-   int ignore[2];
+   int p_results[N_P_VECTORS];
+   int q_results[N_Q_VECTORS];
    int p_failures, q_failures;
    int p_corrected, q_corrected;
    int p,q;
@@ -409,15 +413,14 @@ static int simple_lec(RawBuffer *rb, unsigned char *frame, char *msg)
    p_failures = q_failures = 0;
    p_corrected = q_corrected = 0;
 
-   /* Perform Q-Parity error correction */
-
-   for(q=0; q<N_Q_VECTORS; q++)
-   {  int err;
+   /* Perform Q-Parity error correction.
+      We have no erasure information for Q vectors,
+      so all of them can be decoded in one go. */
 
-      /* We have no erasure information for Q vectors */
+   DecodeQVectors(rb->rt, frame, q_results, NULL, q_vectors);
 
-     GetQVector(frame, q_vector, q);
-     err = DecodePQ(rb->rt, q_vector, Q_PADDING, ignore, 0);
+   for(q=0; q<N_Q_VECTORS; q++)
+   {  int err = q_results[q];
 
      /* See what we've got */
 
@@ -427,21 +430,21 @@ static int simple_lec(RawBuffer *rb, unsigned char *frame, char *msg)
      }
      else         /* Correctable */ 
      {  if(err == 1 || err == 2) /* Store back corrected vector */ 
-	{  SetQVector(frame, q_vector, q);
+	{  SetQVector(frame, q_vectors + q*Q_VECTOR_SIZE, q);
 	   q_corrected++;
 	}
      }
    }
 
-   /* Perform P-Parity error correction */
-
-   for(p=0; p<N_P_VECTORS; p++)
-   {  int err,i;
+   /* Perform P-Parity error correction.
+      Try error correction without erasure information first. */
 
-      /* Try error correction without erasure information */
+   DecodePVectors(rb->rt, frame, p_results, NULL, p_vectors);
 
-      GetPVector(frame, p_vector, p);
-      err = DecodePQ(rb->rt, p_vector, P_PADDING, ignore, 0);
+   for(p=0; p<N_P_VECTORS; p++)
+   {  unsigned char *p_vector = p_vectors + p*P_VECTOR_SIZE;
+      int err = p_results[p];
+      int i;
 
       /* If unsuccessful, try again using erasures.
 	 Erasure information is uncertain, so try this last. */
@@ -749,12 +752,11 @@ int IterativeLEC(RawBuffer *rb)
 
 void UpdateFrameStats(RawBuffer *rb)
 {  unsigned char *new_sample = rb->rawBuf[rb->samplesRead-1];
-   unsigned char vector[Q_VECTOR_SIZE];
+   int results[N_P_VECTORS];
    int p_corr = 0;
    int p_err  = 0;
    int q_corr = 0;
    int q_err  = 0;
-   int err,eras[2];
    int p,q;
 
    /* MAYBE TODO: Try trivial corrections first, e.g.
@@ -765,10 +767,9 @@ void UpdateFrameStats(RawBuffer *rb)
       failure count since we want to pick the vector
       with the least number of defective vectors. */
 
+   DecodePVectors(rb->rt, new_sample, results, NULL, NULL);
    for(p=0; p<N_P_VECTORS; p++)
-   {  GetPVector(new_sample, vector, p);
-      err = DecodePQ(rb->rt, vector, P_PADDING, eras, 0);
-      switch(err)
+   {  switch(results[p])
       {  case 0: 
 	    break;
 	 case 1:
@@ -781,10 +782,9 @@ void UpdateFrameStats(RawBuffer *rb)
       }
    }
 
+   DecodeQVectors(rb->rt, new_sample, results, NULL, NULL);
    for(q=0; q<N_Q_VECTORS; q++)
-   {  GetQVector(new_sample, vector, q);
-      err = DecodePQ(rb->rt, vector, Q_PADDING, eras, 0);
-      switch(err)
+   {  switch(results[q])
       {  case 0: 
 	    break;
 	 case 1:
@@ -827,7 +827,7 @@ void UpdateFrameStats(RawBuffer *rb)
  * a collection of RAW frame samples.
  */
 
-int TryCDFrameRecovery(RawBuffer *rb, unsigned char *outbuf)
+static int try_cd_frame_recovery(RawBuffer *rb, unsigned char *outbuf)
 {  unsigned char *new_frame = rb->workBuf->buf;
 
    /*** Reject unplausible sectors */
@@ -1050,3 +1050,13 @@ int TryCDFrameRecovery(RawBuffer *rb, unsigned char *outbuf)
    rb->recommendedAttempts = Closure->maxReadAttempts;
    return -1;
 }
+
+int TryCDFrameRecovery(RawBuffer *rb, unsigned char *outbuf)
+{  int status;
+
+   ProfileBegin("TryCDFrameRecovery");
+   status = try_cd_frame_recovery(rb, outbuf);
+   ProfileEnd("TryCDFrameRecovery");
+
+   return status;
+}
@@ -191,6 +191,8 @@ void RS01ReadSector(Image *image, unsigned char *buf, gint64 s)
      n = LargeRead(image->file, buf, expected);
      if(n != expected)
        Stop(_("Failed reading sector %" PRId64 " in image: %s"),s,strerror(errno));
+
+     MarkHoleSectors(image->file, buf, s, 1);
   }
 }
 
@@ -208,7 +210,8 @@ void RS01ReadSector(Image *image, unsigned char *buf, gint64 s)
 #define CRCBUFSIZE (1024*256)
 
 void RS01ScanImage(Method *method, Image* image, struct MD5Context *ecc_ctxt, int mode)
-{  unsigned char buf[2048];
+{  ImageScan *scan;
+   Metrics *metrics;
    guint32 *crcbuf = NULL;
    int unrecoverable_sectors = 0;
    int crcidx = 0;
@@ -245,7 +248,11 @@ void RS01ScanImage(Method *method, Image* image, struct MD5Context *ecc_ctxt, in
    /* Prepare for scanning the image and calculating its md5sum */
 
    MD5Init(&image_md5);              /* md5sum of image file itself */
-   LargeSeek(image->file, 0);        /* rewind image file */   
+   scan = OpenImageScan(image->file, image->sectorSize,
+			image->fpState == 2 ? image->imageFP : NULL, FINGERPRINT_SECTOR,
+			NULL, NULL);
+   metrics = CreateMetrics(mode & CREATE_CRC ? "create" : "verify", 1, image->sectorSize,
+			   NULL, NULL, FALSE);
       
    if(mode & PRINT_MODE)
         msg = _("- testing sectors  : %3d%%");
@@ -258,32 +265,28 @@ void RS01ScanImage(Method *method, Image* image, struct MD5Context *ecc_ctxt, in
    /* Go through all sectors and look for the "dead sector marker" */
    
    for(s=0; s<image->sectorSize; s++)
-   {  int n,percent,err;
+   {  unsigned char *buf;
+      int n,idx,percent,err;
 
       /* Check for user interruption */
 
       if(Closure->stopActions)   
       {  image->sectorsMissing += image->sectorSize - s;
 	 if(crcbuf) g_free(crcbuf);
+	 CloseImageScan(scan);
+	 FreeMetrics(metrics);
          return;
       }
 
-      /* Read the next sector */
-
-      n = LargeRead(image->file, buf, 2048);
-      if(n != 2048)
-      {  if(s != image->sectorSize - 1 || n != image->inLast)
-         {  if(crcbuf) g_free(crcbuf);
-	    Stop(_("premature end in image (only %d bytes): %s\n"),n,strerror(errno));
-         }
-	 else /* Zero unused sectors for CRC generation */
-	    memset(buf+image->inLast, 0, 2048-image->inLast);
-      }
+      /* Get the next sector. The scan has already looked for the
+	 dead sector marker and calculated the CRC32; the unused part
+	 of the last sector is zeroed for CRC generation. */
 
-      /* Look for the dead sector marker */
+      idx = ImageScanSector(scan, s);
+      buf = scan->buf + 2048*idx;
+      n = (s == image->sectorSize - 1) ? image->inLast : 2048;
 
-      err = CheckForMissingSector(buf, s, image->fpState == 2 ? image->imageFP : NULL, 
-				  FINGERPRINT_SECTOR);
+      err = scan->missing[idx];
       if(err != SECTOR_PRESENT)
       {    current_missing = TRUE;
 	ExplainMissingSector(buf, s, err, SOURCE_IMAGE, &unrecoverable_sectors);
@@ -313,7 +316,7 @@ void RS01ScanImage(Method *method, Image* image, struct MD5Context *ecc_ctxt, in
 	 /* If creation of the CRC32 is requested, do that. */
 
 	 if(mode & CREATE_CRC)
-	 {  crcbuf[crcidx++] = Crc32(buf, 2048);
+	 {  crcbuf[crcidx++] = scan->crc[idx];
 
 	    if(crcidx >= CRCBUFSIZE)  /* write out CRC buffer contents */
 	    {  size_t size = CRCBUFSIZE*sizeof(guint32);
@@ -321,6 +324,7 @@ void RS01ScanImage(Method *method, Image* image, struct MD5Context *ecc_ctxt, in
 	       MD5Update(ecc_ctxt, (unsigned char*)crcbuf, size);
 	       if(LargeWrite(image->eccFile, crcbuf, size) != size)
 	       { if(crcbuf) g_free(crcbuf);
+		 CloseImageScan(scan);
 		 Stop(_("Error writing CRC information: %s"),strerror(errno));
 	       }
 	       crcidx = 0;
@@ -330,7 +334,7 @@ void RS01ScanImage(Method *method, Image* image, struct MD5Context *ecc_ctxt, in
 	 /* else do the CRC32 check. Missing sectors are skipped in the CRC report. */
 	 
 	 else if(s < image->expectedSectors)
-	 {  guint32 crc = Crc32(buf, 2048); 
+	 {  guint32 crc = scan->crc[idx];
 
             /* If the CRC buf is exhausted, refill. */
 
@@ -344,6 +348,7 @@ void RS01ScanImage(Method *method, Image* image, struct MD5Context *ecc_ctxt, in
 
 	       if(LargeRead(image->eccFile, crcbuf, size) != size)
 	       { if(crcbuf) g_free(crcbuf);
+		 CloseImageScan(scan);
 		 Stop(_("Error reading CRC information: %s"),strerror(errno));
 	       }
 	       crcidx = 0;
@@ -357,6 +362,7 @@ void RS01ScanImage(Method *method, Image* image, struct MD5Context *ecc_ctxt, in
       }
 
       MD5Update(&image_md5, buf, n);  /* update image md5sum */
+      MetricsSetProgress(metrics, 0, s+1, image->sectorsMissing + image->crcErrors);
 
       if(Closure->guiMode && mode & PRINT_MODE) 
 	   percent = (VERIFY_IMAGE_SEGMENTS*(s+1))/image->sectorSize;
@@ -384,6 +390,9 @@ void RS01ScanImage(Method *method, Image* image, struct MD5Context *ecc_ctxt, in
       }
    }
 
+   CloseImageScan(scan);
+   FreeMetrics(metrics);
+
    /*** Flush the rest of the CRC buffer */
 
    if((mode & CREATE_CRC) && crcidx)
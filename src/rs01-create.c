@@ -134,6 +134,7 @@ typedef struct
    unsigned char *parity;
    char *msg;
    GTimer *timer;
+   Metrics *metrics;
 } ecc_closure;
 
 static void ecc_cleanup(gpointer data)
@@ -160,6 +161,7 @@ static void ecc_cleanup(gpointer data)
    if(ec->image) CloseImage(ec->image);
    if(ec->msg)   g_free(ec->msg);
    if(ec->timer) g_timer_destroy(ec->timer);
+   if(ec->metrics) FreeMetrics(ec->metrics);
 
 #ifdef WITH_GUI_YES
    if(Closure->enableCurveSwitch)
@@ -195,6 +197,7 @@ void RS01Create(void)
    int percent = 0,max_percent,progress = 0, last_percent = -1;
    guint64 n_parity_blocks,n_layer_sectors;
    guint64 n_parity_bytes,n_layer_bytes;
+   int cache_mib;
    guint64 chunk;
    int layer;
    int loop_type = GENERIC;
@@ -416,32 +419,49 @@ void RS01Create(void)
    /*** Allocate buffers for the parity calculation and image data caching. 
 
         The algorithm builds the parity file consecutively in chunks of n_parity_blocks.
-        We use all the amount of memory allowed by cacheMiB for caching the parity blocks. */
+        We use all the amount of memory allowed by cacheMiB for caching the parity blocks,
+        as far as it is available. Should the allocation fail nevertheless,
+	we retry with half of the cache size. */
 
-   n_parity_blocks = ((guint64)Closure->cacheMiB<<20) / (guint64)nroots;
-   n_parity_blocks &= ~0x7ff;                   /* round down to multiple of 2048 */
-   n_parity_bytes  = (guint64)nroots * n_parity_blocks;
+   cache_mib = PlanMemory(_("MiB of encoder cache"), Closure->cacheMiB, 1,
+			  (1<<20) + (1<<20)/nroots, 0);
 
-   /* Each chunk of parity blocks is built iteratively by processing the data in layers
-      (first all bytes at pos 0, then pos 1, until ndata layers have been processed).
-      So one buffer of n_layer_bytes = n_parity_blocks needs to be buffered.
-      For practical reasons we require that the layer size is a multiple of the
-      medium sector size of 2048 bytes. */
+   for(;;)
+   {  n_parity_blocks = ((guint64)cache_mib<<20) / (guint64)nroots;
+      n_parity_blocks &= ~0x7ff;                   /* round down to multiple of 2048 */
+      n_parity_bytes  = (guint64)nroots * n_parity_blocks;
 
-   n_layer_bytes   = n_parity_blocks;
-   n_layer_sectors = n_parity_blocks/2048;
+      /* Each chunk of parity blocks is built iteratively by processing the data in layers
+	 (first all bytes at pos 0, then pos 1, until ndata layers have been processed).
+	 So one buffer of n_layer_bytes = n_parity_blocks needs to be buffered.
+	 For practical reasons we require that the layer size is a multiple of the
+	 medium sector size of 2048 bytes. */
 
-   if(n_layer_sectors*2048 != n_parity_blocks)
-     Stop("Internal error: parity blocks are not a multiple of sector size.\n");
+      n_layer_bytes   = n_parity_blocks;
+      n_layer_sectors = n_parity_blocks/2048;
 
-   ec->parity = g_try_malloc(n_parity_bytes);
-   ec->data   = g_try_malloc(n_layer_bytes);
+      if(n_layer_sectors*2048 != n_parity_blocks)
+	Stop("Internal error: parity blocks are not a multiple of sector size.\n");
 
-   if(!ec->parity || !ec->data)
-      Stop(_("Failed allocating memory for I/O cache.\n"
-	     "Cache size is currently %d MiB.\n"
-	     "Try reducing it.\n"),
-	   Closure->cacheMiB);
+      ec->parity = g_try_malloc(n_parity_bytes);
+      ec->data   = g_try_malloc(n_layer_bytes);
+
+      if(ec->parity && ec->data)
+	 break;
+
+      if(ec->parity) g_free(ec->parity);
+      if(ec->data) g_free(ec->data);
+      ec->parity = ec->data = NULL;
+
+      if(cache_mib <= 1)
+	 Stop(_("Failed allocating memory for I/O cache.\n"
+		"Cache size is currently %d MiB.\n"
+		"Try reducing it.\n"),
+	      Closure->cacheMiB);
+
+      cache_mib /= 2;
+      PrintLog(_("Failed allocating memory for I/O cache; retrying with %d MiB.\n"), cache_mib);
+   }
 
    /*** Setup the block counters for mapping medium sectors to ecc blocks 
         The image is divided into ndata sections;
@@ -455,6 +475,7 @@ void RS01Create(void)
    /*** Create ecc information for the medium image. */ 
 
    max_percent = ndata * ((s / n_layer_sectors) + 1);
+   ec->metrics = CreateMetrics("create", 1, ndata*s, NULL, NULL, FALSE);
    g_timer_start(ec->timer);
 
    /* Process the image.
@@ -563,6 +584,7 @@ void RS01Create(void)
 	    /* Report progress */
 
 	    progress++;
+	    MetricsAddSectors(ec->metrics, 0, actual_layer_sectors);
 	    percent = (1000*progress)/max_percent;
 	    if(last_percent != percent) 
 	    {  GuiSetProgress(wl->encPBar2, percent, 1000);
@@ -687,6 +709,7 @@ void RS01Create(void)
 	    /* Report progress */
 
 	    progress++;
+	    MetricsAddSectors(ec->metrics, 0, actual_layer_sectors);
 	    percent = (1000*progress)/max_percent;
 	    if(last_percent != percent) 
 	    {  GuiSetProgress(wl->encPBar2, percent, 1000);
@@ -981,6 +1004,7 @@ void RS01Create(void)
 	    /* Report progress */
 
 	    progress++;
+	    MetricsAddSectors(ec->metrics, 0, actual_layer_sectors);
 	    percent = (1000*progress)/max_percent;
 	    if(last_percent != percent) 
 	    {  GuiSetProgress(wl->encPBar2, percent, 1000);
@@ -1019,6 +1043,8 @@ void RS01Create(void)
    image->eccFile = NULL;
 
    PrintTimeToLog(ec->timer, "for ECC generation.\n");
+   FreeMetrics(ec->metrics);
+   ec->metrics = NULL;
 
    PrintProgress(_("Ecc generation: 100.0%%\n"));
    PrintLog(_("Error correction file \"%s\" created.\n"
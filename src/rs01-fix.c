@@ -62,6 +62,8 @@ typedef struct
    Image *image;
    int earlyTermination;
    char *msg;
+   Metrics *metrics;
+   Arena *arena;
    unsigned char *imgBlock[256];
    guint32 *crcBuf[256];
 } fix_closure;
@@ -86,13 +88,13 @@ static void fix_cleanup(gpointer data)
 
    if(fc->image) CloseImage(fc->image);
    if(fc->msg) g_free(fc->msg);
+   if(fc->metrics) FreeMetrics(fc->metrics);
 
    for(i=0; i<256; i++)
-   {  if(fc->imgBlock[i])
-         g_free(fc->imgBlock[i]);
-      if(fc->crcBuf[i])
+   {  if(fc->crcBuf[i])
 	g_free(fc->crcBuf[i]);
    }
+   if(fc->arena) FreeArena(fc->arena);
 
    if(fc->gt) FreeGaloisTables(fc->gt);
    if(fc->rt) FreeReedSolomonTables(fc->rt);
@@ -348,11 +350,15 @@ void RS01Fix(Image *image)
         We read cache_size * ndata medium sectors ahead. */
 
    cache_size = 2*Closure->cacheMiB;  /* ndata medium sectors are approx. 0.5MiB */
+   cache_size = PlanMemory(_("cached sectors per layer"), cache_size, MIN(16, cache_size),
+			   (gint64)ndata*(2048+sizeof(int)), 0);
 
+   fc->arena = CreateArena("Fix", (gsize)ndata*cache_size*2048);
    for(i=0; i<ndata; i++)
-   {  fc->imgBlock[i] = g_malloc(cache_size*2048);
+   {  fc->imgBlock[i] = ArenaAlloc(fc->arena, cache_size*2048);
       fc->crcBuf[i]   = g_malloc(sizeof(int) * cache_size);
    }
+   PrintArenaStats(fc->arena);
 
    /*** Setup the block counters for mapping medium sectors to
 	ecc blocks */
@@ -368,6 +374,8 @@ void RS01Fix(Image *image)
 
    corrected = uncorrected = 0;
    worst_ecc = damaged_ecc = damaged_sec = local_plot_max = 0;
+   fc->metrics = CreateMetrics("fix", 1, s, NULL, NULL, !Closure->guiMode);
+   fc->metrics->unitSectors = ndata;
 
    for(si=0; si<s; si++)
    { 
@@ -453,6 +461,7 @@ void RS01Fix(Image *image)
 	}
 
 	uncorrected += erasure_count;
+	MetricsAddErrors(fc->metrics, 0, erasure_count);
 	parity_block+=2048;
 
 	/* For truncated images, make sure we leave no "zero holes" in the image
@@ -480,6 +489,7 @@ void RS01Fix(Image *image)
      else  /* try to correct them */
      {  int bi;
 
+        ProfileBegin("decode_ecc_block");
         for(bi=0; bi<2048; bi++)
         {  int offset = cache_offset+bi;
 	   int r, deg_lambda, el, deg_omega;
@@ -709,6 +719,7 @@ void RS01Fix(Image *image)
 	      }
 	   }
 	}
+        ProfileEnd("decode_ecc_block");
      }
 
      /*** Report if any sectors could be recovered.
@@ -725,6 +736,9 @@ void RS01Fix(Image *image)
 
 	   /* Write the recovered sector */
 
+	   if(!PrepareSparseWrite(image->file, idx, 1, eh->mediumFP, eh->fpSector, NULL))
+	     Stop(_("could not write medium sector %" PRId64 ":\n%s"),idx,strerror(errno));
+
 	   if(!LargeSeek(image->file, (gint64)(2048*idx)))
 	     Stop(_("Failed seeking to sector %" PRId64 " in image [%s]: %s"),
 		  idx, "FW", strerror(errno));
@@ -747,25 +761,27 @@ skip:
      cache_sector++;
      cache_offset += 2048;
 
-     /* Report progress */
+     /* Report progress. The fix value plot needs one entry per mille;
+	otherwise the progress is only updated when the reporter asks for it. */
 
-     percent = (1000*(si+1))/s;
+     MetricsAddSectors(fc->metrics, 0, 1);
 
-     if(last_percent != percent) 
-     {
+     if(Closure->guiMode)
+     {  percent = (1000*(si+1))/s;
+
+        if(last_percent != percent) 
+	{
 #ifdef WITH_GUI_YES       
-        if(Closure->guiMode)
-	{  
 	   RS01AddFixValues(wl, percent, local_plot_max);
 	   local_plot_max = 0;
 
 	   RS01UpdateFixResults(wl, corrected, uncorrected);
-	}
-        else
 #endif	  
-	      PrintProgress(_("Ecc progress: %3d.%1d%%"),percent/10,percent%10);
-        last_percent = percent;
+	   last_percent = percent;
+	}
      }
+     else if(MetricsReportDue(fc->metrics))
+       PrintMetricsProgress(fc->metrics, _("Ecc progress: %3d.%1d%%"));
 
      /* Increment the block indices */
 
@@ -775,6 +791,9 @@ skip:
 
    /*** Print results */
 
+   FreeMetrics(fc->metrics);
+   fc->metrics = NULL;
+
    PrintProgress(_("Ecc progress: 100.0%%\n"));
    if(corrected > 0) PrintLog(_("Repaired sectors: %" PRId64 "     \n"),corrected);
    if(uncorrected > 0) 
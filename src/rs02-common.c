@@ -244,6 +244,8 @@ void RS02ReadSector(Image *image, RS02Layout *lay, unsigned char *buf, gint64 s)
   n = LargeRead(image->file, buf, 2048);
   if(n != 2048)
     Stop(_("Failed reading sector %" PRId64 " in image: %s"),s,strerror(errno));
+
+  MarkHoleSectors(image->file, buf, s, 1);
 }
 
 /***
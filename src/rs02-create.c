@@ -47,6 +47,7 @@ typedef struct
    char *msg;
    int earlyTermination;
    GTimer *timer;
+   Metrics *metrics;
    int checksumsReused;
 } ecc_closure;
 
@@ -82,6 +83,7 @@ static void ecc_cleanup(gpointer data)
    if(ec->parity) g_free(ec->parity);
    if(ec->msg) g_free(ec->msg);
    if(ec->timer) g_timer_destroy(ec->timer);
+   if(ec->metrics) FreeMetrics(ec->metrics);
 
    for(i=0; i<256; i++)
      if(ec->slice[i])
@@ -209,6 +211,7 @@ static void check_image(ecc_closure *ec)
       n = LargeRead(image->file, buf, expected);
       if(n != expected)
 	Stop(_("Failed reading sector %" PRId64 " in image: %s"),sectors,strerror(errno));
+      MarkHoleSectors(image->file, buf, sectors, 1);
 
       /* Look for the dead sector marker */
 
@@ -458,7 +461,8 @@ static void create_reed_solomon(ecc_closure *ec)
    int last_percent, percent, max_percent, progress;
    int layer,i,j,k;
    unsigned char *par_ptr;
-   int out_of_memory = 0;
+   int out_of_memory;
+   int cache_mib;
 static gint32 *gf_index_of;    /* These need to be static globals */
 static gint32 *rs_gpoly;       /* for optimization reasons. */
 static gint32 *enc_alpha_to;
@@ -484,42 +488,64 @@ static gint32 *enc_alpha_to;
    /*** Allocate buffers for the parity calculation and image data caching. 
 
         The algorithm builds the parity file consecutively in chunks of n_parity_blocks.
-        We use all the amount of memory allowed by cacheMiB for caching the parity blocks. */
+        We use all the amount of memory allowed by cacheMiB for caching the parity blocks,
+        as far as it is available. Should the allocation fail nevertheless,
+	we retry with half of the cache size. */
 
-   n_parity_blocks = ((guint64)Closure->cacheMiB<<20) / (guint64)nroots;  /* 1 MiB = 2^20 */
-   n_parity_blocks >>= 1;                              /* two buffer sets for scrambling */
-   n_parity_blocks &= ~0x7ff;                          /* round down to multiple of 2048 */
-   n_parity_bytes  = (guint64)nroots * n_parity_blocks;
+   cache_mib = PlanMemory(_("MiB of encoder cache"), Closure->cacheMiB, 1,
+			  (1<<20) + (1<<19)/nroots, 0);
 
-   /* Each chunk of parity blocks is built iteratively by processing the data in layers
-      (first all bytes at pos 0, then pos 1, until ndata layers have been processed).
-      So we need to buffer n_layer_bytes = n_parity_blocks of input data.
-      For practical reasons we require that the layer size is a multiple of the
-      medium sector size of 2048 bytes. */
+   for(;;)
+   {  n_parity_blocks = ((guint64)cache_mib<<20) / (guint64)nroots;  /* 1 MiB = 2^20 */
+      n_parity_blocks >>= 1;                              /* two buffer sets for scrambling */
+      n_parity_blocks &= ~0x7ff;                          /* round down to multiple of 2048 */
+      n_parity_bytes  = (guint64)nroots * n_parity_blocks;
 
-   n_layer_bytes   = n_parity_blocks;
-   n_layer_sectors = n_parity_blocks/2048;
+      /* Each chunk of parity blocks is built iteratively by processing the data in layers
+	 (first all bytes at pos 0, then pos 1, until ndata layers have been processed).
+	 So we need to buffer n_layer_bytes = n_parity_blocks of input data.
+	 For practical reasons we require that the layer size is a multiple of the
+	 medium sector size of 2048 bytes. */
 
-   if(n_layer_sectors*2048 != n_parity_blocks)
-     Stop("Internal error: parity blocks are not a multiple of sector size.\n");
+      n_layer_bytes   = n_parity_blocks;
+      n_layer_sectors = n_parity_blocks/2048;
 
-   ec->parity = g_try_malloc(n_parity_bytes);
-   ec->data   = g_try_malloc(n_layer_bytes);
+      if(n_layer_sectors*2048 != n_parity_blocks)
+	Stop("Internal error: parity blocks are not a multiple of sector size.\n");
 
-   /*** Create buffers for dividing the ecc information into nroots slices */
+      ec->parity = g_try_malloc(n_parity_bytes);
+      ec->data   = g_try_malloc(n_layer_bytes);
 
-   for(i=0; i<nroots; i++)
-   {  ec->slice[i] = g_try_malloc(n_layer_bytes);
-      if(!ec->slice[i])
-	 out_of_memory = 1;
-   }
+      /*** Create buffers for dividing the ecc information into nroots slices */
+
+      out_of_memory = 0;
+      for(i=0; i<nroots; i++)
+      {  ec->slice[i] = g_try_malloc(n_layer_bytes);
+	 if(!ec->slice[i])
+	    out_of_memory = 1;
+      }
+
+      if(!out_of_memory && ec->parity && ec->data)
+	 break;
 
-   if(out_of_memory || !ec->parity || !ec->data)
-   {  LargeTruncate(image->file, (gint64)(2048*ec->lay->dataSectors));
-      Stop(_("Failed allocating memory for I/O cache.\n"
-	     "Cache size is currently %d MiB.\n"
-	     "Try reducing it.\n"),
-	   Closure->cacheMiB);
+      if(ec->parity) g_free(ec->parity);
+      if(ec->data) g_free(ec->data);
+      ec->parity = ec->data = NULL;
+      for(i=0; i<nroots; i++)
+      {  if(ec->slice[i]) g_free(ec->slice[i]);
+	 ec->slice[i] = NULL;
+      }
+
+      if(cache_mib <= 1)
+      {  LargeTruncate(image->file, (gint64)(2048*ec->lay->dataSectors));
+	 Stop(_("Failed allocating memory for I/O cache.\n"
+		"Cache size is currently %d MiB.\n"
+		"Try reducing it.\n"),
+	      Closure->cacheMiB);
+      }
+
+      cache_mib /= 2;
+      PrintLog(_("Failed allocating memory for I/O cache; retrying with %d MiB.\n"), cache_mib);
    }
 
    /*** Setup the block counters for mapping medium sectors to ecc blocks 
@@ -539,6 +565,7 @@ static gint32 *enc_alpha_to;
    max_percent = ndata * ((lay->sectorsPerLayer / n_layer_sectors) + 1);
    progress = percent = 0;
    last_percent = -1;
+   ec->metrics = CreateMetrics("create", 1, ndata*lay->sectorsPerLayer, NULL, NULL, FALSE);
    g_timer_start(ec->timer);
 
    /* Process the image.
@@ -958,6 +985,7 @@ static gint32 *enc_alpha_to;
 	 /* Report progress */
 
 	 progress++;
+	 MetricsAddSectors(ec->metrics, 0, actual_layer_sectors);
 	 percent = (1000*progress)/max_percent;
 	 if(last_percent != percent) 
 	 {  GuiSetProgress(ec->wl->encPBar2, percent, 1000);
@@ -1007,6 +1035,9 @@ static gint32 *enc_alpha_to;
    MD5Update(&ec->md5Ctxt[0], ec->md5Sum, 16*nroots);
    MD5Final(ec->eccSum, &ec->md5Ctxt[0]);
 
+   FreeMetrics(ec->metrics);
+   ec->metrics = NULL;
+
    /*** Restore image bounds to data portion */
 
    image->sectorSize = lay->dataSectors;
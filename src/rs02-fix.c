@@ -40,12 +40,13 @@ typedef struct
    ReedSolomonTables *rt;
    int earlyTermination;
    char *msg;
+   Metrics *metrics;
+   Arena *arena;
    unsigned char *imgBlock[255];
 } fix_closure;
 
 static void fix_cleanup(gpointer data)
 {  fix_closure *fc = (fix_closure*)data;
-   int i;
 
    UnregisterCleanup();
 
@@ -61,11 +62,9 @@ static void fix_cleanup(gpointer data)
 
    if(fc->image) CloseImage(fc->image);
    if(fc->msg) g_free(fc->msg);
+   if(fc->metrics) FreeMetrics(fc->metrics);
 
-   for(i=0; i<255; i++)
-   {  if(fc->imgBlock[i])
-	 g_free(fc->imgBlock[i]); 
-   }
+   if(fc->arena) FreeArena(fc->arena);
 
    if(fc->lay) g_free(fc->lay);
 
@@ -86,11 +85,19 @@ static void expand_image(fix_closure *fc, gint64 new_size)
    int last_percent, percent;
    gint64 sectors, new_sectors;
 
+   last_percent = 0;
+   new_sectors = new_size - image->sectorSize;
+
+   /* Leave the new area as a hole with --sparse-image */
+
+   if(Closure->sparseImage
+      && FillSparseGap(image->file, image->sectorSize, new_size,
+		       fc->eh->mediumFP, FINGERPRINT_SECTOR, "RS02 fix placeholder"))
+     new_sectors = 0;
+
    if(!LargeSeek(image->file, image->file->size))
      Stop(_("Failed seeking to end of image: %s\n"), strerror(errno));
 
-   last_percent = 0;
-   new_sectors = new_size - image->sectorSize;
    for(sectors = 0; sectors < new_sectors; sectors++)
    {  unsigned char buf[2048];
       int n;
@@ -299,9 +306,13 @@ void RS02Fix(Image *image)
 	giving a total cache size of 255*cache_size. */
 
    cache_size = 2*Closure->cacheMiB;  /* ndata+nroots=255 medium sectors are approx. 0.5MiB */
+   cache_size = PlanMemory(_("cached sectors per layer"), cache_size, MIN(16, cache_size),
+			   255*2048, 0);
 
+   fc->arena = CreateArena("Fix", (gsize)255*cache_size*2048);
    for(i=0; i<255; i++)
-      fc->imgBlock[i] = g_malloc(cache_size*2048);
+      fc->imgBlock[i] = ArenaAlloc(fc->arena, cache_size*2048);
+   PrintArenaStats(fc->arena);
 
    /*** Setup the block counters for mapping medium sectors to ecc blocks.
         Error correction begins at lay->CrcLayerIndex so that we have a chance
@@ -325,6 +336,8 @@ void RS02Fix(Image *image)
    /*** Test ecc blocks and attempt error correction */
 
    last_percent = -1;
+   fc->metrics = CreateMetrics("fix", 1, lay->sectorsPerLayer, NULL, NULL, !Closure->guiMode);
+   fc->metrics->unitSectors = lay->ndata;
 
    for(s=0; s<lay->sectorsPerLayer; s++)
    { gint64 si = (s + lay->firstCrcLayerIndex) % lay->sectorsPerLayer;
@@ -382,6 +395,7 @@ void RS02Fix(Image *image)
 
 	      if(LargeRead(image->file, fc->imgBlock[i+ndata]+offset, 2048) != 2048)
 		Stop(_("Failed reading sector %" PRId64 " in image: %s"), esi, strerror(errno));
+	      MarkHoleSectors(image->file, fc->imgBlock[i+ndata]+offset, esi, 1);
 
 	      offset += 2048;
 	   }
@@ -416,6 +430,7 @@ void RS02Fix(Image *image)
 	
 		if(LargeRead(image->file, crc_buf, 2048) != 2048)
 		  Stop(_("problem reading crc data: %s"), strerror(errno));
+		MarkHoleSectors(image->file, (unsigned char*)crc_buf, crc_sector_byte/2048, 1);
 
 		err = CheckForMissingSector((unsigned char*)crc_buf, crc_sector_byte/2048,
 					    eh->mediumFP, eh->fpSector);
@@ -473,11 +488,13 @@ void RS02Fix(Image *image)
 	}
 
 	uncorrected += erasure_count;
+	MetricsAddErrors(fc->metrics, 0, erasure_count);
 	goto skip;
      }
 
      /* Build ecc block and attempt to correct it */
 
+     ProfileBegin("decode_ecc_block");
      for(bi=0; bi<2048; bi++)  /* Run through each ecc block byte */
      {  int offset = cache_offset+bi;
         int r, deg_lambda, el, deg_omega;
@@ -629,6 +646,8 @@ void RS02Fix(Image *image)
 	   }
 	   PrintLog("\n");
 	   uncorrected += erasure_count;
+	   MetricsAddErrors(fc->metrics, 0, erasure_count);
+	   ProfileEnd("decode_ecc_block");
 	   goto skip;
 	}
 
@@ -706,6 +725,7 @@ void RS02Fix(Image *image)
 	   }
 	}
      }
+     ProfileEnd("decode_ecc_block");
 
      /* Write corrected sectors back to disk
         and report them */
@@ -746,6 +766,9 @@ void RS02Fix(Image *image)
 
 	   /* Write the recovered sector */
 
+	   if(!PrepareSparseWrite(image->file, sec, 1, fc->eh->mediumFP, FINGERPRINT_SECTOR, NULL))
+	     Stop(_("could not write medium sector %" PRId64 ":\n%s"), sec, strerror(errno));
+
 	   if(!LargeSeek(image->file, (gint64)(2048*sec)))
 	     Stop(_("Failed seeking to sector %" PRId64 " in image [%s]: %s"),
 		  sec, "FW", strerror(errno));
@@ -779,12 +802,15 @@ skip:
      cache_sector++;
      cache_offset += 2048;
 
-     /* Report progress */
+     /* Report progress. The fix value plot needs one entry per mille;
+	otherwise the progress is only updated when the reporter asks for it. */
+
+     MetricsAddSectors(fc->metrics, 0, 1);
 
-     percent = (1000*s)/lay->sectorsPerLayer;
+     if(Closure->guiMode)
+     {  percent = (1000*s)/lay->sectorsPerLayer;
 
-     if(last_percent != percent) 
-     {  if(Closure->guiMode)
+        if(last_percent != percent) 
 	{
 #ifdef WITH_GUI_YES
 	   RS02AddFixValues(wl, percent, local_plot_max);
@@ -793,10 +819,11 @@ skip:
 	   //if(last_corrected != corrected || last_uncorrected != uncorrected) 
 	   RS02UpdateFixResults(wl, corrected, uncorrected);
 #endif
+	   last_percent = percent;
 	}
-        else PrintProgress(_("Ecc progress: %3d.%1d%%"),percent/10,percent%10);
-        last_percent = percent;
      }
+     else if(MetricsReportDue(fc->metrics))
+       PrintMetricsProgress(fc->metrics, _("Ecc progress: %3d.%1d%%"));
 
      /* Increment the block indices */
 
@@ -808,6 +835,9 @@ skip:
 
    /*** Print results */
 
+   FreeMetrics(fc->metrics);
+   fc->metrics = NULL;
+
    PrintProgress(_("Ecc progress: 100.0%%\n"));
 
    if(corrected > 0) PrintLog(_("Repaired sectors: %" PRId64 " (%" PRId64 " data, %" PRId64 " ecc)\n"),
@@ -350,6 +350,8 @@ typedef struct
    RS02Layout *lay;
    RS02Widgets *wl;
    Bitmap *map;
+   ImageScan *scan;
+   Metrics *metrics;
    guint32 *crcBuf;
    gint8   *crcValid;
    unsigned char crcSum[16];
@@ -362,6 +364,8 @@ static void cleanup(gpointer data)
 
    GuiAllowActions(TRUE);
 
+   if(cc->scan) CloseImageScan(cc->scan);
+   if(cc->metrics) FreeMetrics(cc->metrics);
    if(cc->image) CloseImage(cc->image);
    if(cc->lay) g_free(cc->lay);
    if(cc->map) FreeBitmap(cc->map);
@@ -438,6 +442,7 @@ static void read_crc(verify_closure *cc, RS02Layout *lay)
  
 	       if(LargeRead(cc->image->file, crc_buf, 2048) != 2048)
 		  Stop(_("problem reading crc data: %s"), strerror(errno));
+	       MarkHoleSectors(cc->image->file, (unsigned char*)crc_buf, crc_sector, 1);
 
 	       err = CheckForMissingSector((unsigned char*)crc_buf, crc_sector, eh->mediumFP, eh->fpSector);
 	       if(err != SECTOR_PRESENT)
@@ -554,7 +559,6 @@ void RS02Verify(Image *image)
    char data_digest[33], hdr_digest[33], digest[33];
    gint64 s, crc_idx;
    int last_percent = 0;
-   unsigned char buf[2048];
    gint64 first_missing, last_missing;
    gint64 total_missing = 0;
    gint64 data_missing = 0;
@@ -696,8 +700,9 @@ void RS02Verify(Image *image)
    /*** Check the data portion of the image file for the
 	"dead sector marker" and CRC errors */
    
-   if(!LargeSeek(image->file, 0))
-     Stop(_("Failed seeking to start of image: %s\n"), strerror(errno));
+   cc->scan = OpenImageScan(image->file, expected_sectors, eh->mediumFP, eh->fpSector,
+			    NULL, "padding beyond the image");
+   cc->metrics = CreateMetrics("verify", 1, expected_sectors, NULL, NULL, FALSE);
 
    MD5Init(&image_md5);
    MD5Init(&ecc_md5);
@@ -710,7 +715,8 @@ void RS02Verify(Image *image)
    ecc_slice  = 0;
 
    for(s=0; s<expected_sectors; s++)
-   {  int percent,current_missing;
+   {  unsigned char *buf;
+      int idx,percent,current_missing;
       int defective = 0;
 
       /* Check for user interruption */
@@ -724,14 +730,11 @@ void RS02Verify(Image *image)
          goto terminate;
       }
 
-      /* Read the next sector */
+      /* Get the next sector; a truncated image is padded
+	 with dead sector markers by the scan. */
 
-      if(s < image->sectorSize)  /* image may be truncated */
-      {  int n = LargeRead(image->file, buf, 2048);
-         if(n != 2048)
-	    Stop(_("premature end in image (only %d bytes): %s\n"),n,strerror(errno));
-      }
-      else CreateMissingSector(buf, s, eh->mediumFP, eh->fpSector, "padding beyond the image");
+      idx = ImageScanSector(cc->scan, s);
+      buf = cc->scan->buf + 2048*idx;
 
       if(s < lay->dataSectors)
       {  if(s < lay->dataSectors - 1)
@@ -741,7 +744,7 @@ void RS02Verify(Image *image)
 
       /* Look for the dead sector marker */
 
-      current_missing = CheckForMissingSector(buf, s, eh->mediumFP, eh->fpSector);
+      current_missing = cc->scan->missing[idx];
       if(current_missing != SECTOR_PRESENT)
 	ExplainMissingSector(buf, s, current_missing, SOURCE_IMAGE, &unrecoverable_sectors);
 
@@ -771,7 +774,7 @@ void RS02Verify(Image *image)
 	 test its CRC sum */
 
       if(s < lay->dataSectors && !current_missing)
-      {  guint32 crc = Crc32(buf, 2048);
+      {  guint32 crc = cc->scan->crc[idx];
 
 	 if(cc->crcValid[crc_idx] && crc != cc->crcBuf[crc_idx])
 	 {  PrintCLI(_("* CRC error, sector: %" PRId64 "\n"), s);
@@ -800,6 +803,8 @@ void RS02Verify(Image *image)
 	 }
       }
 
+      MetricsSetProgress(cc->metrics, 0, s+1, total_missing + data_crc_errors);
+
       if(Closure->guiMode) 
 	    percent = (VERIFY_IMAGE_SEGMENTS*(s+1))/expected_sectors;
       else  percent = (100*(s+1))/expected_sectors;
@@ -831,6 +836,11 @@ void RS02Verify(Image *image)
       }
    }
 
+   CloseImageScan(cc->scan);
+   cc->scan = NULL;
+   FreeMetrics(cc->metrics);
+   cc->metrics = NULL;
+
    /* Complete damage summary */
 
    if(Closure->guiMode)
@@ -337,6 +337,7 @@ void RS03ReadSectors(Image *image, RS03Layout *lay, unsigned char *buf,
 
    /* All sectors are consecutively readable in image case */
    
+   ProfileBegin("RS03ReadSectors");
    if(!LargeSeek(target_file, (gint64)(2048*start_sector)))
       Stop(_("Failed seeking to sector %" PRId64 " in image: %s"),
 	   start_sector, strerror(errno));
@@ -345,6 +346,9 @@ void RS03ReadSectors(Image *image, RS03Layout *lay, unsigned char *buf,
    if(n != byte_size)
       Stop(_("Failed reading sector %" PRId64 " in image: %s"),
 	   start_sector, strerror(errno));
+
+   MarkHoleSectors(target_file, buf, start_sector, (byte_size+2047)/2048);
+   ProfileEnd("RS03ReadSectors");
 }
 
 /***
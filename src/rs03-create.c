@@ -66,6 +66,33 @@
  *** Local data package used during encoding
  ***/
 
+/* Per encoder thread bookkeeping. Each encoder only writes into its own
+   entry; padding keeps the entries on separate cache lines.
+   Progress and waiting times are counted in ec->metrics. */
+
+typedef struct
+{  gint batches;            /* number of work batches processed */
+   gint node;               /* placement node index or -1 */
+   char pad[56];
+} encoder_stats;
+
+/* One stage of the reader/encoder/writer pipeline */
+
+#define MAX_RING_DEPTH 8
+
+enum { BUFFER_FREE, BUFFER_READ, BUFFER_ENCODED };
+
+typedef struct
+{  unsigned char **data;    /* ndata layers; the last one holds the CRCs */
+   guint32 *crc;            /* only an alias pointer into data! */
+   unsigned char **mmapBase;/* mmap() works on multiples of page sizes */
+   guint64 *mmapSize;       /* so the mmap area might differ from sector range */
+   unsigned char **slice;   /* parity divided into nroots slices */
+   guint64 chunk;           /* first layer sector held in this buffer */
+   guint64 layerSectors;    /* last chunk maybe smaller than chunkSize */
+   int state;               /* BUFFER_FREE -> _READ -> _ENCODED -> _FREE */
+} chunk_buffer;
+
 typedef struct
 {  Method *self;
    Image *image;
@@ -77,39 +104,42 @@ typedef struct
    ReedSolomonTables *rt;
 
    guint32 pageSize;           /* needed for memory mapping */
-   unsigned char **ioData;     /* shared buffers between IO and RS threads */
-   guint32 *ioCrc;             /* only an alias pointer into data! */
-   unsigned char **ioMmapBase; /* mmap() works on multiples of page sizes */
-   guint64 *ioMmapSize;        /* so the mmap area might differ from sector range */
-   unsigned char **encoderData;/* shared buffers between IO and RS threads */
-   guint32 *encoderCrc;        /* only an alias pointer into data! */
-   unsigned char **encoderMmapBase;
-   guint64 *encoderMmapSize;
-   unsigned char *paritybase;
-   unsigned char *parity;
+   chunk_buffer *ring;         /* buffers passed between reader, encoders and writer */
+   int ringDepth;
+   Arena *arena;               /* holds the data and slice buffers of the ring */
+   guint64 chunkCount;         /* number of chunks in the image */
+   unsigned char **encoderData;/* alias pointers into the chunk being encoded */
+   guint32 *encoderCrc;
    unsigned char **slice;
-   int slicesFree;          /* flag for sharing it between IO and encoder */
    guint32 *firstCrc;       /* storage for first CRC block */
    guint64 chunkSize;       /* we can process this much layer sectors at a time */
    guint64 chunkBytes;      /* 2048 * above */
 
-   /* The IO and encoder threads are working interleaved.
-      Each one keeps track of its state in a separate data set. */
-   
-   guint64 ioChunk;         /* chunk we are currently working on */
+   /* The chunk currently processed by the encoders */
+
    guint64 encoderChunk; 
-   guint64 flushChunk; 
-   guint64 ioLayerSectors;  /* last layer maybe smaller than chunkSize */
    guint64 encoderLayerSectors;  
-   guint64 flushLayerSectors;  
+   guint64 encodeIndex;     /* number of chunks handed to the encoders so far */
+   int encoding;            /* encoders are busy with a chunk */
+   guint64 chunksWritten;   /* number of chunks saved by the writer */
+   GThread *writer;
+   char *writeError;        /* left by the writer for the IO thread */
 
    GMutex *lock;            /* lock on this struct */
-   GCond *ioCond;           /* sync between encoder and IO threads */
+   GCond *ioCond;           /* writer tells the IO thread that a buffer is free */
+   GCond *workCond;         /* encoders wait here for the next chunk */
+   GCond *writeCond;        /* encoders tell the writer that a chunk is done */
    GTimer *avgTimer;        /* total (=average encoding timer) */
    GTimer *contTimer;       /* continuous timing */
    guint64 sectorsToEncode; /* total number of sector to encode */
-   int buffersToEncode;     /* number of unprocessed buffers */
-   int nextBufferIndex;     /* next buffer which needs to be encoded */
+   gint buffersToEncode;    /* number of unprocessed buffers (atomic) */
+   gint nextBufferIndex;    /* next buffer which needs to be encoded (atomic) */
+   int chunkGeneration;     /* incremented for each chunk handed to the encoders */
+   int batchSize;           /* buffers claimed by an encoder at once */
+   encoder_stats *stats;    /* per encoder counters, cache line aligned */
+   void *statsBase;
+   Metrics *metrics;        /* progress of the encoders */
+   CodecPlacement *placement; /* only when threads are to be pinned */
    GThread *thread[MAX_CODEC_THREADS];
    char *msg;
    int earlyTermination;
@@ -119,12 +149,28 @@ typedef struct
    int progress;            /* for the status gauge / message */
    int lastProgress;
    int lastPercent;
-   int cpuBound,ioBound;
 } ecc_closure;
 
+/* Stop the writer thread before touching the output file
+   from somewhere else. */
+
+static void stop_writer(ecc_closure *ec)
+{
+   if(!ec->writer)
+      return;
+
+   g_mutex_lock(ec->lock);
+   ec->abortImmediately = TRUE;
+   g_cond_signal(ec->writeCond);
+   g_mutex_unlock(ec->lock);
+
+   g_thread_join(ec->writer);
+   ec->writer = NULL;
+}
+
 static void ecc_cleanup(gpointer data)
 {  ecc_closure *ec = (ecc_closure*)data;
-   int i;
+   int i,j;
 
    UnregisterCleanup();
 
@@ -136,7 +182,7 @@ static void ecc_cleanup(gpointer data)
       /* Nudge workers to wake up and abort */
 
       g_mutex_lock(ec->lock);
-      g_cond_broadcast(ec->ioCond);
+      g_cond_broadcast(ec->workCond);
       g_mutex_unlock(ec->lock);
 
       /* Wait for all worker to exit */
@@ -146,6 +192,8 @@ static void ecc_cleanup(gpointer data)
 	 fflush(stdout);
       }
    }
+   stop_writer(ec);
+   if(ec->metrics) FreeMetrics(ec->metrics);
 
    if(ec->earlyTermination)
    {  GuiSetLabelText(ec->wl->encFootline,
@@ -166,6 +214,8 @@ static void ecc_cleanup(gpointer data)
    /*** Clean up */
 
    if(ec->image) CloseImage(ec->image);
+   if(Closure->eccTarget == ECC_IMAGE && ec->writeHandle)
+      LargeClose(ec->writeHandle);
    if(ec->lock)
    {  g_mutex_clear(ec->lock);
       g_free(ec->lock);
@@ -174,56 +224,50 @@ static void ecc_cleanup(gpointer data)
    {  g_cond_clear(ec->ioCond);
       g_free(ec->ioCond);
    }
+   if(ec->workCond)
+   {  g_cond_clear(ec->workCond);
+      g_free(ec->workCond);
+   }
+   if(ec->writeCond)
+   {  g_cond_clear(ec->writeCond);
+      g_free(ec->writeCond);
+   }
+   if(ec->writeError) g_free(ec->writeError);
+   if(ec->statsBase) g_free(ec->statsBase);
    if(ec->eh) g_free(ec->eh);
    if(ec->eh_le) g_free(ec->eh_le);
    if(ec->rt) FreeReedSolomonTables(ec->rt);
    if(ec->gt) FreeGaloisTables(ec->gt);
-   if(ec->paritybase) g_free(ec->paritybase);
+   if(ec->placement) FreeCodecPlacement(ec->placement);
    if(ec->msg) g_free(ec->msg);
    if(ec->avgTimer) g_timer_destroy(ec->avgTimer);
    if(ec->contTimer) g_timer_destroy(ec->contTimer);
    if(ec->firstCrc) g_free(ec->firstCrc);
 
+   for(j=0; ec->ring && j<ec->ringDepth; j++)
+   {  chunk_buffer *cb = &ec->ring[j];
+
 #ifdef HAVE_MMAP
-   if(Closure->encodingIOStrategy == IO_STRATEGY_MMAP)
-   {  if(ec->lay)
+      if(cb->mmapBase)
       {  for(i=0; i<ec->lay->ndata-1; i++)
-	 {  if(ec->ioMmapBase && ec->ioMmapBase[i])
-	    {  if(munmap(ec->ioMmapBase[i], ec->ioMmapSize[i]) == -1)
-		  Stop("munmap() failed: %s\n", strerror(errno));
-	       ec->ioData[i] = NULL;
-	       ec->ioMmapBase[i] = NULL;
-	    }
-
-	    if(ec->encoderMmapBase && ec->encoderMmapBase[i])
-	    {  if(munmap(ec->encoderMmapBase[i], ec->encoderMmapSize[i]) == -1)
+	    if(cb->mmapBase[i])
+	    {  if(munmap(cb->mmapBase[i], cb->mmapSize[i]) == -1)
 		  Stop("munmap() failed: %s\n", strerror(errno));
-	       ec->encoderData[i] = NULL;
-	       ec->encoderMmapBase[i] = NULL;
+	       cb->data[i] = NULL;
+	       cb->mmapBase[i] = NULL;
 	    }
-	 }
+	 g_free(cb->mmapBase);
+	 g_free(cb->mmapSize);
       }
-      g_free(ec->ioMmapBase);
-      g_free(ec->ioMmapSize);
-      g_free(ec->encoderMmapBase);
-      g_free(ec->encoderMmapSize);
-   }
 #endif
 
-   if(ec->lay) g_free(ec->lay);
-
-   for(i=0; i<256; i++)
-   {  if(ec->slice && ec->slice[i])
-         g_free(ec->slice[i]);
-      if(ec->ioData && ec->ioData[i])
-         g_free(ec->ioData[i]);
-      if(ec->encoderData && ec->encoderData[i])
-         g_free(ec->encoderData[i]);
+      if(cb->slice) g_free(cb->slice);
+      if(cb->data) g_free(cb->data);
    }
+   if(ec->ring) g_free(ec->ring);
+   if(ec->arena) FreeArena(ec->arena);
 
-   if(ec->slice)  g_free(ec->slice);
-   if(ec->ioData) g_free(ec->ioData);
-   if(ec->encoderData) g_free(ec->encoderData);
+   if(ec->lay) g_free(ec->lay);
    g_free(ec);
 
    GuiExitWorkerThread();
@@ -239,6 +283,8 @@ static void ecc_cleanup(gpointer data)
 
 static void abort_encoding(ecc_closure *ec, int truncate)
 {  
+   stop_writer(ec);
+
    if(truncate && ec->lay)
    {  if(Closure->eccTarget == ECC_FILE)
 	 LargeUnlink(Closure->eccName);
@@ -562,41 +608,32 @@ static void prepare_crc_block(ecc_closure *ec, CrcBlock *cb)
  * Calculate the Reed-Solomon error correction code
  */
 
-/* The IO thread. Reads the image sectors and dispatches them to the
-   Reed-Solomon encoder threads. Does also collect and write out the CRC and
-   parity sectors. */
-
-static void flip_buffers(ecc_closure *ec)
-{  unsigned char **dtmp;
-   guint32 *ctmp;
-   guint64 *etmp;
+/* The image is processed in chunks which travel through a ring of
+   chunk buffers: The IO thread reads chunk n+1 while the encoder threads
+   work on chunk n and the writer thread saves CRC and parity of chunk n-1.
+   Each buffer is owned by exactly one of these stages, as recorded in
+   its state; state transitions are protected by ec->lock. */
 
-   ctmp = ec->ioCrc;  ec->ioCrc  = ec->encoderCrc;  ec->encoderCrc  = ctmp;
-   dtmp = ec->ioData; ec->ioData = ec->encoderData; ec->encoderData = dtmp;
-   dtmp = ec->ioMmapBase; ec->ioMmapBase = ec->encoderMmapBase; ec->encoderMmapBase = dtmp;
-   etmp = ec->ioMmapSize; ec->ioMmapSize = ec->encoderMmapSize; ec->encoderMmapSize = etmp;
-}
-
-static void read_next_chunk(ecc_closure *ec, guint64 chunk)
+static void read_next_chunk(ecc_closure *ec, chunk_buffer *cb, guint64 chunk)
 {  RS03Layout *lay = ec->lay;
    int layer;
 
    /* The last chunk may contain fewer sectors. */
 
-   ec->ioChunk = chunk;
-   if(ec->ioChunk+ec->chunkSize < lay->sectorsPerLayer)
-      ec->ioLayerSectors = ec->chunkSize;
-   else 
-   {  ec->ioLayerSectors = lay->sectorsPerLayer-ec->ioChunk;
-      verbose("NOTE: actual_layer_sectors %d\n", ec->ioLayerSectors);
+   cb->chunk = chunk;
+   if(cb->chunk+ec->chunkSize < lay->sectorsPerLayer)
+      cb->layerSectors = ec->chunkSize;
+   else
+   {  cb->layerSectors = lay->sectorsPerLayer-cb->chunk;
+      verbose("NOTE: actual_layer_sectors %d\n", cb->layerSectors);
    }
 
-   memset(ec->ioCrc, 0, ec->chunkBytes);
+   memset(cb->crc, 0, ec->chunkBytes);
 
    /* Read the next layers of the current chunk. */
 
    for(layer=0; layer<lay->ndata-1; layer++) /* exclude CRC layer */
-   {  guint64 first_sec = layer*lay->sectorsPerLayer+ec->ioChunk;
+   {  guint64 first_sec = layer*lay->sectorsPerLayer+cb->chunk;
       guint64 error_sec;
       int err=0;
 #ifdef HAVE_MMAP
@@ -614,11 +651,11 @@ static void read_next_chunk(ecc_closure *ec, guint64 chunk)
 
 #ifdef HAVE_MMAP
       if(Closure->encodingIOStrategy == IO_STRATEGY_MMAP)
-      {  if(ec->ioMmapBase[layer])
-	 {  if(munmap(ec->ioMmapBase[layer], ec->ioMmapSize[layer]) == -1)
+      {  if(cb->mmapBase[layer])
+	 {  if(munmap(cb->mmapBase[layer], cb->mmapSize[layer]) == -1)
 	       Stop("munmap() failed: %s\n", strerror(errno));
-	    ec->ioMmapBase[layer] = NULL;
-	    ec->ioData[layer] = NULL;
+	    cb->mmapBase[layer] = NULL;
+	    cb->data[layer] = NULL;
 	 }
 
 	 /* There is a padding area between the last data sector and the
@@ -630,52 +667,53 @@ static void read_next_chunk(ecc_closure *ec, guint64 chunk)
 	    padding sectors in memory). */
 
 	 if(Closure->eccTarget == ECC_FILE
-	    && RS03SectorIndex(lay, layer, ec->ioChunk+ec->ioLayerSectors) 
+	    && RS03SectorIndex(lay, layer, cb->chunk+cb->layerSectors)
 	    >= lay->dataSectors)
-	 {  guint64 n_sectors = ec->ioLayerSectors;
+	 {  guint64 n_sectors = cb->layerSectors;
 
-	    if(!ec->ioData[layer])
-	       ec->ioData[layer] = g_malloc(ec->chunkBytes+2048);
+	    if(!cb->data[layer])
+	       cb->data[layer] = ArenaAlloc(ec->arena, ec->chunkBytes+2048);
 
-	    if(ec->ioChunk+ec->ioLayerSectors < lay->sectorsPerLayer)
+	    if(cb->chunk+cb->layerSectors < lay->sectorsPerLayer)
 	       n_sectors++;
 
-	    RS03ReadSectors(ec->image, lay, ec->ioData[layer], 
-			    layer, ec->ioChunk, n_sectors, RS03_READ_DATA);
+	    RS03ReadSectors(ec->image, lay, cb->data[layer],
+			    layer, cb->chunk, n_sectors, RS03_READ_DATA);
 	 }
 	 else /* can use memory mapping */
 	 {
-	    page_offset = 2048*RS03SectorIndex(lay, layer, ec->ioChunk);
+	    page_offset = 2048*RS03SectorIndex(lay, layer, cb->chunk);
 	    shift = page_offset % ec->pageSize;
 	    page_offset -= shift;
-	    
-	    if(ec->ioLayerSectors == ec->chunkSize)
-	         ec->ioMmapSize[layer] = 2048*ec->ioLayerSectors + 2048 + shift;
-	    else ec->ioMmapSize[layer] = 2048*ec->ioLayerSectors + shift;
-
-	    ec->ioMmapBase[layer] = mmap(NULL, ec->ioMmapSize[layer],
-					 PROT_READ, MMAP_FLAGS,
-					 ec->image->file->fileHandle, 
-					 page_offset);
-	    if(ec->ioMmapBase[layer] == MAP_FAILED)
+
+	    if(cb->layerSectors == ec->chunkSize)
+	         cb->mmapSize[layer] = 2048*cb->layerSectors + 2048 + shift;
+	    else cb->mmapSize[layer] = 2048*cb->layerSectors + shift;
+
+	    cb->mmapBase[layer] = mmap(NULL, cb->mmapSize[layer],
+				       PROT_READ, MMAP_FLAGS,
+				       ec->image->file->fileHandle,
+				       page_offset);
+	    if(cb->mmapBase[layer] == MAP_FAILED)
 	       Stop(_("Failed mmap()ing layer %d: %s\n"), layer, strerror(errno));
 
-	    ec->ioData[layer] = ec->ioMmapBase[layer]+shift;
+	    cb->data[layer] = cb->mmapBase[layer]+shift;
 	 }
       }
       else
 #endif /* HAVE_MMAP */
       {
-	 RS03ReadSectors(ec->image, lay, ec->ioData[layer], 
-			 layer, ec->ioChunk, ec->ioLayerSectors, RS03_READ_DATA);
+	 RS03ReadSectors(ec->image, lay, cb->data[layer],
+			 layer, cb->chunk, cb->layerSectors, RS03_READ_DATA);
       }
 
-      err = CheckForMissingSectors(ec->ioData[layer], first_sec, 
-				   lay->eh->mediumFP, lay->eh->fpSector, 
-				   ec->ioLayerSectors, &error_sec);
+      err = CheckForMissingSectors(cb->data[layer], first_sec,
+				   lay->eh->mediumFP, lay->eh->fpSector,
+				   cb->layerSectors, &error_sec);
 
       if(err != SECTOR_PRESENT)
       {   /* Remove partial ecc data */
+	  stop_writer(ec);
 	  if(Closure->eccTarget == ECC_FILE)
 	  {  LargeClose(ec->image->eccFile);
 	     ec->image->eccFile = ec->writeHandle = NULL;
@@ -701,16 +739,16 @@ static void read_next_chunk(ecc_closure *ec, guint64 chunk)
 
       /* One sector more to chain back the CRC sums
          (unless we are already in the last chunk).
-         Additional space is provided in the ec->ioData buffer. */
+         Additional space is provided in the cb->data buffer. */
 
 #ifdef HAVE_MMAP
       if(Closure->encodingIOStrategy == IO_STRATEGY_READWRITE)
       {
 #endif
-	 if(ec->ioChunk+ec->ioLayerSectors < lay->sectorsPerLayer)
-	 {  
-	    RS03ReadSectors(ec->image, lay, ec->ioData[layer]+ec->chunkBytes, 
-			    layer, ec->ioChunk+ec->ioLayerSectors, 1, RS03_READ_DATA);
+	 if(cb->chunk+cb->layerSectors < lay->sectorsPerLayer)
+	 {
+	    RS03ReadSectors(ec->image, lay, cb->data[layer]+ec->chunkBytes,
+			    layer, cb->chunk+cb->layerSectors, 1, RS03_READ_DATA);
 	 }
 #ifdef HAVE_MMAP
       }
@@ -718,28 +756,34 @@ static void read_next_chunk(ecc_closure *ec, guint64 chunk)
    } /* all layers from chunk finished */
 }
 
-static void flush_crc(ecc_closure *ec, LargeFile *file_out)
+/* The writer thread must not call Stop() itself as the cleanup would
+   wait for it; it leaves the error message for the IO thread instead. */
+
+static int flush_crc(ecc_closure *ec, chunk_buffer *cb, LargeFile *file_out)
 {  RS03Layout *lay = ec->lay;
    gint64 crc_sect;
    gint64 i;
 
    /* Write out the CRC layer */
-      
+
    verbose("%s", "IO: writing CRC layer\n");
-   crc_sect = 2048*(ec->encoderChunk+lay->firstCrcPos);
+   crc_sect = 2048*(cb->chunk+lay->firstCrcPos);
    if(!LargeSeek(file_out, crc_sect))
-   {  ec->abortImmediately = TRUE;
-
-      Stop(_("Failed seeking to sector %" PRId64 " in image: %s"), crc_sect, strerror(errno));
+   {  ec->writeError = g_strdup_printf(_("Failed seeking to sector %" PRId64 " in image: %s"),
+					 crc_sect, strerror(errno));
+      return FALSE;
    }
-   for(i=0; i<ec->encoderLayerSectors; i++)
-      if(LargeWrite(file_out, ec->encoderCrc+512*i, 2048) != 2048)
-      {  ec->abortImmediately = TRUE;
-	 Stop(_("Failed writing to sector %" PRId64 " in image: %s"), crc_sect, strerror(errno));
+   for(i=0; i<cb->layerSectors; i++)
+      if(LargeWrite(file_out, cb->crc+512*i, 2048) != 2048)
+      {  ec->writeError = g_strdup_printf(_("Failed writing to sector %" PRId64 " in image: %s"),
+					    crc_sect, strerror(errno));
+	 return FALSE;
       }
+
+   return TRUE;
 }
 
-static void flush_parity(ecc_closure *ec, LargeFile *file_out)
+static int flush_parity(ecc_closure *ec, chunk_buffer *cb, LargeFile *file_out)
 {  RS03Layout *lay = ec->lay;
    gint64 i;
    int k;
@@ -750,201 +794,317 @@ static void flush_parity(ecc_closure *ec, LargeFile *file_out)
    for(k=0; k<lay->nroots; k++)
    {  gint64 idx=0;
 
-      for(i=0; i<ec->flushLayerSectors; i++, idx+=2048)
-      {  gint64 s = RS03SectorIndex(lay, k+lay->ndata, ec->flushChunk+i);
-	
+      for(i=0; i<cb->layerSectors; i++, idx+=2048)
+      {  gint64 s = RS03SectorIndex(lay, k+lay->ndata, cb->chunk+i);
+
 	 if(!LargeSeek(file_out, 2048*s))
-	 {  ec->abortImmediately = TRUE;
-	    Stop(_("Failed seeking to sector %" PRId64 " in image: %s"), s, strerror(errno));
+	 {  ec->writeError = g_strdup_printf(_("Failed seeking to sector %" PRId64 " in image: %s"),
+					       s, strerror(errno));
+	    return FALSE;
 	 }
-	 if(LargeWrite(file_out, ec->slice[k]+idx, 2048) != 2048)
-	 {  ec->abortImmediately = TRUE;
-	    Stop(_("Failed writing to sector %" PRId64 " in image: %s"), s, strerror(errno));
+	 if(LargeWrite(file_out, cb->slice[k]+idx, 2048) != 2048)
+	 {  ec->writeError = g_strdup_printf(_("Failed writing to sector %" PRId64 " in image: %s"),
+					       s, strerror(errno));
+	    return FALSE;
 	 }
       }
    }
    verbose("%s", "IO: parity written.\n");
+
+   return TRUE;
+}
+
+/* Hand the next chunk over to the encoder threads if it has been read
+   and the encoders are idle. Must be called with ec->lock held.
+   The buffer index is reset last so that an encoder claiming work
+   without taking the lock sees a consistent chunk description. */
+
+static void try_publish_chunk(ecc_closure *ec)
+{  chunk_buffer *cb = &ec->ring[ec->encodeIndex % ec->ringDepth];
+
+   if(ec->encoding || cb->state != BUFFER_READ)
+      return;
+
+   ec->encoding            = TRUE;
+   ec->encoderData         = cb->data;
+   ec->encoderCrc          = cb->crc;
+   ec->slice               = cb->slice;
+   ec->encoderLayerSectors = cb->layerSectors;
+   ec->encoderChunk        = cb->chunk;
+   g_atomic_int_set(&ec->buffersToEncode, cb->layerSectors);
+   g_atomic_int_set(&ec->nextBufferIndex, 0);
+   ec->chunkGeneration++;
+   g_cond_broadcast(ec->workCond);
+}
+
+/* Called by the encoder which completed the current chunk,
+   with ec->lock held. Passes the chunk on to the writer and
+   continues with the next one, if it is already available. */
+
+static void finish_chunk(ecc_closure *ec)
+{  chunk_buffer *cb = &ec->ring[ec->encodeIndex % ec->ringDepth];
+
+   cb->state = BUFFER_ENCODED;
+   g_cond_signal(ec->writeCond);
+
+   ec->encoding = FALSE;
+   ec->encodeIndex++;
+   ec->sectorsToEncode -= ec->lay->ndata*cb->layerSectors;
+
+   if(!ec->sectorsToEncode)  /* let the encoders terminate */
+      g_cond_broadcast(ec->workCond);
+   else try_publish_chunk(ec);
+}
+
+static gpointer writer_thread(ecc_closure *ec)
+{  LargeFile *file_out = ec->writeHandle;
+   guint64 n;
+
+   verbose("%s", "Writer thread initializing\n");
+
+   for(n=0; n<ec->chunkCount; n++)
+   {  chunk_buffer *cb = &ec->ring[n % ec->ringDepth];
+      int ok;
+
+      ProfileBegin("writer_wait");
+      g_mutex_lock(ec->lock);
+      while(cb->state != BUFFER_ENCODED && !ec->abortImmediately)
+	 g_cond_wait(ec->writeCond, ec->lock);
+      g_mutex_unlock(ec->lock);
+      ProfileEnd("writer_wait");
+
+      if(ec->abortImmediately)
+	 break;
+
+      ProfileBegin("flush_crc");
+      ok = flush_crc(ec, cb, file_out);
+      ProfileEnd("flush_crc");
+
+      if(ok)
+      {  ProfileBegin("flush_parity");
+	 ok = flush_parity(ec, cb, file_out);
+	 ProfileEnd("flush_parity");
+      }
+
+      if(!ok)
+      {  g_mutex_lock(ec->lock);
+	 ec->abortImmediately = TRUE;
+	 g_cond_broadcast(ec->workCond);
+	 g_cond_signal(ec->ioCond);
+	 g_mutex_unlock(ec->lock);
+	 break;
+      }
+
+      g_mutex_lock(ec->lock);
+      cb->state = BUFFER_FREE;
+      ec->chunksWritten++;
+      g_cond_signal(ec->ioCond);
+      g_mutex_unlock(ec->lock);
+   }
+
+   verbose("%s", "Writer thread finished\n");
+   return NULL;
+}
+
+/* The encoders only count their own progress;
+   the metrics reporter sums it up and calls us. */
+
+static void report_progress(Metrics *m, MetricsSample *sample, gpointer data)
+{  ecc_closure *ec = (ecc_closure*)data;
+   int percent;
+
+   ec->progress = sample->sectors;
+   percent = (1000*(gint64)ec->progress)/ec->lay->sectorsPerLayer;
+   if(ec->lastPercent == percent)
+      return;
+
+   ec->lastPercent = percent;
+#ifdef WITH_GUI_YES
+   if(Closure->guiMode)
+   {  gdouble elapsed;
+      gulong ignore;
+
+      elapsed=g_timer_elapsed(ec->contTimer, &ignore);
+      if(elapsed > 1.0)
+      {  gdouble mbs = ((double)ec->lay->ndata*(ec->progress-ec->lastProgress))/(512.0*elapsed);
+	 GuiSetLabelText(ec->wl->encPerformance,
+			 _("%5.2fMiB/s current"), mbs);
+	 ec->lastProgress = ec->progress;
+	 g_timer_reset(ec->contTimer);
+      }
+      GuiSetProgress(ec->wl->encPBar2, percent, 1000);
+   }
+   else
+#endif /* WITH_GUI_YES */
+     PrintProgress(_("Ecc generation: %3d.%1d%%"), percent/10, percent%10);
+}
+
+/* Wait until the given buffer has been processed by the encoders
+   and the writer, updating the progress information every now and then.
+   Returns the buffer state found when we arrived, which tells which
+   part of the pipeline is lagging behind. */
+
+static int wait_for_buffer(ecc_closure *ec, chunk_buffer *cb)
+{  int state;
+
+   g_mutex_lock(ec->lock);
+   state = cb->state;
+   while(cb->state != BUFFER_FREE && !ec->abortImmediately)
+   {  verbose("%s", "IO: Waiting for a free buffer\n");
+      g_cond_wait(ec->ioCond, ec->lock);
+   }
+   g_mutex_unlock(ec->lock);
+
+   if(ec->writeError)
+      Stop("%s", ec->writeError);
+
+   return state;
 }
 
 static gpointer io_thread(ecc_closure *ec)
 {  RS03Layout *lay = ec->lay;
-   LargeFile *file_out = ec->writeHandle;
    int nroots = lay->nroots;
    int ndata  = lay->ndata;
    int nroots_aligned = (nroots+15)&~15; /* 128bit alignment */
-   guint64 n_parity_bytes  = (guint64)nroots_aligned * ec->chunkBytes;
-   guint64 chunk;
-   int needs_preload = 1;
-   int parity_available = 0;
-   int i;
+   guint64 n_parity_bytes  = (guint64)nroots_aligned * 2048 * ec->batchSize;
+   guint64 n_buffer_bytes;
+   guint64 chunk,n;
+   int i,j;
 
    verbose("%s", "Reader thread initializing\n");
 
-   /*** Allocate local parity buffer aligned at 128bit boundary */
-
-   ec->paritybase = g_malloc(n_parity_bytes+16);      /* output buffer */
-   ec->parity     = ec->paritybase + (16- ((intptr_t)ec->paritybase & 15));
-
-   /*** Create buffer for the ndata input layers 
-        Space is provided for one more sector so that
-        we can read the additional sector needed for
-        chaining the CRCs. */
+   /*** Decide on the number of chunk buffers.
+	Three buffers are needed for keeping reader, encoders and writer
+	busy at the same time; more of them are used if the cache size
+	permits so that short stalls in one stage are absorbed. */
 
-   ec->ioData      = g_malloc0(256*sizeof(unsigned char*));
-   ec->encoderData = g_malloc0(256*sizeof(unsigned char*));
-#ifdef HAVE_MMAP  /* allocate CRC layer only */
+#ifdef HAVE_MMAP
    if(Closure->encodingIOStrategy == IO_STRATEGY_MMAP)
-   {  ec->ioMmapBase      = g_malloc0(256*sizeof(unsigned char*));
-      ec->encoderMmapBase = g_malloc0(256*sizeof(unsigned char*));
-      ec->ioMmapSize      = g_malloc0(256*sizeof(guint64));
-      ec->encoderMmapSize = g_malloc0(256*sizeof(guint64));
-      ec->ioData[ndata-1]      = g_malloc(ec->chunkBytes);
-      ec->encoderData[ndata-1] = g_malloc(ec->chunkBytes);
-   }
+        n_buffer_bytes = ec->chunkBytes*(nroots+1);
    else
+#endif
+        n_buffer_bytes = ec->chunkBytes*(nroots+ndata) + 2048*ndata;
+
+   ec->ringDepth = ((guint64)Closure->cacheMiB<<20) / n_buffer_bytes;
+   if(ec->ringDepth < 3) ec->ringDepth = 3;
+   if(ec->ringDepth > MAX_RING_DEPTH) ec->ringDepth = MAX_RING_DEPTH;
+   ec->ringDepth = PlanMemory(_("chunk buffers"), ec->ringDepth, 3, n_buffer_bytes,
+			      Closure->codecThreads*n_parity_bytes);
+   ec->chunkCount = (lay->sectorsPerLayer + ec->chunkSize - 1) / ec->chunkSize;
+   if(ec->ringDepth > ec->chunkCount) ec->ringDepth = ec->chunkCount;
+
+   /*** Create the chunk buffers. Each provides room for the ndata
+        input layers and for dividing the ecc information into
+	nroots slices. Space is provided for one more sector
+	so that we can read the additional sector needed for
+        chaining the CRCs. All of them are taken from one arena. */
+
+   ec->arena = CreateArena("Encoder", ec->ringDepth*n_buffer_bytes);
+   ec->ring = g_malloc0(ec->ringDepth*sizeof(chunk_buffer));
+   for(j=0; j<ec->ringDepth; j++)
+   {  chunk_buffer *cb = &ec->ring[j];
+
+      cb->data = g_malloc0(256*sizeof(unsigned char*));
+#ifdef HAVE_MMAP  /* allocate CRC layer only */
+      if(Closure->encodingIOStrategy == IO_STRATEGY_MMAP)
+      {  cb->mmapBase = g_malloc0(256*sizeof(unsigned char*));
+	 cb->mmapSize = g_malloc0(256*sizeof(guint64));
+	 cb->data[ndata-1] = ArenaAlloc(ec->arena, ec->chunkBytes);
+      }
+      else
 #endif /* HAVE_MMAP*/
-   {  for(i=0; i<ndata; i++)
-      {  ec->ioData[i] = g_malloc(ec->chunkBytes+2048);
-	 ec->encoderData[i] = g_malloc(ec->chunkBytes+2048);
+      {  for(i=0; i<ndata; i++)
+	    cb->data[i] = ArenaAlloc(ec->arena, ec->chunkBytes+2048);
       }
+      cb->crc = (guint32*)cb->data[ndata-1]; /* CRC layer */
+
+      cb->slice = g_malloc0(256*sizeof(unsigned char*));
+      for(i=0; i<nroots; i++)
+	 cb->slice[i] = ArenaAlloc(ec->arena, ec->chunkBytes);
    }
 
-   ec->ioCrc      = (guint32*)ec->ioData[ndata-1]; /* CRC layer */
-   ec->encoderCrc = (guint32*)ec->encoderData[ndata-1]; 
    ec->firstCrc   = g_malloc(256*sizeof(guint32));
 
-   /*** Create buffers for dividing the ecc information into nroots slices */
+   Verbose("Cache allocation: %d*(%lldK+%lldK)+%d*%lldK=%lldM (chunk buffers of data+descrambling; encoder parity)\n",
+	   ec->ringDepth,
+	   (long long)((n_buffer_bytes-ec->chunkBytes*nroots)/1024),
+	   (long long)((ec->chunkBytes*nroots)/1024),
+	   Closure->codecThreads,
+	   (long long)((n_parity_bytes)/1024),
+	   (long long)((ec->ringDepth*n_buffer_bytes+Closure->codecThreads*n_parity_bytes)/(1024*1024)));
+   PrintArenaStats(ec->arena);
 
-   ec->slice      = g_malloc0(256*sizeof(unsigned char*));
-   for(i=0; i<nroots; i++)
-     ec->slice[i] = g_malloc(ec->chunkBytes);
+   /*** Start the writer thread */
 
-   Verbose("Cache allocation: %lldK+%lldK+%lldK=%lldM (data+parity+descrambling)\n",
-	   (long long)((2*ec->chunkBytes*ndata)/1024),
-	   (long long)((n_parity_bytes)/1024),
-	   (long long)((ec->chunkBytes*nroots)/1024),
-	   (long long)((2*ec->chunkBytes*ndata+n_parity_bytes+ec->chunkBytes*nroots)/(1024*1024)));
+   {  GError *err = NULL;
 
-   /*** Create ecc information for the protected sectors portion of the image. */ 
+      ec->writer = g_thread_try_new("writer", (GThreadFunc)writer_thread, (gpointer)ec, &err);
+      if(!ec->writer)
+      {  ec->abortImmediately = TRUE;
+	 Stop("Could not create writer thread: %s", err->message);
+      }
+   }
+
+   /*** Create ecc information for the protected sectors portion of the image. */
 
    /* Process the image.
       From each layer a chunk of ec->chunkSize sectors is read in at once.
-      So after (lay->sectorsPerLayer/ec->chunkSize)+1 iterations 
+      So after (lay->sectorsPerLayer/ec->chunkSize)+1 iterations
       the whole image has been processed. */
 
    verbose("NOTE: ndata = %d, chunk size = %d\n", ndata, ec->chunkSize);
    verbose("NOTE: sectors per layer = %lld\n", (long long)lay->sectorsPerLayer);
 
-   for(chunk=0; chunk<lay->sectorsPerLayer; chunk+=ec->chunkSize) 
-   {  int cpu_bound = 0;
+   for(chunk=0, n=0; chunk<lay->sectorsPerLayer; chunk+=ec->chunkSize, n++)
+   {  chunk_buffer *cb = &ec->ring[n % ec->ringDepth];
+      int state;
 
       verbose("Starting IO processing for chunk %d\n", chunk);
 
-      /* preload first chunk */
-
-      if(needs_preload)
-      {  read_next_chunk(ec, chunk);
-	 //	 flush_crc(ec, file_out);  // FIXME
-	 needs_preload = 0;
-	 verbose("%s", "IO: first chunk loaded\n");
-	 continue;
-      }
+      /* Wait until the buffer has been written out, then refill it */
 
-      /* Broadcast read to the worker threads */
-      if(parity_available)
-         flush_crc(ec, file_out);
+      ProfileBegin("wait_for_buffer");
+      state = wait_for_buffer(ec, cb);
+      ProfileEnd("wait_for_buffer");
 
-      flip_buffers(ec);
-
-      g_mutex_lock(ec->lock);
-      ec->buffersToEncode     = ec->ioLayerSectors;
-      ec->encoderLayerSectors = ec->ioLayerSectors;
-      ec->nextBufferIndex     = 0;
-      ec->encoderChunk        = ec->ioChunk;
-      ec->slicesFree          = FALSE;
-      g_cond_broadcast(ec->ioCond);
-      g_mutex_unlock(ec->lock);
-
-      /* Write out parity from last run */
-
-      if(parity_available)
-      {  //flush_crc(ec, file_out);
-	 flush_parity(ec, file_out);
-      }
+      ProfileBegin("read_next_chunk");
+      read_next_chunk(ec, cb, chunk);
+      ProfileEnd("read_next_chunk");
 
       g_mutex_lock(ec->lock);
-      ec->slicesFree = TRUE;  /* we have saved the slices; go ahead */
-      g_cond_broadcast(ec->ioCond);
+      cb->state = BUFFER_READ;
+      try_publish_chunk(ec);
       g_mutex_unlock(ec->lock);
 
-      /* Read the next chunk while encoders are working */
+      /* Report progress. If the buffer was still waiting for
+	 the encoders, reading is faster than encoding. */
 
-      read_next_chunk(ec, chunk);
-      //      flush_crc(ec, file_out);  // FIXME
+      verbose("IO: chunk %d read\n", chunk);
 
-      /* Remember the current portion for writing it out */
-
-      ec->flushLayerSectors = ec->encoderLayerSectors;
-      ec->flushChunk        = ec->encoderChunk;
-      parity_available      = TRUE;
-
-      /* Wait until the encoders have finished */
-
-      g_mutex_lock(ec->lock);
-      cpu_bound = ec->buffersToEncode;
-      while(ec->buffersToEncode)
-      {  verbose("%s", "IO: Waiting for encoders to finish\n");
-	 g_cond_wait(ec->ioCond, ec->lock);
-      }
-      g_mutex_unlock(ec->lock);
-
-      /* Report progress */
-
-      verbose("IO: chunk %d finished\n", ec->ioChunk);
-
-      if(cpu_bound) 
+      if(state == BUFFER_READ)
       {  GuiSetLabelText(ec->wl->encBottleneck, _("CPU bound"));
-	 ec->cpuBound++;
+	 MetricsAddBound(ec->metrics, TRUE);
       }
       else
       {  GuiSetLabelText(ec->wl->encBottleneck, _("I/O bound"));
-	 ec->ioBound++;
+	 MetricsAddBound(ec->metrics, FALSE);
       }
    } /* chunk finished */
 
-   /* Broadcast read to the worker threads */
-
-   flush_crc(ec, file_out);
-   flush_parity(ec, file_out);
-   flip_buffers(ec);
-
-   g_mutex_lock(ec->lock);
-   ec->buffersToEncode     = ec->ioLayerSectors;
-   ec->encoderLayerSectors = ec->ioLayerSectors;
-   ec->nextBufferIndex     = 0;
-   ec->encoderChunk        = ec->ioChunk;
-   ec->slicesFree          = FALSE;
-   g_cond_broadcast(ec->ioCond);
-   g_mutex_unlock(ec->lock);
-
-   /* Wait for encoders to finish last chunk */
+   /* Wait for encoders and writer to finish the remaining chunks */
 
    g_mutex_lock(ec->lock);
-   ec->slicesFree = TRUE;  /* we have saved the slices; go ahead */
-   g_cond_broadcast(ec->ioCond);
-   while(ec->buffersToEncode)
-   {  verbose("%s", "IO: Waiting for encoders to finish last chunk\n");
+   while(ec->chunksWritten < ec->chunkCount && !ec->abortImmediately)
+   {  verbose("%s", "IO: Waiting for encoders and writer to finish\n");
       g_cond_wait(ec->ioCond, ec->lock);
    }
    g_mutex_unlock(ec->lock);
 
-   /* Write out CRC and parity */
-
-   ec->flushLayerSectors = ec->encoderLayerSectors;
-   ec->flushChunk        = ec->encoderChunk;
+   if(ec->writeError)
+      Stop("%s", ec->writeError);
 
-   flush_crc(ec, file_out);
-   flush_parity(ec, file_out);
+   g_thread_join(ec->writer);
+   ec->writer = NULL;
 
    verbose("%s", "IO: finished\n"); fflush(stdout);
    return NULL;
@@ -953,6 +1113,8 @@ static gpointer io_thread(ecc_closure *ec)
 
 static gpointer encoder_thread(ecc_closure *ec)
 {  GThread *self;
+   encoder_stats *stats;
+   unsigned char *paritybase, *parity;
    unsigned char *par_ptr;
    int cl_size;
    int my_number=-1;
@@ -960,8 +1122,7 @@ static gpointer encoder_thread(ecc_closure *ec)
    int ndata  = ec->lay->ndata;
    int nroots_aligned = (nroots+15)&~15;
    int shift[ndata];
-   int enc_size = 1;
-   int percent;
+   int generation = 0;
    int idx;
    int i,j,k;
 
@@ -975,6 +1136,20 @@ static gpointer encoder_thread(ecc_closure *ec)
      if(ec->thread[i] == self)
        my_number = i;
    g_mutex_unlock(ec->lock);
+   stats = &ec->stats[my_number];
+
+   /*** Move to our cpu or node before allocating anything,
+	so that the parity buffer is placed in local memory. */
+
+   stats->node = PlaceCodecThread(ec->placement, Closure->threadPlacement, my_number);
+
+   /*** Allocate private parity buffer aligned at 128bit boundary.
+	Clearing it here makes sure its pages are first touched
+	(and therefore allocated) on the node we are running on. */
+
+   paritybase = g_malloc(2048*ec->batchSize*nroots_aligned+16);
+   parity     = paritybase + (16- ((intptr_t)paritybase & 15));
+   memset(parity, 0, 2048*ec->batchSize*nroots_aligned);
 
    /*** Pre-calculate some values */
 
@@ -993,65 +1168,90 @@ static gpointer encoder_thread(ecc_closure *ec)
    verbose("ENC: Encoder thread %d initialized.\n", my_number);
 
    for(;;)
-   {  int layer;
+   {  gint64 wait_start;
+      int layer;
       int layer_offset;
+      int enc_size;
+
+      /* Claim the next batch of buffers without locking.
+	 Once the current chunk is exhausted, sleep until 
+	 the IO thread hands out the next one. */
+
+      layer_offset = g_atomic_int_add(&ec->nextBufferIndex, ec->batchSize);
+
+      if(layer_offset >= (int)ec->encoderLayerSectors)
+      {  wait_start = g_get_monotonic_time();
+	 ProfileBegin("encoder_wait");
+	 g_mutex_lock(ec->lock);
+	 while(   ec->sectorsToEncode 
+	       && !ec->abortImmediately
+	       && ec->chunkGeneration == generation)
+	 {  verbose("ENC: encoder %d waiting for work\n", my_number);
+	    g_cond_wait(ec->workCond, ec->lock);
+	 }
+	 generation = ec->chunkGeneration;
+	 ProfileEnd("encoder_wait");
 
-      g_mutex_lock(ec->lock);
-      while(   ec->sectorsToEncode 
-	    && !ec->abortImmediately
-	    && ec->nextBufferIndex >= ec->encoderLayerSectors)
-      {  verbose("ENC: encoder %d waiting for work\n", my_number);
- 	 g_cond_wait(ec->ioCond, ec->lock);
+	 /* Termination criterion */
+
+	 if(!ec->sectorsToEncode || ec->abortImmediately)  
+	 {  g_mutex_unlock(ec->lock);
+	    MetricsAddWait(ec->metrics, my_number, wait_start);
+	    g_free(paritybase);
+	    verbose("ENC: encoder %d exiting\n", my_number);
+	    return NULL;
+	 }
+	 g_mutex_unlock(ec->lock);
+	 MetricsAddWait(ec->metrics, my_number, wait_start);
+	 continue;
       }
-      layer_offset = ec->nextBufferIndex;
+
+      enc_size = MIN(ec->batchSize, ec->encoderLayerSectors - layer_offset);
+      stats->batches++;
 
       verbose("ENC: encoder %d got work for buffer index %d\n", 
 	      my_number,layer_offset);
 
-      /* Termination criterion */
-
-      if(!ec->sectorsToEncode || ec->abortImmediately)  
-      {  g_mutex_unlock(ec->lock);
-	 verbose("ENC: encoder %d exiting\n", my_number);
-	 return NULL;
-      }
-      ec->nextBufferIndex +=enc_size;
-      g_mutex_unlock(ec->lock);
-
       /* Now process the data bytes of the given layer section. */
 
       for(layer=0; layer<ndata; layer++)
       {  unsigned char *data   = ec->encoderData[layer] + 2048*layer_offset;
-	 unsigned char *parity = ec->parity + 2048*nroots_aligned*layer_offset;
+	 int s;
 
 	 /* Calculate the CRC32 layer (ndata-1) */
 
-	 if(layer < ndata-1) 
-	 {  /* The first ecc block CRC needs to be cached for wrap-around */
+	 for(s=layer_offset; s<layer_offset+enc_size; s++)
+	 {  unsigned char *sector = ec->encoderData[layer] + 2048*s;
 
-	    if(!ec->encoderChunk && !layer_offset)
-	    {  ec->firstCrc[layer] = Crc32(data, 2048);
-	    }
+	    if(layer < ndata-1) 
+	    {  /* The first ecc block CRC needs to be cached for wrap-around */
 
-	    /* Chain back CRC sums from next sector into current one */
+	       if(!ec->encoderChunk && !s)
+	       {  ec->firstCrc[layer] = Crc32(sector, 2048);
+	       }
 
-	    if(ec->encoderChunk+layer_offset < ec->lay->sectorsPerLayer-1)
-	    {  ec->encoderCrc[512*layer_offset+layer] = Crc32(data+2048, 2048);
-	    }
-	    else /* wrap-around: fill in CRCs from first ecc block */
-	    {  ec->encoderCrc[512*layer_offset+layer] = ec->firstCrc[layer];
+	       /* Chain back CRC sums from next sector into current one */
+
+	       if(ec->encoderChunk+s < ec->lay->sectorsPerLayer-1)
+	       {  ec->encoderCrc[512*s+layer] = Crc32(sector+2048, 2048);
+	       }
+	       else /* wrap-around: fill in CRCs from first ecc block */
+	       {  ec->encoderCrc[512*s+layer] = ec->firstCrc[layer];
+	       }
 	    }
-	 }
 
-	 if(layer == ndata-1)
-	    prepare_crc_block(ec, (CrcBlock*)&ec->encoderCrc[512*layer_offset]);
+	    if(layer == ndata-1)
+	       prepare_crc_block(ec, (CrcBlock*)&ec->encoderCrc[512*s]);
+	 }
 
 	 /* Reed-Solomon part */       
 
 	 if(!layer) /* clear parity if this is a new run */
 	   memset(parity, 0, 2048*enc_size*nroots_aligned);
 
+	 ProfileBegin("EncodeNextLayer");
 	 EncodeNextLayer(ec->rt, data, parity, 2048*enc_size, shift[layer]);
+	 ProfileEnd("EncodeNextLayer");
       }
 
       /* After processing the last data layer the parity bytes have been
@@ -1059,17 +1259,8 @@ static gpointer encoder_thread(ecc_closure *ec)
 	 Now we split them up into nroots slices and cache them in the output
 	 buffer. */
 
-      g_mutex_lock(ec->lock);
-      while(!ec->slicesFree && !ec->abortImmediately)
-      {  g_cond_wait(ec->ioCond, ec->lock);
-      }
-      g_mutex_unlock(ec->lock);
-
-      if(ec->abortImmediately)
-	 return NULL;
-
       idx = 2048*layer_offset;
-      par_ptr = ec->parity + 2048*nroots_aligned*layer_offset;
+      par_ptr = parity;
 
       /* Step through the encoded data in cl_size chunks.
 	 If we have enough L1/L2 cache for nroots*cl_size
@@ -1098,52 +1289,30 @@ static gpointer encoder_thread(ecc_closure *ec)
 	 par_ptr += cl_size*nroots_aligned;
       }
 
-      g_mutex_lock(ec->lock);
-      ec->progress+=enc_size;
-      percent = (1000*ec->progress)/ec->lay->sectorsPerLayer;
-      if(ec->lastPercent != percent) 
-      {
-	ec->lastPercent = percent;
-	g_mutex_unlock(ec->lock);
-#ifdef WITH_GUI_YES	
-	if(Closure->guiMode)
-	{    gdouble elapsed;
-	     gulong ignore;
-
-	     elapsed=g_timer_elapsed(ec->contTimer, &ignore);
-	     if(elapsed > 1.0)
-	     {  gdouble mbs = ((double)ndata*(ec->progress-ec->lastProgress))/(512.0*elapsed);
-		GuiSetLabelText(ec->wl->encPerformance, 
-				_("%5.2fMiB/s current"), mbs);
-		ec->lastProgress = ec->progress;
-		g_timer_reset(ec->contTimer);
-	     }
-             GuiSetProgress(ec->wl->encPBar2, percent, 1000);
-	}
-	else
-#endif /* WITH_GUI_YES */
-	  PrintProgress(_("Ecc generation: %3d.%1d%%"), percent/10, percent%10);
-      }
-      else g_mutex_unlock(ec->lock);
+      /* finish processing of this batch; progress is collected
+	 by the metrics reporter. Only the encoder completing the chunk
+	 needs to take the lock for passing it on to the writer. */
 
-      /* finish processing of this buffer */
+      MetricsAddSectors(ec->metrics, my_number, enc_size);
 
       verbose("ENC: encoder %d finished slice %d/ chunk %d\n", 
 	      my_number, layer_offset, ec->encoderChunk);
-      g_mutex_lock(ec->lock);
-      ec->sectorsToEncode-=enc_size*ndata;
-      ec->buffersToEncode-=enc_size;
-      if(!ec->buffersToEncode)
-      {  g_cond_broadcast(ec->ioCond);
-	 verbose("%s", "ENC: processed last buffer; telling IO process.\n");
+
+      if(g_atomic_int_add(&ec->buffersToEncode, -enc_size) == enc_size)
+      {  wait_start = g_get_monotonic_time();
+	 g_mutex_lock(ec->lock);
+	 finish_chunk(ec);
+	 g_mutex_unlock(ec->lock);
+	 MetricsAddWait(ec->metrics, my_number, wait_start);
+	 verbose("%s", "ENC: processed last buffer; telling writer.\n");
 	 fflush(stdout);
       }
-      g_mutex_unlock(ec->lock);
    }
 }
 
 static void create_reed_solomon(ecc_closure *ec)
-{  int nroots = ec->lay->nroots;
+{  MetricsSample sample;
+   int nroots = ec->lay->nroots;
    int ndata = ec->lay->ndata;
    int i;
 #ifdef WITH_GUI_YES
@@ -1185,10 +1354,23 @@ static void create_reed_solomon(ecc_closure *ec)
 
 	So we need to buffer 2048*Closure->prefetchSectors of input data.
 	For practical reasons we require that the layer size is a multiple of the
-	medium sector size of 2048 bytes. */
+	medium sector size of 2048 bytes.
 
-   ec->chunkBytes  = 2048*Closure->prefetchSectors;
-   ec->chunkSize   = Closure->prefetchSectors;
+	The chunks are made smaller if the minimum of three chunk buffers
+	(see io_thread()) and the encoder parity buffers would not fit
+	into the available memory. */
+
+   {  int nroots_aligned = (nroots+15)&~15;
+      gint64 layers = nroots+ndata;
+#ifdef HAVE_MMAP
+      if(Closure->encodingIOStrategy == IO_STRATEGY_MMAP)
+	 layers = nroots+1;
+#endif
+      ec->chunkSize = PlanMemory(_("sectors per chunk"), Closure->prefetchSectors,
+				 MIN(32, Closure->prefetchSectors), 3*2048*layers,
+				 3*2048*ndata + (gint64)Closure->codecThreads*nroots_aligned*2048*32);
+      ec->chunkBytes = 2048*ec->chunkSize;
+   }
 
 #ifdef SYS_MINGW
    {
@@ -1204,13 +1386,43 @@ static void create_reed_solomon(ecc_closure *ec)
 
    ec->lock          = g_malloc(sizeof(GMutex)); g_mutex_init(ec->lock);
    ec->ioCond        = g_malloc(sizeof(GCond)); g_cond_init(ec->ioCond);
+   ec->workCond      = g_malloc(sizeof(GCond)); g_cond_init(ec->workCond);
+   ec->writeCond     = g_malloc(sizeof(GCond)); g_cond_init(ec->writeCond);
+   ec->statsBase     = g_malloc0(Closure->codecThreads*sizeof(encoder_stats)+64);
+   ec->stats         = (encoder_stats*)((char*)ec->statsBase + (64 - ((intptr_t)ec->statsBase & 63)));
+   ec->metrics       = CreateMetrics("create", Closure->codecThreads, ec->lay->sectorsPerLayer,
+				     report_progress, ec, FALSE);
+   ec->metrics->unitSectors = ndata;
    ec->sectorsToEncode = ndata*ec->lay->sectorsPerLayer;
    if(Closure->eccTarget == ECC_FILE)
       ec->writeHandle   = ec->image->eccFile;
-   else
-      ec->writeHandle   = ec->image->file;
+   else /* the writer thread must not move the reader's file pointer */
+   {  ec->writeHandle   = LargeOpen(Closure->imageName, O_RDWR, IMG_PERMS);
+      if(!ec->writeHandle)
+	 Stop(_("Can't open %s:\n%s"), Closure->imageName, strerror(errno));
+   }
    ec->lastPercent   = -1;
-   ec->cpuBound = ec->ioBound = 0;
+
+   /*** Encoders claim this many layer sectors at once.
+	By default aim for about four batches per thread and chunk,
+	which keeps the threads busy without hammering on the
+	shared buffer index. */
+
+   ec->batchSize = Closure->encodingBatchSize;
+   if(!ec->batchSize)
+   {  ec->batchSize = ec->chunkSize / (4*Closure->codecThreads);
+      if(ec->batchSize > 32) ec->batchSize = 32;
+   }
+   if(ec->batchSize > ec->chunkSize) ec->batchSize = ec->chunkSize;
+   if(ec->batchSize < 1) ec->batchSize = 1;
+
+   /*** Find out where the encoders may be placed */
+
+   if(Closure->threadPlacement != PLACEMENT_NONE)
+   {  ec->placement = CreateCodecPlacement();
+      Verbose("Thread placement: %d CPUs on %d NUMA node(s)\n",
+	      ec->placement->nCpus, ec->placement->nNodes);
+   }
 
    /*** Initialize the encoder tables*/
 
@@ -1245,6 +1457,46 @@ static void create_reed_solomon(ecc_closure *ec)
       verbose("SCHED: joined with worker %d\n", i);
       fflush(stdout);
    }
+
+   /*** Show the final state of the progress */
+
+   StopMetricsReporter(ec->metrics);
+   SampleMetrics(ec->metrics, &sample);
+   report_progress(ec->metrics, &sample, ec);
+
+   /*** Encoder statistics depend on timing; keep them out of the regression tests */
+
+   if(Closure->regtestMode)
+   {  verbose("%s", "SCHED: scheduler finished.\n");
+      return;
+   }
+
+   Verbose("Encoder batch size: %d sectors\n", ec->batchSize);
+   for(i=0; i<Closure->codecThreads; i++)
+      Verbose("Encoder %2d: %d batches, %.3fs spent waiting\n",
+	      i, ec->stats[i].batches, (double)ec->metrics->slot[i].waitTimeUS/1000000.0);
+
+   /*** Show how much each node contributed */
+
+   if(ec->placement)
+   {  double elapsed = g_timer_elapsed(ec->avgTimer, NULL);
+      int node;
+
+      for(node=0; node<ec->placement->nNodes; node++)
+      {  guint64 sectors = 0;
+	 int threads = 0;
+
+	 for(i=0; i<Closure->codecThreads; i++)
+	    if(ec->stats[i].node == node)
+	    {  sectors += (guint64)ec->metrics->slot[i].sectors*ndata;
+	       threads++;
+	    }
+
+	 Verbose("Node %2d: %d encoders, %.2fMiB/s\n",
+		 ec->placement->nodeId[node], threads,
+		 elapsed > 0.0 ? (double)sectors/(512.0*elapsed) : 0.0);
+      }
+   }
    verbose("%s", "SCHED: scheduler finished.\n");
 }
 
@@ -1424,7 +1676,7 @@ void RS03Create(void)
    GuiSetLabelText(wl->encPerformance, _("%5.2fMiB/s average"), mbs);
    GuiSetLabelText(ec->wl->encBottleneck, 
 		   _("%d times CPU bound; %d times I/O bound"),
-		   ec->cpuBound, ec->ioBound);
+		   ec->metrics->cpuBound, ec->metrics->ioBound);
 
    GuiSetProgress(wl->encPBar2, 100, 100);
 
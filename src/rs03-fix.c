@@ -39,12 +39,13 @@ typedef struct
    Image *image;
    int earlyTermination;
    char *msg;
+   Metrics *metrics;
+   Arena *arena;
    unsigned char *imgBlock[255];
 } fix_closure;
 
 static void fix_cleanup(gpointer data)
 {  fix_closure *fc = (fix_closure*)data;
-   int i;
 
    UnregisterCleanup();
 
@@ -60,11 +61,9 @@ static void fix_cleanup(gpointer data)
 
    if(fc->msg) g_free(fc->msg);
    if(fc->image) CloseImage(fc->image);
+   if(fc->metrics) FreeMetrics(fc->metrics);
 
-   for(i=0; i<255; i++)
-   {  if(fc->imgBlock[i])
-	 g_free(fc->imgBlock[i]); 
-   }
+   if(fc->arena) FreeArena(fc->arena);
 
    if(fc->lay) g_free(fc->lay);
    if(fc->gt) FreeGaloisTables(fc->gt);
@@ -81,15 +80,24 @@ static void fix_cleanup(gpointer data)
 
 static void expand_image(Image *image, EccHeader *eh, gint64 new_size)
 {  int last_percent, percent;
-   gint64 sectors, new_sectors;
-
-   if(!LargeSeek(image->file, image->file->size))
-     Stop(_("Failed seeking to end of image: %s\n"), strerror(errno));
+   gint64 first, sectors, new_sectors;
 
    last_percent = 0;
    new_sectors = new_size - image->sectorSize;
+   first = 0;
+
+   /* Leave the new area as a hole with --sparse-image.
+      The last sector is still written as it may be clipped. */
+
+   if(Closure->sparseImage
+      && FillSparseGap(image->file, image->sectorSize, new_size-1,
+		       image->imageFP, FINGERPRINT_SECTOR, "RS03 fix placeholder"))
+     first = new_sectors-1;
+
+   if(!LargeSeek(image->file, first ? (gint64)(2048*(image->sectorSize+first)) : image->file->size))
+     Stop(_("Failed seeking to end of image: %s\n"), strerror(errno));
 
-   for(sectors = 0; sectors < new_sectors; sectors++)
+   for(sectors = first; sectors < new_sectors; sectors++)
    {  unsigned char buf[2048];
       int length,n;
 
@@ -355,9 +363,13 @@ void RS03Fix(Image *image)
 	giving a total cache size of 255*cache_size. */
 
    cache_size = 2*Closure->cacheMiB;  /* ndata+nroots=255 medium sectors are approx. 0.5MiB */
+   cache_size = PlanMemory(_("cached sectors per layer"), cache_size, MIN(16, cache_size),
+			   255*2048, 0);
 
+   fc->arena = CreateArena("Fix", (gsize)255*cache_size*2048);
    for(i=0; i<255; i++)
-      fc->imgBlock[i] = g_malloc(cache_size*2048);
+      fc->imgBlock[i] = ArenaAlloc(fc->arena, cache_size*2048);
+   PrintArenaStats(fc->arena);
 
    /*** Setup the block counters for mapping medium sectors to ecc blocks.
 	We begin at the first ecc block (0) */
@@ -378,6 +390,8 @@ void RS03Fix(Image *image)
    /*** Test ecc blocks and attempt error correction */
 
    last_percent = -1;
+   fc->metrics = CreateMetrics("fix", 1, lay->sectorsPerLayer, NULL, NULL, !Closure->guiMode);
+   fc->metrics->unitSectors = lay->ndata;
 
    for(s=0; s<lay->sectorsPerLayer; s++)
    { int bi;
@@ -529,11 +543,13 @@ void RS03Fix(Image *image)
      }
 
 	uncorrected += erasure_count;
+	MetricsAddErrors(fc->metrics, 0, erasure_count);
 	goto skip;
      }
 
      /* Build ecc block and attempt to correct it */
 
+     ProfileBegin("decode_ecc_block");
      for(bi=0; bi<2048; bi++)  /* Run through each ecc block byte */
      {  int offset = cache_offset+bi;
         int r, deg_lambda, el, deg_omega;
@@ -688,6 +704,8 @@ void RS03Fix(Image *image)
 	   }
 	   PrintCLI("\n");
 	   uncorrected += erasure_count;
+	   MetricsAddErrors(fc->metrics, 0, erasure_count);
+	   ProfileEnd("decode_ecc_block");
 	   goto skip;
 	}
 
@@ -776,6 +794,7 @@ void RS03Fix(Image *image)
 	   }
 	}
      }
+     ProfileEnd("decode_ecc_block");
 
      /* Write corrected sectors back to disc
         and report them */
@@ -829,6 +848,9 @@ void RS03Fix(Image *image)
 	   if(   lay->target == ECC_IMAGE 
 	      || i < ndata-1)
 	   {
+	      if(!PrepareSparseWrite(image->file, sec, 1, image->imageFP, FINGERPRINT_SECTOR, NULL))
+		 Stop(_("could not write medium sector %" PRId64 ":\n%s"), sec, strerror(errno));
+
 	      if(!LargeSeek(image->file, (gint64)(2048*sec)))
 		 Stop(_("Failed seeking to sector %" PRId64 " in image [%s]: %s"),
 		      sec, "FW", strerror(errno));
@@ -875,26 +897,28 @@ skip:
      cache_sector++;
      cache_offset += 2048;
 
-     /* Report progress */
+     /* Report progress. The fix value plot needs one entry per mille;
+	otherwise the progress is only updated when the reporter asks for it. */
 
-     percent = (1000*s)/lay->sectorsPerLayer;
+     MetricsAddSectors(fc->metrics, 0, 1);
 
-     if(last_percent != percent) 
-     {
+     if(Closure->guiMode)
+     {  percent = (1000*s)/lay->sectorsPerLayer;
+
+        if(last_percent != percent) 
+	{
 #ifdef WITH_GUI_YES
-        if(Closure->guiMode)
-	{  
 	   RS03AddFixValues(wl, percent, local_plot_max);
 	   local_plot_max = 0;
 
 	   //if(last_corrected != corrected || last_uncorrected != uncorrected) 
 	   RS03UpdateFixResults(wl, corrected, uncorrected);
-	}
-        else
 #endif
-	  PrintProgress(_("Ecc progress: %3d.%1d%%"),percent/10,percent%10);
-        last_percent = percent;
+	   last_percent = percent;
+	}
      }
+     else if(MetricsReportDue(fc->metrics))
+       PrintMetricsProgress(fc->metrics, _("Ecc progress: %3d.%1d%%"));
 
      /* Increment the block indices */
 
@@ -904,6 +928,9 @@ skip:
 
    /*** Print results */
 
+   FreeMetrics(fc->metrics);
+   fc->metrics = NULL;
+
    PrintProgress(_("Ecc progress: 100.0%%\n"));
 
    if(corrected > 0)
@@ -385,7 +385,10 @@ typedef struct
    RS03Widgets *wl;
    CrcBuf *crcBuf;
    Bitmap *map;
+   ImageScan *scan;
+   Metrics *metrics;
    unsigned char crcSum[16];
+   Arena *arena;
    unsigned char *eccBlock[256];
    GaloisTables *gt;
    ReedSolomonTables *rt;
@@ -393,12 +396,13 @@ typedef struct
 
 static void cleanup(gpointer data)
 {  verify_closure *vc = (verify_closure*)data;
-   int i;
 
    UnregisterCleanup();
 
    GuiAllowActions(TRUE);
 
+   if(vc->scan) CloseImageScan(vc->scan);
+   if(vc->metrics) FreeMetrics(vc->metrics);
    if(vc->image) CloseImage(vc->image);
    if(vc->lay) 
    {  g_free(vc->lay);
@@ -406,9 +410,7 @@ static void cleanup(gpointer data)
    if(vc->map) FreeBitmap(vc->map);
    if(vc->crcBuf) FreeCrcBuf(vc->crcBuf);
 
-   for(i=0; i<255; i++)
-      if(vc->eccBlock[i])
-	 g_free(vc->eccBlock[i]);
+   if(vc->arena) FreeArena(vc->arena);
 
    if(vc->gt) FreeGaloisTables(vc->gt);
    if(vc->rt) FreeReedSolomonTables(vc->rt);
@@ -418,6 +420,29 @@ static void cleanup(gpointer data)
    GuiExitWorkerThread();
 }
 
+/*
+ * Reader for the image scan. Sectors are requested in
+ * virtual (layer) order, but RS03ReadSectors() must not
+ * cross layer boundaries.
+ */
+
+static void read_sectors(gpointer data, unsigned char *buf, gint64 first, int count)
+{  verify_closure *vc = (verify_closure*)data;
+   gint64 spl = vc->lay->sectorsPerLayer;
+
+   while(count > 0)
+   {  gint64 layer_sector = first % spl;
+      int n = MIN(count, spl - layer_sector);
+
+      RS03ReadSectors(vc->image, vc->lay, buf, first / spl, layer_sector, n,
+		      RS03_READ_DATA|RS03_READ_CRC|RS03_READ_ECC);
+
+      buf   += 2048*n;
+      first += n;
+      count -= n;
+   }
+}
+
 /***
  *** Prognosis for correctability
  ***/
@@ -490,7 +515,7 @@ static int check_syndromes(verify_closure *vc)
 {  RS03Layout *lay = vc->lay;
    Image *image = vc->image;
    gint64 li,ecc_block;
-   gint64 cache_idx = Closure->prefetchSectors;
+   gint64 prefetch, cache_idx;
    gint64 ecc_good, ecc_bad, ecc_bad_sub;
    int percent,last_percent = -1;
    int bad_counted;
@@ -500,24 +525,41 @@ static int check_syndromes(verify_closure *vc)
 		   _("Checking the image and error correction files."),
 		   _("- Checking ecc blocks (deep verify) -"));
 
-   /* Allocate buffers and initialize layer sector addresses */
+   /* Allocate buffers and initialize layer sector addresses.
+      Fewer sectors are prefetched when memory is short. */
 
-   for(i=0, li=0; i<GF_FIELDMAX; i++,li+=lay->sectorsPerLayer)
-   {  
-      vc->eccBlock[i] = g_try_malloc(2048*Closure->prefetchSectors);
-      if(!vc->eccBlock[i])  /* out of memory */
-      {  int j;
+   prefetch = PlanMemory(_("prefetched sectors"), Closure->prefetchSectors,
+			 MIN(32, Closure->prefetchSectors), 255*2048, 0);
+
+   for(;;)
+   {  vc->arena = CreateArena("Verify", (gsize)GF_FIELDMAX*2048*prefetch);
+      for(i=0, li=0; i<GF_FIELDMAX; i++,li+=lay->sectorsPerLayer)
+      {  vc->eccBlock[i] = ArenaTryAlloc(vc->arena, 2048*prefetch);
+	 if(!vc->eccBlock[i])
+	    break;
+      }
 
-	 for(j=0; j<i; j++)
-	    g_free(vc->eccBlock[j]);
+      if(i == GF_FIELDMAX)
+	 break;
 
-	 GuiSetLabelText(vc->wl->cmpEccSyndromes,
+      /* out of memory */
+
+      FreeArena(vc->arena);
+      vc->arena = NULL;
+
+      if(prefetch <= 32)
+      {  GuiSetLabelText(vc->wl->cmpEccSyndromes,
 			 _("<span %s>Out of memory; try reducing sector prefetch!</span>"),
 			 Closure->redMarkup);
 	 PrintLog(_("* Ecc block test   : out of memory; try reducing sector prefetch!\n"));
 	 return 0;
       }
+
+      prefetch /= 2;
+      Verbose("Out of memory; retrying with %" PRId64 " prefetched sectors\n", prefetch);
    }
+   PrintArenaStats(vc->arena);
+   cache_idx = prefetch;
 
    /* Init Reed-Solomon tables */
 
@@ -545,10 +587,10 @@ static int check_syndromes(verify_closure *vc)
 
       /* Reload cache? */
       
-      if(cache_idx == Closure->prefetchSectors)
+      if(cache_idx == prefetch)
       {  
 	 cache_idx = 0;
-	 num_sectors = Closure->prefetchSectors;
+	 num_sectors = prefetch;
 	 if(ecc_block+num_sectors >= lay->sectorsPerLayer)
 	    num_sectors = lay->sectorsPerLayer - ecc_block;
 
@@ -566,6 +608,7 @@ static int check_syndromes(verify_closure *vc)
 	 dead sector markers; therefore we can skip this test. */
 
       bad_counted = FALSE;
+      ProfileBegin("check_syndromes");
 
       for(i=0; i<2048; i++) 
       {  int result;
@@ -583,6 +626,7 @@ static int check_syndromes(verify_closure *vc)
 	    }
 	 }
       }
+      ProfileEnd("check_syndromes");
       cache_idx++;
 
       if(!bad_counted) ecc_good++;
@@ -645,7 +689,6 @@ void RS03Verify(Image *image)
    char data_digest[33], hdr_digest[33];
    gint64 s, crc_idx;
    int last_percent = 0;
-   unsigned char buf[2048];
    gint64 first_missing, last_missing;
    gint64 total_missing,data_missing,crc_missing,ecc_missing;
    gint64 new_missing = 0, new_crc_errors = 0;
@@ -988,12 +1031,9 @@ void RS03Verify(Image *image)
    /*** Check the data portion of the image file for the
 	"dead sector marker" and CRC errors */
    
-   if(!LargeSeek(image->file, 0))
-     Stop(_("Failed seeking to start of image: %s\n"), strerror(errno));
-
-   if(lay->target == ECC_FILE)
-     if(!LargeSeek(image->eccFile, 4096))  /* skip the header */
-       Stop(_("Failed seeking to start of ecc file: %s\n"), strerror(errno));
+   vc->scan = OpenImageScanWithReader(virtual_expected, eh->mediumFP, eh->fpSector, NULL,
+				      read_sectors, vc);
+   vc->metrics = CreateMetrics("verify", 1, virtual_expected, NULL, NULL, FALSE);
 
    MD5Init(&image_md5);
 
@@ -1003,7 +1043,8 @@ void RS03Verify(Image *image)
    crc_idx = 0;
 
    for(s=0; s<virtual_expected; s++)
-   {  int percent,current_missing;
+   {  unsigned char *buf;
+      int idx,percent,current_missing;
       int defective = 0;
 
       /* Check for user interruption */
@@ -1017,13 +1058,10 @@ void RS03Verify(Image *image)
          goto terminate;
       }
 
-      /* Read the next sector */
+      /* Get the next sector */
 
-      RS03ReadSectors(image, vc->lay, buf,
-		      s/vc->lay->sectorsPerLayer,
-		      s%vc->lay->sectorsPerLayer,
-		      1,
-		      RS03_READ_DATA|RS03_READ_CRC|RS03_READ_ECC);
+      idx = ImageScanSector(vc->scan, s);
+      buf = vc->scan->buf + 2048*idx;
 
       /* update the MD5 sum */
 
@@ -1035,7 +1073,7 @@ void RS03Verify(Image *image)
 
       /* Look for the dead sector marker */
 
-      current_missing = CheckForMissingSector(buf, s, eh->mediumFP, eh->fpSector);
+      current_missing = vc->scan->missing[idx];
 
       /* Truncated images and ecc files may create "legal" dead sectors. */
 
@@ -1113,7 +1151,7 @@ void RS03Verify(Image *image)
       if(   !current_missing
 	 && (   (lay->target == ECC_IMAGE && s < lay->firstCrcPos)
 	     || (lay->target == ECC_FILE && s < lay->dataSectors)))
-      {  guint32 crc = Crc32(buf, 2048);
+      {  guint32 crc = vc->scan->crc[idx];
 
 	 if(GetBit(vc->crcBuf->valid,crc_idx)
 	    && crc != vc->crcBuf->crcbuf[crc_idx])
@@ -1129,6 +1167,8 @@ void RS03Verify(Image *image)
       if(!defective)
 	SetBit(vc->map, s);
 
+      MetricsSetProgress(vc->metrics, 0, s+1, total_missing + data_crc_errors);
+
 #ifdef WITH_GUI_YES      
       if(Closure->guiMode) 
       {   /* data part / spiral animation */
@@ -1202,6 +1242,11 @@ void RS03Verify(Image *image)
 #endif /* WITH_GUI_YES */
    }
 
+   CloseImageScan(vc->scan);
+   vc->scan = NULL;
+   FreeMetrics(vc->metrics);
+   vc->metrics = NULL;
+
    /* Complete damage summary */
 
    if(Closure->guiMode)
@@ -273,6 +273,9 @@ DeviceHandle* OpenDevice(char *device)
 
 void CloseDevice(DeviceHandle *dh)
 {
+  if(dh->readQueue)
+    CloseReadQueue(dh);
+
   if(dh->simImage)
       LargeClose(dh->simImage);
 
@@ -305,6 +308,10 @@ void CloseDevice(DeviceHandle *dh)
     g_free(dh->mediumDescr);
   if(dh->defects)
     FreeBitmap(dh->defects);
+  if(dh->simDrive)
+    FreeSimulatedDrive(dh);
+  if(dh->trace)
+    CloseDefectTrace(dh);
 
   g_free(dh);
  
@@ -162,6 +162,9 @@ DeviceHandle* OpenDevice(char *device)
 
 void CloseDevice(DeviceHandle *dh)
 { 
+  if(dh->readQueue)
+    CloseReadQueue(dh);
+
   if(dh->canReadDefective)
     SetRawMode(dh, MODE_PAGE_UNSET);
 
@@ -180,6 +183,10 @@ void CloseDevice(DeviceHandle *dh)
     g_free(dh->mediumDescr);
   if(dh->defects)
     FreeBitmap(dh->defects);
+  if(dh->simDrive)
+    FreeSimulatedDrive(dh);
+  if(dh->trace)
+    CloseDefectTrace(dh);
   g_free(dh);
 }
 
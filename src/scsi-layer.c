@@ -2145,7 +2145,7 @@ gint64 CurrentMediumSize(int get_blank_size)
 void SpinupDevice(DeviceHandle *dh)
 {  AlignedBuffer *ab;
    GTimer *timer;
-   gint64 s;
+   gint64 s, start_clock;
 
    if(!Closure->spinupDelay)
       return;
@@ -2156,6 +2156,7 @@ void SpinupDevice(DeviceHandle *dh)
 
    timer = g_timer_new();
    g_timer_start(timer);
+   start_clock = SimulatedClock(dh);
 
    for(s=0; ;s+=dh->clusterSize)
    {  int status;
@@ -2167,7 +2168,9 @@ void SpinupDevice(DeviceHandle *dh)
       status = ReadSectorsFast(dh, ab->buf, s, dh->clusterSize);
       if(status) break;
 
-      elapsed = g_timer_elapsed(timer, &ignore);
+      if(start_clock < 0)
+	   elapsed = g_timer_elapsed(timer, &ignore);
+      else elapsed = (SimulatedClock(dh) - start_clock)/1000000.0;
       if(elapsed > Closure->spinupDelay)
 	break;
    }
@@ -2299,13 +2302,12 @@ int TestUnitReady(DeviceHandle *dh)
 
 /*
  * Sector reading using the packet interface.
+ * The command blocks are built separately so that
+ * they can be queued as well (see scsi-queue.c).
  */
 
-static int read_dvd_sector(DeviceHandle *dh, unsigned char *buf, int lba, int nsectors)
-{  Sense *sense = &dh->sense;
-   unsigned char cmd[MAX_CDB_SIZE];
-   int ret;
-
+static int dvd_read_cdb(unsigned char *cmd, int lba, int nsectors)
+{
    memset(cmd, 0, MAX_CDB_SIZE);
    cmd[0] = 0x28;  /* READ(10) */
    cmd[1] = 0;  /* no special flags */
@@ -2314,21 +2316,14 @@ static int read_dvd_sector(DeviceHandle *dh, unsigned char *buf, int lba, int ns
    cmd[4] = (lba >>  8) & 0xff;
    cmd[5] = lba & 0xff;
    cmd[6] = 0;         /* reserved */
-   cmd[7] = 0;         /* number of sectors */
-   cmd[8] = nsectors;  /* read 1 sector */
-
-   ret = SendPacket(dh, cmd, 10, buf, 2048*nsectors, sense, DATA_READ);
+   cmd[7] = (nsectors >> 8) & 0xff;  /* number of sectors */
+   cmd[8] = nsectors & 0xff;
 
-   if(ret<0) RememberSense(sense->sense_key, sense->asc, sense->ascq);
-
-   return ret;
+   return 10;
 }
 
-static int read_cd_sector(DeviceHandle *dh, unsigned char *buf, int lba, int nsectors)
-{  Sense *sense = &dh->sense;
-   unsigned char cmd[MAX_CDB_SIZE];
-   int ret;
-
+static int cd_read_cdb(DeviceHandle *dh, unsigned char *cmd, int lba, int nsectors)
+{
    memset(cmd, 0, MAX_CDB_SIZE);
    cmd[0]  = 0xbe;         /* READ CD */
    switch(dh->subType)
@@ -2339,14 +2334,48 @@ static int read_cd_sector(DeviceHandle *dh, unsigned char *buf, int lba, int nse
    cmd[3]  = (lba >> 16) & 0xff;
    cmd[4]  = (lba >>  8) & 0xff;
    cmd[5]  = lba & 0xff;
-   cmd[6]  = 0;        /* number of sectors to read (3 bytes) */
-   cmd[7]  = 0;  
-   cmd[8]  = nsectors; /* read nsectors */
+   cmd[6]  = (nsectors >> 16) & 0xff;  /* number of sectors to read (3 bytes) */
+   cmd[7]  = (nsectors >>  8) & 0xff;
+   cmd[8]  = nsectors & 0xff;
 
    cmd[9]  = 0x10;  /* we want the user data only */
    cmd[10] = 0;    /* reserved stuff */
    cmd[11] = 0;    /* no special wishes for the control byte */
 
+   return 12;
+}
+
+/*
+ * Build the command block dh->read would send.
+ * Returns the command block size.
+ */
+
+int BuildReadCDB(DeviceHandle *dh, unsigned char *cmd, gint64 lba, int nsectors)
+{
+   if(dh->read == read_cd_sector)
+        return cd_read_cdb(dh, cmd, lba, nsectors);
+   else return dvd_read_cdb(cmd, lba, nsectors);
+}
+
+static int read_dvd_sector(DeviceHandle *dh, unsigned char *buf, int lba, int nsectors)
+{  Sense *sense = &dh->sense;
+   unsigned char cmd[MAX_CDB_SIZE];
+   int ret;
+
+   dvd_read_cdb(cmd, lba, nsectors);
+   ret = SendPacket(dh, cmd, 10, buf, 2048*nsectors, sense, DATA_READ);
+
+   if(ret<0) RememberSense(sense->sense_key, sense->asc, sense->ascq);
+
+   return ret;
+}
+
+static int read_cd_sector(DeviceHandle *dh, unsigned char *buf, int lba, int nsectors)
+{  Sense *sense = &dh->sense;
+   unsigned char cmd[MAX_CDB_SIZE];
+   int ret;
+
+   cd_read_cdb(dh, cmd, lba, nsectors);
    ret = SendPacket(dh, cmd, 12, buf, 2048*nsectors, sense, DATA_READ);
 
    if(ret<0) RememberSense(sense->sense_key, sense->asc, sense->ascq);
@@ -2481,9 +2510,10 @@ static int read_raw_cd_sector(DeviceHandle *dh, unsigned char *outbuf, int lba,
 /*
  * Sector reading through the device handle.
  * dh->read dispatches to one the routines above.
+ * If queued is TRUE, the first attempt is taken from the read queue.
  */
 
-int ReadSectors(DeviceHandle *dh, unsigned char *buf, gint64 s, int nsectors)
+static int read_sectors(DeviceHandle *dh, unsigned char *buf, gint64 s, int nsectors, int queued)
 {  int retry,status = -1;
    int recommended_attempts = Closure->minReadAttempts;
 
@@ -2498,6 +2528,7 @@ int ReadSectors(DeviceHandle *dh, unsigned char *buf, gint64 s, int nsectors)
 	  dh->sense.asc       = 255;
 	  dh->sense.ascq      = 255;
 	  RememberSense(dh->sense.sense_key, dh->sense.asc, dh->sense.ascq);
+	  SimulateReadTime(dh, s, nsectors, i);
 	  return TRUE;
        }
    }
@@ -2527,9 +2558,14 @@ int ReadSectors(DeviceHandle *dh, unsigned char *buf, gint64 s, int nsectors)
    {  
       /* Dispatch between normal reader and raw reader */
 
-      if(Closure->readRaw && dh->readRaw)
-	   status = dh->readRaw(dh, buf, s, nsectors);
-      else status = dh->read(dh, buf, s, nsectors);
+      TraceReadStart(dh);
+      if(!queued || retry > 1 || !FetchQueuedRead(dh, buf, s, nsectors, &status))
+      {  CancelQueuedReads(dh);
+	 if(Closure->readRaw && dh->readRaw)
+	      status = dh->readRaw(dh, buf, s, nsectors);
+	 else status = dh->read(dh, buf, s, nsectors);
+      }
+      TraceReadDone(dh, s, nsectors, status, retry);
 
       if(Closure->readRaw && dh->rawBuffer)
 	recommended_attempts = dh->rawBuffer->recommendedAttempts;
@@ -2597,6 +2633,31 @@ int ReadSectors(DeviceHandle *dh, unsigned char *buf, gint64 s, int nsectors)
    return status;
 }
 
+int ReadSectors(DeviceHandle *dh, unsigned char *buf, gint64 s, int nsectors)
+{  int status;
+
+   ProfileBegin("ReadSectors");
+   status = read_sectors(dh, buf, s, nsectors, FALSE);
+   ProfileEnd("ReadSectors");
+
+   return status;
+}
+
+/*
+ * Like ReadSectors(), but the sectors are expected at the
+ * head of the read queue. Falls back to ReadSectors() otherwise.
+ */
+
+int ReadQueuedSectors(DeviceHandle *dh, unsigned char *buf, gint64 s, int nsectors)
+{  int status;
+
+   ProfileBegin("ReadQueuedSectors");
+   status = read_sectors(dh, buf, s, nsectors, TRUE);
+   ProfileEnd("ReadQueuedSectors");
+
+   return status;
+}
+
 /*
  * Sector reading through the device handle.
  * dh->read dispatches to one the routines above.
@@ -2617,13 +2678,17 @@ int ReadSectorsFast(DeviceHandle *dh, unsigned char *buf, gint64 s, int nsectors
 	  dh->sense.asc       = 255;
 	  dh->sense.ascq      = 255;
 	  RememberSense(dh->sense.sense_key, dh->sense.asc, dh->sense.ascq);
+	  SimulateReadTime(dh, s, nsectors, i);
 	  return TRUE;
        }
    }
 
    /* Try normal read */
 
+   CancelQueuedReads(dh);
+   TraceReadStart(dh);
    status = dh->read(dh, buf, s, nsectors);
+   TraceReadDone(dh, s, nsectors, status, 1);
 
    return status;
 }
@@ -2813,6 +2878,14 @@ Image* OpenImageFromDevice(char *device, int query_only)
    if(Closure->simulateDefects)
      dh->defects = SimulateDefects(dh->sectors);
 
+   /* Set up the timing model for the simulated drive */
+
+   OpenSimulatedDrive(dh);
+
+   /* Record or replay the read session */
+
+   OpenDefectTrace(dh);
+
    return image;
 }
 
@@ -141,6 +141,9 @@ typedef struct _DeviceHandle
   
    LargeFile *simImage;       /* Image for simulation mode */
    int pass;                  /* provided by the reader to simulate failure in specific passes */
+   struct _SimulatedDrive *simDrive; /* timing model for the simulated drive */
+   struct _DefectTrace *trace;       /* recorded or replayed read session */
+   struct _ReadQueue *readQueue;     /* READ commands in flight */
   
    /*
     * OS-independent data about the device
@@ -156,6 +159,7 @@ typedef struct _DeviceHandle
    double singleRate;         /* supposed KB/sec @ single speed */
    int maxRate;               /* guessed maximum transfer rate */
    int clusterSize;           /* number of sectors per cluster */
+   int maxTransfer;           /* max. sectors per READ command; 0 if unknown */
 
    /*
     * Raw reading support
@@ -264,6 +268,39 @@ DeviceHandle* open_spti_device(char*);
 int SendPacket(DeviceHandle*, unsigned char*, int, unsigned char*, int, Sense*, int);
 int SimulateSendPacket(DeviceHandle*, unsigned char*, int, unsigned char*, int, Sense*, int);
 
+/*
+ * Timing model for the simulated drive from scsi-simulated.c
+ */
+
+void OpenSimulatedDrive(DeviceHandle*);
+void FreeSimulatedDrive(DeviceHandle*);
+void SimulateReadTime(DeviceHandle*, gint64, int, int);
+gint64 SimulatedClock(DeviceHandle*);
+void PrintSimulatedDriveStats(DeviceHandle*);
+
+/*
+ * Recording and replaying read sessions from defect-trace.c
+ */
+
+void OpenDefectTrace(DeviceHandle*);
+void CloseDefectTrace(DeviceHandle*);
+void TraceReadStart(DeviceHandle*);
+void TraceReadDone(DeviceHandle*, gint64, int, int, int);
+int  ReplayDefectTrace(DeviceHandle*, gint64, int, Sense*);
+double ReplayedErrorTime(DeviceHandle*, gint64);
+
+/*
+ * Queued reading from scsi-queue.c
+ */
+
+int  OpenReadQueue(DeviceHandle*, int);
+void CloseReadQueue(DeviceHandle*);
+int  QueueReadSectors(DeviceHandle*, gint64, int);
+gint64 QueuedSector(DeviceHandle*);
+gint64 NextQueuedSector(DeviceHandle*);
+int  FetchQueuedRead(DeviceHandle*, unsigned char*, gint64, int, int*);
+void CancelQueuedReads(DeviceHandle*);
+
 /*** 
  *** scsi-layer.c
  ***
@@ -288,6 +325,8 @@ void LoadMedium(struct _DeviceHandle*, int);
 int  TestUnitReady(DeviceHandle*);
 
 int ReadSectors(DeviceHandle*, unsigned char*, gint64, int);
+int ReadQueuedSectors(DeviceHandle*, unsigned char*, gint64, int);
+int BuildReadCDB(DeviceHandle*, unsigned char*, gint64, int);
 int ReadSectorsFast(DeviceHandle*, unsigned char*, gint64, int);
 
 #endif /* SCSI_LAYER_H */
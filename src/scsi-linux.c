@@ -97,6 +97,33 @@ char* DefaultDevice()
    }
 }
 
+/*
+ * The maximum transfer length is a property of the
+ * block device queue and can be obtained from sysfs.
+ */
+
+static void query_max_transfer(DeviceHandle *dh, char *device)
+{  char *path,*base,*sysfile;
+   FILE *file;
+   int kb;
+
+   path = realpath(device, NULL);
+   if(!path) return;
+
+   base = strrchr(path, '/');
+   base = base ? base+1 : path;
+   sysfile = g_strdup_printf("/sys/block/%s/queue/max_sectors_kb", base);
+   free(path);
+
+   file = fopen(sysfile, "r");
+   if(file)
+   {  if(fscanf(file, "%d", &kb) == 1 && kb >= 2)
+	 dh->maxTransfer = kb/2;
+      fclose(file);
+   }
+   g_free(sysfile);
+}
+
 DeviceHandle* OpenDevice(char *device)
 {  DeviceHandle *dh; 
 
@@ -126,6 +153,8 @@ DeviceHandle* OpenDevice(char *device)
 	 Stop(_("Could not open %s: %s"),device, strerror(errno));
 	 return NULL;
       }
+
+      query_max_transfer(dh, device);
    }
 
    dh->device = g_strdup(device);
@@ -135,6 +164,9 @@ DeviceHandle* OpenDevice(char *device)
 
 void CloseDevice(DeviceHandle *dh)
 { 
+  if(dh->readQueue)
+    CloseReadQueue(dh);
+
   if(dh->simImage)
       LargeClose(dh->simImage);
 
@@ -154,6 +186,10 @@ void CloseDevice(DeviceHandle *dh)
     g_free(dh->mediumDescr);
   if(dh->defects)
     FreeBitmap(dh->defects);
+  if(dh->simDrive)
+    FreeSimulatedDrive(dh);
+  if(dh->trace)
+    CloseDefectTrace(dh);
   g_free(dh);
 }
 
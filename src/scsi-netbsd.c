@@ -147,6 +147,9 @@ DeviceHandle* OpenDevice(char *device)
 
 void CloseDevice(DeviceHandle *dh)
 {
+  if(dh->readQueue)
+    CloseReadQueue(dh);
+
   if(dh->canReadDefective)
     SetRawMode(dh, MODE_PAGE_UNSET);
 
@@ -163,6 +166,10 @@ void CloseDevice(DeviceHandle *dh)
     g_free(dh->mediumDescr);
   if(dh->defects)
     FreeBitmap(dh->defects);
+  if(dh->simDrive)
+    FreeSimulatedDrive(dh);
+  if(dh->trace)
+    CloseDefectTrace(dh);
   g_free(dh);
 }
 
@@ -0,0 +1,475 @@
+/*  dvdisaster: Additional error correction for optical media.
+ *  Copyright (C) 2004-2017 Carsten Gnoerlich.
+ *  Copyright (C) 2019-2021 The dvdisaster development team.
+ *
+ *  Email: support@dvdisaster.org
+ *
+ *  This file is part of dvdisaster.
+ *
+ *  dvdisaster is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  dvdisaster is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with dvdisaster. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*** src type: no GUI code ***/
+
+#include "dvdisaster.h"
+
+#include "scsi-layer.h"
+
+/***
+ *** Queued reading.
+ ***
+ * ReadSectors() sends one READ command and waits for its completion,
+ * so the drive idles while the linear reader post-processes the data.
+ * The read queue keeps up to <depth> READ commands for the following
+ * clusters in flight, so that the next command is already waiting
+ * in the drive when the previous one completes.
+ *
+ * Commands are passed to the drive through the asynchronous write()/read()
+ * interface of the Linux sg driver when possible. Otherwise (other systems,
+ * the CDROM driver and the simulated drive) a submission thread
+ * sends the queued commands one after another through SendPacket().
+ */
+
+enum
+{  SLOT_FREE,
+   SLOT_QUEUED,     /* waiting for the submission thread */
+   SLOT_BUSY,       /* sent to the drive */
+   SLOT_DONE        /* completed, result not yet fetched */
+};
+
+typedef struct
+{  gint64 lba;
+   int nsectors;
+   unsigned char cdb[MAX_CDB_SIZE];
+   int cdbSize;
+   AlignedBuffer *buf;
+   Sense sense;
+   int status;
+   int state;
+} QueueSlot;
+
+typedef struct _ReadQueue
+{  QueueSlot slot[MAX_READ_QUEUE];
+   int depth;               /* max. number of commands in flight */
+   int head;                /* oldest queued command */
+   int count;               /* number of queued commands */
+   int sgFd;                /* sg node for asynchronous commands, or -1 */
+   int packId;              /* sg pack id of the head slot */
+
+   GThread *thread;         /* submission thread if sgFd < 0 */
+   GMutex *lock;
+   GCond *cond;
+   int exitThread;
+} ReadQueue;
+
+/***
+ *** Asynchronous commands through the Linux sg driver
+ ***/
+
+#ifdef SYS_LINUX
+#include <scsi/sg.h>
+
+/*
+ * The drive is usually opened through its block device (/dev/srN),
+ * which does not offer the write()/read() interface.
+ * Find the matching /dev/sgN node via sysfs.
+ */
+
+static int open_sg_node(DeviceHandle *dh)
+{  char *path,*node = NULL;
+   char *base;
+   GDir *dir;
+   const char *name;
+   int fd,one = 1;
+
+   path = realpath(dh->device, NULL);
+   if(!path) return -1;
+
+   base = strrchr(path, '/');
+   base = base ? base+1 : path;
+
+   if(!strncmp(base, "sg", 2))
+      node = g_strdup(path);
+   else
+   {  char *sysdir = g_strdup_printf("/sys/block/%s/device/scsi_generic", base);
+
+      dir = g_dir_open(sysdir, 0, NULL);
+      if(dir)
+      {  if((name = g_dir_read_name(dir)))
+	    node = g_strdup_printf("/dev/%s", name);
+	 g_dir_close(dir);
+      }
+      g_free(sysdir);
+   }
+   free(path);
+
+   if(!node) return -1;
+
+   fd = open(node, O_RDWR);
+   if(fd >= 0 && ioctl(fd, SG_SET_FORCE_PACK_ID, &one) < 0)
+   {  close(fd);
+      fd = -1;
+   }
+
+   Verbose("# read queue: %s %s\n", node, fd >= 0 ? "opened" : "not usable");
+   g_free(node);
+
+   return fd;
+}
+
+static void fill_sg_header(ReadQueue *rq, QueueSlot *slot, struct sg_io_hdr *hdr, int pack_id)
+{
+   memset(hdr, 0, sizeof(struct sg_io_hdr));
+   hdr->interface_id    = 'S';
+   hdr->dxfer_direction = SG_DXFER_FROM_DEV;
+   hdr->cmd_len         = slot->cdbSize;
+   hdr->mx_sb_len       = sizeof(Sense);
+   hdr->dxfer_len       = 2048*slot->nsectors;
+   hdr->dxferp          = slot->buf->buf;
+   hdr->cmdp            = slot->cdb;
+   hdr->sbp             = (unsigned char*)&slot->sense;
+   hdr->timeout         = 10*60*1000;
+   hdr->flags           = SG_FLAG_LUN_INHIBIT;
+   hdr->pack_id         = pack_id;
+}
+
+static void submit_sg(ReadQueue *rq, QueueSlot *slot, int pack_id)
+{  struct sg_io_hdr hdr;
+
+   fill_sg_header(rq, slot, &hdr, pack_id);
+
+   if(write(rq->sgFd, &hdr, sizeof(hdr)) < 0)
+   {  slot->sense.sense_key = 3;   /* pseudo error indicating */
+      slot->sense.asc       = 255; /* ioctl() failure */
+      slot->sense.ascq      = 254;
+      slot->status = -1;
+      slot->state  = SLOT_DONE;
+   }
+   else slot->state = SLOT_BUSY;
+}
+
+static void reap_sg(ReadQueue *rq, QueueSlot *slot, int pack_id)
+{  struct sg_io_hdr hdr;
+
+   fill_sg_header(rq, slot, &hdr, pack_id);
+
+   if(read(rq->sgFd, &hdr, sizeof(hdr)) < 0)
+   {  slot->sense.sense_key = 3;
+      slot->sense.asc       = 255;
+      slot->sense.ascq      = 254;
+      slot->status = -1;
+   }
+   else slot->status = hdr.status ? -1 : 0;
+
+   slot->state = SLOT_DONE;
+}
+#else
+static int  open_sg_node(DeviceHandle *dh) { return -1; }
+static void submit_sg(ReadQueue *rq, QueueSlot *slot, int pack_id) {}
+static void reap_sg(ReadQueue *rq, QueueSlot *slot, int pack_id) {}
+#endif
+
+/***
+ *** Submission thread for all other cases
+ ***/
+
+static gpointer submission_thread(gpointer data)
+{  DeviceHandle *dh = (DeviceHandle*)data;
+   ReadQueue *rq = dh->readQueue;
+
+   g_mutex_lock(rq->lock);
+
+   for(;;)
+   {  QueueSlot *slot = NULL;
+      int i;
+
+      /* Commands are executed in the order they were queued */
+
+      for(i=0; i<rq->count; i++)
+      {  QueueSlot *s = &rq->slot[(rq->head+i) % rq->depth];
+
+	 if(s->state == SLOT_QUEUED)
+	 {  slot = s;
+	    break;
+	 }
+      }
+
+      if(!slot)
+      {  if(rq->exitThread)
+	    break;
+	 g_cond_wait(rq->cond, rq->lock);
+	 continue;
+      }
+
+      slot->state = SLOT_BUSY;
+      g_mutex_unlock(rq->lock);
+
+      memset(&slot->sense, 0, sizeof(Sense));
+      slot->status = SendPacket(dh, slot->cdb, slot->cdbSize, slot->buf->buf,
+				2048*slot->nsectors, &slot->sense, DATA_READ);
+
+      g_mutex_lock(rq->lock);
+      slot->state = SLOT_DONE;
+      g_cond_broadcast(rq->cond);
+   }
+
+   g_mutex_unlock(rq->lock);
+
+   return NULL;
+}
+
+/***
+ *** Queue management
+ ***/
+
+/*
+ * Set up the queue. Returns FALSE if queued reading can not be used
+ * with the current reading setup; the caller uses ReadSectors() then.
+ */
+
+int OpenReadQueue(DeviceHandle *dh, int depth)
+{  ReadQueue *rq;
+   int i;
+
+   if(dh->readQueue)
+      return TRUE;
+
+   /* Raw reading, C2 scanning and simulated defects all
+      work on single synchronous commands. */
+
+   if(depth < 2 || Closure->readRaw || dh->defects || !dh->read)
+      return FALSE;
+
+   if(depth > MAX_READ_QUEUE)
+      depth = MAX_READ_QUEUE;
+
+   rq = g_malloc0(sizeof(ReadQueue));
+   rq->depth = depth;
+   for(i=0; i<depth; i++)
+      rq->slot[i].buf = CreateAlignedBuffer(2048*MAX_READ_BLOCK);
+
+   rq->sgFd = -1;
+   if(!dh->simImage && Closure->useSCSIDriver == DRIVER_SG)
+      rq->sgFd = open_sg_node(dh);
+
+   dh->readQueue = rq;
+
+   if(rq->sgFd < 0)
+   {  GError *err = NULL;
+
+      rq->lock = g_malloc(sizeof(GMutex)); g_mutex_init(rq->lock);
+      rq->cond = g_malloc(sizeof(GCond)); g_cond_init(rq->cond);
+      rq->thread = g_thread_try_new("read queue", submission_thread, (gpointer)dh, &err);
+      if(!rq->thread)
+	 Stop("Failed to create read queue thread: %s", err->message);
+   }
+
+   if(!dh->simImage)  /* keep the output of simulated drives stable */
+      Verbose("# read queue: %d commands, %s\n", depth,
+	      rq->sgFd >= 0 ? "sg write/read" : "submission thread");
+
+   return TRUE;
+}
+
+/*
+ * Wait for the head command to complete and remove it from the queue.
+ * Must be called with the lock held for the submission thread.
+ */
+
+static QueueSlot* wait_head(ReadQueue *rq)
+{  QueueSlot *slot = &rq->slot[rq->head];
+
+   if(rq->sgFd >= 0)
+   {  if(slot->state == SLOT_BUSY)
+	 reap_sg(rq, slot, rq->packId);
+      rq->packId++;
+   }
+   else
+   {  while(slot->state != SLOT_DONE)
+	 g_cond_wait(rq->cond, rq->lock);
+   }
+
+   rq->head = (rq->head+1) % rq->depth;
+   rq->count--;
+   slot->state = SLOT_FREE;
+
+   return slot;
+}
+
+/*
+ * Queue reading nsectors starting at sector s.
+ * Returns FALSE if the queue is full.
+ */
+
+int QueueReadSectors(DeviceHandle *dh, gint64 s, int nsectors)
+{  ReadQueue *rq = dh->readQueue;
+   QueueSlot *slot;
+   int idx;
+
+   if(!rq || rq->count >= rq->depth || nsectors > MAX_READ_BLOCK)
+      return FALSE;
+
+   idx  = (rq->head+rq->count) % rq->depth;
+   slot = &rq->slot[idx];
+
+   slot->lba      = s;
+   slot->nsectors = nsectors;
+   slot->cdbSize  = BuildReadCDB(dh, slot->cdb, s, nsectors);
+   memset(&slot->sense, 0, sizeof(Sense));
+
+   if(rq->sgFd >= 0)
+   {  submit_sg(rq, slot, rq->packId+rq->count);
+      rq->count++;
+   }
+   else
+   {  g_mutex_lock(rq->lock);
+      slot->state = SLOT_QUEUED;
+      rq->count++;
+      g_cond_broadcast(rq->cond);
+      g_mutex_unlock(rq->lock);
+   }
+
+   return TRUE;
+}
+
+/*
+ * Returns the first sector of the oldest queued command,
+ * or -1 if the queue is empty.
+ */
+
+gint64 QueuedSector(DeviceHandle *dh)
+{  ReadQueue *rq = dh->readQueue;
+
+   if(!rq || !rq->count)
+      return -1;
+
+   return rq->slot[rq->head].lba;
+}
+
+/*
+ * Returns the sector following the last queued command,
+ * or -1 if the queue is empty.
+ */
+
+gint64 NextQueuedSector(DeviceHandle *dh)
+{  ReadQueue *rq = dh->readQueue;
+   QueueSlot *slot;
+
+   if(!rq || !rq->count)
+      return -1;
+
+   slot = &rq->slot[(rq->head+rq->count-1) % rq->depth];
+   return slot->lba + slot->nsectors;
+}
+
+/*
+ * Deliver the result of the head command if it matches the requested
+ * sectors. The sense data is passed on as if dh->read had been called.
+ * Returns FALSE and cancels all queued commands otherwise.
+ */
+
+int FetchQueuedRead(DeviceHandle *dh, unsigned char *buf, gint64 s, int nsectors, int *status)
+{  ReadQueue *rq = dh->readQueue;
+   QueueSlot *slot;
+
+   if(!rq || !rq->count)
+      return FALSE;
+
+   slot = &rq->slot[rq->head];
+   if(slot->lba != s || slot->nsectors != nsectors)
+   {  CancelQueuedReads(dh);
+      return FALSE;
+   }
+
+   if(rq->lock) g_mutex_lock(rq->lock);
+   slot = wait_head(rq);
+   if(rq->lock) g_mutex_unlock(rq->lock);
+
+   memcpy(&dh->sense, &slot->sense, sizeof(Sense));
+   *status = slot->status;
+
+   if(slot->status < 0)
+      RememberSense(dh->sense.sense_key, dh->sense.asc, dh->sense.ascq);
+   else memcpy(buf, slot->buf->buf, 2048*nsectors);
+
+   return TRUE;
+}
+
+/*
+ * Drop all queued commands. Commands already sent to the drive
+ * can not be aborted, so wait for their completion.
+ */
+
+void CancelQueuedReads(DeviceHandle *dh)
+{  ReadQueue *rq = dh->readQueue;
+
+   if(!rq || !rq->count)
+      return;
+
+   if(rq->lock) g_mutex_lock(rq->lock);
+
+   /* Commands not yet picked up by the submission thread
+      are simply dropped. */
+
+   if(rq->thread)
+   {  int i;
+
+      for(i=0; i<rq->count; i++)
+      {  QueueSlot *slot = &rq->slot[(rq->head+i) % rq->depth];
+	 if(slot->state == SLOT_QUEUED)
+	    slot->state = SLOT_DONE;
+      }
+   }
+
+   while(rq->count)
+      wait_head(rq);
+
+   rq->head = 0;
+   if(rq->lock) g_mutex_unlock(rq->lock);
+}
+
+void CloseReadQueue(DeviceHandle *dh)
+{  ReadQueue *rq = dh->readQueue;
+   int i;
+
+   if(!rq) return;
+
+   CancelQueuedReads(dh);
+
+   if(rq->thread)
+   {  g_mutex_lock(rq->lock);
+      rq->exitThread = TRUE;
+      g_cond_broadcast(rq->cond);
+      g_mutex_unlock(rq->lock);
+      g_thread_join(rq->thread);
+   }
+
+   if(rq->lock)
+   {  g_mutex_clear(rq->lock);
+      g_free(rq->lock);
+   }
+   if(rq->cond)
+   {  g_cond_clear(rq->cond);
+      g_free(rq->cond);
+   }
+
+   if(rq->sgFd >= 0)
+      close(rq->sgFd);
+
+   for(i=0; i<rq->depth; i++)
+      FreeAlignedBuffer(rq->slot[i].buf);
+
+   g_free(rq);
+   dh->readQueue = NULL;
+}
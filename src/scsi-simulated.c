@@ -39,6 +39,325 @@ void InitSimulatedCD()
    g_ptr_array_add(Closure->deviceNames, g_strdup_printf(_("Simulated CD (%s)"), Closure->simulateCD));
 }
 
+/***
+ *** Timing model for the simulated drive
+ ***
+ * The drive is described by a profile consisting of "symbol: value"
+ * lines, just like the .dvdisaster file. Missing entries take the
+ * defaults given below:
+ *
+ *   speed-inner: 20        reading speed at the innermost track (x)
+ *   speed-outer: 48        reading speed at the outermost track (x)
+ *   zones: 0               number of constant speed zones (0 = continuous)
+ *   capacity: 360000       number of sectors covering the whole radius
+ *   seek-min: 20           shortest seek incl. rotational latency (ms)
+ *   seek-max: 150          full stroke seek (ms)
+ *   spin-up: 1500          time for spinning up the medium (ms)
+ *   spin-down: 0           idle time until the drive spins down (s; 0 = never)
+ *   retry-penalty: 1000    time spent retrying an unreadable sector (ms)
+ *   cache-size: 1024       size of the read-ahead cache (sectors)
+ *   bus-rate: 33000        transfer rate from the cache (KiB/s)
+ *   command-overhead: 0.1  fixed cost per READ command (ms)
+ *
+ * The radius of a sector grows with the square root of its LBA;
+ * the reading speed is interpolated between speed-inner and speed-outer
+ * over the radius (CAV/PCAV), optionally in steps of equal width (ZCLV).
+ * Equal inner and outer speeds give a CLV drive.
+ * After each command the drive keeps reading ahead into its cache
+ * at media speed. Requests hitting the cache are served at bus rate;
+ * requests not continuing at the current head position cost a seek
+ * depending on the radial distance.
+ *
+ * With the virtual clock, the time spent by the drive is accumulated
+ * instead of waited for. The host is assumed to use no time at all,
+ * so results do not depend on machine load.
+ */
+
+#define RADIUS_INNER 25.0  /* mm; program area of a CD */
+#define RADIUS_OUTER 58.0
+
+typedef struct _SimulatedDrive
+{  /* Drive profile; times in seconds */
+
+   double speedInner, speedOuter;
+   int zones;
+   gint64 capacity;
+   double seekMin, seekMax;
+   double spinUp, spinDown;
+   double retryPenalty;
+   gint64 cacheSize;
+   double busRate;            /* KiB/s */
+   double commandOverhead;
+   double singleRate;         /* KiB/s at 1x */
+
+   /* Drive state; times in microseconds */
+
+   int virtualClock;
+   GTimer *timer;             /* for the real clock */
+   gint64 clock;              /* virtual clock */
+   gint64 idleSince;
+   int spinning;
+   gint64 head;               /* next sector under the head */
+   gint64 cacheStart, cacheEnd; /* cached sectors [start, end) */
+   gint64 requestEnd;         /* end of the last request */
+   int prefetching;
+
+   /* Statistics */
+
+   gint64 commands, mediaSectors, cachedSectors;
+   gint64 seeks, spinUps, errors;
+   gint64 busy;
+} SimulatedDrive;
+
+static void read_profile(SimulatedDrive *sd, char *path)
+{  FILE *file;
+   char line[512];
+
+   file = portable_fopen(path, "rb");
+   if(!file)
+      Stop(_("Could not open %s: %s"), path, strerror(errno));
+
+   while(fgets(line, sizeof(line), file))
+   {  char symbol[41];
+      char *value;
+      int n;
+
+      if(*line == '#') continue;
+      if(sscanf(line, "%40[0-9a-zA-Z-]%n", symbol, &n) != 1) continue;
+      if(line[n] != ':') continue;
+      value = line+n+1;
+
+      if(!strcmp(symbol, "speed-inner"))      { sd->speedInner = atof(value); continue; }
+      if(!strcmp(symbol, "speed-outer"))      { sd->speedOuter = atof(value); continue; }
+      if(!strcmp(symbol, "zones"))            { sd->zones = atoi(value); continue; }
+      if(!strcmp(symbol, "capacity"))         { sd->capacity = atoll(value); continue; }
+      if(!strcmp(symbol, "seek-min"))         { sd->seekMin = atof(value)/1000.0; continue; }
+      if(!strcmp(symbol, "seek-max"))         { sd->seekMax = atof(value)/1000.0; continue; }
+      if(!strcmp(symbol, "spin-up"))          { sd->spinUp = atof(value)/1000.0; continue; }
+      if(!strcmp(symbol, "spin-down"))        { sd->spinDown = atof(value); continue; }
+      if(!strcmp(symbol, "retry-penalty"))    { sd->retryPenalty = atof(value)/1000.0; continue; }
+      if(!strcmp(symbol, "cache-size"))       { sd->cacheSize = atoll(value); continue; }
+      if(!strcmp(symbol, "bus-rate"))         { sd->busRate = atof(value); continue; }
+      if(!strcmp(symbol, "command-overhead")) { sd->commandOverhead = atof(value)/1000.0; continue; }
+
+      PrintLog(_("%s: unknown drive profile entry \"%s\"\n"), path, symbol);
+   }
+
+   fclose(file);
+
+   if(sd->speedInner <= 0.0 || sd->speedOuter <= 0.0 || sd->capacity <= 0 || sd->busRate <= 0.0)
+      Stop(_("%s: speeds, capacity and bus rate must be positive.\n"), path);
+}
+
+void OpenSimulatedDrive(DeviceHandle *dh)
+{  SimulatedDrive *sd;
+
+   if(!dh->simImage || (!Closure->simulateTiming && !Closure->simulateVirtualClock))
+      return;
+
+   sd = g_malloc0(sizeof(SimulatedDrive));
+
+   sd->speedInner      = 20.0;
+   sd->speedOuter      = 48.0;
+   sd->capacity        = 360000;
+   sd->seekMin         = 0.020;
+   sd->seekMax         = 0.150;
+   sd->spinUp          = 1.5;
+   sd->retryPenalty    = 1.0;
+   sd->cacheSize       = 1024;
+   sd->busRate         = 33000.0;
+   sd->commandOverhead = 0.0001;
+   sd->singleRate      = dh->singleRate > 0.0 ? dh->singleRate : 150.0;
+
+   if(Closure->simulateTiming)
+      read_profile(sd, Closure->simulateTiming);
+
+   sd->virtualClock = Closure->simulateVirtualClock;
+   sd->timer = g_timer_new();
+   g_timer_start(sd->timer);
+   sd->cacheStart = sd->cacheEnd = -1;
+
+   dh->simDrive = sd;
+}
+
+void FreeSimulatedDrive(DeviceHandle *dh)
+{  SimulatedDrive *sd = dh->simDrive;
+
+   if(!sd) return;
+
+   g_timer_destroy(sd->timer);
+   g_free(sd);
+   dh->simDrive = NULL;
+}
+
+/*
+ * Drive geometry
+ */
+
+static double radius(SimulatedDrive *sd, gint64 lba)
+{  double r2 = RADIUS_INNER*RADIUS_INNER;
+   double frac = (double)MIN(MAX(lba, 0), sd->capacity) / (double)sd->capacity;
+
+   return sqrt(r2 + (RADIUS_OUTER*RADIUS_OUTER - r2)*frac);
+}
+
+static double sectors_per_second(SimulatedDrive *sd, gint64 lba)
+{  double frac = (radius(sd, lba) - RADIUS_INNER) / (RADIUS_OUTER - RADIUS_INNER);
+   double speed;
+
+   if(sd->zones > 1)
+      frac = floor(MIN(frac*sd->zones, sd->zones-1)) / (sd->zones-1);
+   else if(sd->zones == 1)
+      frac = 0.0;
+
+   speed = sd->speedInner + (sd->speedOuter - sd->speedInner)*frac;
+
+   return speed*sd->singleRate/2.0;
+}
+
+static double seek_time(SimulatedDrive *sd, gint64 from, gint64 to)
+{  double distance = fabs(radius(sd, from) - radius(sd, to)) / (RADIUS_OUTER - RADIUS_INNER);
+
+   return sd->seekMin + (sd->seekMax - sd->seekMin)*sqrt(distance);
+}
+
+static gint64 drive_clock(SimulatedDrive *sd)
+{  gulong ignore;
+
+   if(sd->virtualClock)
+      return sd->clock;
+
+   return (gint64)(1000000.0*g_timer_elapsed(sd->timer, &ignore));
+}
+
+/*
+ * Account for the read-ahead done while the host was busy
+ */
+
+static void update_prefetch(SimulatedDrive *sd, gint64 now)
+{  gint64 n, limit;
+
+   if(!sd->prefetching)
+      return;
+
+   n = (gint64)((now - sd->idleSince)/1000000.0 * sectors_per_second(sd, sd->cacheEnd));
+   limit = sd->requestEnd + sd->cacheSize;
+
+   sd->cacheEnd   = MIN(sd->cacheEnd + n, limit);
+   sd->cacheStart = MAX(sd->cacheStart, sd->cacheEnd - sd->cacheSize);
+   sd->head       = sd->cacheEnd;
+   sd->prefetching = sd->cacheEnd < limit;
+}
+
+/*
+ * Charge the time for a READ command of nsectors starting at lba;
+ * the sector at lba+good was unreadable if good < nsectors.
+ */
+
+void SimulateReadTime(DeviceHandle *dh, gint64 lba, int nsectors, int good)
+{  SimulatedDrive *sd = dh->simDrive;
+   char *nodelay;
+   gint64 now, cost, hit = 0;
+   double t;
+
+   if(!sd) return;
+
+   now = drive_clock(sd);
+   t = sd->commandOverhead;
+   sd->commands++;
+
+   if(sd->spinning && sd->spinDown > 0.0 && (now - sd->idleSince)/1000000.0 > sd->spinDown)
+   {  sd->spinning = FALSE;
+      sd->prefetching = FALSE;
+   }
+
+   if(!sd->spinning)
+   {  t += sd->spinUp;
+      sd->spinning = TRUE;
+      sd->spinUps++;
+   }
+   else update_prefetch(sd, now);
+
+   /* Leading sectors may come from the cache */
+
+   if(lba >= sd->cacheStart && lba < sd->cacheEnd)
+   {  hit = MIN(sd->cacheEnd - lba, good);
+      t += hit*2.0/sd->busRate;
+      sd->cachedSectors += hit;
+   }
+
+   /* Everything else comes from the medium */
+
+   if(hit < nsectors)
+   {  gint64 pos = lba + hit;
+
+      if(pos != sd->head)
+      {  t += seek_time(sd, sd->head, pos);
+	 sd->seeks++;
+	 sd->cacheStart = pos;
+      }
+
+      t += (good - hit) / sectors_per_second(sd, pos);
+      sd->mediaSectors += good - hit;
+
+      if(good < nsectors)
+      {  double replayed = ReplayedErrorTime(dh, lba+good);
+
+	 t += replayed >= 0.0 ? replayed : sd->retryPenalty;
+	 sd->errors++;
+      }
+   }
+
+   /* Read-ahead continues behind a successful request */
+
+   sd->requestEnd  = lba + good;
+   sd->prefetching = good == nsectors && sd->cacheSize > 0;
+   if(sd->cacheEnd < sd->requestEnd || !sd->prefetching)
+      sd->cacheEnd = sd->requestEnd;
+   if(sd->cacheStart < 0 || sd->cacheStart > sd->requestEnd)
+      sd->cacheStart = lba;
+   sd->cacheStart = MAX(sd->cacheStart, sd->cacheEnd - sd->cacheSize);
+   sd->head = sd->cacheEnd;
+
+   /* Advance the clock */
+
+   cost = (gint64)(1000000.0*t);
+   sd->busy += cost;
+
+   if(sd->virtualClock)
+      sd->clock += cost;
+   else
+   {  nodelay = getenv("DVDISASTER_SCSI_SIMULATED_NODELAY");
+      if(!nodelay || strcmp(nodelay, "1"))
+	 g_usleep(cost);
+   }
+
+   sd->idleSince = drive_clock(sd);
+}
+
+/*
+ * Virtual clock in microseconds, or -1 if the real clock is used
+ */
+
+gint64 SimulatedClock(DeviceHandle *dh)
+{
+   if(!dh || !dh->simDrive || !dh->simDrive->virtualClock)
+      return -1;
+
+   return dh->simDrive->clock;
+}
+
+void PrintSimulatedDriveStats(DeviceHandle *dh)
+{  SimulatedDrive *sd = dh ? dh->simDrive : NULL;
+
+   if(!sd) return;
+
+   PrintLog(_("Simulated drive: %.1fs busy (%" PRId64 " commands, %" PRId64 " sectors from medium, %" PRId64 " from cache,\n"
+	      "                 %" PRId64 " seeks, %" PRId64 " unreadable, %" PRId64 " spin-ups)\n"),
+	    sd->busy/1000000.0, sd->commands, sd->mediaSectors, sd->cachedSectors,
+	    sd->seeks, sd->errors, sd->spinUps);
+}
+
 /***
  *** Simulate the SCSI device
  ***/
@@ -251,6 +570,17 @@ int SimulateSendPacket(DeviceHandle *dh, unsigned char *cdb, int cdb_size, unsig
 		    return -1;
 		 }
 
+		 /* Fail like the drive in a recorded read session */
+
+		 if(dh->trace)
+		 {  i = ReplayDefectTrace(dh, lba, alloc_len, sense);
+		    if(i < alloc_len)
+		    {  memset(out_buf, 0, alloc_len*2048);
+		       SimulateReadTime(dh, lba, alloc_len, i);
+		       return -1;
+		    }
+		 }
+
 		 /* Check for dead sector markers and pass them on
 		    as read errors */
 
@@ -269,6 +599,7 @@ int SimulateSendPacket(DeviceHandle *dh, unsigned char *cdb, int cdb_size, unsig
 			  {  g_free(sim_hint);
 			     memset(out_buf, 0, alloc_len*2048);
 			     write_sense(sense, 4, 0x09, 0x02); /* hardware error, focus servo failure  */
+			     SimulateReadTime(dh, lba, alloc_len, i);
 			     return -1;
 			  }
 
@@ -290,6 +621,7 @@ int SimulateSendPacket(DeviceHandle *dh, unsigned char *cdb, int cdb_size, unsig
 			    else
 			    {  memset(out_buf, 0, alloc_len*2048);
 			       write_sense(sense, 3, 0x11, 0x00); /* unrecovered read error */
+			       SimulateReadTime(dh, lba, alloc_len, i);
 			       return -1;
 			    }
 			  }
@@ -299,16 +631,23 @@ int SimulateSendPacket(DeviceHandle *dh, unsigned char *cdb, int cdb_size, unsig
 			  g_free(sim_hint);
 			  memset(out_buf, 0, alloc_len*2048);
 			  write_sense(sense, 3, 0x11, 0x00); /* unrecovered read error */
+			  SimulateReadTime(dh, lba, alloc_len, i);
 			  return -1;
 		       }
 		       else /* standard read error */
 		       {  memset(out_buf, 0, alloc_len*2048);
 			  write_sense(sense, 3, 0x11, 0x00); /* unrecovered read error */
+			  SimulateReadTime(dh, lba, alloc_len, i);
 			  return -1;
 		       }
 		    }
 		 }
 
+		 if(dh->simDrive)
+		 {  SimulateReadTime(dh, lba, alloc_len, alloc_len);
+		    return 0;
+		 }
+
 		 nodelay = getenv("DVDISASTER_SCSI_SIMULATED_NODELAY");
 		 if (!nodelay || strcmp(nodelay, "1")) {
 		   fact = (int)(200.0*sin(-0.5+(double)lba/6280.0));
@@ -87,18 +87,37 @@ enum
    ITERATION_RUN_HEURISTICS
 };
 
+/* Already tried solutions are kept in an open addressing hash table,
+   keyed by a 128bit hash of the frame. */
+
+typedef struct _visited_frame
+{  guint64 hash[2];
+   int penalty;                   /* penalty for allready tried solution */
+   int used;
+} visited_frame;
+
+/* The best solution found so far; shared by all strategies of an iteration */
+
+typedef struct _best_state
+{  GMutex lock;
+   int bonus;
+   int malus;
+   int job;                       /* strategy which found the solution */
+} best_state;
+
 typedef struct _sh_context
 {  RawBuffer *rb;
-   unsigned char *visited;        /* md5sums of already tried solutions */
-   int *penalty;                  /* penalty for allready tried solution */
-   int visitedMax;
+   best_state *best;
+   int job;                       /* index of the strategy using this context */
+   visited_frame *visited;        /* hash table of already tried solutions */
+   int visitedMax;                /* table size, a power of two */
    int visitedCnt;
+   gint64 lookups;                /* number of table lookups */
+   gint64 probes;                 /* number of slots inspected by lookups */
    int iteration;                 /* for iterative running within the editor */
    char msg[SMART_LEC_MESSAGE_SIZE]; /* diagnostic output */
 
    unsigned char bestFrame[MAX_RAW_TRANSFER_SIZE];
-   int bestBonus;
-   int bestMalus;
 
    int pState[N_P_VECTORS];
    int pPosition[N_P_VECTORS];    /* position of erroneous byte in P vector */
@@ -120,39 +139,146 @@ static sh_context* create_sh_context(RawBuffer *rb)
 {  sh_context *shc = g_malloc0(sizeof(sh_context));
 
    shc->rb = rb;
-   shc->visited = g_malloc(16*4);
-   shc->penalty = g_malloc(sizeof(int)*4);
-   shc->visitedMax = 4;
+   shc->best = g_malloc0(sizeof(best_state));
+   g_mutex_init(&shc->best->lock);
+   shc->visitedMax = 64;
+   shc->visited = g_malloc0(sizeof(visited_frame)*shc->visitedMax);
    shc->visitedCnt = 0;
 
    return shc;
 }
 
 static void free_sh_context(sh_context *shc)
-{  
+{  RawBuffer *rb = shc->rb;
+
+   /* Keep the statistics for PrintPQStats() */
+
+   rb->visitedFrames  = shc->visitedCnt;
+   rb->visitedLookups = shc->lookups;
+   rb->visitedProbes  = shc->probes;
+
+   g_mutex_clear(&shc->best->lock);
+   g_free(shc->best);
    g_free(shc->visited);
-   g_free(shc->penalty);
    g_free(shc);
 }
 
 /*
- * Predicate for recognizing a better solution
+ * Predicate for recognizing a better solution.
+ * Equally good solutions are decided in favour of the strategy
+ * coming first, as if the strategies had been run one after another.
  */
 
 int found_better_solution(sh_context *shc, int bonus, int malus)
-{
-   if(bonus < 0 || malus > shc->bestMalus)
+{  best_state *best = shc->best;
+   int better;
+
+   if(bonus < 0)
       return FALSE;
 
-   if(   (malus < shc->bestMalus  && bonus > 0)
-      || (malus == shc->bestMalus && bonus > shc->bestBonus))
-   {  shc->bestBonus = bonus;
-      shc->bestMalus = malus;
+   g_mutex_lock(&best->lock);
+
+   better =    (malus < best->malus  && bonus > 0)
+            || (malus == best->malus && bonus > best->bonus)
+            || (malus == best->malus && bonus == best->bonus && bonus > 0 && shc->job < best->job);
+
+   if(better)
+   {  best->bonus = bonus;
+      best->malus = malus;
+      best->job   = shc->job;
       verbose("pick %d/%d\n",bonus,malus);
-      return TRUE;
    }
 
-   return FALSE;
+   g_mutex_unlock(&best->lock);
+
+   return better;
+}
+
+/*
+ * Calculate a 128bit hash of the frame.
+ * Two 64bit multiply/rotate hashes with different seeds are
+ * run over the frame word by word.
+ */
+
+#define HASH_MUL1 0x9e3779b97f4a7c15ULL
+#define HASH_MUL2 0xc2b2ae3d27d4eb4fULL
+
+static inline guint64 mix64(guint64 h)
+{  h ^= h >> 33;
+   h *= 0xff51afd7ed558ccdULL;
+   h ^= h >> 33;
+   return h;
+}
+
+static void hash_frame(unsigned char *frame, int size, guint64 *hash)
+{  guint64 h1 = 0x243f6a8885a308d3ULL ^ size;
+   guint64 h2 = 0x13198a2e03707344ULL ^ size;
+   guint64 w;
+   int i;
+
+   for(i=0; i+8<=size; i+=8)
+   {  memcpy(&w, frame+i, 8);
+      h1 = ((h1 ^ w) * HASH_MUL1);
+      h1 = (h1 << 29) | (h1 >> 35);
+      h2 = ((h2 + w) * HASH_MUL2);
+      h2 = (h2 << 31) | (h2 >> 33);
+   }
+
+   if(i<size)
+   {  w = 0;
+      memcpy(&w, frame+i, size-i);
+      h1 = (h1 ^ w) * HASH_MUL1;
+      h2 = (h2 + w) * HASH_MUL2;
+   }
+
+   hash[0] = mix64(h1 ^ (h2 >> 17));
+   hash[1] = mix64(h2 ^ (h1 >> 23));
+}
+
+/*
+ * Find the slot of a frame hash in the table;
+ * returns either the matching or the first free slot.
+ */
+
+static visited_frame *lookup_hash(sh_context *shc, guint64 *hash)
+{  int mask = shc->visitedMax-1;
+   int idx  = hash[0] & mask;
+
+   shc->lookups++;
+   for(;;)
+   {  visited_frame *vf = &shc->visited[idx];
+
+      shc->probes++;
+      if(!vf->used || (vf->hash[0] == hash[0] && vf->hash[1] == hash[1]))
+	 return vf;
+
+      idx = (idx+1) & mask;
+   }
+}
+
+/*
+ * Double the table size once it is half filled
+ */
+
+static void grow_visited(sh_context *shc)
+{  visited_frame *old = shc->visited;
+   int old_max = shc->visitedMax;
+   int i;
+
+   shc->visitedMax *= 2;
+   shc->visited = g_malloc0(sizeof(visited_frame)*shc->visitedMax);
+
+   for(i=0; i<old_max; i++)
+      if(old[i].used)
+      {  int mask = shc->visitedMax-1;
+	 int idx  = old[i].hash[0] & mask;
+
+	 while(shc->visited[idx].used)
+	    idx = (idx+1) & mask;
+	 shc->visited[idx] = old[i];
+      }
+
+   g_free(old);
 }
 
 /*
@@ -160,19 +286,22 @@ int found_better_solution(sh_context *shc, int bonus, int malus)
  */
 
 static void push_frame(sh_context *shc, unsigned char *frame)
-{  MD5Context ctxt;
+{  visited_frame *vf;
+   guint64 hash[2];
 
-   if(shc->visitedCnt >= shc->visitedMax)
-   {  shc->visitedMax *= 2;
-      shc->visited = g_realloc(shc->visited, 16*shc->visitedMax);
-      shc->penalty = g_realloc(shc->penalty, sizeof(int)*shc->visitedMax);
-   }
+   if(2*(shc->visitedCnt+1) > shc->visitedMax)
+      grow_visited(shc);
+
+   hash_frame(frame, shc->rb->sampleSize, hash);
+   vf = lookup_hash(shc, hash);
 
-   MD5Init(&ctxt);
-   MD5Update(&ctxt, frame, shc->rb->sampleSize);
-   MD5Final(&shc->visited[16*shc->visitedCnt], &ctxt);
-   shc->penalty[shc->visitedCnt] = 0;
-   shc->visitedCnt++;
+   if(!vf->used)
+   {  vf->hash[0] = hash[0];
+      vf->hash[1] = hash[1];
+      vf->penalty = 0;
+      vf->used    = TRUE;
+      shc->visitedCnt++;
+   }
    printf("pushed\n");
 }
 
@@ -180,21 +309,14 @@ static void push_frame(sh_context *shc, unsigned char *frame)
  * Check whether the solution was found before
  */
 
-static int frame_visited(sh_context *shc, unsigned char *frame)
-{  MD5Context ctxt;
-   unsigned char md5sum[16];
-   int i,n;
-
-   MD5Init(&ctxt);
-   MD5Update(&ctxt, frame, shc->rb->sampleSize);
-   MD5Final(md5sum, &ctxt);
+static visited_frame *frame_visited(sh_context *shc, unsigned char *frame)
+{  visited_frame *vf;
+   guint64 hash[2];
 
-   n = shc->visitedCnt*16;
-   for(i=0; i<n; i+=16)
-      if(!memcmp(md5sum, &shc->visited[i], 16))
-	 return i/16+1;
+   hash_frame(frame, shc->rb->sampleSize, hash);
+   vf = lookup_hash(shc, hash);
 
-   return 0;
+   return vf->used ? vf : NULL;
 }
 
 /*
@@ -202,14 +324,13 @@ static int frame_visited(sh_context *shc, unsigned char *frame)
  */
 
 static int cycle_penalty(sh_context *shc, unsigned char *frame)
-{  int idx = frame_visited(shc, frame);
+{  visited_frame *vf = frame_visited(shc, frame);
 
-   if(!idx) return 0;
+   if(!vf) return 0;
 
-   idx--;
-   shc->penalty[idx] += CYCLE_PENALTY;
+   vf->penalty += CYCLE_PENALTY;
 
-   return shc->penalty[idx];
+   return vf->penalty;
 }
 
 /*
@@ -291,10 +412,9 @@ static int decode_q(RawBuffer *rb, unsigned char* q_vector, int *pos)
  */
 
 void CollectGoodVectors(RawBuffer *rb)
-{  unsigned char vector[Q_VECTOR_SIZE];
-   int eras[2];
+{  unsigned char vectors[N_Q_VECTORS*Q_VECTOR_SIZE];  /* large enough for the P vectors, too */
+   int results[N_P_VECTORS];
    int sample_idx;
-   int err;
    int i,p,q;
 
    if(!rb->samplesRead)  /* We need at least one sample */
@@ -304,14 +424,14 @@ void CollectGoodVectors(RawBuffer *rb)
 
    /* Find all P vectors which are accepted by the error correction */
 
+   DecodePVectors(rb->rt, rb->rawBuf[sample_idx], results, NULL, vectors);
+
    for(p=0; p<N_P_VECTORS; p++)
-   {  int found = FALSE;
+   {  unsigned char *vector = vectors + p*P_VECTOR_SIZE;
+      int found = FALSE;
       int last_p = rb->pn[p];
 
-      GetPVector(rb->rawBuf[sample_idx], vector, p);
-      err = DecodePQ(rb->rt, vector, P_PADDING, eras, 0);
-
-      if(err != 0 && err != 1) 
+      if(results[p] != 0 && results[p] != 1) 
 	 continue;
 
       for(i=0; i<last_p; i++)
@@ -328,14 +448,14 @@ void CollectGoodVectors(RawBuffer *rb)
 
    /* Find all Q vectors which are accepted by the error correction */
 
+   DecodeQVectors(rb->rt, rb->rawBuf[sample_idx], results, NULL, vectors);
+
    for(q=0; q<N_Q_VECTORS; q++)
-   {  int found = FALSE;
+   {  unsigned char *vector = vectors + q*Q_VECTOR_SIZE;
+      int found = FALSE;
       int last_q = rb->qn[q];
 
-      GetQVector(rb->rawBuf[sample_idx], vector, q);
-      err = DecodePQ(rb->rt, vector, Q_PADDING, eras, 0);
-
-      if(err != 0 && err != 1) 
+      if(results[q] != 0 && results[q] != 1) 
 	 continue;
 
       for(i=0; i<last_q; i++)
@@ -365,6 +485,10 @@ void PrintPQStats(RawBuffer *rb)
 
    for(i=0; i<N_Q_VECTORS; i++)
       PrintLog("Q%02d: %02d\n", i, rb->qn[i]);
+
+   PrintLog("SmartLEC visited frames: %d (%" PRId64 " lookups, %.2f probes/lookup)\n",
+	    rb->visitedFrames, rb->visitedLookups,
+	    rb->visitedLookups ? (double)rb->visitedProbes/(double)rb->visitedLookups : 0.0);
 }
 
 /***
@@ -373,8 +497,10 @@ void PrintPQStats(RawBuffer *rb)
 
 static void update_pq_state(sh_context *shc)
 {  RawBuffer *rb = shc->rb;
-   unsigned char vector[Q_VECTOR_SIZE];
-   int eras[2],err,i;
+   unsigned char vectors[N_Q_VECTORS*Q_VECTOR_SIZE];  /* large enough for the P vectors, too */
+   int results[N_P_VECTORS];
+   int position[N_P_VECTORS];
+   int i;
    int crossed,crossed_idx;
 
    memset(shc->crossedP, 0, sizeof(shc->crossedP));
@@ -384,19 +510,18 @@ static void update_pq_state(sh_context *shc)
    memset(shc->hitByP, 0, sizeof(shc->hitByP));
    memset(shc->hitByQ, 0, sizeof(shc->hitByQ));
 
-   for(i=0; i<N_P_VECTORS; i++)
-   {  GetPVector(rb->recovered, vector, i);
-      err = DecodePQ(rb->rt, vector, P_PADDING, eras, 0);
+   DecodePVectors(rb->rt, rb->recovered, results, position, vectors);
 
-      switch(err)
+   for(i=0; i<N_P_VECTORS; i++)
+   {  switch(results[i])
       {  case 0: 
 	    shc->pState[i] = 0; 
 	    break;
 	 case 1:
 	    shc->pState[i]    = 1;
-	    shc->pPosition[i] = eras[0];
-	    shc->pValue[i]    = vector[eras[0]];
-	    ByteIndexToQ(PToByteIndex(i, eras[0]), &crossed, &crossed_idx);
+	    shc->pPosition[i] = position[i];
+	    shc->pValue[i]    = vectors[i*P_VECTOR_SIZE + position[i]];
+	    ByteIndexToQ(PToByteIndex(i, position[i]), &crossed, &crossed_idx);
 	    shc->crossedQ[i]  = crossed;
 	    shc->crossedQIdx[i]  = crossed_idx;
 	    shc->hitByP[crossed]++;
@@ -407,19 +532,18 @@ static void update_pq_state(sh_context *shc)
       }
    }
 
-   for(i=0; i<N_Q_VECTORS; i++)
-   {  GetQVector(rb->recovered, vector, i);
-      err = DecodePQ(rb->rt, vector, Q_PADDING, eras, 0);
+   DecodeQVectors(rb->rt, rb->recovered, results, position, vectors);
 
-      switch(err)
+   for(i=0; i<N_Q_VECTORS; i++)
+   {  switch(results[i])
       {  case 0: 
 	    shc->qState[i] = 0; 
 	    break;
 	 case 1:
 	    shc->qState[i]    = 1;
-	    shc->qPosition[i] = eras[0];
-	    shc->qValue[i]    = vector[eras[0]];
-	    ByteIndexToP(QToByteIndex(i, eras[0]), &crossed, &crossed_idx);
+	    shc->qPosition[i] = position[i];
+	    shc->qValue[i]    = vectors[i*Q_VECTOR_SIZE + position[i]];
+	    ByteIndexToP(QToByteIndex(i, position[i]), &crossed, &crossed_idx);
 	    shc->crossedP[i]  = crossed;
 	    shc->crossedPIdx[i]  = crossed_idx;
 	    shc->hitByQ[crossed]++;
@@ -1605,30 +1729,103 @@ static void pick_best_frame(sh_context *shc, char *message)
 		  rb->bestFrame, rb->bestP2, rb->bestP1, rb->bestQ2, rb->bestQ1);
 }
 
+/*
+ * The strategies only read the current frame and the P/Q state,
+ * so they are run in parallel. Each strategy gets a private copy
+ * of the context for keeping its best frame, message and cycle
+ * penalties, while the shared best_state decides which solution wins.
+ * The cycle penalties are summed up after all strategies have finished.
+ */
+
+typedef void (*strategy_func)(sh_context*);
+
+static strategy_func strategies[] =
+{  many_p_correct_one_q,
+   many_q_correct_one_p,
+#ifndef LOCAL_ONLY
+   try_alternative_vectors,
+   try_alternative_crossing_bytes,
+#endif
+   find_p_with_two_erasures,
+   swap_p_for_new_improvement,
+   try_indirect_improvement
+};
+
+#define N_STRATEGIES ((int)(sizeof(strategies)/sizeof(strategy_func)))
+
+typedef struct
+{  sh_context *job[N_STRATEGIES];
+   gint next;                     /* next strategy to be run */
+} strategy_jobs;
+
+static gpointer strategy_worker(gpointer data)
+{  strategy_jobs *sj = (strategy_jobs*)data;
+   int i;
+
+   while((i = g_atomic_int_add(&sj->next, 1)) < N_STRATEGIES)
+      strategies[i](sj->job[i]);
+
+   return NULL;
+}
+
+static void run_strategies(sh_context *shc)
+{  strategy_jobs sj;
+   int i,k;
+
+   for(i=0; i<N_STRATEGIES; i++)
+   {  sh_context *job = g_malloc(sizeof(sh_context));
+
+      memcpy(job, shc, sizeof(sh_context));
+      job->visited = g_malloc(sizeof(visited_frame)*shc->visitedMax);
+      memcpy(job->visited, shc->visited, sizeof(visited_frame)*shc->visitedMax);
+      job->lookups = job->probes = 0;
+      job->job = i;
+      sj.job[i] = job;
+   }
+   sj.next = 0;
+
+   RunWorkerThreads(Closure->codecThreads, strategy_worker, &sj);
+
+   /* Add up the cycle penalties */
+
+   for(k=0; k<shc->visitedMax; k++)
+      if(shc->visited[k].used)
+      {  int penalty = shc->visited[k].penalty;
+
+	 for(i=0; i<N_STRATEGIES; i++)
+	    shc->visited[k].penalty += sj.job[i]->visited[k].penalty - penalty;
+      }
+
+   /* Take over the winning solution */
+
+   for(i=0; i<N_STRATEGIES; i++)
+   {  sh_context *job = sj.job[i];
+
+      if(i == shc->best->job)
+      {  memcpy(shc->bestFrame, job->bestFrame, shc->rb->sampleSize);
+	 memcpy(shc->msg, job->msg, SMART_LEC_MESSAGE_SIZE);
+      }
+
+      shc->lookups += job->lookups;
+      shc->probes  += job->probes;
+      g_free(job->visited);
+      g_free(job);
+   }
+}
+
 static int smart_lec_iteration(sh_context *shc, char *message)
 {  RawBuffer *rb = shc->rb;
   
-   shc->bestBonus = 0;
-   shc->bestMalus = 100000;
+   shc->best->bonus = 0;
+   shc->best->malus = 100000;
+   shc->best->job   = N_STRATEGIES;
    memcpy(shc->bestFrame, rb->recovered, rb->sampleSize);
    sprintf(shc->msg, "smart_lec: no further improvement");
 
    update_pq_state(shc);
    print_pq_state(shc);
 
-   many_p_correct_one_q(shc);
-   many_q_correct_one_p(shc);
-#ifndef LOCAL_ONLY
-   try_alternative_vectors(shc);
-
-   try_alternative_crossing_bytes(shc);
-#endif
-
-   find_p_with_two_erasures(shc);
-
-   swap_p_for_new_improvement(shc);
-
-   try_indirect_improvement(shc);
+   run_strategies(shc);
 
    if(frame_visited(shc, shc->bestFrame))
       printf("pruning!\n");